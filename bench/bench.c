@@ -0,0 +1,416 @@
+/*
+ * End-to-end load scenarios against bench/mock (Linux): one-shot neo, the stdin
+ * daemon and the socket daemon, each at several client counts. Reports throughput,
+ * p50/p99 latency, errors and peak RSS so regressions show up before production.
+ * For the daemons it also samples their own memory (anonymous + shared-anonymous pages,
+ * i.e. RSS minus the libraries' code) at idle and through the run; --rss-budget makes
+ * the run fail when either goes over (make rsscheck). The forward scenario runs one-shot
+ * neo -d against the socket daemon and counts a request as an error unless the client's
+ * latency report came through (prompt build and config load times, cache hit or miss);
+ * any such error fails the run (make forwardcheck).
+ *
+ *   bench/bench [-n REQUESTS] [-c 1,8,64] [-s oneshot,stdin,socket,forward] [--neo PATH]
+ *               [--ttfb MS] [--tps N] [--tokens N] [--error-rate F] [--429-rate F]
+ *               [--rss-budget KB]
+ *
+ * Run from the repository root (make bench) so the bundled skills are in the prompt.
+ */
+#define _GNU_SOURCE
+#include "buf.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLY_TIMEOUT_MS 60000
+
+static const char *neo_path = "./neo";
+static char dir[64], config_path[96], socket_path[96];
+static int requests = 200;
+static long rss_budget_kb;  /* 0: report only */
+static int over_budget;
+static int forward_failed;
+
+/* Latencies of one scenario run, shared with the client processes. */
+typedef struct {
+  long next;   /* next request number to claim */
+  long errors;
+  long max_rss_kb;
+  double ms[];
+} results_t;
+
+static results_t *res;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static long claim(void) {
+  long i = __atomic_fetch_add(&res->next, 1, __ATOMIC_RELAXED);
+  return i < requests ? i : -1;
+}
+
+static void record(long i, double ms, int ok) {
+  res->ms[i] = ms;
+  if (!ok) __atomic_fetch_add(&res->errors, 1, __ATOMIC_RELAXED);
+}
+
+static void note_rss(long kb) {
+  long cur = __atomic_load_n(&res->max_rss_kb, __ATOMIC_RELAXED);
+  while (kb > cur && !__atomic_compare_exchange_n(&res->max_rss_kb, &cur, kb, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/* Peak resident set of a live process, from /proc. */
+static long peak_rss_kb(pid_t pid) {
+  char path[64], line[256];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE *f = fopen(path, "r");
+  long kb = 0;
+  if (!f) return 0;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "VmHWM: %ld", &kb) == 1) break;
+  fclose(f);
+  return kb;
+}
+
+/* What the process itself holds resident: RssAnon + RssShmem. */
+static long own_rss_kb(pid_t pid) {
+  char path[64], line[256];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE *f = fopen(path, "r");
+  long kb, total = 0;
+  if (!f) return 0;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "RssAnon: %ld", &kb) == 1 || sscanf(line, "RssShmem: %ld", &kb) == 1) total += kb;
+  fclose(f);
+  return total;
+}
+
+static void question(char *buf, size_t cap, long i) {
+  snprintf(buf, cap, "bench question %ld: summarize what you know about nanjing", i);
+}
+
+/* ---- mock server and neo processes ---- */
+
+static pid_t spawn(char *const argv[], int *in_fd, int *out_fd, int *err_fd) {
+  int in[2] = { -1, -1 }, out[2] = { -1, -1 }, err[2] = { -1, -1 };
+  if ((in_fd && pipe(in) < 0) || (out_fd && pipe(out) < 0) || (err_fd && pipe(err) < 0)) return -1;
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_RDWR);
+    dup2(in_fd ? in[0] : null, 0);
+    dup2(out_fd ? out[1] : null, 1);
+    dup2(err_fd ? err[1] : null, 2);
+    for (int fd = 3; fd < 256; fd++) close(fd);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  if (in_fd) { close(in[0]); *in_fd = in[1]; }
+  if (out_fd) { close(out[1]); *out_fd = out[0]; }
+  if (err_fd) { close(err[1]); *err_fd = err[0]; }
+  return pid;
+}
+
+static void stop(pid_t pid) {
+  if (pid <= 0) return;
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static int write_config(int port) {
+  FILE *f = fopen(config_path, "w");
+  if (!f) return -1;
+  fprintf(f, "model:\n  base_url: \"http://127.0.0.1:%d/v1\"\n  name: \"mock\"\n  api_key: \"bench\"\n"
+             "  max_tokens: 256\n  temperature: 0.7\n"
+             "skills:\n  directory: \"skills\"\n  high_priority:\n    - \"nanjing\"\n  unmatched: index\n"
+             "memory:\n  path: \"MEMORY.md\"\n  max_chars: 4000\n"
+             "session:\n  max_turns: 10\n"
+             "daemon:\n  request_timeout: 60\n"
+             "cache:\n  entries: 0\n", port);
+  return fclose(f);
+}
+
+/* ---- scenarios; each client is a forked process working through the shared counter ---- */
+
+static void client_oneshot(void) {
+  char msg[128];
+  for (long i; (i = claim()) >= 0;) {
+    question(msg, sizeof(msg), i);
+    char *argv[] = { (char *)neo_path, "-c", config_path, "--no-daemon", msg, NULL };
+    double t0 = now_ms();
+    pid_t pid = spawn(argv, NULL, NULL, NULL);
+    int status = 0;
+    struct rusage ru;
+    if (pid < 0 || wait4(pid, &status, 0, &ru) < 0) { record(i, now_ms() - t0, 0); continue; }
+    record(i, now_ms() - t0, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    note_rss(ru.ru_maxrss);
+  }
+}
+
+/* neo -d forwarded to the daemon: ok only when its report shows what the daemon measured. */
+static int forward_report_ok(const char *err) {
+  const char *p = strstr(err, "daemon prompt build "), *c = strstr(err, "), cache "),
+             *s = strstr(err, "(config + skills load ");
+  return p && c && s && atof(p + 20) > 0 && (strncmp(c + 9, "hit", 3) == 0 || strncmp(c + 9, "miss", 4) == 0) &&
+         atof(s + 22) > 0;
+}
+
+static void client_forward(void) {
+  char msg[128];
+  setenv("NEO_SOCKET", socket_path, 1);
+  for (long i; (i = claim()) >= 0;) {
+    question(msg, sizeof(msg), i);
+    char *argv[] = { (char *)neo_path, "-c", config_path, "-d", msg, NULL };
+    buf_t err = {0};
+    int err_fd = -1, status = 0;
+    double t0 = now_ms();
+    pid_t pid = spawn(argv, NULL, NULL, &err_fd);
+    char tmp[16384];
+    for (ssize_t n; pid > 0 && (n = read(err_fd, tmp, sizeof(tmp))) > 0;) buf_append(&err, tmp, (size_t)n);
+    if (err_fd >= 0) close(err_fd);
+    int ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+             err.data && forward_report_ok(err.data);
+    record(i, now_ms() - t0, ok);
+    buf_free(&err);
+  }
+}
+
+/* Read one frame reply (CHUNK... then END or ERR) for a framed request. 1 ok, 0 error. */
+static int read_framed_reply(int fd, buf_t *in) {
+  for (;;) {
+    char *nl;
+    while (in->len && (nl = memchr(in->data, '\n', in->len)) != NULL) {
+      char type[8], id[64];
+      size_t len;
+      if (sscanf(in->data, "%7s %63s %zu", type, id, &len) != 3) return 0;
+      size_t hdr = (size_t)(nl - in->data) + 1;
+      if (in->len < hdr + len) break;
+      buf_consume(in, hdr + len);
+      if (strcmp(type, "END") == 0) return 1;
+      if (strcmp(type, "ERR") == 0) return 0;
+    }
+    struct pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, REPLY_TIMEOUT_MS) <= 0) return 0;
+    char tmp[16384];
+    ssize_t n = read(fd, tmp, sizeof(tmp));
+    if (n <= 0) return 0;
+    buf_append(in, tmp, (size_t)n);
+  }
+}
+
+static void client_socket(void) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    for (long i; (i = claim()) >= 0;) record(i, 0, 0);
+    return;
+  }
+  buf_t in = {0}, out = {0};
+  char msg[128];
+  for (long i; (i = claim()) >= 0;) {
+    question(msg, sizeof(msg), i);
+    out.len = 0;
+    buf_printf(&out, "REQ %ld %zu session=-\n%s", i, strlen(msg), msg);
+    double t0 = now_ms();
+    int ok = write(fd, out.data, out.len) == (ssize_t)out.len && read_framed_reply(fd, &in);
+    record(i, now_ms() - t0, ok);
+  }
+  buf_free(&in);
+  buf_free(&out);
+  close(fd);
+}
+
+/* The stdin daemon answers one line per question on stdout; failures only show on stderr. */
+static void client_stdin(int to, int from, int err) {
+  buf_t in = {0}, errs = {0};
+  char msg[160];
+  for (long i; (i = claim()) >= 0;) {
+    question(msg, sizeof(msg) - 1, i);
+    strcat(msg, "\n");
+    double t0 = now_ms();
+    int ok = -1;
+    if (write(to, msg, strlen(msg)) != (ssize_t)strlen(msg)) ok = 0;
+    while (ok < 0) {
+      char *nl;
+      if ((nl = memchr(in.data ? in.data : "", '\n', in.len)) != NULL) {
+        buf_consume(&in, (size_t)(nl - in.data) + 1);
+        ok = 1;
+        break;
+      }
+      if (strstr(errs.data ? errs.data : "", "request failed")) {
+        errs.len = 0;
+        errs.data[0] = '\0';
+        ok = 0;
+        break;
+      }
+      struct pollfd p[2] = { { from, POLLIN, 0 }, { err, POLLIN, 0 } };
+      if (poll(p, 2, REPLY_TIMEOUT_MS) <= 0) { ok = 0; break; }
+      char tmp[16384];
+      for (int k = 0; k < 2; k++) {
+        if (!(p[k].revents & (POLLIN | POLLHUP))) continue;
+        ssize_t n = read(p[k].fd, tmp, sizeof(tmp));
+        if (n <= 0) { ok = 0; break; }
+        buf_append(k ? &errs : &in, tmp, (size_t)n);
+      }
+    }
+    record(i, now_ms() - t0, ok == 1);
+  }
+  buf_free(&in);
+  buf_free(&errs);
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, int clients, double wall_ms, long idle_kb, long own_kb) {
+  qsort(res->ms, (size_t)requests, sizeof(double), cmp_double);
+  double p50 = res->ms[(requests - 1) / 2], p99 = res->ms[(int)((requests - 1) * 0.99)];
+  printf("%-10s %7d %9d %7ld %9.1f %9.2f %9.2f %8.1f", name, clients, requests, res->errors,
+         requests / (wall_ms / 1000.0), p50, p99, res->max_rss_kb / 1024.0);
+  if (own_kb > 0) printf(" %8.2f %8.2f", idle_kb / 1024.0, own_kb / 1024.0);
+  else printf(" %8s %8s", "-", "-");
+  if (rss_budget_kb > 0 && own_kb > rss_budget_kb) {
+    printf("  over budget (%.2f MB)", rss_budget_kb / 1024.0);
+    over_budget = 1;
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+static void run(const char *name, int clients) {
+  memset(res, 0, sizeof(*res) + (size_t)requests * sizeof(double));
+  pid_t daemon = 0;
+  int to = -1, from = -1, err = -1;
+  if (strcmp(name, "stdin") == 0) {
+    if (clients != 1) return; /* one conversation on one pipe */
+    char *argv[] = { (char *)neo_path, "-c", config_path, "daemon", NULL };
+    daemon = spawn(argv, &to, &from, &err);
+  } else if (strcmp(name, "socket") == 0 || strcmp(name, "forward") == 0) {
+    unlink(socket_path);
+    char *argv[] = { (char *)neo_path, "-c", config_path, "daemon", "--socket", socket_path, NULL };
+    daemon = spawn(argv, NULL, NULL, NULL);
+    for (int i = 0; i < 200 && access(socket_path, F_OK) != 0; i++) usleep(10000);
+  }
+  long idle_kb = 0, own_kb = 0;
+  if (daemon > 0) {
+    usleep(100000); /* let it finish starting up */
+    own_kb = idle_kb = own_rss_kb(daemon);
+  }
+
+  pid_t *pids = calloc((size_t)clients, sizeof(pid_t));
+  double t0 = now_ms();
+  for (int c = 0; pids && c < clients; c++) {
+    pids[c] = fork();
+    if (pids[c] != 0) continue;
+    if (strcmp(name, "oneshot") == 0) client_oneshot();
+    else if (strcmp(name, "stdin") == 0) client_stdin(to, from, err);
+    else if (strcmp(name, "forward") == 0) client_forward();
+    else client_socket();
+    _exit(0);
+  }
+  int left = 0;
+  for (int c = 0; pids && c < clients; c++) left += pids[c] > 0;
+  while (left > 0) { /* reap the clients, sampling the daemon's memory meanwhile */
+    for (int c = 0; c < clients; c++)
+      if (pids[c] > 0 && waitpid(pids[c], NULL, daemon > 0 ? WNOHANG : 0) != 0) {
+        pids[c] = 0;
+        left--;
+      }
+    if (daemon > 0 && left > 0) {
+      long kb = own_rss_kb(daemon);
+      if (kb > own_kb) own_kb = kb;
+      usleep(5000);
+    }
+  }
+  double wall = now_ms() - t0;
+  free(pids);
+  if (daemon > 0) {
+    note_rss(peak_rss_kb(daemon));
+    if (to >= 0) close(to);
+    stop(daemon);
+    if (from >= 0) close(from);
+    if (err >= 0) close(err);
+  }
+  if (strcmp(name, "forward") == 0 && res->errors) forward_failed = 1;
+  report(name, clients, wall, idle_kb, own_kb);
+}
+
+int main(int argc, char **argv) {
+  const char *clients_list = "1,8,64", *scenarios = "oneshot,stdin,socket";
+  char *mock_argv[16] = { "bench/mock", "-p", "0" };
+  int mock_argc = 3;
+  for (int i = 1; i < argc; i++) {
+    const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(argv[i], "-n") == 0 && v) requests = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && v) clients_list = argv[++i];
+    else if (strcmp(argv[i], "-s") == 0 && v) scenarios = argv[++i];
+    else if (strcmp(argv[i], "--neo") == 0 && v) neo_path = argv[++i];
+    else if (strcmp(argv[i], "--rss-budget") == 0 && v) rss_budget_kb = atol(argv[++i]);
+    else if ((strcmp(argv[i], "--ttfb") == 0 || strcmp(argv[i], "--tps") == 0 || strcmp(argv[i], "--tokens") == 0 ||
+              strcmp(argv[i], "--error-rate") == 0 || strcmp(argv[i], "--429-rate") == 0) && v && mock_argc < 14) {
+      mock_argv[mock_argc++] = argv[i];
+      mock_argv[mock_argc++] = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [-n REQUESTS] [-c 1,8,64] [-s oneshot,stdin,socket,forward] [--neo PATH]\n"
+                      "       [--ttfb MS] [--tps N] [--tokens N] [--error-rate F] [--429-rate F] [--rss-budget KB]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (requests < 1) requests = 1;
+  signal(SIGPIPE, SIG_IGN);
+
+  snprintf(dir, sizeof(dir), "/tmp/neo-bench-XXXXXX");
+  if (!mkdtemp(dir)) { perror("bench: mkdtemp"); return 1; }
+  snprintf(config_path, sizeof(config_path), "%s/config.yaml", dir);
+  snprintf(socket_path, sizeof(socket_path), "%s/neo.sock", dir);
+
+  int mock_out;
+  pid_t mock = spawn(mock_argv, NULL, &mock_out, NULL);
+  char portbuf[16] = "";
+  ssize_t n = mock > 0 ? read(mock_out, portbuf, sizeof(portbuf) - 1) : -1;
+  int port = n > 0 ? atoi(portbuf) : 0;
+  if (port <= 0 || write_config(port) != 0) {
+    fprintf(stderr, "bench: could not start bench/mock\n");
+    stop(mock);
+    return 1;
+  }
+  res = mmap(NULL, sizeof(*res) + (size_t)requests * sizeof(double), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (res == MAP_FAILED) { stop(mock); return 1; }
+
+  printf("mock:");
+  for (int i = 3; i < mock_argc; i++) printf(" %s", mock_argv[i]);
+  printf("%s\n", mock_argc == 3 ? " defaults (ttfb 20 ms, 32 tokens, no pacing, no errors)" : "");
+  printf("%-10s %7s %9s %7s %9s %9s %9s %8s %8s %8s\n", "scenario", "clients", "requests", "errors", "req/s", "p50 ms",
+         "p99 ms", "RSS MB", "idle MB", "own MB");
+  char *slist = strdup(scenarios);
+  for (char *sp, *s = strtok_r(slist, ",", &sp); s; s = strtok_r(NULL, ",", &sp)) {
+    char *clist = strdup(clients_list);
+    for (char *cp, *c = strtok_r(clist, ",", &cp); c; c = strtok_r(NULL, ",", &cp))
+      if (atoi(c) > 0) run(s, atoi(c));
+    free(clist);
+  }
+  free(slist);
+
+  stop(mock);
+  unlink(config_path);
+  unlink(socket_path);
+  rmdir(dir);
+  return over_budget || forward_failed;
+}
@@ -0,0 +1,422 @@
+/*
+ * Microbenchmarks for the local CPU work on the request path: prompt assembly, skill
+ * matching (by name and by embedding), JSON escaping/encoding/decoding, file reads and
+ * session eviction. One check rides along: the README's embedding example must still pick
+ * its skill at the default min_score (nonzero exit otherwise).
+ *
+ *   bench/micro [--json] [--filter SUBSTRING] [--min-ms N]
+ *
+ * Unity build: the sources under test are #included so their static functions can be
+ * called directly. malloc/calloc/realloc are interposed (glibc) to count allocations
+ * and requested bytes per operation. --json prints one object per line, for diffing
+ * results between commits.
+ */
+#define _GNU_SOURCE
+#include "../src/skills.c"
+#include "../src/llm.c"
+#include "../src/session.c"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SYSTEM_CAP (256 * 1024) /* same as the daemon's SYSTEM_MAX */
+
+/* ---- allocation counting ---- */
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static int counting;
+static unsigned long n_allocs, n_alloc_bytes;
+
+void *malloc(size_t n) {
+  if (counting) { n_allocs++; n_alloc_bytes += n; }
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+  if (counting) { n_allocs++; n_alloc_bytes += n * size; }
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+  if (counting) { n_allocs++; n_alloc_bytes += n; }
+  return __libc_realloc(p, n);
+}
+
+/* ---- harness ---- */
+
+static int json_out;
+static const char *filter;
+static double min_ms = 200;
+
+typedef void (*bench_fn)(void *arg);
+
+static double clock_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Double the iteration count until one batch takes min_ms; report that batch. */
+static void run(const char *name, const char *variant, size_t bytes_in, bench_fn fn, void *arg) {
+  char full[128];
+  snprintf(full, sizeof(full), "%s/%s", name, variant);
+  if (filter && !strstr(full, filter)) return;
+  fn(arg); /* warm caches and lazily sized buffers */
+  double ms = 0;
+  unsigned long iters = 1;
+  for (;; iters *= 2) {
+    n_allocs = n_alloc_bytes = 0;
+    counting = 1;
+    double t0 = clock_ms();
+    for (unsigned long i = 0; i < iters; i++) fn(arg);
+    ms = clock_ms() - t0;
+    counting = 0;
+    if (ms >= min_ms || iters >= (1ul << 30)) break;
+  }
+  double ns = ms * 1e6 / (double)iters;
+  double allocs = (double)n_allocs / (double)iters, abytes = (double)n_alloc_bytes / (double)iters;
+  if (json_out)
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"iters\":%lu,\"ns_per_op\":%.1f,\"bytes_per_op\":%.0f,"
+           "\"allocs_per_op\":%.2f,\"input_bytes\":%zu}\n", name, variant, iters, ns, abytes, allocs, bytes_in);
+  else if (bytes_in)
+    printf("%-34s %-14s %10lu %14.1f %12.0f %10.2f %10.1f\n", name, variant, iters, ns, abytes, allocs,
+           (double)bytes_in / ns * 1000.0);
+  else
+    printf("%-34s %-14s %10lu %14.1f %12.0f %10.2f %10s\n", name, variant, iters, ns, abytes, allocs, "-");
+  fflush(stdout);
+}
+
+/* ---- synthetic corpora ---- */
+
+static const char *zh_words[] = { "南京", "历史", "文化", "城市", "长江", "博物馆", "美食", "地铁", "大学", "公园" };
+static const char *en_words[] = { "the", "agent", "reads", "skills", "and", "builds", "a", "prompt", "for", "model" };
+
+/* Message of about len bytes; zh mixes Chinese and English the way real questions do. */
+static char *make_message(size_t len, int zh) {
+  char *s = malloc(len + 16);
+  size_t n = 0;
+  for (unsigned i = 0; n < len; i = i * 1103515245u + 12345u) {
+    const char *w = zh && (i >> 16) % 3 ? zh_words[(i >> 8) % 10] : en_words[(i >> 8) % 10];
+    size_t wl = strlen(w);
+    if (n + wl + 1 > len) break;
+    memcpy(s + n, w, wl);
+    n += wl;
+    if (!zh || (i >> 12) % 4 == 0) s[n++] = ' ';
+  }
+  s[n] = '\0';
+  return s;
+}
+
+/* A code answer: quotes, backslashes, tabs and newlines on every line. */
+static char *make_code(size_t len) {
+  static const char *line = "\tprintf(\"%s\\n\", path); /* \"quoted\" C:\\dir\\file */\n";
+  size_t ll = strlen(line);
+  char *s = malloc(len + ll + 1);
+  size_t n = 0;
+  while (n + ll <= len) {
+    memcpy(s + n, line, ll);
+    n += ll;
+  }
+  s[n] = '\0';
+  return s;
+}
+
+static char corpus_dir[64];
+static int corpus_max;
+
+static void write_file(const char *path, const char *data) {
+  FILE *f = fopen(path, "w");
+  if (!f) return;
+  fputs(data, f);
+  fclose(f);
+}
+
+/* corpus_dir/skills/sNNNNN/SKILL.md, about 1.5 KB each, half Chinese. */
+static int make_corpus(int n) {
+  snprintf(corpus_dir, sizeof(corpus_dir), "/tmp/neo-micro-XXXXXX");
+  if (!mkdtemp(corpus_dir)) return -1;
+  char path[160];
+  snprintf(path, sizeof(path), "%s/skills", corpus_dir);
+  mkdir(path, 0755);
+  char *body = make_message(1500, 1);
+  for (int i = 0; i < n; i++) {
+    snprintf(path, sizeof(path), "%s/skills/s%05d", corpus_dir, i);
+    mkdir(path, 0755);
+    strcat(path, "/SKILL.md");
+    write_file(path, body);
+  }
+  free(body);
+  corpus_max = n;
+  return 0;
+}
+
+static void remove_corpus(void) {
+  char path[160];
+  for (int i = 0; i < corpus_max; i++) {
+    snprintf(path, sizeof(path), "%s/skills/s%05d/SKILL.md", corpus_dir, i);
+    unlink(path);
+    *strrchr(path, '/') = '\0';
+    rmdir(path);
+  }
+  snprintf(path, sizeof(path), "%s/file-4k", corpus_dir);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/file-64k", corpus_dir);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/skills", corpus_dir);
+  rmdir(path);
+  rmdir(corpus_dir);
+}
+
+/* ---- cases ---- */
+
+typedef struct {
+  agent_config_t conf;
+  skills_index_t *index;
+  const char *message;
+  char *dest;
+} prompt_case_t;
+
+static void prompt_case_init(prompt_case_t *c, int n, const char *message, arena_t *arena, int embed) {
+  memset(c, 0, sizeof(*c));
+  c->conf.embed.enabled = embed;
+  c->conf.embed.top_k = 2;
+  c->conf.embed.min_score = -1;
+  c->conf.skills.paths = calloc((size_t)n, sizeof(char *));
+  for (int i = 0; i < n; i++) {
+    char path[160];
+    snprintf(path, sizeof(path), "%s/skills/s%05d/SKILL.md", corpus_dir, i);
+    c->conf.skills.paths[i] = strdup(path);
+  }
+  c->conf.skills.path_count = n;
+  c->message = message;
+  c->dest = malloc(SYSTEM_CAP);
+  c->index = arena ? skills_index_build(&c->conf, arena) : NULL;
+}
+
+static void prompt_case_free(prompt_case_t *c) {
+  for (int i = 0; i < c->conf.skills.path_count; i++) free(c->conf.skills.paths[i]);
+  free(c->conf.skills.paths);
+  free(c->dest);
+}
+
+static void b_skills_append(void *arg) {
+  prompt_case_t *c = arg;
+  c->dest[0] = '\0';
+  skills_append_to_system_prompt(&c->conf, c->message, c->dest, SYSTEM_CAP, -1, NULL);
+}
+
+static void b_skills_from_index(void *arg) {
+  prompt_case_t *c = arg;
+  c->dest[0] = '\0';
+  skills_append_from_index(c->index, c->message, c->dest, SYSTEM_CAP, -1, NULL);
+}
+
+typedef struct {
+  const char *text;
+  int8_t a[EMBED_HASH_DIM], b[EMBED_HASH_DIM];
+} embed_case_t;
+
+static void b_embed_text(void *arg) {
+  embed_case_t *c = arg;
+  embed_text(NULL, c->text, strlen(c->text), c->a);
+}
+
+static void b_embed_dot(void *arg) {
+  static volatile int sink;
+  embed_case_t *c = arg;
+  sink += embed_dot(c->a, c->b, EMBED_HASH_DIM);
+}
+
+static void b_skill_matches(void *arg) {
+  static volatile int sink;
+  sink += skill_matches_user("skills/translate/SKILL.md", arg);
+}
+
+static void b_buf_json_escape(void *arg) {
+  buf_t b = {0};
+  buf_json_escape(&b, arg);
+  buf_free(&b);
+}
+
+static void b_build_chat_body(void *arg) {
+  const llm_request_t *req = arg;
+  buf_t b = {0};
+  build_chat_body(&b, req, 0);
+  buf_free(&b);
+}
+
+static void b_extract_content(void *arg) {
+  llm_response_t r = {0};
+  extract_content_from_json(arg, &r);
+  llm_response_free(&r);
+}
+
+static void b_read_file(void *arg) {
+  static char buf[TMP_BUF_SIZE];
+  read_file_into(buf, sizeof(buf), arg, SKILL_FULL_CHARS);
+}
+
+static void b_session_append(void *arg) {
+  session_t *s = session_find("micro", 1);
+  session_append(s, "user", arg); /* full history: evicts the oldest message each time */
+}
+
+/* ---- checks ---- */
+
+/* picked ("nanjing 0.07, ...") names want and nothing else. */
+static int only_pick(const char *picked, const char *want) {
+  size_t n = strlen(want);
+  return strncmp(picked, want, n) == 0 && picked[n] == ' ' && !strchr(picked, ',');
+}
+
+/* The repo's own skills picked for message by embedding at the default min_score, one-shot
+   and from the index: want must be the only one both times, so an unrelated skill that
+   scores just as well (by hash collisions) fails it too. Run from the repo root; skipped
+   when skills/ is not there. Returns 0 when it holds. */
+static int check_embed_pick(const char *message, const char *want) {
+  static const char *names[] = { "code", "explain", "me", "nanjing", "note", "summarize", "todo", "translate" };
+  enum { N = sizeof(names) / sizeof(names[0]) };
+  char *paths[N], full[128];
+  snprintf(full, sizeof(full), "embed_pick/%s", want);
+  if (filter && !strstr(full, filter)) return 0;
+  if (access("skills/nanjing/SKILL.md", R_OK) != 0) {
+    fprintf(stderr, "micro: no skills/ here, %s not checked\n", full);
+    return 0;
+  }
+  agent_config_t conf;
+  memset(&conf, 0, sizeof(conf));
+  conf.embed.enabled = 1;
+  conf.embed.top_k = 2;
+  conf.embed.min_score = -1;
+  conf.prompt_compact = 1;
+  for (int i = 0; i < N; i++) {
+    paths[i] = malloc(64);
+    snprintf(paths[i], 64, "skills/%s/SKILL.md", names[i]);
+  }
+  conf.skills.paths = paths;
+  conf.skills.path_count = N;
+  skills_report_t disk = {0}, index = {0};
+  char *dest = malloc(SYSTEM_CAP);
+  arena_t arena;
+  int ok = 0;
+  if (dest && arena_init(&arena, 4u << 20) == 0) {
+    dest[0] = '\0';
+    skills_append_to_system_prompt(&conf, message, dest, SYSTEM_CAP, -1, &disk);
+    skills_index_t *idx = skills_index_build(&conf, &arena);
+    if (idx) {
+      dest[0] = '\0';
+      skills_append_from_index(idx, message, dest, SYSTEM_CAP, -1, &index);
+    }
+    ok = idx && only_pick(disk.picked, want) && only_pick(index.picked, want);
+    arena_free(&arena);
+  }
+  if (json_out)
+    printf("{\"check\":\"%s\",\"ok\":%s}\n", full, ok ? "true" : "false");
+  else
+    printf("%-34s %-14s %s (one-shot: %s; index: %s)\n", "embed_pick", want, ok ? "ok" : "FAIL", disk.picked, index.picked);
+  fflush(stdout);
+  for (int i = 0; i < N; i++) free(paths[i]);
+  free(dest);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) json_out = 1;
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+    else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) min_ms = atof(argv[++i]);
+    else {
+      fprintf(stderr, "Usage: %s [--json] [--filter SUBSTRING] [--min-ms N]\n", argv[0]);
+      return 1;
+    }
+  }
+  static const int skill_counts[] = { 10, 100, 1000, 10000 };
+  static const size_t sizes[] = { 4096, 16384, 65536 - 16 };
+  static const char *size_names[] = { "4KB", "16KB", "64KB" };
+
+  if (make_corpus(10000) != 0) { perror("micro: corpus"); return 1; }
+  if (!json_out)
+    printf("%-34s %-14s %10s %14s %12s %10s %10s\n", "bench", "case", "iters", "ns/op", "bytes/op", "allocs/op", "MB/s");
+
+  /* prompt assembly over N skills, reading files (one-shot) and from the index (daemon) */
+  char *question = make_message(200, 1);
+  for (int k = 0; k < 4; k++) {
+    char variant[32];
+    snprintf(variant, sizeof(variant), "%d-skills", skill_counts[k]);
+    arena_t arena;
+    int have_arena = arena_init(&arena, 64u << 20) == 0;
+    prompt_case_t c;
+    prompt_case_init(&c, skill_counts[k], question, have_arena ? &arena : NULL, 0);
+    run("skills_append_to_system_prompt", variant, 0, b_skills_append, &c);
+    if (c.index) run("skills_append_from_index", variant, 0, b_skills_from_index, &c);
+    prompt_case_free(&c);
+    if (have_arena) arena_free(&arena);
+  }
+
+  /* the same with embed.enabled: the message embedded and scored against every skill */
+  for (int k = 0; k < 3; k++) {
+    char variant[32];
+    snprintf(variant, sizeof(variant), "%d-skills-embed", skill_counts[k]);
+    arena_t arena;
+    int have_arena = arena_init(&arena, 64u << 20) == 0;
+    prompt_case_t c;
+    prompt_case_init(&c, skill_counts[k], question, have_arena ? &arena : NULL, 1);
+    if (k < 2) run("skills_append_to_system_prompt", variant, 0, b_skills_append, &c);
+    if (c.index) run("skills_append_from_index", variant, 0, b_skills_from_index, &c);
+    prompt_case_free(&c);
+    if (have_arena) arena_free(&arena);
+  }
+  embed_case_t ec;
+  ec.text = question;
+  embed_text(NULL, question, strlen(question), ec.b);
+  run("embed_text", "zh-200B", strlen(question), b_embed_text, &ec);
+  char dim_name[16];
+  snprintf(dim_name, sizeof(dim_name), "%d", EMBED_HASH_DIM);
+  run("embed_dot", dim_name, 0, b_embed_dot, &ec);
+  /* the README's example: no skill name or keyword in it, nanjing only by embedding */
+  int failed = check_embed_pick("推荐几个景点", "nanjing");
+
+  /* skill matching, JSON escape and session eviction over message sizes */
+  for (int s = 0; s < 3; s++) {
+    for (int zh = 0; zh < 2; zh++) {
+      char variant[32];
+      snprintf(variant, sizeof(variant), "%s-%s", zh ? "zh" : "en", size_names[s]);
+      char *msg = make_message(sizes[s], zh);
+      run("skill_matches_user", variant, strlen(msg), b_skill_matches, msg);
+      run("session_append(evict)", variant, strlen(msg), b_session_append, msg);
+      free(msg);
+    }
+    char variant[32];
+    snprintf(variant, sizeof(variant), "code-%s", size_names[s]);
+    char *code = make_code(sizes[s]);
+    run("buf_json_escape", variant, strlen(code), b_buf_json_escape, code);
+    llm_message_t m = { "user", code };
+    llm_request_t req = { "http://x", "m", "k", 256, 0.7, question, &m, 1, LLM_THINK_DEFAULT, 0, 0, LLM_BACKEND_DEFAULT, NULL, 0 };
+    run("build_chat_body", variant, strlen(code), b_build_chat_body, &req);
+    buf_t resp = {0};
+    buf_puts(&resp, "{\"id\":\"x\",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"");
+    buf_json_escape(&resp, code);
+    buf_puts(&resp, "\"},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":10,\"completion_tokens\":20}}");
+    run("extract_content_from_json", variant, resp.len, b_extract_content, resp.data);
+    buf_free(&resp);
+    free(code);
+  }
+
+  /* file reads as done per skill per request in one-shot mode */
+  static const char *file_names[] = { "file-4k", "file-64k" };
+  static const size_t file_sizes[] = { 4096, 64000 };
+  for (int f = 0; f < 2; f++) {
+    char path[160];
+    snprintf(path, sizeof(path), "%s/%s", corpus_dir, file_names[f]);
+    char *data = make_message(file_sizes[f], 1);
+    write_file(path, data);
+    run("read_file_into", file_names[f] + 5, strlen(data), b_read_file, path);
+    free(data);
+  }
+
+  free(question);
+  remove_corpus();
+  return failed;
+}
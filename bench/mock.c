@@ -0,0 +1,189 @@
+/*
+ * Mock OpenAI-compatible /chat/completions server for benchmarks (Linux).
+ * One thread per connection, HTTP/1.1 keep-alive, plain JSON or SSE streaming.
+ *
+ *   bench/mock [-p PORT] [--ttfb MS] [--tps N] [--tokens N] [--error-rate F] [--429-rate F]
+ *
+ * -p 0 picks a free port; the port actually bound is printed on stdout.
+ */
+#define _GNU_SOURCE /* memmem */
+#include "buf.h"
+#include "http.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static int ttfb_ms = 20;
+static double tokens_per_s = 0; /* 0: all tokens at once */
+static int n_tokens = 32;
+static double error_rate, rate_limit_rate;
+
+static void sleep_ms(double ms) {
+  if (ms <= 0) return;
+  struct timespec ts = { (time_t)(ms / 1000), (long)((ms - (time_t)(ms / 1000) * 1000.0) * 1e6) };
+  while (nanosleep(&ts, &ts) != 0) {}
+}
+
+static int send_all(int fd, const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+    if (w <= 0) return -1;
+    p += w;
+    n -= (size_t)w;
+  }
+  return 0;
+}
+
+static int send_buf(int fd, buf_t *b) {
+  int r = b->len ? send_all(fd, b->data, b->len) : 0;
+  b->len = 0;
+  return r;
+}
+
+static void usage_json(buf_t *out, size_t prompt_bytes) {
+  buf_printf(out, "\"usage\":{\"prompt_tokens\":%zu,\"completion_tokens\":%d,\"total_tokens\":%zu}",
+             prompt_bytes / 4, n_tokens, prompt_bytes / 4 + (size_t)n_tokens);
+}
+
+static int reply_error(int fd, int status, int keep_alive) {
+  buf_t out = {0};
+  const char *body = status == 429 ? "{\"error\":{\"message\":\"rate limited (mock)\",\"type\":\"rate_limit\"}}"
+                                   : "{\"error\":{\"message\":\"injected failure (mock)\",\"type\":\"server_error\"}}";
+  http_response(&out, status, "application/json", body, strlen(body), keep_alive);
+  int r = send_buf(fd, &out);
+  buf_free(&out);
+  return r;
+}
+
+static int reply_json(int fd, size_t prompt_bytes, int keep_alive) {
+  sleep_ms(ttfb_ms);
+  if (tokens_per_s > 0) sleep_ms(n_tokens * 1000.0 / tokens_per_s);
+  buf_t body = {0}, out = {0};
+  buf_puts(&body, "{\"id\":\"mock\",\"object\":\"chat.completion\",\"model\":\"mock\",\"choices\":[{\"index\":0,"
+                  "\"message\":{\"role\":\"assistant\",\"content\":\"");
+  for (int i = 0; i < n_tokens; i++) buf_printf(&body, "tok%d ", i);
+  buf_puts(&body, "\"},\"finish_reason\":\"stop\"}],");
+  usage_json(&body, prompt_bytes);
+  buf_puts(&body, "}");
+  http_response(&out, 200, "application/json", body.data, body.len, keep_alive);
+  int r = send_buf(fd, &out);
+  buf_free(&body);
+  buf_free(&out);
+  return r;
+}
+
+static int reply_stream(int fd, size_t prompt_bytes, int keep_alive) {
+  buf_t out = {0}, ev = {0};
+  http_stream_head(&out, "text/event-stream", keep_alive);
+  int r = send_buf(fd, &out);
+  sleep_ms(ttfb_ms);
+  for (int i = 0; i < n_tokens && r == 0; i++) {
+    if (i && tokens_per_s > 0) sleep_ms(1000.0 / tokens_per_s);
+    ev.len = 0;
+    buf_printf(&ev, "data: {\"id\":\"mock\",\"object\":\"chat.completion.chunk\",\"choices\":[{\"index\":0,"
+                    "\"delta\":{\"content\":\"tok%d \"},\"finish_reason\":null}]}\n\n", i);
+    http_chunk(&out, ev.data, ev.len);
+    r = send_buf(fd, &out);
+  }
+  ev.len = 0;
+  buf_puts(&ev, "data: {\"id\":\"mock\",\"object\":\"chat.completion.chunk\",\"choices\":[],");
+  usage_json(&ev, prompt_bytes);
+  buf_puts(&ev, "}\n\ndata: [DONE]\n\n");
+  http_chunk(&out, ev.data, ev.len);
+  http_chunk(&out, NULL, 0);
+  if (r == 0) r = send_buf(fd, &out);
+  buf_free(&ev);
+  buf_free(&out);
+  return r;
+}
+
+static void *serve_conn(void *arg) {
+  int fd = (int)(long)arg;
+  static unsigned conns;
+  unsigned seed = (unsigned)time(NULL) ^ (__atomic_fetch_add(&conns, 1, __ATOMIC_RELAXED) * 2654435761u);
+  buf_t in = {0};
+  for (;;) {
+    http_request_t req;
+    long head;
+    while ((head = http_parse_head(in.data ? in.data : "", in.len, &req)) == 0 ||
+           (head > 0 && in.len < (size_t)head + (size_t)req.content_length)) {
+      char tmp[16384];
+      ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+      if (n <= 0) goto done;
+      buf_append(&in, tmp, (size_t)n);
+    }
+    if (head < 0) break;
+    const char *body = in.data + head;
+    int r;
+    double roll = (double)rand_r(&seed) / ((double)RAND_MAX + 1.0);
+    if (strcmp(req.path, "/v1/chat/completions") != 0 && strcmp(req.path, "/chat/completions") != 0)
+      r = reply_error(fd, 404, req.keep_alive);
+    else if (roll < rate_limit_rate)
+      r = reply_error(fd, 429, req.keep_alive);
+    else if (roll < rate_limit_rate + error_rate)
+      r = reply_error(fd, 500, req.keep_alive);
+    else if (memmem(body, (size_t)req.content_length, "\"stream\":true", 13))
+      r = reply_stream(fd, (size_t)req.content_length, req.keep_alive);
+    else
+      r = reply_json(fd, (size_t)req.content_length, req.keep_alive);
+    buf_consume(&in, (size_t)head + (size_t)req.content_length);
+    if (r != 0 || !req.keep_alive) break;
+  }
+done:
+  buf_free(&in);
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int port = 18080;
+  for (int i = 1; i < argc; i++) {
+    const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(argv[i], "-p") == 0 && v) port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ttfb") == 0 && v) ttfb_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--tps") == 0 && v) tokens_per_s = atof(argv[++i]);
+    else if (strcmp(argv[i], "--tokens") == 0 && v) n_tokens = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--error-rate") == 0 && v) error_rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "--429-rate") == 0 && v) rate_limit_rate = atof(argv[++i]);
+    else {
+      fprintf(stderr, "Usage: %s [-p PORT] [--ttfb MS] [--tps N] [--tokens N] [--error-rate F] [--429-rate F]\n", argv[0]);
+      return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((unsigned short)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &alen) < 0) {
+    perror("mock: listen");
+    return 1;
+  }
+  printf("%d\n", ntohs(addr.sin_port));
+  fflush(stdout);
+  for (;;) {
+    int c = accept(fd, NULL, NULL);
+    if (c < 0) continue;
+    setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    pthread_t t;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t, &attr, serve_conn, (void *)(long)c) != 0) close(c);
+    pthread_attr_destroy(&attr);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Shared arena: anonymous MAP_SHARED memory inherited by forked workers at the same
+ * address, so pointers stored inside stay valid in every process.
+ */
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+int arena_init(arena_t *a, size_t size) {
+  memset(a, 0, sizeof(*a));
+#ifdef HAVE_MMAP
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return -1;
+#else
+  void *p = calloc(1, size);
+  if (!p) return -1;
+#endif
+  a->base = p;
+  a->size = size;
+  return 0;
+}
+
+void *arena_alloc(arena_t *a, size_t n) {
+  size_t off = (a->used + 15) & ~(size_t)15;
+  if (!a->base || off > a->size || n > a->size - off) return NULL;
+  a->used = off + n;
+  return a->base + off;
+}
+
+char *arena_memdup(arena_t *a, const char *s, size_t n) {
+  char *p = arena_alloc(a, n + 1);
+  if (!p) return NULL;
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+  return s ? arena_memdup(a, s, strlen(s)) : NULL;
+}
+
+void arena_seal(arena_t *a) {
+#ifdef HAVE_MMAP
+  if (a->base) mprotect(a->base, a->size, PROT_READ);
+#else
+  (void)a;
+#endif
+}
+
+/* Zeroed like a fresh mapping, since callers count on that. Only the process that
+   resets it can write; the others keep their read-only view of the same pages. */
+void arena_reset(arena_t *a) {
+  if (!a->base) return;
+#ifdef HAVE_MMAP
+  mprotect(a->base, a->size, PROT_READ | PROT_WRITE);
+#endif
+  memset(a->base, 0, a->used);
+  a->used = 0;
+}
+
+void arena_free(arena_t *a) {
+  if (!a->base) return;
+#ifdef HAVE_MMAP
+  munmap(a->base, a->size);
+#else
+  free(a->base);
+#endif
+  memset(a, 0, sizeof(*a));
+}
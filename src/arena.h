@@ -0,0 +1,22 @@
+#ifndef NEO_ARENA_H
+#define NEO_ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator over one shared mapping. Filled once before the daemon forks, then
+   sealed read-only so every worker reads the same physical pages. */
+typedef struct {
+  char *base;
+  size_t size;
+  size_t used;
+} arena_t;
+
+int arena_init(arena_t *a, size_t size);
+void *arena_alloc(arena_t *a, size_t n);
+char *arena_strdup(arena_t *a, const char *s);
+char *arena_memdup(arena_t *a, const char *s, size_t n); /* NUL-terminated copy of n bytes */
+void arena_seal(arena_t *a);
+void arena_reset(arena_t *a); /* writable and empty again, for the next fill */
+void arena_free(arena_t *a);
+
+#endif
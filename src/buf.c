@@ -0,0 +1,74 @@
+#include "buf.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int buf_reserve(buf_t *b, size_t extra) {
+  if (b->len + extra + 1 <= b->cap) return 0;
+  size_t cap = b->cap ? b->cap : 256;
+  while (cap < b->len + extra + 1) cap *= 2;
+  char *n = realloc(b->data, cap);
+  if (!n) return -1;
+  b->data = n;
+  b->cap = cap;
+  return 0;
+}
+
+int buf_append(buf_t *b, const char *s, size_t n) {
+  if (buf_reserve(b, n) != 0) return -1;
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  b->data[b->len] = '\0';
+  return 0;
+}
+
+int buf_puts(buf_t *b, const char *s) {
+  return buf_append(b, s, strlen(s));
+}
+
+int buf_printf(buf_t *b, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (n < 0 || buf_reserve(b, (size_t)n) != 0) return -1;
+  va_start(ap, fmt);
+  vsnprintf(b->data + b->len, (size_t)n + 1, fmt, ap);
+  va_end(ap);
+  b->len += (size_t)n;
+  return 0;
+}
+
+int buf_json_escape(buf_t *b, const char *s) {
+  if (!s) return 0;
+  size_t n = strlen(s);
+  if (buf_reserve(b, n + n / 8 + 16) != 0) return -1;
+  const char *run = s; /* flush unescaped spans in one copy */
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    if (buf_append(b, run, (size_t)(s - run)) != 0) return -1;
+    run = s + 1;
+    char esc[8];
+    if (c == '"' || c == '\\') { esc[0] = '\\'; esc[1] = (char)c; esc[2] = '\0'; }
+    else if (c == '\n') strcpy(esc, "\\n");
+    else if (c == '\r') strcpy(esc, "\\r");
+    else if (c == '\t') strcpy(esc, "\\t");
+    else snprintf(esc, sizeof(esc), "\\u%04x", c);
+    if (buf_puts(b, esc) != 0) return -1;
+  }
+  return buf_append(b, run, (size_t)(s - run));
+}
+
+void buf_consume(buf_t *b, size_t n) {
+  if (n >= b->len) { b->len = 0; if (b->data) b->data[0] = '\0'; return; }
+  memmove(b->data, b->data + n, b->len - n + 1);
+  b->len -= n;
+}
+
+void buf_free(buf_t *b) {
+  free(b->data);
+  b->data = NULL;
+  b->len = b->cap = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef NEO_BUF_H
+#define NEO_BUF_H
+
+#include <stddef.h>
+
+/* Growable byte buffer; data is always NUL-terminated once anything was appended. */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} buf_t;
+
+int buf_reserve(buf_t *b, size_t extra);
+int buf_append(buf_t *b, const char *s, size_t n);
+int buf_puts(buf_t *b, const char *s);
+int buf_printf(buf_t *b, const char *fmt, ...);
+/* Append s as the inside of a JSON string literal. */
+int buf_json_escape(buf_t *b, const char *s);
+void buf_consume(buf_t *b, size_t n); /* drop n bytes from the front */
+void buf_free(buf_t *b);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Shared response cache: fixed slots in an anonymous shared mapping, seqlock per slot.
+ */
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+typedef struct {
+  uint32_t seq;     /* odd while a writer owns the slot */
+  uint32_t len;
+  uint64_t key;
+  int64_t expires;  /* wall-clock seconds */
+} slot_hdr_t;
+
+struct cache {
+  uint32_t entries;
+  uint32_t max_bytes;
+  uint32_t stride;
+  int32_t ttl;
+  unsigned long hits;
+  unsigned long misses;
+  size_t size;      /* of the whole mapping */
+};
+
+static cache_t *cache;
+
+static slot_hdr_t *slot_for(cache_t *c, uint64_t key) {
+  char *base = (char *)c + ((sizeof(cache_t) + 63) & ~(size_t)63);
+  return (slot_hdr_t *)(base + (size_t)(key % c->entries) * c->stride);
+}
+
+cache_t *cache_create(int entries, int max_bytes, int ttl_s) {
+  if (entries <= 0 || max_bytes <= 0) return NULL;
+  size_t stride = (sizeof(slot_hdr_t) + (size_t)max_bytes + 63) & ~(size_t)63;
+  size_t size = ((sizeof(cache_t) + 63) & ~(size_t)63) + stride * (size_t)entries;
+#ifdef HAVE_MMAP
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+#else
+  void *p = calloc(1, size);
+  if (!p) return NULL;
+#endif
+  cache_t *c = p;
+  c->entries = (uint32_t)entries;
+  c->max_bytes = (uint32_t)max_bytes;
+  c->stride = (uint32_t)stride;
+  c->ttl = ttl_s;
+  c->size = size;
+  return c;
+}
+
+void cache_destroy(cache_t *c) {
+  if (!c) return;
+#ifdef HAVE_MMAP
+  munmap(c, c->size);
+#else
+  free(c);
+#endif
+}
+
+int cache_init(int entries, int max_bytes, int ttl_s) {
+  if (entries <= 0 || max_bytes <= 0) return 0;
+  cache = cache_create(entries, max_bytes, ttl_s);
+  return cache ? 0 : -1;
+}
+
+int cache_enabled(void) {
+  return cache != NULL;
+}
+
+uint64_t cache_hash(uint64_t h, const void *data, size_t n) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint64_t cache_hash_str(uint64_t h, const char *s) {
+  return s ? cache_hash(h, s, strlen(s) + 1) : cache_hash(h, "", 1);
+}
+
+uint64_t cache_request_key(const llm_request_t *req) {
+  uint64_t h = CACHE_HASH_INIT;
+  char params[64];
+  snprintf(params, sizeof(params), "%d %.2f %d %d %d", req->max_tokens, req->temperature, req->thinking,
+           req->think_budget, req->no_think);
+  h = cache_hash_str(h, req->base_url);
+  h = cache_hash_str(h, req->model);
+  h = cache_hash_str(h, params);
+  const char *system_prompt = req->system_prompt ? req->system_prompt : "";
+  const char *clock = strstr(system_prompt, "Current date and time:");
+  const char *after = clock ? strstr(clock, "\n\n") : NULL;
+  if (clock && after) {
+    h = cache_hash(h, system_prompt, (size_t)(clock - system_prompt));
+    h = cache_hash_str(h, after);
+  } else
+    h = cache_hash_str(h, system_prompt);
+  for (int i = 0; i < req->n_messages; i++) {
+    h = cache_hash_str(h, req->messages[i].role);
+    h = cache_hash_str(h, req->messages[i].content);
+  }
+  return h;
+}
+
+char *cache_get(uint64_t key, size_t *len) {
+  return cache_lookup(cache, key, len);
+}
+
+void cache_put(uint64_t key, const char *data, size_t len) {
+  cache_store(cache, key, data, len);
+}
+
+char *cache_lookup(cache_t *c, uint64_t key, size_t *len) {
+  if (!c) return NULL;
+  slot_hdr_t *s = slot_for(c, key);
+  uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+  char *copy = NULL;
+  if (!(seq & 1) && s->key == key && s->len > 0 && s->len <= c->max_bytes && s->expires > (int64_t)time(NULL)) {
+    uint32_t n = s->len;
+    copy = malloc(n + 1);
+    if (copy) {
+      memcpy(copy, (char *)(s + 1), n);
+      copy[n] = '\0';
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || s->key != key) {
+        free(copy); /* overwritten while we copied */
+        copy = NULL;
+      } else if (len)
+        *len = n;
+    }
+  }
+  __atomic_fetch_add(copy ? &c->hits : &c->misses, 1, __ATOMIC_RELAXED);
+  return copy;
+}
+
+void cache_store(cache_t *c, uint64_t key, const char *data, size_t len) {
+  if (!c || len == 0 || len > c->max_bytes) return;
+  slot_hdr_t *s = slot_for(c, key);
+  uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  if ((seq & 1) || !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return; /* another worker is writing this slot */
+  s->key = key;
+  s->len = (uint32_t)len;
+  s->expires = (int64_t)time(NULL) + c->ttl;
+  memcpy((char *)(s + 1), data, len);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void cache_counts(unsigned long *hits, unsigned long *misses) {
+  *hits = cache ? __atomic_load_n(&cache->hits, __ATOMIC_RELAXED) : 0;
+  *misses = cache ? __atomic_load_n(&cache->misses, __ATOMIC_RELAXED) : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef NEO_CACHE_H
+#define NEO_CACHE_H
+
+#include "llm.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Response cache in one MAP_SHARED region created before the daemon forks, so every
+   worker hits the same entries. Slots are direct-mapped by key and guarded by a per-slot
+   sequence counter: readers never block, a writer that loses the race just skips. */
+
+#define CACHE_HASH_INIT 14695981039346656037ULL
+
+/* A cache of its own (libneo keeps one per context); NULL when off (entries or
+   max_bytes <= 0) or out of memory. Safe to share between threads as well. */
+typedef struct cache cache_t;
+cache_t *cache_create(int entries, int max_bytes, int ttl_s);
+void cache_destroy(cache_t *c);
+char *cache_lookup(cache_t *c, uint64_t key, size_t *len); /* malloc'd copy or NULL */
+void cache_store(cache_t *c, uint64_t key, const char *data, size_t len);
+
+/* The process's cache, shared with forked workers; the functions below use it. */
+int cache_init(int entries, int max_bytes, int ttl_s);
+int cache_enabled(void);
+uint64_t cache_hash(uint64_t h, const void *data, size_t n); /* FNV-1a, chainable */
+uint64_t cache_hash_str(uint64_t h, const char *s);          /* includes the terminator */
+/* Key over everything that shapes the reply except the per-minute clock line, so a
+   repeated question stays a hit for the whole TTL. */
+uint64_t cache_request_key(const llm_request_t *req);
+char *cache_get(uint64_t key, size_t *len);                   /* malloc'd copy or NULL */
+void cache_put(uint64_t key, const char *data, size_t len);
+void cache_counts(unsigned long *hits, unsigned long *misses);
+
+#endif
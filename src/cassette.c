@@ -0,0 +1,184 @@
+/*
+ * Cassette file: "NEOCAS1\n", then one record per response, each 8-byte aligned:
+ *
+ *   uint64 key | uint32 status | uint32 n_segs | uint64 data_len | uint64 reserved
+ *   n_segs x { uint32 at_us, uint32 len }
+ *   data_len bytes, zero-padded to a multiple of 8
+ *
+ * Records are only ever appended (one write each), so a cassette can be grown across
+ * runs and by several workers at once. Replay maps the file and builds an in-memory
+ * open-addressing index over the record headers.
+ */
+#include "cassette.h"
+#include "cache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#endif
+
+#define MAGIC "NEOCAS1\n"
+
+typedef struct {
+  uint64_t key;
+  uint32_t status;
+  uint32_t n_segs;
+  uint64_t data_len;
+  uint64_t reserved;
+} record_t;
+
+static int mode = CASSETTE_OFF;
+static int realtime;
+static int rec_fd = -1;
+static const char *map;   /* replay: the whole file */
+static size_t map_len;
+static size_t *slots;     /* replay index: record offset + 1, 0 = empty */
+static size_t n_slots;
+
+int cassette_mode(void) { return mode; }
+int cassette_realtime(void) { return realtime; }
+
+static size_t pad8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static const record_t *record_at(size_t off) {
+  return (const record_t *)(map + off);
+}
+
+static void index_put(size_t off) {
+  uint64_t key = record_at(off)->key;
+  for (size_t i = (size_t)key & (n_slots - 1);; i = (i + 1) & (n_slots - 1)) {
+    if (slots[i] == 0 || record_at(slots[i] - 1)->key == key) { /* later records replace earlier ones */
+      slots[i] = off + 1;
+      return;
+    }
+  }
+}
+
+static int load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb) != 0 || (size_t)sb.st_size < 8) {
+    if (fd >= 0) close(fd);
+    fprintf(stderr, "neo: cannot read cassette %s\n", path);
+    return -1;
+  }
+  map_len = (size_t)sb.st_size;
+#ifdef HAVE_MMAP
+  void *p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  map = p == MAP_FAILED ? NULL : p;
+#else
+  char *p = malloc(map_len);
+  if (p && read(fd, p, map_len) != (ssize_t)map_len) { free(p); p = NULL; }
+  map = p;
+#endif
+  close(fd);
+  if (!map || memcmp(map, MAGIC, 8) != 0) {
+    fprintf(stderr, "neo: %s is not a neo cassette\n", path);
+    return -1;
+  }
+  size_t n = 0;
+  for (size_t off = 8; off + sizeof(record_t) <= map_len; n++) {
+    const record_t *r = record_at(off);
+    off += sizeof(record_t) + (size_t)r->n_segs * sizeof(cassette_seg_t) + pad8((size_t)r->data_len);
+  }
+  for (n_slots = 16; n_slots < n * 2; n_slots *= 2) {}
+  slots = calloc(n_slots, sizeof(size_t));
+  if (!slots) return -1;
+  for (size_t off = 8; off + sizeof(record_t) <= map_len;) {
+    const record_t *r = record_at(off);
+    size_t next = off + sizeof(record_t) + (size_t)r->n_segs * sizeof(cassette_seg_t) + pad8((size_t)r->data_len);
+    if (next > map_len) break; /* torn last record */
+    index_put(off);
+    off = next;
+  }
+  return 0;
+}
+
+int cassette_open(const char *path, int m, int rt) {
+  realtime = rt;
+  if (m == CASSETTE_REPLAY) {
+    if (load(path) != 0) return -1;
+  } else if (m == CASSETTE_RECORD) {
+    rec_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat sb;
+    if (rec_fd < 0 || fstat(rec_fd, &sb) != 0) {
+      fprintf(stderr, "neo: cannot write cassette %s\n", path);
+      return -1;
+    }
+    if (sb.st_size == 0 && write(rec_fd, MAGIC, 8) != 8) return -1;
+  }
+  mode = m;
+  return 0;
+}
+
+uint64_t cassette_key(const char *url, const char *body) {
+  uint64_t h = cache_hash_str(CACHE_HASH_INIT, url);
+  /* the system prompt's clock line changes every minute; leave it out like the cache does */
+  const char *clock = strstr(body, "Current date and time:");
+  const char *after = clock ? strstr(clock, "\\n\\n") : NULL;
+  if (clock && after) {
+    h = cache_hash(h, body, (size_t)(clock - body));
+    return cache_hash_str(h, after);
+  }
+  return cache_hash_str(h, body);
+}
+
+int cassette_find(uint64_t key, cassette_entry_t *out) {
+  if (!slots) return -1;
+  for (size_t i = (size_t)key & (n_slots - 1); slots[i]; i = (i + 1) & (n_slots - 1)) {
+    const record_t *r = record_at(slots[i] - 1);
+    if (r->key != key) continue;
+    out->status = (long)r->status;
+    out->segs = (const cassette_seg_t *)(r + 1);
+    out->n_segs = (int)r->n_segs;
+    out->data = (const char *)(out->segs + r->n_segs);
+    out->len = (size_t)r->data_len;
+    return 0;
+  }
+  return -1;
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+void cassette_rec_begin(cassette_rec_t *r) {
+  memset(r, 0, sizeof(*r));
+  r->t0_us = now_us();
+}
+
+void cassette_rec_add(cassette_rec_t *r, const char *p, size_t n) {
+  cassette_seg_t seg = { (uint32_t)(now_us() - r->t0_us), (uint32_t)n };
+  buf_append(&r->segs, (const char *)&seg, sizeof(seg));
+  buf_append(&r->data, p, n);
+}
+
+void cassette_rec_free(cassette_rec_t *r) {
+  buf_free(&r->data);
+  buf_free(&r->segs);
+}
+
+void cassette_rec_end(cassette_rec_t *r, uint64_t key, long status) {
+  if (rec_fd >= 0) {
+    record_t h = { key, (uint32_t)status, (uint32_t)(r->segs.len / sizeof(cassette_seg_t)), r->data.len, 0 };
+    buf_t out = {0};
+    static const char zeros[8];
+    buf_append(&out, (const char *)&h, sizeof(h));
+    if (r->segs.len) buf_append(&out, r->segs.data, r->segs.len);
+    if (r->data.len) buf_append(&out, r->data.data, r->data.len);
+    buf_append(&out, zeros, pad8(r->data.len) - r->data.len);
+    if (out.data && write(rec_fd, out.data, out.len) != (ssize_t)out.len)
+      fprintf(stderr, "neo: cassette write failed\n");
+    buf_free(&out);
+  }
+  cassette_rec_free(r);
+}
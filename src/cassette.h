@@ -0,0 +1,53 @@
+#ifndef NEO_CASSETTE_H
+#define NEO_CASSETTE_H
+
+#include "buf.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Record/replay of raw provider responses (--record FILE / --replay FILE). Responses
+ * are keyed by a hash of URL and request body (minus the per-minute clock line) and
+ * kept with the arrival time of every chunk, so a replay can reproduce the original
+ * TTFB and streaming cadence or serve everything at once.
+ */
+enum { CASSETTE_OFF, CASSETTE_RECORD, CASSETTE_REPLAY };
+
+/* Record appends to path (created if missing); replay maps it and indexes it once.
+   realtime: replay with the recorded timing. Call before forking workers. */
+int cassette_open(const char *path, int mode, int realtime);
+int cassette_mode(void);
+int cassette_realtime(void);
+
+uint64_t cassette_key(const char *url, const char *body);
+
+typedef struct {
+  uint32_t at_us; /* arrival, from the start of the request */
+  uint32_t len;
+} cassette_seg_t;
+
+typedef struct {
+  long status;
+  const char *data; /* all segments back to back; points into the mapping */
+  size_t len;
+  const cassette_seg_t *segs;
+  int n_segs;
+} cassette_entry_t;
+
+/* 0 and *out filled when key was recorded (the latest recording wins), -1 otherwise. */
+int cassette_find(uint64_t key, cassette_entry_t *out);
+
+/* One response being recorded. */
+typedef struct {
+  buf_t data;
+  buf_t segs;
+  uint64_t t0_us;
+} cassette_rec_t;
+
+void cassette_rec_begin(cassette_rec_t *r);
+void cassette_rec_add(cassette_rec_t *r, const char *p, size_t n);
+/* Append the response to the file (one write, so workers can share it) and free r. */
+void cassette_rec_end(cassette_rec_t *r, uint64_t key, long status);
+void cassette_rec_free(cassette_rec_t *r);
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * Prompt compaction, line by line and in place (output never outruns input). Outside
+ * code fences a line loses its comments, repeated inner whitespace and trailing
+ * whitespace, and runs of one punctuation mark are cut to three (ASCII) or two
+ * (full-width); then markdown that only draws is dropped or shortened.
+ */
+#include "compact.h"
+#include "cache.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DUP_MIN 16 /* shorter lines ("- yes", "}") repeat legitimately */
+
+size_t compact_tokens(const char *p, size_t n) {
+  size_t ascii = 0, wide = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)p[i];
+    if (c < 0x80) ascii++;
+    else if (c >= 0xC0) wide++;
+  }
+  return (ascii + 3) / 4 + wide;
+}
+
+static size_t utf8_len(unsigned char c) {
+  if (c < 0xC0) return 1; /* ASCII, or a stray continuation byte */
+  if (c < 0xE0) return 2;
+  if (c < 0xF0) return 3;
+  return 4;
+}
+
+static unsigned codepoint(const unsigned char *p, size_t k) {
+  if (k == 1) return p[0];
+  if (k == 2) return (p[0] & 0x1Fu) << 6 | (p[1] & 0x3Fu);
+  if (k == 3) return (p[0] & 0x0Fu) << 12 | (p[1] & 0x3Fu) << 6 | (p[2] & 0x3Fu);
+  return (p[0] & 0x07u) << 18 | (p[1] & 0x3Fu) << 12 | (p[2] & 0x3Fu) << 6 | (p[3] & 0x3Fu);
+}
+
+/* How many of cp in a row say all there is to say; 0: any number (not punctuation). */
+static int run_keep(unsigned cp) {
+  if (cp < 0x80) return cp && strchr("!?.,;:~=*-_", (int)cp) ? 3 : 0;
+  if ((cp >= 0x3001 && cp <= 0x303F) || (cp >= 0xFF01 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20) ||
+      (cp >= 0xFF3B && cp <= 0xFF40) || (cp >= 0xFF5B && cp <= 0xFF65) || (cp >= 0x2010 && cp <= 0x2027) ||
+      (cp >= 0x2500 && cp <= 0x257F))
+    return 2;
+  return 0;
+}
+
+static int rule_mark(unsigned cp) {
+  return cp == '-' || cp == '*' || cp == '_' || cp == '=' || cp == '~' || cp == 0x2014 || cp == 0x2015 ||
+         cp == 0x2500 || cp == 0x2501 || cp == 0x2550 || cp == 0x30FB || cp == 0xFF0A || cp == 0xFF0D ||
+         cp == 0xFF1D || cp == 0xFF5E;
+}
+
+/* "---", "* * *", "=====", "——————": a line of one mark (spaces allowed). */
+static int is_rule(const char *s, size_t n) {
+  unsigned first = 0;
+  int count = 0;
+  for (size_t i = 0; i < n;) {
+    size_t k = utf8_len((unsigned char)s[i]);
+    if (i + k > n) return 0;
+    unsigned cp = codepoint((const unsigned char *)s + i, k);
+    i += k;
+    if (cp == ' ') continue;
+    if (count ? cp != first : !rule_mark(cp)) return 0;
+    first = cp;
+    count++;
+  }
+  return count >= (first < 0x80 ? 3 : 2);
+}
+
+/* "|---|:--:|": the row under a table header. */
+static int is_table_rule(const char *s, size_t n) {
+  int bar = 0, dash = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] == '|') bar = 1;
+    else if (s[i] == '-') dash = 1;
+    else if (s[i] != ':' && s[i] != ' ') return 0;
+  }
+  return bar && dash;
+}
+
+/* Whitespace, comments and punctuation runs of the line p[0..n) into w (w <= p);
+   returns the new length. Leading indentation stays: it nests lists. */
+static size_t squeeze_line(char *w, const char *p, size_t n, int *comment) {
+  size_t o = 0, i = 0;
+  int lead = 1, space = 0, run = 0;
+  unsigned run_cp = 0;
+  while (i < n) {
+    if (*comment) {
+      while (i < n && !(n - i >= 3 && memcmp(p + i, "-->", 3) == 0)) i++;
+      if (i < n) {
+        i += 3;
+        *comment = 0;
+      }
+      continue;
+    }
+    if (n - i >= 4 && memcmp(p + i, "<!--", 4) == 0) {
+      *comment = 1;
+      i += 4;
+      continue;
+    }
+    unsigned char c = (unsigned char)p[i];
+    size_t k = utf8_len(c);
+    if (i + k > n) k = n - i;
+    unsigned cp = codepoint((const unsigned char *)p + i, k);
+    if (c == ' ' || c == '\t' || c == '\r' || cp == 0x3000) {
+      if (!lead) space = 1;
+      else if (c == ' ' || c == '\t') w[o++] = (char)c;
+      i += k;
+      run = 0;
+      continue;
+    }
+    lead = 0;
+    if (space) {
+      w[o++] = ' ';
+      space = 0;
+    }
+    int keep = run_keep(cp);
+    if (keep && run && cp == run_cp) {
+      if (++run > keep) {
+        i += k;
+        continue;
+      }
+    } else {
+      run_cp = cp;
+      run = 1;
+    }
+    memmove(w + o, p + i, k);
+    o += k;
+    i += k;
+  }
+  while (o > 0 && (w[o - 1] == ' ' || w[o - 1] == '\t')) o--;
+  return o;
+}
+
+/* Markdown of the squeezed line s[0..n): 0 drops it (blank, rule, table separator,
+   empty heading), else its new length. *para: the line ends a paragraph (blank, rule).
+   after_text: the line above is text, so "---" or "===" underlines a heading. */
+static size_t markdown_line(char *s, size_t n, int after_text, int *para) {
+  size_t i = 0;
+  while (i < n && (s[i] == ' ' || s[i] == '\t')) i++;
+  *para = i == n;
+  if (i == n || is_table_rule(s + i, n - i)) return 0;
+  if (is_rule(s + i, n - i)) {
+    if (after_text && (s[i] == '-' || s[i] == '=')) return n;
+    *para = 1;
+    return 0;
+  }
+  if (s[i] == '#') {
+    size_t h = i, k = n;
+    while (h < n && s[h] == '#') h++;
+    while (k > h && s[k - 1] == '#') k--;
+    if (k == h) return 0;
+    if (k < n && s[k - 1] == ' ') { /* "## Title ##": a closing sequence needs the space */
+      while (k > h && s[k - 1] == ' ') k--;
+      if (k == h) return 0;
+      return k;
+    }
+    return n;
+  }
+  if (n - i >= 2 && (s[i] == '*' || s[i] == '+') && s[i + 1] == ' ') s[i] = '-';
+  return n;
+}
+
+static int fence_line(const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && (p[i] == ' ' || p[i] == '\t')) i++;
+  return n - i >= 3 && (memcmp(p + i, "```", 3) == 0 || memcmp(p + i, "~~~", 3) == 0);
+}
+
+size_t compact_text(char *text, size_t len, compact_saved_t *saved) {
+  size_t before = saved ? compact_tokens(text, len) : 0;
+  size_t w = 0, r = 0;
+  int fence = 0, comment = 0, blank = 0;
+  while (r < len) {
+    const char *p = text + r, *eol = memchr(p, '\n', len - r);
+    size_t n = eol ? (size_t)(eol - p) : len - r;
+    r += n + (eol ? 1 : 0);
+    /* a kept line goes after the newline(s) ending the one before; the input has
+       already given up at least that many bytes */
+    char *dst = text + w + (w ? 1 + blank : 0);
+    size_t o;
+    int is_fence = !comment && fence_line(p, n);
+    if (fence || is_fence) {
+      o = n;
+      while (o > 0 && (p[o - 1] == ' ' || p[o - 1] == '\t' || p[o - 1] == '\r')) o--;
+      memmove(dst, p, o);
+      if (is_fence) fence = !fence;
+    } else {
+      int para;
+      o = markdown_line(dst, squeeze_line(dst, p, n, &comment), w > 0 && !blank, &para);
+      if (!o) {
+        if (para) blank = w > 0; /* table separators, comments, empty headings just go */
+        continue;
+      }
+    }
+    if (w) {
+      text[w++] = '\n';
+      if (blank) text[w++] = '\n';
+    }
+    w += o;
+    blank = 0;
+  }
+  text[w] = '\0';
+  if (saved) {
+    size_t after = compact_tokens(text, w);
+    saved->chars += len - w;
+    saved->tokens += before > after ? before - after : 0;
+  }
+  return w;
+}
+
+/* A kept line: its hash and where it now is in the text (w only trails r, so a kept
+   line is never overwritten). */
+typedef struct {
+  uint64_t hash;
+  size_t off, len;
+} seen_line_t;
+
+size_t compact_dedupe(char *text, size_t len, compact_saved_t *saved) {
+  size_t lines = 1;
+  for (const char *q = text; (q = memchr(q, '\n', len - (size_t)(q - text))) != NULL; q++) lines++;
+  size_t cap = 64;
+  while (cap < lines * 2) cap <<= 1;
+  seen_line_t *seen = calloc(cap, sizeof(*seen));
+  if (!seen) return len;
+  size_t w = 0, r = 0;
+  int fence = 0, blank = 0;
+  while (r < len) {
+    const char *p = text + r, *eol = memchr(p, '\n', len - r);
+    size_t n = eol ? (size_t)(eol - p) : len - r, next = r + n + (eol ? 1 : 0);
+    int is_fence = fence_line(p, n), drop = 0;
+    if (!fence && !is_fence && n >= DUP_MIN) {
+      uint64_t h = cache_hash(CACHE_HASH_INIT, p, n) | 1; /* 0 marks a free slot */
+      size_t at = (size_t)h & (cap - 1);
+      while (seen[at].hash && !(seen[at].hash == h && seen[at].len == n && memcmp(text + seen[at].off, p, n) == 0))
+        at = (at + 1) & (cap - 1); /* a different line with the same hash is kept */
+      drop = seen[at].hash != 0;
+      if (!drop) {
+        seen[at].hash = h;
+        seen[at].off = w;
+        seen[at].len = n;
+      }
+    }
+    if (!drop && !fence && n == 0) {
+      drop = blank;
+      blank = 1;
+    } else if (!drop)
+      blank = 0;
+    if (drop) {
+      if (saved) {
+        saved->chars += next - r;
+        saved->tokens += compact_tokens(p, n);
+      }
+    } else {
+      memmove(text + w, p, next - r);
+      w += next - r;
+      if (is_fence) fence = !fence;
+    }
+    r = next;
+  }
+  free(seen);
+  text[w] = '\0';
+  return w;
+}
@@ -0,0 +1,30 @@
+#ifndef NEO_COMPACT_H
+#define NEO_COMPACT_H
+
+#include <stddef.h>
+
+/*
+ * Prompt compaction (prompt.compact): skill, bootstrap and memory files lose what costs
+ * prefill time without telling the model anything, i.e. HTML comments, horizontal rules
+ * and table separator rows, closing #s of headings, trailing and repeated whitespace,
+ * runs of blank lines and of the same punctuation mark. Fenced code is kept as written.
+ * Repeated lines are dropped once the whole prompt is assembled, so a fact that several
+ * skills state is sent once.
+ */
+
+typedef struct {
+  size_t chars; /* bytes taken out */
+  size_t tokens; /* estimated (compact_tokens) */
+} compact_saved_t;
+
+/* Compact text[0..len) in place; returns the new length (text is NUL-terminated there).
+   What was taken out is added to *saved (may be NULL). */
+size_t compact_text(char *text, size_t len, compact_saved_t *saved);
+/* Drop every line of text[0..len) (outside code fences, 16 bytes or longer) that
+   already appeared above it, then blank-line runs left behind; returns the new length. */
+size_t compact_dedupe(char *text, size_t len, compact_saved_t *saved);
+/* Rough token count: ~4 bytes per token for ASCII, one per multi-byte character (CJK
+   text runs close to that). */
+size_t compact_tokens(const char *p, size_t n);
+
+#endif
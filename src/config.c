@@ -1,4 +1,5 @@
 #include "config.h"
+#include "llm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,6 +59,24 @@ void config_free(agent_config_t *c) {
   c->skills.high_priority_count = 0;
   free(c->memory.path);
   c->memory.path = NULL;
+  free(c->embed.model);
+  c->embed.model = NULL;
+  free(c->daemon_socket);
+  free(c->session_journal);
+  c->daemon_socket = NULL;
+  for (int i = 0; i < c->profile_count; i++) {
+    profile_config_t *p = &c->profiles[i];
+    free(p->name);
+    free(p->base_url);
+    free(p->model);
+    free(p->api_key);
+  }
+  c->profile_count = 0;
+  for (int i = 0; i < c->route_count; i++) {
+    free(c->routes[i].profile);
+    free_path_list(c->routes[i].skills, c->routes[i].skill_count);
+  }
+  c->route_count = 0;
 }
 
 static void add_path(char ***paths, int *count, const char *val, int max_count) {
@@ -71,30 +90,137 @@ static void add_path(char ***paths, int *count, const char *val, int max_count)
   (*count)++;
 }
 
+/* "[a, b]" or "a, b" into list. */
+static void add_name_list(char ***list, int *count, char *val) {
+  char *p = val;
+  while (*p == ' ' || *p == '\t' || *p == '[') p++;
+  while (*p && *p != ']' && *p != '#' && *p != '\n') {
+    size_t n = strcspn(p, ",]#\r\n");
+    char item[MAX_STR];
+    snprintf(item, sizeof(item), "%.*s", (int)n, p);
+    char *it = trim_quotes(item);
+    if (*it) add_path(list, count, it, MAX_PATHS);
+    p += n;
+    if (*p == ',') p++;
+    while (*p == ' ' || *p == '\t') p++;
+  }
+}
+
+static int yes(const char *v) {
+  while (*v == ' ' || *v == '\t') v++;
+  return strncmp(v, "yes", 3) == 0 || strncmp(v, "true", 4) == 0 || *v == '1';
+}
+
+/* thinking: on | off (anything else: provider default) */
+static int thinking_mode(const char *v) {
+  while (*v == ' ' || *v == '\t' || *v == '"') v++;
+  if (strncmp(v, "on", 2) == 0 || yes(v)) return LLM_THINK_ON;
+  if (strncmp(v, "off", 3) == 0 || strncmp(v, "no", 2) == 0 || strncmp(v, "false", 5) == 0 || *v == '0')
+    return LLM_THINK_OFF;
+  return LLM_THINK_DEFAULT;
+}
+
+/* backend: llama.cpp | vllm | openai (anything else: unset) */
+static int backend_kind(const char *v) {
+  while (*v == ' ' || *v == '\t' || *v == '"') v++;
+  if (strncmp(v, "llama", 5) == 0) return LLM_BACKEND_LLAMACPP;
+  if (strncmp(v, "vllm", 4) == 0) return LLM_BACKEND_VLLM;
+  if (strncmp(v, "openai", 6) == 0) return LLM_BACKEND_OPENAI;
+  return LLM_BACKEND_DEFAULT;
+}
+
+static void parse_profile_key(profile_config_t *p, char *t) {
+  if (strncmp(t, "name:", 5) == 0) { free(p->name); p->name = dup_str(trim_quotes(t + 5)); }
+  else if (strncmp(t, "base_url:", 9) == 0) { free(p->base_url); p->base_url = dup_str(trim_quotes(t + 9)); }
+  else if (strncmp(t, "model:", 6) == 0) { free(p->model); p->model = dup_str(trim_quotes(t + 6)); }
+  else if (strncmp(t, "api_key:", 8) == 0) { free(p->api_key); p->api_key = dup_str(trim_quotes(t + 8)); }
+  else if (strncmp(t, "max_tokens:", 11) == 0) p->max_tokens = atoi(t + 11);
+  else if (strncmp(t, "temperature:", 12) == 0) p->temperature = atof(t + 12);
+  else if (strncmp(t, "thinking:", 9) == 0) p->thinking = thinking_mode(t + 9);
+  else if (strncmp(t, "thinking_budget:", 16) == 0) p->think_budget = atoi(t + 16);
+  else if (strncmp(t, "no_think:", 9) == 0) p->no_think = yes(t + 9);
+  else if (strncmp(t, "backend:", 8) == 0) p->backend = backend_kind(t + 8);
+  else if (strncmp(t, "slots:", 6) == 0) p->slots = atoi(t + 6);
+}
+
+static void parse_route_key(route_config_t *r, char *t) {
+  if (strncmp(t, "profile:", 8) == 0) { free(r->profile); r->profile = dup_str(trim_quotes(t + 8)); }
+  else if (strncmp(t, "skills:", 7) == 0) add_name_list(&r->skills, &r->skill_count, t + 7);
+  else if (strncmp(t, "min_chars:", 10) == 0) r->min_chars = atoi(t + 10);
+  else if (strncmp(t, "max_chars:", 10) == 0) r->max_chars = atoi(t + 10);
+  else if (strncmp(t, "code:", 5) == 0) r->code = yes(t + 5);
+}
+
 int config_load_file(agent_config_t *c, const char *path) {
   FILE *f = fopen(path, "r");
   if (!f) return -1;
 
   char line[1024];
-  int in_model = 0, in_skills = 0, in_memory = 0, in_bootstrap = 0, in_session = 0, in_high_priority = 0;
+  enum { SEC_NONE, SEC_MODEL, SEC_SKILLS, SEC_MEMORY, SEC_BOOTSTRAP, SEC_SESSION, SEC_DAEMON, SEC_CACHE,
+         SEC_PROMPT, SEC_EMBED, SEC_PROFILES, SEC_ROUTES } sec = SEC_NONE;
+  int in_high_priority = 0;
+  int entry_ok = 0; /* profiles/routes: the current "- " entry fit in the table */
   c->memory.max_chars = 4000;
   c->model.max_tokens = 4096;
   c->model.temperature = 0.7;
   c->bootstrap.max_chars_per_file = 8000;
+  c->prompt_compact = 1;
+  c->embed.top_k = 2;
+  c->embed.min_score = -1;
   c->session_max_turns = 10;
+  c->session_journal_sync_ms = 10;
+#ifdef NEO_LOWMEM
+  c->session_max_bytes = 16384;
+#endif
+  c->daemon_request_timeout = 120;
+#ifdef NEO_LOWMEM
+  c->daemon_max_inflight = 8;
+#else
+  c->daemon_max_inflight = 32;
+#endif
+  c->daemon_max_queue = 256;
+  c->daemon_keepalive = 30;
+  c->cache.max_bytes = 16384;
+  c->cache.ttl = 600;
 
   while (fgets(line, sizeof(line), f)) {
     char *t = line;
     while (*t == ' ' || *t == '\t') t++;
     if (*t == '#' || *t == '\n' || *t == '\0') continue;
 
-    if (strncmp(t, "model:", 6) == 0) { in_model = 1; in_skills = 0; in_memory = 0; in_bootstrap = 0; in_session = 0; continue; }
-    if (strncmp(t, "skills:", 7) == 0) { in_skills = 1; in_high_priority = 0; in_model = 0; in_memory = 0; in_bootstrap = 0; in_session = 0; continue; }
-    if (strncmp(t, "memory:", 7) == 0) { in_memory = 1; in_model = 0; in_skills = 0; in_bootstrap = 0; in_session = 0; continue; }
-    if (strncmp(t, "bootstrap:", 10) == 0) { in_bootstrap = 1; in_model = 0; in_skills = 0; in_memory = 0; in_session = 0; continue; }
-    if (strncmp(t, "session:", 8) == 0) { in_session = 1; in_model = 0; in_skills = 0; in_memory = 0; in_bootstrap = 0; continue; }
+    if ((sec == SEC_PROFILES || sec == SEC_ROUTES) && t == line && *t != '-')
+      sec = SEC_NONE; /* a top-level key ends the list */
+    if (t == line && strncmp(t, "profiles:", 9) == 0) { sec = SEC_PROFILES; entry_ok = 0; continue; }
+    if (t == line && strncmp(t, "routes:", 7) == 0) { sec = SEC_ROUTES; entry_ok = 0; continue; }
+    if (sec == SEC_PROFILES || sec == SEC_ROUTES) { /* model: etc. belong to the entry here, not a new section */
+      if (strncmp(t, "- ", 2) == 0) {
+        t += 2;
+        while (*t == ' ' || *t == '\t') t++;
+        if (sec == SEC_PROFILES && (entry_ok = c->profile_count < MAX_PROFILES))
+          c->profiles[c->profile_count++].temperature = -1;
+        if (sec == SEC_ROUTES && (entry_ok = c->route_count < MAX_ROUTES))
+          c->route_count++;
+      }
+      if (entry_ok && sec == SEC_PROFILES) parse_profile_key(&c->profiles[c->profile_count - 1], t);
+      if (entry_ok && sec == SEC_ROUTES) parse_route_key(&c->routes[c->route_count - 1], t);
+      continue;
+    }
+    if (sec == SEC_EMBED && t != line && strncmp(t, "model:", 6) == 0) { /* embed.model, not the section */
+      free(c->embed.model);
+      c->embed.model = dup_str(trim_quotes(t + 6));
+      continue;
+    }
+    if (strncmp(t, "model:", 6) == 0) { sec = SEC_MODEL; continue; }
+    if (strncmp(t, "skills:", 7) == 0) { sec = SEC_SKILLS; in_high_priority = 0; continue; }
+    if (strncmp(t, "memory:", 7) == 0) { sec = SEC_MEMORY; continue; }
+    if (strncmp(t, "bootstrap:", 10) == 0) { sec = SEC_BOOTSTRAP; continue; }
+    if (strncmp(t, "session:", 8) == 0) { sec = SEC_SESSION; continue; }
+    if (strncmp(t, "daemon:", 7) == 0) { sec = SEC_DAEMON; continue; }
+    if (strncmp(t, "cache:", 6) == 0) { sec = SEC_CACHE; continue; }
+    if (strncmp(t, "prompt:", 7) == 0) { sec = SEC_PROMPT; continue; }
+    if (strncmp(t, "embed:", 6) == 0) { sec = SEC_EMBED; continue; }
 
-    if (in_model) {
+    if (sec == SEC_MODEL) {
       if (strncmp(t, "base_url:", 9) == 0) {
         free(c->model.base_url);
         c->model.base_url = dup_str(trim_quotes(t + 9));
@@ -111,31 +237,43 @@ int config_load_file(agent_config_t *c, const char *path) {
         c->model.max_tokens = atoi(t + 11);
       else if (strncmp(t, "temperature:", 12) == 0)
         c->model.temperature = atof(t + 12);
+      else if (strncmp(t, "thinking:", 9) == 0)
+        c->model.thinking = thinking_mode(t + 9);
+      else if (strncmp(t, "thinking_budget:", 16) == 0)
+        c->model.think_budget = atoi(t + 16);
+      else if (strncmp(t, "no_think:", 9) == 0)
+        c->model.no_think = yes(t + 9);
+      else if (strncmp(t, "backend:", 8) == 0)
+        c->model.backend = backend_kind(t + 8);
+      else if (strncmp(t, "slots:", 6) == 0)
+        c->model.slots = atoi(t + 6);
     }
-    if (in_memory) {
+    if (sec == SEC_MEMORY) {
       if (strncmp(t, "path:", 5) == 0) {
         free(c->memory.path);
         c->memory.path = dup_str(trim_quotes(t + 5));
       } else if (strncmp(t, "max_chars:", 10) == 0)
         c->memory.max_chars = atoi(t + 10);
+      else if (strncmp(t, "write_back:", 11) == 0)
+        c->memory.write_back = yes(t + 11);
     }
-    if (in_bootstrap) {
+    if (sec == SEC_BOOTSTRAP) {
       if (strncmp(t, "- path:", 7) == 0)
         add_path(&c->bootstrap.paths, &c->bootstrap.path_count, trim_quotes(t + 7), MAX_PATHS);
       else if (strncmp(t, "max_chars_per_file:", 19) == 0)
         c->bootstrap.max_chars_per_file = atoi(t + 19);
     }
-    if (in_skills && strncmp(t, "- path:", 7) == 0) {
+    if (sec == SEC_SKILLS && strncmp(t, "- path:", 7) == 0) {
       add_path(&c->skills.paths, &c->skills.path_count, trim_quotes(t + 7), MAX_PATHS);
       if (c->skills.path_count > 0) {
         int *np = realloc(c->skills.priority, c->skills.path_count * sizeof(int));
         if (np) { c->skills.priority = np; c->skills.priority[c->skills.path_count - 1] = 0; }
       }
     }
-    if (in_skills && (strstr(t, "priority: high") != NULL || strstr(t, "priority: 1") != NULL))
+    if (sec == SEC_SKILLS && (strstr(t, "priority: high") != NULL || strstr(t, "priority: 1") != NULL))
       if (c->skills.path_count > 0 && c->skills.priority)
         c->skills.priority[c->skills.path_count - 1] = 1;
-    if (in_skills && strncmp(t, "unmatched:", 10) == 0) {
+    if (sec == SEC_SKILLS && strncmp(t, "unmatched:", 10) == 0) {
       in_high_priority = 0;
       t += 10;
       while (*t == ' ' || *t == '\t') t++;
@@ -144,24 +282,75 @@ int config_load_file(agent_config_t *c, const char *path) {
       else if (strncmp(t, "index", 5) == 0 && (t[5] == ' ' || t[5] == '\t' || t[5] == '#' || t[5] == '\0'))
         c->skills.unmatched = 0;
     }
-    if (in_skills && strncmp(t, "directory:", 10) == 0) {
+    if (sec == SEC_SKILLS && strncmp(t, "directory:", 10) == 0) {
       in_high_priority = 0;
       free(c->skills.directory);
       c->skills.directory = dup_str(trim_quotes(t + 10));
     }
-    if (in_skills && strncmp(t, "high_priority:", 14) == 0) { in_high_priority = 1; continue; }
-    if (in_skills && in_high_priority && strncmp(t, "- ", 2) == 0) {
+    if (sec == SEC_SKILLS && strncmp(t, "high_priority:", 14) == 0) { in_high_priority = 1; continue; }
+    if (sec == SEC_SKILLS && in_high_priority && strncmp(t, "- ", 2) == 0) {
       if (c->skills.high_priority_count < MAX_PATHS)
         add_path(&c->skills.high_priority, &c->skills.high_priority_count, trim_quotes(t + 2), MAX_PATHS);
       continue;
     }
-    if (in_skills && (strncmp(t, "directory:", 10) == 0 || strncmp(t, "unmatched:", 10) == 0 || strncmp(t, "- path:", 7) == 0))
+    if (sec == SEC_SKILLS && (strncmp(t, "directory:", 10) == 0 || strncmp(t, "unmatched:", 10) == 0 || strncmp(t, "- path:", 7) == 0))
       in_high_priority = 0;
-    if (in_session && strncmp(t, "max_turns:", 10) == 0)
+    if (sec == SEC_SESSION && strncmp(t, "max_turns:", 10) == 0)
       c->session_max_turns = atoi(t + 10);
+    if (sec == SEC_SESSION && strncmp(t, "max_bytes:", 10) == 0)
+      c->session_max_bytes = atoi(t + 10);
+    if (sec == SEC_SESSION && strncmp(t, "journal:", 8) == 0) {
+      free(c->session_journal);
+      c->session_journal = dup_str(trim_quotes(t + 8));
+    }
+    if (sec == SEC_SESSION && strncmp(t, "journal_sync_ms:", 16) == 0)
+      c->session_journal_sync_ms = atoi(t + 16);
+    if (sec == SEC_DAEMON && strncmp(t, "request_timeout:", 16) == 0)
+      c->daemon_request_timeout = atoi(t + 16);
+    if (sec == SEC_DAEMON && strncmp(t, "workers:", 8) == 0)
+      c->daemon_workers = atoi(t + 8);
+    if (sec == SEC_DAEMON && strncmp(t, "max_inflight:", 13) == 0)
+      c->daemon_max_inflight = atoi(t + 13);
+    if (sec == SEC_DAEMON && strncmp(t, "max_queue:", 10) == 0)
+      c->daemon_max_queue = atoi(t + 10);
+    if (sec == SEC_DAEMON && strncmp(t, "keepalive:", 10) == 0)
+      c->daemon_keepalive = atoi(t + 10);
+    if (sec == SEC_DAEMON && strncmp(t, "socket:", 7) == 0) {
+      free(c->daemon_socket);
+      c->daemon_socket = dup_str(trim_quotes(t + 7));
+    }
+    if (sec == SEC_PROMPT && strncmp(t, "compact:", 8) == 0)
+      c->prompt_compact = yes(t + 8);
+    if (sec == SEC_EMBED) {
+      if (strncmp(t, "enabled:", 8) == 0) c->embed.enabled = yes(t + 8);
+      else if (strncmp(t, "top_k:", 6) == 0) c->embed.top_k = atoi(t + 6);
+      else if (strncmp(t, "min_score:", 10) == 0) c->embed.min_score = atof(t + 10);
+    }
+    if (sec == SEC_CACHE) {
+      if (strncmp(t, "entries:", 8) == 0) c->cache.entries = atoi(t + 8);
+      else if (strncmp(t, "max_bytes:", 10) == 0) c->cache.max_bytes = atoi(t + 10);
+      else if (strncmp(t, "ttl:", 4) == 0) c->cache.ttl = atoi(t + 4);
+    }
   }
   fclose(f);
   if (c->session_max_turns <= 0) c->session_max_turns = 10;
+  if (c->session_journal_sync_ms < 0) c->session_journal_sync_ms = 0;
+  if (c->daemon_request_timeout <= 0) c->daemon_request_timeout = 120;
+  if (c->daemon_max_inflight < 0) c->daemon_max_inflight = 0;
+  if (c->daemon_max_queue < 0) c->daemon_max_queue = 0;
+  if (c->daemon_keepalive < 0) c->daemon_keepalive = 0;
+  if (c->embed.top_k < 0) c->embed.top_k = 0;
+  if (c->cache.entries < 0) c->cache.entries = 0;
+  if (c->cache.max_bytes <= 0) c->cache.max_bytes = 16384;
+  if (c->cache.ttl <= 0) c->cache.ttl = 600;
+  for (int i = 0; i < c->route_count; i++) {
+    int found = 0;
+    for (int k = 0; k < c->profile_count && c->routes[i].profile; k++)
+      if (c->profiles[k].name && strcmp(c->profiles[k].name, c->routes[i].profile) == 0) found = 1;
+    if (!found)
+      fprintf(stderr, "neo: %s: route %d names unknown profile %s, ignored\n", path, i + 1,
+              c->routes[i].profile ? c->routes[i].profile : "(none)");
+  }
 
 #if defined(__linux__) || defined(__APPLE__)
   if (c->skills.directory && c->skills.directory[0]) {
@@ -244,3 +433,46 @@ void config_apply_env(agent_config_t *c) {
   v = getenv("NEO_CONFIG");
   (void)v;
 }
+
+static char **clone_path_list(arena_t *a, char **paths, int n) {
+  if (!paths || n <= 0) return NULL;
+  char **np = arena_alloc(a, n * sizeof(char *));
+  if (!np) return NULL;
+  for (int i = 0; i < n; i++) np[i] = arena_strdup(a, paths[i]);
+  return np;
+}
+
+agent_config_t *config_clone_into(arena_t *a, const agent_config_t *src) {
+  agent_config_t *c = arena_alloc(a, sizeof(*c));
+  if (!c) return NULL;
+  *c = *src;
+  c->model.provider = arena_strdup(a, src->model.provider);
+  c->model.base_url = arena_strdup(a, src->model.base_url);
+  c->model.name = arena_strdup(a, src->model.name);
+  c->model.api_key = arena_strdup(a, src->model.api_key);
+  c->bootstrap.paths = clone_path_list(a, src->bootstrap.paths, src->bootstrap.path_count);
+  c->skills.paths = clone_path_list(a, src->skills.paths, src->skills.path_count);
+  c->skills.high_priority = clone_path_list(a, src->skills.high_priority, src->skills.high_priority_count);
+  c->skills.directory = arena_strdup(a, src->skills.directory);
+  if (src->skills.priority && src->skills.path_count > 0) {
+    c->skills.priority = arena_alloc(a, src->skills.path_count * sizeof(int));
+    if (c->skills.priority) memcpy(c->skills.priority, src->skills.priority, src->skills.path_count * sizeof(int));
+  }
+  c->memory.path = arena_strdup(a, src->memory.path);
+  c->embed.model = arena_strdup(a, src->embed.model);
+  c->daemon_socket = arena_strdup(a, src->daemon_socket);
+  c->session_journal = arena_strdup(a, src->session_journal);
+  for (int i = 0; i < src->profile_count; i++) {
+    profile_config_t *p = &c->profiles[i];
+    const profile_config_t *q = &src->profiles[i];
+    p->name = arena_strdup(a, q->name);
+    p->base_url = arena_strdup(a, q->base_url);
+    p->model = arena_strdup(a, q->model);
+    p->api_key = arena_strdup(a, q->api_key);
+  }
+  for (int i = 0; i < src->route_count; i++) {
+    c->routes[i].profile = arena_strdup(a, src->routes[i].profile);
+    c->routes[i].skills = clone_path_list(a, src->routes[i].skills, src->routes[i].skill_count);
+  }
+  return c;
+}
@@ -1,6 +1,8 @@
 #ifndef NEO_CONFIG_H
 #define NEO_CONFIG_H
 
+#include "arena.h"
+
 typedef struct {
   char *provider;
   char *base_url;
@@ -8,6 +10,11 @@ typedef struct {
   char *api_key;
   int max_tokens;
   double temperature;
+  int thinking;     /* LLM_THINK_*: thinking: on | off; unset leaves it to the provider */
+  int think_budget; /* thinking_budget: cap on reasoning tokens; 0: none */
+  int no_think;     /* no_think: yes also sends Qwen3's /no_think when thinking is off */
+  int backend;      /* LLM_BACKEND_*: backend: llama.cpp | vllm steers the server's prompt cache */
+  int slots;        /* slots: llama.cpp's -np; > 0 pins each session to one slot */
 } model_config_t;
 
 typedef struct {
@@ -29,14 +36,73 @@ typedef struct {
 typedef struct {
   char *path;
   int max_chars;
+  int write_back; /* daemon: append ```memory entries from replies to path */
 } memory_config_t;
 
+typedef struct {
+  int enabled;      /* also pick skills and memory chunks by embedding similarity */
+  char *model;      /* int8 static embedding model (embed.h); NULL: hashed vectors */
+  int top_k;        /* most skills picked this way per message */
+  double min_score; /* cosine a skill pick needs; < 0: EMBED_MIN_SCORE_* for the vectors in use */
+} embed_config_t;
+
+typedef struct {
+  int entries;   /* response cache slots shared by all daemon workers; 0 = off */
+  int max_bytes; /* largest response kept per slot */
+  int ttl;       /* seconds an entry stays valid */
+} cache_config_t;
+
+#define MAX_PROFILES 8
+#define MAX_ROUTES   16
+
+/* A named model to route to; fields left unset fall back to model.*. */
+typedef struct {
+  char *name;
+  char *base_url;
+  char *model;
+  char *api_key;
+  int max_tokens;     /* 0: model.max_tokens */
+  double temperature; /* < 0: model.temperature */
+  int thinking;       /* unset: model.thinking, model.no_think */
+  int think_budget;   /* 0: model.think_budget */
+  int no_think;
+  int backend;        /* unset: model.backend, model.slots */
+  int slots;
+} profile_config_t;
+
+/* Routes are tried in order; the first whose conditions all hold picks its profile,
+   and a query no route takes goes to model.*. */
+typedef struct {
+  char *profile;
+  char **skills;      /* one of these skills is matched by the message */
+  int skill_count;
+  int min_chars;      /* message length in characters; 0: no bound */
+  int max_chars;
+  int code;           /* 1: the message looks like code */
+} route_config_t;
+
 typedef struct {
   model_config_t model;
+  profile_config_t profiles[MAX_PROFILES];
+  int profile_count;
+  route_config_t routes[MAX_ROUTES];
+  int route_count;
   bootstrap_config_t bootstrap;
   skills_config_t skills;
   memory_config_t memory;
+  embed_config_t embed;
+  cache_config_t cache;
+  int prompt_compact;         /* compact skill, bootstrap and memory text and drop repeated lines (default on) */
   int session_max_turns;
+  int session_max_bytes;      /* history text kept per session; 0: no limit (LOWMEM builds: 16 KB) */
+  char *session_journal;      /* directory for the daemon's session journal; NULL: sessions die with it */
+  int session_journal_sync_ms; /* longest a written turn waits for fdatasync (default 10); 0: every loop round */
+  int daemon_request_timeout; /* seconds per request unless the client asks for less/more; default 120 */
+  int daemon_workers;         /* prefork worker processes for the socket daemon; 0/1 = single process */
+  int daemon_max_inflight;    /* upstream requests at once per process, the rest queue; 0: no limit */
+  int daemon_max_queue;       /* requests waiting per process before new ones get "busy" */
+  int daemon_keepalive;       /* seconds an upstream endpoint may sit idle before it is probed again; 0: off */
+  char *daemon_socket;        /* default daemon socket; one-shot queries are forwarded to it when it is up */
 } agent_config_t;
 
 void config_init(agent_config_t *c);
@@ -44,4 +110,7 @@ void config_free(agent_config_t *c);
 int config_load_file(agent_config_t *c, const char *path);
 void config_apply_env(agent_config_t *c);
 
+/* Deep copy into a shared arena; the copy is never passed to config_free. */
+agent_config_t *config_clone_into(arena_t *a, const agent_config_t *src);
+
 #endif
@@ -1,135 +1,405 @@
 /*
- * Daemon mode: stdin loop or Unix socket server, with session history.
+ * Daemon mode: stdin loop, Unix socket server and OpenAI-compatible HTTP gateway, with session history.
  */
+#define _GNU_SOURCE /* struct ucred */
+#include "buf.h"
+#include "cache.h"
 #include "config.h"
+#include "http.h"
+#include "journal.h"
 #include "llm.h"
+#include "loop.h"
+#include "mapreduce.h"
+#include "memory.h"
+#include "openai.h"
+#include "prompt.h"
+#include "route.h"
+#include "session.h"
 #include "skills.h"
+#include "stats.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define SYSTEM_MAX (256 * 1024)
-#define LINE_MAX   (64 * 1024)
+#define LINE_MAX   (64 * 1024) /* line protocol: longest question */
 
 #if defined(__linux__) || defined(__APPLE__)
 #define HAVE_UNIX_SOCKET 1
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #endif
 
-static size_t read_file_into(char *buf, size_t cap, const char *path, size_t max_chars) {
-  FILE *f = fopen(path, "r");
-  if (!f) return 0;
-  size_t n = 0;
-  if (max_chars <= 0 || max_chars > cap - 1) max_chars = cap - 1;
-  while (n < max_chars && fgets(buf + n, (int)(cap - n), f))
-    n = strlen(buf);
-  if (n >= cap - 1) n = cap - 2;
-  buf[n] = '\0';
-  fclose(f);
-  return n;
-}
-
-static void append_section(char *dest, size_t cap, const char *title, const char *path, const char *content) {
-  if (!content || !content[0]) return;
-  size_t used = strlen(dest);
-  if (used + strlen(title) + strlen(path) + strlen(content) + 64 > cap) return;
-  strncat(dest, title, cap - used - 1);
-  strncat(dest, path, cap - used - 1);
-  strncat(dest, "\n\n", cap - used - 1);
-  strncat(dest, content, cap - used - 1);
-  strncat(dest, "\n\n", cap - used - 1);
+#ifdef __linux__
+#define HAVE_INOTIFY 1
+#include <dirent.h>
+#include <sys/inotify.h>
+#endif
+
+/* Read-only state shared by all workers: config copy and skill index, built together
+   in one arena. A reload builds a new snapshot off to the side and swaps it in between
+   two requests; requests in flight already hold everything they need (the encoded
+   body, or mapreduce's own copies), so the old arena can go right away. */
+typedef struct {
+  arena_t arena; /* empty when conf is the caller's own (no arena) */
+  agent_config_t *conf;
+  const skills_index_t *skills;
+} snapshot_t;
+
+static snapshot_t live;
+static const char *reload_path;  /* config re-read on SIGHUP or file change; NULL: no reload */
+static const char *reload_model; /* -m given at startup, re-applied on reload */
+
+void daemon_config_source(const char *config_path, const char *model) {
+  reload_path = config_path;
+  reload_model = model;
+}
+
+static prompt_info_t prompt_info; /* of the last build_system_prompt */
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
 }
 
 static void build_system_prompt(agent_config_t *conf, const char *user_message, char *out, size_t cap) {
-  char *tmp = malloc(65536);
-  if (!tmp) { out[0] = '\0'; return; }
-  out[0] = '\0';
-  strncat(out, "You are a helpful assistant. Follow any skill and bootstrap instructions below.\n\n", cap - 1);
-  {
-    time_t now = time(NULL);
-    struct tm *utc = gmtime(&now);
-    char datebuf[80];
-    char line[96];
-    if (utc && strftime(datebuf, sizeof(datebuf), "%Y-%m-%d %H:%M UTC", utc) > 0)
-      snprintf(line, sizeof(line), "Current date and time: %s\n\n", datebuf);
-    else
-      strcpy(line, "Current date and time: (unknown)\n\n");
-    strncat(out, line, cap - 1);
-  }
-  skills_append_to_system_prompt(conf, user_message, out, cap, 1); /* high priority first */
-  for (int i = 0; i < conf->bootstrap.path_count; i++) {
-    size_t max_c = (conf->bootstrap.max_chars_per_file > 0) ? (size_t)conf->bootstrap.max_chars_per_file : 8000;
-    if (read_file_into(tmp, 65536, conf->bootstrap.paths[i], max_c) > 0)
-      append_section(out, cap, "## Bootstrap: ", conf->bootstrap.paths[i], tmp);
-  }
-  skills_append_to_system_prompt(conf, user_message, out, cap, 0); /* normal skills */
-  if (conf->memory.path) {
-    if (read_file_into(tmp, 65536, conf->memory.path, (size_t)conf->memory.max_chars) > 0)
-      append_section(out, cap, "## Memory (context)\n\n", "", tmp);
-  }
-  free(tmp);
-}
-
-#define MAX_SESSION_MESSAGES 64
-static struct {
-  char *role;
-  char *content;
-} session_messages[MAX_SESSION_MESSAGES];
-static int session_count = 0;
-
-static void session_append(const char *role, const char *content) {
-  if (!role || !content) return;
-  if (session_count >= MAX_SESSION_MESSAGES) {
-    free(session_messages[0].role);
-    free(session_messages[0].content);
-    memmove(&session_messages[0], &session_messages[1], (session_count - 1) * sizeof(session_messages[0]));
-    session_count--;
-  }
-  session_messages[session_count].role = strdup(role);
-  session_messages[session_count].content = strdup(content);
-  if (session_messages[session_count].role && session_messages[session_count].content)
-    session_count++;
-  else {
-    free(session_messages[session_count].role);
-    free(session_messages[session_count].content);
-  }
+  prompt_build(conf, live.skills, user_message, out, cap, &prompt_info);
 }
 
-static void session_trim_to(int max_turns) {
-  int max_msg = max_turns * 2;
-  while (session_count > max_msg) {
-    free(session_messages[0].role);
-    free(session_messages[0].content);
-    memmove(&session_messages[0], &session_messages[1], (session_count - 1) * sizeof(session_messages[0]));
-    session_count--;
+/* System prompt for a turn of s (may be NULL) on route r: built into out, or the one s
+   kept. On a caching backend a session keeps the prompt of its first turn, since the
+   clock line and the skills matched per message would otherwise change it every turn,
+   and with it everything the server has cached behind it. */
+static const char *turn_system_prompt(agent_config_t *conf, session_t *s, const route_t *r, const char *user_message,
+                                      char *out, size_t cap) {
+  int keep = s && r->backend >= LLM_BACKEND_LLAMACPP;
+  if (keep && s->count > 0 && s->system) {
+    memset(&prompt_info, 0, sizeof(prompt_info));
+    return s->system;
+  }
+  build_system_prompt(conf, user_message, out, cap);
+  if (keep) {
+    free(s->system);
+    s->system = strdup(out);
   }
+  return out;
 }
 
-static int do_one_turn(agent_config_t *conf, char *system_prompt, const char *user_input, llm_response_t *out) {
-  llm_message_t *msgs = malloc((session_count + 1) * sizeof(llm_message_t));
-  if (!msgs) return -1;
+/* History of s (may be NULL) followed by the new user message; caller frees. */
+static llm_message_t *turn_messages(const session_t *s, const char *user_input, int *n_out) {
+  int count = s ? s->count : 0;
+  llm_message_t *msgs = malloc((count + 1) * sizeof(llm_message_t));
+  if (!msgs) return NULL;
   int n = 0;
-  for (int i = 0; i < session_count && session_messages[i].content; i++)
-    msgs[n++] = (llm_message_t){ session_messages[i].role, session_messages[i].content };
+  for (int i = 0; i < count && s->messages[i].content; i++)
+    msgs[n++] = (llm_message_t){ s->messages[i].role, s->messages[i].content };
   msgs[n++] = (llm_message_t){ "user", user_input };
-  int err = llm_chat_messages(
-    conf->model.base_url, conf->model.name, conf->model.api_key,
-    conf->model.max_tokens, conf->model.temperature,
-    system_prompt, msgs, n, out);
+  *n_out = n;
+  return msgs;
+}
+
+static int do_one_turn(const route_t *route, session_t *session, const char *system_prompt, const char *user_input,
+                       llm_opts_t *opts, stats_request_t *rec, llm_response_t *out) {
+  int n;
+  llm_message_t *msgs = turn_messages(session, user_input, &n);
+  if (!msgs) return -1;
+  llm_request_t req = { route->base_url, route->model, route->api_key, route->max_tokens, route->temperature,
+                        system_prompt, msgs, n, route->thinking, route->think_budget, route->no_think,
+                        route->backend, session ? session->id : NULL, route->slots };
+  uint64_t key = cache_enabled() ? cache_request_key(&req) : 0;
+  if (key && (out->data = cache_get(key, &out->size)) != NULL) {
+    free(msgs);
+    rec->cached = 1;
+    return 0;
+  }
+  int err = llm_chat_request(&req, opts, out);
+  rec->llm = opts->timing;
+  rec->failed = err != 0;
+  if (err == 0 && key && out->data) cache_put(key, out->data, out->size);
   free(msgs);
   return err;
 }
 
+/* memory.write_back: the reply's ```memory entries go to the writer thread. */
+static void queue_memory(const agent_config_t *conf, const char *reply, size_t len, int debug) {
+  int n = memory_reply(conf, reply, len);
+  if (debug && n)
+    fprintf(stderr, "neo daemon: %d memory entr%s queued for %s\n", n, n == 1 ? "y" : "ies", conf->memory.path);
+}
+
+/* Add a finished turn to s and, when there is one, the journal. A session that keeps
+   its system prompt for a caching backend is cut back to half the limits once over
+   them, so its history then stays put for several turns instead of losing its oldest
+   turn (and the server's cache of everything after it) on every one. */
+static void session_remember(session_t *s, const agent_config_t *conf, const char *user, const char *answer) {
+  if (!s) return;
+  journal_turn(s->id, s->count == 0, user, answer);
+  session_append(s, "user", user);
+  session_append(s, "assistant", answer);
+  int turns = conf->session_max_turns > 0 ? conf->session_max_turns : 10;
+  size_t bytes = (size_t)conf->session_max_bytes;
+  if (s->system && (s->count > turns * 2 || (bytes && s->bytes > bytes))) {
+    turns = (turns + 1) / 2;
+    bytes /= 2;
+  }
+  session_trim_to(s, turns, bytes);
+}
+
+static double elapsed_ms_since(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) * 1000.0 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static double setup_ms; /* how long daemon_prepare took: setup every one-shot run repeats */
+
+static size_t snapshot_size(const agent_config_t *conf) {
+  return 256 * 1024 + skills_index_size(conf);
+}
+
+/* Copy conf and its skill files into a (writable, empty) arena and seal it; -1: no room. */
+static int snapshot_fill(snapshot_t *s, arena_t *a, const agent_config_t *conf) {
+  s->conf = config_clone_into(a, conf);
+  s->skills = s->conf ? skills_index_build(s->conf, a) : NULL;
+  arena_seal(a);
+  return s->conf ? 0 : -1;
+}
+
+/* Copy conf and its skill files into a fresh sealed arena. -1 leaves *s empty. */
+static int snapshot_build(snapshot_t *s, const agent_config_t *conf) {
+  memset(s, 0, sizeof(*s));
+  if (arena_init(&s->arena, snapshot_size(conf)) != 0) return -1;
+  if (snapshot_fill(s, &s->arena, conf) != 0) {
+    arena_free(&s->arena);
+    s->skills = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/* Load everything read-only into the shared arena once, before any worker is forked.
+   Returns the config to serve from (the shared copy, or conf if the arena is unavailable). */
+static agent_config_t *daemon_prepare(agent_config_t *conf) {
+  struct timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (stats_init() != 0) fprintf(stderr, "neo daemon: stats are per worker (mmap failed)\n");
+  if (conf->cache.entries > 0 && cache_init(conf->cache.entries, conf->cache.max_bytes, conf->cache.ttl) != 0)
+    fprintf(stderr, "neo daemon: response cache disabled (mmap failed)\n");
+  if (snapshot_build(&live, conf) != 0) live.conf = conf;
+  conf = live.conf;
+  for (int i = 0; i < conf->profile_count; i++) stats_route_name(i + 1, conf->profiles[i].name);
+  setup_ms = elapsed_ms_since(&t0);
+  return conf;
+}
+
+/* The config file as it reads now, with the environment and --model over it. */
+static int reload_config(agent_config_t *c, const char *why) {
+  config_init(c);
+  if (config_load_file(c, reload_path) != 0) {
+    fprintf(stderr, "neo daemon: reload (%s): cannot load %s, keeping the running config\n", why, reload_path);
+    config_free(c);
+    return -1;
+  }
+  config_apply_env(c);
+  if (reload_model) {
+    free(c->model.name);
+    c->model.name = strdup(reload_model);
+  }
+  return 0;
+}
+
+/* Re-read the config (and through it the skills) into a new snapshot of its own.
+   On any failure *next is left empty. why names the trigger for the log. */
+static int reload_build(snapshot_t *next, const char *why) {
+  agent_config_t c;
+  memset(next, 0, sizeof(*next));
+  if (!reload_path || reload_config(&c, why) != 0) return -1;
+  int rc = snapshot_build(next, &c);
+  config_free(&c);
+  if (rc != 0) fprintf(stderr, "neo daemon: reload (%s): out of memory, keeping the running config\n", why);
+  return rc;
+}
+
+/* Make next the live snapshot. The old arena goes if this process mapped it; one in a
+   shared slot (arena left empty) is only ever refilled by the supervisor. */
+static void reload_swap(snapshot_t *next, const char *why, const struct timespec *t0, int verbose) {
+  snapshot_t old = live;
+  live = *next;
+  arena_free(&old.arena);
+  for (int i = 0; i < live.conf->profile_count; i++) stats_route_name(i + 1, live.conf->profiles[i].name);
+  if (verbose)
+    fprintf(stderr, "neo daemon: reloaded %s (%s) in %.1f ms: %d skills, %d profiles, %d routes\n", reload_path, why,
+            elapsed_ms_since(t0), live.conf->skills.path_count, live.conf->profile_count, live.conf->route_count);
+}
+
+/* Reload right here; on any failure the running snapshot stays. */
+static int daemon_reload(const char *why, int verbose) {
+  struct timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  snapshot_t next;
+  if (reload_build(&next, why) != 0) return -1;
+  reload_swap(&next, why, &t0, verbose);
+  return 0;
+}
+
+#ifdef HAVE_UNIX_SOCKET
+/*
+ * Reload triggers. Signal handlers only set a flag and write a byte to wake_pipe, so a
+ * process blocked in poll() wakes up and reloads from its loop. With inotify the
+ * config file, every skill file and the skills directory are watched as well.
+ */
+static volatile sig_atomic_t stop_requested, reload_requested, child_exited;
+static int wake_pipe[2] = { -1, -1 };
+static int watch_fd = -1;
+
+static void on_signal(int sig) {
+  int saved = errno;
+  if (sig == SIGHUP) reload_requested = 1;
+  else if (sig == SIGCHLD) child_exited = 1;
+  else stop_requested = 1;
+  if (wake_pipe[1] >= 0) {
+    ssize_t n = write(wake_pipe[1], "", 1);
+    (void)n;
+  }
+  errno = saved;
+}
+
+/* A fresh pipe for this process (a forked worker must not wake its parent). */
+static void wake_open(void) {
+  if (wake_pipe[0] >= 0) close(wake_pipe[0]);
+  if (wake_pipe[1] >= 0) close(wake_pipe[1]);
+  wake_pipe[0] = wake_pipe[1] = -1;
+  if (pipe(wake_pipe) != 0) return;
+  for (int i = 0; i < 2; i++) {
+    fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+  }
+}
+
+static void wake_drain(void) {
+  char tmp[64];
+  while (wake_pipe[0] >= 0 && read(wake_pipe[0], tmp, sizeof(tmp)) > 0) {}
+}
+
+static void catch_signal(int sig, int restart) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sa.sa_flags = restart ? SA_RESTART : 0;
+  sigaction(sig, &sa, NULL);
+}
+
+#ifdef HAVE_INOTIFY
+#define WATCH_MAX 128
+static struct {
+  int wd;
+  char name[64]; /* entry in that directory that matters; "" any subdirectory */
+} watches[WATCH_MAX];
+static int n_watches;
+
+static void watch_add(const char *dir, const char *name) {
+  if (n_watches >= WATCH_MAX) return;
+  int wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR);
+  if (wd < 0) return;
+  watches[n_watches].wd = wd;
+  snprintf(watches[n_watches].name, sizeof(watches[n_watches].name), "%s", name);
+  n_watches++;
+}
+
+/* Editors save by renaming over the file, so watch its directory for its name. */
+static void watch_file(const char *path) {
+  char dir[1024];
+  const char *slash = strrchr(path, '/');
+  if (!slash) {
+    watch_add(".", path);
+    return;
+  }
+  snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  watch_add(dir[0] ? dir : "/", slash + 1);
+}
+
+/* (Re)point the watches at what the live config reads; called after every reload,
+   since it may name other skills. */
+static void watch_arm(void) {
+  if (!reload_path) return;
+  if (watch_fd < 0 && (watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) return;
+  for (int i = 0; i < n_watches; i++) inotify_rm_watch(watch_fd, watches[i].wd);
+  n_watches = 0;
+  const agent_config_t *conf = live.conf;
+  watch_file(reload_path);
+  for (int i = 0; i < conf->skills.path_count; i++) watch_file(conf->skills.paths[i]);
+  const char *sdir = conf->skills.directory;
+  if (sdir && sdir[0]) { /* a new skill is a new subdirectory, its SKILL.md written after */
+    watch_add(sdir, "");
+    DIR *d = opendir(sdir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+      if (e->d_name[0] == '.') continue;
+      char sub[1024];
+      snprintf(sub, sizeof(sub), "%s/%s", sdir, e->d_name);
+      watch_add(sub, "SKILL.md");
+    }
+    if (d) closedir(d);
+  }
+}
+
+/* Drain pending events; 1 if one of them touched a watched file. */
+static int watch_changed(void) {
+  char ev_buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int hit = 0;
+  ssize_t n;
+  while (watch_fd >= 0 && (n = read(watch_fd, ev_buf, sizeof(ev_buf))) > 0) {
+    for (char *p = ev_buf; p < ev_buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(*ev) + ev->len;
+      if (!ev->len) continue;
+      for (int i = 0; i < n_watches; i++) {
+        if (watches[i].wd != ev->wd) continue;
+        if (watches[i].name[0] ? strcmp(ev->name, watches[i].name) == 0 : (ev->mask & IN_ISDIR) != 0) hit = 1;
+      }
+    }
+  }
+  return hit;
+}
+#else
+static void watch_arm(void) {}
+static int watch_changed(void) { return 0; }
+#endif
+#endif
+
 #define D_RESET   "\033[0m"
 #define D_CYAN    "\033[36m"
 #define D_YELLOW  "\033[33m"
 #define D_GREEN   "\033[32m"
 #define D_BOLD    "\033[1m"
-static void daemon_debug_print(agent_config_t *conf, const char *system_prompt, const char *user_message) {
+/* The model for msg: the one the client named, else what the routes pick. think
+   (LLM_THINK_*) is the client's reasoning switch, over the route's. */
+static void pick_route(const agent_config_t *conf, const char *model, int think, const char *msg, int debug,
+                       route_t *r) {
+  char why[256];
+  if (model) {
+    route_default(conf, r);
+    r->model = model;
+    snprintf(why, sizeof(why), "model %s named by the client, routes skipped", model);
+  } else
+    route_pick(conf, msg, r, why, sizeof(why));
+  if (think) r->thinking = think;
+  if (debug) fprintf(stderr, "neo daemon: %s\n", why);
+}
+
+static void daemon_debug_print(agent_config_t *conf, const route_t *r, const char *system_prompt, const char *user_message) {
   const char *t = getenv("TERM");
   int use_color = t && t[0] && strcmp(t, "dumb") != 0;
   const char *cy = use_color ? D_CYAN : "";
@@ -138,9 +408,8 @@ static void daemon_debug_print(agent_config_t *conf, const char *system_prompt,
   const char *bd = use_color ? D_BOLD : "";
   const char *re = use_color ? D_RESET : "";
   fprintf(stderr, "\n%s%s=== NEO DEBUG: request params ===%s\n", bd, cy, re);
-  fprintf(stderr, "%sbase_url: %s\nmodel: %s\nmax_tokens: %d\ntemperature: %.2f\n%s", cy,
-          conf->model.base_url ? conf->model.base_url : "(null)", conf->model.name ? conf->model.name : "(null)",
-          conf->model.max_tokens, conf->model.temperature, re);
+  fprintf(stderr, "%sprofile: %s\nbase_url: %s\nmodel: %s\nmax_tokens: %d\ntemperature: %.2f\n%s", cy, r->name,
+          r->base_url ? r->base_url : "(null)", r->model ? r->model : "(null)", r->max_tokens, r->temperature, re);
   if (conf->skills.path_count > 0) {
     fprintf(stderr, "%sloaded skills: ", cy);
     for (int i = 0; i < conf->skills.path_count; i++)
@@ -149,29 +418,77 @@ static void daemon_debug_print(agent_config_t *conf, const char *system_prompt,
   }
   fprintf(stderr, "\n%s%s=== NEO DEBUG: system prompt (%zu chars) ===%s\n%s%s%s\n%s%s=== END system prompt ===%s\n",
           bd, yl, strlen(system_prompt), re, yl, system_prompt, re, bd, yl, re);
+  if (prompt_info.picked[0]) fprintf(stderr, "%sskills picked by embedding: %s%s\n", yl, prompt_info.picked, re);
+  if (prompt_info.saved.chars) {
+    size_t len = strlen(system_prompt);
+    fprintf(stderr, "%s~%zu tokens; compaction took out %zu chars (~%zu tokens, %.0f%%)%s\n", yl,
+            compact_tokens(system_prompt, len), prompt_info.saved.chars, prompt_info.saved.tokens,
+            100.0 * (double)prompt_info.saved.chars / (double)(len + prompt_info.saved.chars), re);
+  }
   fprintf(stderr, "\n%s%s=== NEO DEBUG: user message (%zu chars) ===%s\n%s%s%s\n%s%s=== END user message ===%s\n\n",
           bd, gr, strlen(user_message), re, gr, user_message, re, bd, gr, re);
 }
 
 int run_daemon_stdin(agent_config_t *conf, int debug) {
   char *system_prompt = malloc(SYSTEM_MAX);
-  char *line_buf = malloc(LINE_MAX);
-  if (!system_prompt || !line_buf) {
-    free(system_prompt);
-    free(line_buf);
-    return -1;
-  }
-  session_count = 0;
+  char *line_buf = NULL; /* grown by getline to the longest line so far */
+  size_t line_cap = 0;
+  ssize_t got;
+  if (!system_prompt) return -1;
+  conf = daemon_prepare(conf);
+  if (conf->session_journal)
+    journal_open(conf->session_journal, 0, conf->session_journal_sync_ms, conf->session_max_turns,
+                 (size_t)conf->session_max_bytes);
+  session_t *session = session_find("", 1);
+#ifdef HAVE_UNIX_SOCKET
+  catch_signal(SIGHUP, 1);
+  watch_arm();
+#endif
   fprintf(stderr, "neo daemon: stdin mode. Type 'exit' or 'quit' or EOF to stop.\n");
-  while (fgets(line_buf, LINE_MAX, stdin)) {
-    size_t len = strlen(line_buf);
+  while ((got = getline(&line_buf, &line_cap, stdin)) > 0) {
+#ifdef HAVE_UNIX_SOCKET
+    int changed = watch_changed(); /* picked up before the next question, not during one */
+    if (reload_requested || changed) {
+      daemon_reload(reload_requested ? "SIGHUP" : "file changed", 1);
+      reload_requested = 0;
+      watch_arm();
+    }
+    conf = live.conf;
+#endif
+    size_t len = (size_t)got;
     while (len > 0 && (line_buf[len - 1] == '\n' || line_buf[len - 1] == '\r')) line_buf[--len] = '\0';
     if (len == 0) continue;
     if (strcmp(line_buf, "exit") == 0 || strcmp(line_buf, "quit") == 0) break;
-    build_system_prompt(conf, line_buf, system_prompt, SYSTEM_MAX);
-    if (debug) daemon_debug_print(conf, system_prompt, line_buf);
+    if (strcmp(line_buf, "stats") == 0) {
+      buf_t b = {0};
+      stats_prometheus(&b);
+      fwrite(b.data, 1, b.len, stdout);
+      fflush(stdout);
+      buf_free(&b);
+      continue;
+    }
+    stats_request_t rec = {0};
+    double t0 = now_ms();
+    route_t route;
+    pick_route(conf, NULL, LLM_THINK_DEFAULT, line_buf, debug, &route);
+    const char *prompt = turn_system_prompt(conf, session, &route, line_buf, system_prompt, SYSTEM_MAX);
+    rec.route = route.index;
+    rec.prompt_ms = now_ms() - t0;
+    rec.skills_ms = prompt_info.skills_ms;
+    if (debug) daemon_debug_print(conf, &route, prompt, line_buf);
     llm_response_t resp = {0};
-    if (do_one_turn(conf, system_prompt, line_buf, &resp) != 0) {
+    llm_opts_t opts = { .timeout_ms = conf->daemon_request_timeout * 1000L, .cancel_fd = -1 };
+    int err = do_one_turn(&route, session, prompt, line_buf, &opts, &rec, &resp);
+    rec.total_ms = now_ms() - t0;
+    if (debug && resp.thinking_size) fprintf(stderr, "neo daemon: %zu bytes of reasoning left out\n", resp.thinking_size);
+    stats_record(&rec);
+    if (debug) stats_print_request(stderr, &rec);
+    if (trace_on) {
+      trace_record("request", trace_now_us() - (uint64_t)(rec.total_ms * 1000.0), (uint64_t)(rec.total_ms * 1000.0),
+                   "failed", err != 0);
+      trace_flush();
+    }
+    if (err != 0) {
       fprintf(stderr, "neo: LLM request failed\n");
       llm_response_free(&resp);
       continue;
@@ -180,19 +497,1512 @@ int run_daemon_stdin(agent_config_t *conf, int debug) {
       fwrite(resp.data, 1, resp.size, stdout);
       if (resp.size > 0 && resp.data[resp.size - 1] != '\n') putchar('\n');
       fflush(stdout);
-      session_append("user", line_buf);
-      session_append("assistant", resp.data);
-      session_trim_to(conf->session_max_turns > 0 ? conf->session_max_turns : 10);
+      session_remember(session, conf, line_buf, resp.data);
+      journal_sync(); /* one turn at a time here: nothing to group with */
+      queue_memory(conf, resp.data, resp.size, debug);
     }
     llm_response_free(&resp);
   }
+  memory_flush();
   free(system_prompt);
   free(line_buf);
   return 0;
 }
 
 #ifdef HAVE_UNIX_SOCKET
-int run_daemon_socket(agent_config_t *conf, const char *socket_path, int debug) {
+#define CLIENT_TIMEOUT_MAX 600
+
+/* Scheduler lanes: interactive requests start before batch ones. */
+enum { LANE_INTERACTIVE, LANE_BATCH };
+
+static int parse_lane(const char *v) {
+  if (strcmp(v, "batch") == 0) return LANE_BATCH;
+  if (strcmp(v, "interactive") == 0) return LANE_INTERACTIVE;
+  return -1;
+}
+
+/* Optional "timeout=SECONDS " and "prio=batch " prefixes, in any order, let a line
+   client bound its own request and pick its lane. Returns the message start and stores
+   the timeout (0 when absent) and lane (-1 when absent). */
+static char *parse_line_prefix(char *line, int *timeout_s, int *lane) {
+  *timeout_s = 0;
+  *lane = -1;
+  for (;;) {
+    char *end;
+    if (strncmp(line, "timeout=", 8) == 0) {
+      long v = strtol(line + 8, &end, 10);
+      if (end == line + 8 || (*end != ' ' && *end != '\t')) return line;
+      if (v > CLIENT_TIMEOUT_MAX) v = CLIENT_TIMEOUT_MAX;
+      *timeout_s = v > 0 ? (int)v : 0;
+    } else if (strncmp(line, "prio=", 5) == 0) {
+      end = line + 5 + strcspn(line + 5, " \t");
+      if (!*end) return line;
+      *end = '\0';
+      *lane = parse_lane(line + 5);
+      end++;
+    } else
+      return line;
+    while (*end == ' ' || *end == '\t') end++;
+    line = end;
+  }
+}
+
+static void log_abort(int reason, double elapsed_ms) {
+  unsigned long hangup, deadline;
+  stats_abort(reason == LLM_ABORT_HANGUP ? STATS_ABORT_HANGUP : STATS_ABORT_DEADLINE);
+  stats_aborts(&hangup, &deadline);
+  fprintf(stderr, "neo daemon: request aborted (%s) after %.0f ms; aborts so far: hangup=%lu deadline=%lu\n",
+          reason == LLM_ABORT_HANGUP ? "client hung up" : "deadline exceeded", elapsed_ms,
+          hangup, deadline);
+}
+
+/*
+ * Socket server: one event loop per process. A connection whose first line starts with
+ * "REQ " speaks the framed protocol (many pipelined requests, answers streamed back as
+ * CHUNK frames in whatever order they complete); anything else is the classic one-line
+ * request, streamed back raw and closed. Connections accepted on the --http listener
+ * speak HTTP/1.1 (OpenAI chat completions), one request at a time, kept alive.
+ */
+#define FRAME_MAX (16 * 1024 * 1024)
+
+typedef struct conn conn_t;
+
+/* Per-request options from the frame header; the line protocol uses the defaults. */
+typedef struct {
+  const char *session; /* "" default session, "-" stateless */
+  int timeout_s;       /* 0: daemon.request_timeout */
+  const char *model;   /* NULL: configured model */
+  int stats;
+  const char *file;    /* map-reduce the message over this file (absolute path) */
+  int chunk_tokens;
+  int parallel;
+  int think;           /* LLM_THINK_*: think=on|off */
+  int lane;            /* LANE_*: prio=interactive|batch; -1: the connection's */
+} req_opts_t;
+
+typedef struct job {
+  conn_t *conn;
+  char id[64];
+  char session[SESSION_ID_MAX];
+  int stateless;
+  char *user_msg;
+  uint64_t cache_key;
+  llm_stream_t *stream;
+  mr_job_t *mr;       /* framed file= request */
+  struct timespec t0;
+  int stats;          /* framed: report timings in the END frame */
+  int route;          /* route_t.index, for per-profile stats */
+  int cached;
+  double prompt_ms;
+  double skills_ms;
+  llm_timing_t timing;
+  struct endpoint *endpoint; /* upstream it went to, kept warm (NULL: not one of them) */
+  /* HTTP only */
+  int stream_reply; /* SSE to the client rather than one JSON body */
+  int sent_head;
+  char model[128];
+  long created;
+  /* scheduler */
+  int lane;
+  int state;          /* JOB_* */
+  unsigned flow;      /* fair-queuing flow: named session, else connection */
+  double tag;         /* virtual finish time within the lane */
+  struct timespec started;
+  req_opts_t opts;    /* framed/line request, kept until it starts */
+  char opt_model[128];
+  char *opt_file;
+  char *body;         /* HTTP request body, parsed when it starts */
+  struct job *next_queued;
+  struct job *next;
+} job_t;
+
+enum { JOB_NEW, JOB_QUEUED, JOB_RUNNING };
+
+struct conn {
+  int fd;
+  int framed;   /* -1 until the first bytes decide */
+  int http;     /* accepted on the HTTP listener */
+  int busy;     /* HTTP: a request is in flight, later ones wait in the buffer */
+  int keep_alive;
+  int continued; /* HTTP: "100 Continue" already sent for the pending request */
+  int read_eof;
+  int closing;  /* no more requests: close once jobs finish and output drains */
+  int in_parse; /* jobs finishing synchronously (cache hits) must not free the conn */
+  char last;    /* last byte streamed in line mode */
+  int peer_known; /* Unix socket: the client's credentials, for file= */
+  uid_t peer_uid;
+  gid_t peer_gid;
+  int lane;     /* for requests that don't pick one */
+  buf_t in;
+  buf_t out;
+  job_t *jobs;
+};
+
+static int serve_debug;
+static char *serve_prompt; /* scratch for build_system_prompt */
+static int http_listen_fd = -1;
+static double cold_connect_ms; /* last fresh upstream connect + TLS: what a one-shot run pays */
+static buf_t http_scratch;   /* one SSE event before chunk framing */
+static unsigned long http_seq;
+
+static void conn_update(conn_t *c);
+static void conn_parse(conn_t *c);
+static void on_conn(int fd, int revents, void *user);
+static int session_owner(const char *id);
+static int conn_hand_off(conn_t *c, int worker);
+
+/*
+ * Warmup: when a process starts serving, every distinct endpoint of model.* and the
+ * profiles is probed (llm_probe_start), so DNS, TCP and TLS are done before the first
+ * question and the connection waits in curl's pool; the system prompt is built once to
+ * read its files and fault in the scratch buffer. Readiness is logged when the probes
+ * have answered. With daemon.keepalive, an endpoint that no request or probe has used
+ * for that many seconds is probed again, before the server or a NAT drops the connection.
+ */
+#define WARM_TIMEOUT_MS 5000L
+
+struct endpoint {
+  const char *base_url; /* in live.conf; the list is rebuilt on reload */
+  const char *api_key;
+  double last_used;     /* monotonic ms of the last request or probe */
+  llm_stream_t *probe;
+};
+
+static struct endpoint endpoints[MAX_PROFILES + 1];
+static int n_endpoints;
+static int warm_on;           /* serving from the event loop, which drives the probes */
+static int warm_pending = -1; /* startup probes still out; -1: readiness logged */
+static int warm_ok;
+static double warm_t0, warm_slowest_ms, warm_prompt_ms;
+static const char *serve_where; /* single process: what it listens on, for the ready line */
+static int serve_worker;
+
+static void warm_ready(void) {
+  char who[600];
+  if (serve_worker) snprintf(who, sizeof(who), "worker %d", serve_worker);
+  else snprintf(who, sizeof(who), "listening on %s,", serve_where ? serve_where : "?");
+  fprintf(stderr, "neo daemon: %s ready in %.1f ms: %d of %d upstreams connected (slowest %.1f ms), "
+                  "prompt built in %.2f ms\n",
+          who, now_ms() - warm_t0, warm_ok, n_endpoints, warm_slowest_ms, warm_prompt_ms);
+  warm_pending = -1;
+}
+
+static void warm_done(void *user, const llm_result_t *res) {
+  struct endpoint *e = user;
+  double ms = res->timing.dns_ms + res->timing.connect_ms + res->timing.tls_ms;
+  e->probe = NULL;
+  e->last_used = now_ms();
+  if (res->err) {
+    if (warm_pending > 0 || serve_debug)
+      fprintf(stderr, "neo daemon: upstream %s did not answer%s\n", e->base_url, res->aborted ? " in time" : "");
+  } else {
+    if (res->timing.new_connection) cold_connect_ms = ms;
+    if (warm_pending > 0) {
+      warm_ok++;
+      if (ms > warm_slowest_ms) warm_slowest_ms = ms;
+    }
+  }
+  if (warm_pending > 0 && --warm_pending == 0) warm_ready();
+}
+
+static int same_str(const char *a, const char *b) {
+  return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static void warm_add(const char *base_url, const char *api_key) {
+  if (!base_url || n_endpoints >= MAX_PROFILES + 1) return;
+  for (int i = 0; i < n_endpoints; i++)
+    if (same_str(endpoints[i].base_url, base_url) && same_str(endpoints[i].api_key, api_key)) return;
+  endpoints[n_endpoints++] = (struct endpoint){ base_url, api_key, 0, NULL };
+}
+
+static void warm_probe(struct endpoint *e) {
+  e->last_used = now_ms();
+  e->probe = llm_probe_start(e->base_url, e->api_key, WARM_TIMEOUT_MS, warm_done, e);
+}
+
+/* Probe every endpoint of live.conf. After a reload, probes still out are dropped
+   first: the strings they point at are gone. */
+static void warm_setup(void) {
+  for (int i = 0; i < n_endpoints; i++)
+    if (endpoints[i].probe) llm_stream_cancel(endpoints[i].probe);
+  n_endpoints = 0;
+  const agent_config_t *conf = live.conf;
+  warm_add(conf->model.base_url, conf->model.api_key);
+  for (int i = 0; i < conf->profile_count; i++) {
+    const profile_config_t *p = &conf->profiles[i];
+    warm_add(p->base_url ? p->base_url : conf->model.base_url, p->api_key ? p->api_key : conf->model.api_key);
+  }
+  int started = 0;
+  for (int i = 0; i < n_endpoints; i++) {
+    warm_probe(&endpoints[i]);
+    if (endpoints[i].probe) started++;
+  }
+  if (warm_pending >= 0 && (warm_pending = started) == 0) warm_ready();
+}
+
+/* A request is going to base_url: its connection is in use, no probe needed. */
+static struct endpoint *warm_touch(const char *base_url) {
+  for (int i = 0; base_url && i < n_endpoints; i++)
+    if (strcmp(endpoints[i].base_url, base_url) == 0) {
+      endpoints[i].last_used = now_ms();
+      return &endpoints[i];
+    }
+  return NULL;
+}
+
+/* Milliseconds until an endpoint is due for a keepalive probe; -1: none. */
+static int warm_timeout_ms(void) {
+  double every = live.conf->daemon_keepalive * 1000.0, next = -1;
+  if (!warm_on || every <= 0) return -1;
+  for (int i = 0; i < n_endpoints; i++)
+    if (!endpoints[i].probe && (next < 0 || endpoints[i].last_used + every < next))
+      next = endpoints[i].last_used + every;
+  if (next < 0) return -1;
+  double left = next - now_ms();
+  return left <= 0 ? 0 : (int)left + 1;
+}
+
+static void warm_tick(void) {
+  double every = live.conf->daemon_keepalive * 1000.0, now = now_ms();
+  if (!warm_on || every <= 0) return;
+  for (int i = 0; i < n_endpoints; i++) {
+    struct endpoint *e = &endpoints[i];
+    if (e->probe || now - e->last_used < every) continue;
+    if (serve_debug) fprintf(stderr, "neo daemon: keepalive probe to %s\n", e->base_url);
+    warm_probe(e);
+  }
+}
+
+/*
+ * Scheduler: at most daemon.max_inflight requests per process are upstream at once;
+ * the rest wait in one bounded queue. Interactive requests start before batch ones, and
+ * batch ones never hold the last quarter of the slots, so an interactive request that
+ * finds the daemon full of bulk work waits for one slot, not for the backlog. Within a
+ * lane, flows (named sessions, else connections) share the slots by weighted fair
+ * queuing: a request's virtual finish tag is max(lane clock, its flow's last tag) plus
+ * a cost growing with the message size, and the smallest tag starts next, so a script
+ * pipelining a hundred questions doesn't hold up a session asking one. Admission sheds
+ * early with a "busy" reply: batch once the queue is half full, anything once it is
+ * full or once the expected wait already exceeds the request's deadline.
+ */
+#define FLOWS 256
+
+static job_t *queue;            /* waiting jobs, in arrival order */
+static int queued[2];
+static int running[2];
+static double lane_clock[2];
+static double flow_tag[2][FLOWS]; /* flows hashed into a fixed table; a collision only merges two flows */
+static double service_ms;       /* moving average of how long a started request runs */
+static int dispatching;
+
+static void job_start(job_t *j);
+
+static void queue_remove(job_t *j) {
+  for (job_t **pp = &queue; *pp; pp = &(*pp)->next_queued)
+    if (*pp == j) { *pp = j->next_queued; break; }
+  queued[j->lane]--;
+}
+
+static double job_waited_ms(const job_t *j) {
+  return (j->started.tv_sec - j->t0.tv_sec) * 1000.0 + (j->started.tv_nsec - j->t0.tv_nsec) / 1e6;
+}
+
+/* Release j's place in the scheduler and free it. */
+static void job_free(job_t *j) {
+  if (j->state == JOB_QUEUED) {
+    queue_remove(j);
+    stats_dequeue(j->lane, elapsed_ms_since(&j->t0), 0);
+  } else if (j->state == JOB_RUNNING) {
+    double ms = elapsed_ms_since(&j->started);
+    service_ms = service_ms > 0 ? service_ms * 0.9 + ms * 0.1 : ms;
+    running[j->lane]--;
+    stats_running(-1);
+  }
+  free(j->user_msg);
+  free(j->opt_file);
+  free(j->body);
+  free(j);
+}
+
+/* NULL when j may join the queue, else the reason to turn it away. */
+static const char *sched_admit(const job_t *j, int timeout_s) {
+  int cap = live.conf->daemon_max_inflight, limit = live.conf->daemon_max_queue, waiting = queued[0] + queued[1];
+  if (cap <= 0 || (waiting == 0 && running[0] + running[1] < cap)) return NULL;
+  if (waiting >= limit || (j->lane == LANE_BATCH && waiting >= limit / 2)) return "busy: queue full";
+  int ahead = j->lane == LANE_BATCH ? waiting : queued[LANE_INTERACTIVE];
+  double deadline_ms = (timeout_s > 0 ? timeout_s : live.conf->daemon_request_timeout) * 1000.0;
+  if (service_ms * (ahead + 1) / cap > deadline_ms) return "busy: the wait would exceed the deadline";
+  return NULL;
+}
+
+static job_t *sched_pick(int lane) {
+  job_t *best = NULL;
+  for (job_t *j = queue; j; j = j->next_queued)
+    if (j->lane == lane && (!best || j->tag < best->tag)) best = j;
+  return best;
+}
+
+/* Start queued jobs while there are free slots. Jobs finishing on the spot (cache hits,
+   errors) call back in here; the outer loop carries on for them. */
+static void sched_dispatch(void) {
+  if (dispatching) return;
+  dispatching = 1;
+  for (;;) {
+    int cap = live.conf->daemon_max_inflight;
+    if (cap > 0 && running[0] + running[1] >= cap) break;
+    job_t *j = sched_pick(LANE_INTERACTIVE);
+    if (!j && (cap <= 0 || running[LANE_BATCH] < (cap > 1 ? cap - (cap + 3) / 4 : 1))) j = sched_pick(LANE_BATCH);
+    if (!j) break;
+    queue_remove(j);
+    j->state = JOB_RUNNING;
+    running[j->lane]++;
+    lane_clock[j->lane] = j->tag;
+    clock_gettime(CLOCK_MONOTONIC, &j->started);
+    stats_dequeue(j->lane, job_waited_ms(j), 1);
+    stats_running(1);
+    job_start(j);
+  }
+  dispatching = 0;
+}
+
+static void conn_close(conn_t *c, int hangup) {
+  while (c->jobs) {
+    job_t *j = c->jobs;
+    c->jobs = j->next;
+    llm_stream_cancel(j->stream);
+    mr_cancel(j->mr);
+    if (hangup) log_abort(LLM_ABORT_HANGUP, elapsed_ms_since(&j->t0));
+    job_free(j);
+  }
+  loop_unwatch(c->fd);
+  close(c->fd);
+  buf_free(&c->in);
+  buf_free(&c->out);
+  free(c);
+  sched_dispatch(); /* slots of the jobs just dropped */
+}
+
+/* -1 when the peer is gone. */
+static int conn_flush(conn_t *c) {
+  while (c->out.len > 0) {
+    ssize_t n = write(c->fd, c->out.data, c->out.len);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    buf_consume(&c->out, (size_t)n);
+  }
+  return 0;
+}
+
+static void frame(conn_t *c, const char *type, const char *id, const char *data, size_t len) {
+  buf_printf(&c->out, "%s %s %zu\n", type, id, len);
+  if (len) buf_append(&c->out, data, len);
+}
+
+static void http_event(conn_t *c, job_t *j, const char *role, const char *text, size_t len, const char *finish) {
+  http_scratch.len = 0;
+  oai_chunk_event(&http_scratch, j->id, j->model, j->created, role, text, len, finish);
+  http_chunk(&c->out, http_scratch.data, http_scratch.len);
+}
+
+static void http_error(conn_t *c, int status, const char *type, const char *message) {
+  buf_t body = {0};
+  oai_error(&body, type, message);
+  http_response(&c->out, status, "application/json", body.data, body.len, c->keep_alive);
+  buf_free(&body);
+}
+
+static void job_chunk(void *user, const char *text, size_t len) {
+  job_t *j = user;
+  conn_t *c = j->conn;
+  if (c->http) {
+    if (!j->stream_reply) return; /* the whole answer goes out in job_finish */
+    if (!j->sent_head) {
+      http_stream_head(&c->out, "text/event-stream", c->keep_alive);
+      http_event(c, j, "assistant", "", 0, NULL);
+      j->sent_head = 1;
+    }
+    http_event(c, j, NULL, text, len, NULL);
+  } else if (c->framed) frame(c, "CHUNK", j->id, text, len);
+  else buf_append(&c->out, text, len);
+  c->last = text[len - 1];
+  loop_watch(c->fd, (c->read_eof || c->closing ? 0 : POLLIN) | POLLOUT, on_conn, c);
+}
+
+static void job_unlink(job_t *j) {
+  for (job_t **pp = &j->conn->jobs; *pp; pp = &(*pp)->next)
+    if (*pp == j) { *pp = j->next; break; }
+  job_free(j);
+}
+
+/* A job of c is gone: serve the pipelined request it held up (HTTP, or a frame waiting
+   to be handed to its session's worker) and flush, unless c is being parsed further up
+   the stack, which does both itself. */
+static void conn_job_gone(conn_t *c) {
+  if (c->in_parse) return;
+  if ((c->http || c->framed > 0) && c->in.len) {
+    c->in_parse = 1;
+    conn_parse(c);
+    c->in_parse = 0;
+  }
+  conn_update(c);
+}
+
+/* Turned away at admission. */
+static void job_busy(job_t *j, const char *why) {
+  conn_t *c = j->conn;
+  stats_shed(j->lane);
+  if (serve_debug) fprintf(stderr, "neo daemon: %s request %s turned away (%s)\n",
+                           j->lane == LANE_BATCH ? "batch" : "interactive", j->id, why);
+  if (c->http) {
+    http_error(c, 429, "server_busy", why);
+    c->busy = 0;
+  } else if (c->framed) frame(c, "ERR", j->id, why, strlen(why));
+  else buf_printf(&c->out, "neo: %s\n", why);
+  job_unlink(j);
+}
+
+/* Queue j, or turn it away; key names its flow (NULL or a shared session: the
+   connection), size weighs it. */
+static void sched_submit(job_t *j, const char *key, size_t size, int timeout_s) {
+  const char *why = sched_admit(j, timeout_s);
+  if (why) {
+    job_busy(j, why);
+    return;
+  }
+  uint64_t h = key && *key && strcmp(key, "-") != 0 ? cache_hash_str(CACHE_HASH_INIT, key)
+                                                    : (uint64_t)(uintptr_t)j->conn * 0x9E3779B97F4A7C15ULL;
+  j->flow = (unsigned)(h >> 32) % FLOWS;
+  double *last = &flow_tag[j->lane][j->flow];
+  j->tag = (*last > lane_clock[j->lane] ? *last : lane_clock[j->lane]) + 1.0 + (double)size / 16384.0;
+  *last = j->tag;
+  stats_queue(j->lane, queued[j->lane]);
+  j->state = JOB_QUEUED;
+  job_t **pp = &queue;
+  while (*pp) pp = &(*pp)->next_queued;
+  *pp = j;
+  queued[j->lane]++;
+  sched_dispatch();
+}
+
+static void http_finish(conn_t *c, job_t *j, int err, int aborted, const char *content, size_t len) {
+  const char *why = aborted == LLM_ABORT_DEADLINE ? "deadline exceeded" : "upstream LLM request failed";
+  if (j->sent_head) { /* mid-stream: all that is left is to say so and end the body */
+    if (err) {
+      http_scratch.len = 0;
+      buf_puts(&http_scratch, "data: ");
+      oai_error(&http_scratch, "upstream_error", why);
+      buf_puts(&http_scratch, "\n\n");
+      http_chunk(&c->out, http_scratch.data, http_scratch.len);
+    } else
+      http_event(c, j, NULL, NULL, 0, "stop");
+    http_chunk(&c->out, "data: [DONE]\n\n", 14);
+    http_chunk(&c->out, NULL, 0);
+  } else if (err)
+    http_error(c, aborted == LLM_ABORT_DEADLINE ? 504 : 502, "upstream_error", why);
+  else if (j->stream_reply) {
+    http_stream_head(&c->out, "text/event-stream", c->keep_alive);
+    http_event(c, j, "assistant", "", 0, NULL);
+    http_event(c, j, NULL, NULL, 0, "stop");
+    http_chunk(&c->out, "data: [DONE]\n\n", 14);
+    http_chunk(&c->out, NULL, 0);
+  } else {
+    buf_t body = {0};
+    oai_completion(&body, j->id, j->model, j->created, content, len);
+    http_response(&c->out, 200, "application/json", body.data, body.len, c->keep_alive);
+    buf_free(&body);
+  }
+  c->busy = 0;
+  if (!c->keep_alive) c->closing = 1;
+}
+
+static void job_finish(job_t *j, int err, int aborted, const char *content, size_t len) {
+  conn_t *c = j->conn;
+  if (j->endpoint) j->endpoint->last_used = now_ms(); /* the connection went back to the pool just now */
+  stats_request_t rec = { j->prompt_ms, j->skills_ms, j->timing, elapsed_ms_since(&j->t0), j->cached, err != 0, j->route };
+  stats_record(&rec);
+  if (serve_debug) stats_print_request(stderr, &rec);
+  if (trace_on) { /* one span per request, then hand this request's events to the file */
+    trace_record(c->http ? "http request" : "request", trace_now_us() - (uint64_t)(rec.total_ms * 1000.0),
+                 (uint64_t)(rec.total_ms * 1000.0), "bytes", (long)len);
+    trace_flush();
+  }
+  if (err && aborted != LLM_ABORT_NONE) log_abort(aborted, elapsed_ms_since(&j->t0));
+  if (!err && !j->cached) queue_memory(live.conf, content, len, serve_debug); /* a hit was, when it was answered */
+  if (c->http) {
+    http_finish(c, j, err, aborted, content, len);
+    if (!err && j->cache_key) cache_put(j->cache_key, content, len);
+  } else if (err) {
+    if (c->framed) {
+      const char *why = aborted == LLM_ABORT_DEADLINE ? "deadline exceeded" : "LLM request failed";
+      frame(c, "ERR", j->id, why, strlen(why));
+    }
+  } else {
+    if (c->framed && j->stats) {
+      char info[256];
+      int n = snprintf(info, sizeof(info),
+                       "prompt_ms=%.2f queue_ms=%.1f connect_ms=%.1f cold_connect_ms=%.1f setup_ms=%.1f cache=%s",
+                       j->prompt_ms, job_waited_ms(j), j->timing.dns_ms + j->timing.connect_ms + j->timing.tls_ms,
+                       cold_connect_ms, setup_ms, j->cached ? "hit" : "miss");
+      if (!j->cached && j->timing.cached_tokens >= 0 && n < (int)sizeof(info))
+        n += snprintf(info + n, sizeof(info) - (size_t)n, " cached_tokens=%ld", j->timing.cached_tokens);
+      if (n >= (int)sizeof(info)) n = (int)sizeof(info) - 1;
+      frame(c, "END", j->id, info, (size_t)n);
+    } else if (c->framed) frame(c, "END", j->id, NULL, 0);
+    else if (c->last != '\n') buf_append(&c->out, "\n", 1);
+    if (!j->stateless) {
+      session_remember(session_find(j->session, 1), live.conf, j->user_msg, content);
+    }
+    if (j->cache_key) cache_put(j->cache_key, content, len);
+  }
+  job_unlink(j);
+  conn_job_gone(c);
+  sched_dispatch(); /* c may be gone by now */
+}
+
+static void job_done(void *user, const llm_result_t *res) {
+  job_t *j = user;
+  j->stream = NULL; /* freed by llm after this callback */
+  j->timing = res->timing;
+  if (serve_debug && res->thinking_len) fprintf(stderr, "neo daemon: %zu bytes of reasoning left out\n", res->thinking_len);
+  if (res->timing.new_connection)
+    cold_connect_ms = res->timing.dns_ms + res->timing.connect_ms + res->timing.tls_ms;
+  job_finish(j, res->err, res->aborted, res->content, res->len);
+}
+
+static job_t *job_new(conn_t *c, const char *id) {
+  job_t *j = calloc(1, sizeof(*j));
+  if (!j) return NULL;
+  j->conn = c;
+  clock_gettime(CLOCK_MONOTONIC, &j->t0);
+  snprintf(j->id, sizeof(j->id), "%s", id);
+  j->next = c->jobs;
+  c->jobs = j;
+  return j;
+}
+
+/* Answer req from the cache or start it upstream; the job finishes later, or right
+   away on a cache hit or an error. */
+static void job_run(job_t *j, const llm_request_t *req, int timeout_s) {
+  if (cache_enabled()) {
+    j->cache_key = cache_request_key(req);
+    size_t len;
+    char *hit = cache_get(j->cache_key, &len);
+    if (hit) {
+      j->cached = 1;
+      job_chunk(j, hit, len);
+      j->cache_key = 0;
+      job_finish(j, 0, LLM_ABORT_NONE, hit, len);
+      free(hit);
+      return;
+    }
+  }
+  /* the deadline counts from arrival: time spent queued is gone */
+  long timeout_ms = (timeout_s > 0 ? timeout_s : live.conf->daemon_request_timeout) * 1000L - (long)job_waited_ms(j);
+  if (timeout_ms <= 0) {
+    job_finish(j, -1, LLM_ABORT_DEADLINE, NULL, 0);
+    return;
+  }
+  j->endpoint = warm_touch(req->base_url);
+  j->stream = llm_stream_start(req, timeout_ms, job_chunk, job_done, j);
+  if (!j->stream) job_finish(j, -1, LLM_ABORT_NONE, NULL, 0);
+}
+
+static void file_progress(void *user, const char *line, size_t len) {
+  job_t *j = user;
+  conn_t *c = j->conn;
+  frame(c, "PROG", j->id, line, len);
+  loop_watch(c->fd, (c->read_eof || c->closing ? 0 : POLLIN) | POLLOUT, on_conn, c);
+}
+
+static void file_done(void *user, int err, int aborted, const char *text, size_t len) {
+  job_t *j = user;
+  j->mr = NULL; /* freed by mapreduce before this callback */
+  job_finish(j, err, aborted, text, len);
+}
+
+/* Whether the peer has the group or other permission bit on sb; root and the owner
+   (who could chmod it) always do. */
+static int peer_may(const conn_t *c, const struct stat *sb, mode_t group, mode_t other) {
+  if (c->peer_uid == 0 || sb->st_uid == c->peer_uid) return 1;
+  return (sb->st_mode & (sb->st_gid == c->peer_gid ? group : other)) != 0;
+}
+
+/* A file= path is opened for the client only if it could read the file itself: the
+   daemon may run as another user, and whatever it reads goes to the provider. Every
+   directory on the resolved path must be searchable by the peer and the file readable
+   by it; a symlink met on the way means the path changed after it was resolved.
+   Returns the open file, or -1. */
+static int open_for_peer(const conn_t *c, const char *path) {
+  struct stat sb;
+  char *real = c->peer_known ? realpath(path, NULL) : NULL;
+  if (!real) return -1;
+  int dir = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC), fd = -1;
+  for (char *p = real + 1; dir >= 0 && *p;) {
+    if (fstat(dir, &sb) != 0 || !peer_may(c, &sb, S_IXGRP, S_IXOTH)) break;
+    char *slash = strchr(p, '/');
+    if (slash) *slash = '\0';
+    int next = openat(dir, p, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | (slash ? O_DIRECTORY : O_NONBLOCK));
+    close(dir);
+    dir = -1;
+    if (slash) {
+      dir = next;
+      p = slash + 1;
+    } else if (next >= 0 && fstat(next, &sb) == 0 && S_ISREG(sb.st_mode) && peer_may(c, &sb, S_IRGRP, S_IROTH)) {
+      fd = next;
+      break;
+    } else {
+      if (next >= 0) close(next);
+      break;
+    }
+  }
+  if (dir >= 0) close(dir);
+  free(real);
+  return fd;
+}
+
+/* file=: chunks of the file are answered in parallel, then merged; PROG frames report
+   each step and the merged answer streams back as CHUNK frames. The whole job holds
+   one scheduler slot. */
+static void start_file_job(job_t *j, const req_opts_t *o, const char *instruction) {
+  agent_config_t *conf = live.conf;
+  int fd = open_for_peer(j->conn, o->file);
+  if (fd < 0) {
+    conn_t *c = j->conn;
+    const char *why = "file not readable by the client";
+    frame(c, "ERR", j->id, why, strlen(why));
+    job_unlink(j);
+    conn_job_gone(c);
+    return;
+  }
+  build_system_prompt(conf, instruction, serve_prompt, SYSTEM_MAX);
+  route_t r;
+  pick_route(conf, o->model, o->think, instruction, serve_debug, &r);
+  j->route = r.index;
+  j->prompt_ms = elapsed_ms_since(&j->started);
+  j->skills_ms = prompt_info.skills_ms;
+  if (serve_debug) daemon_debug_print(conf, &r, serve_prompt, instruction);
+  mr_params_t p = { { r.base_url, r.model, r.api_key, r.max_tokens, r.temperature, serve_prompt, NULL, 0,
+                      r.thinking, r.think_budget, r.no_think, r.backend, NULL, r.slots },
+                    o->file, instruction, o->chunk_tokens, o->parallel,
+                    (o->timeout_s > 0 ? o->timeout_s : conf->daemon_request_timeout) * 1000L, fd };
+  if (mr_start(&p, job_chunk, file_progress, file_done, j, &j->mr) != 0) {
+    conn_t *c = j->conn;
+    frame(c, "ERR", j->id, "cannot read file", 16);
+    job_unlink(j);
+    conn_job_gone(c);
+  }
+}
+
+/* A framed or line request: options are copied into the job, which waits for the
+   scheduler to start it. */
+static void start_job(conn_t *c, const char *id, const req_opts_t *o, const char *msg) {
+  job_t *j = job_new(c, id);
+  if (!j || !(j->user_msg = strdup(msg)) || (o->file && !(j->opt_file = strdup(o->file)))) {
+    if (j) job_unlink(j);
+    if (c->framed) frame(c, "ERR", id, "out of memory", 13);
+    return;
+  }
+  j->stateless = o->file || strcmp(o->session, "-") == 0;
+  j->stats = o->stats;
+  snprintf(j->session, sizeof(j->session), "%s", o->session);
+  snprintf(j->opt_model, sizeof(j->opt_model), "%s", o->model ? o->model : "");
+  j->opts = *o;
+  j->opts.session = j->session;
+  j->opts.model = o->model ? j->opt_model : NULL;
+  j->opts.file = j->opt_file;
+  if (o->lane >= 0) c->lane = o->lane; /* and for the connection's later requests */
+  j->lane = c->lane;
+  sched_submit(j, j->stateless ? NULL : j->session, strlen(msg), o->timeout_s);
+}
+
+static void run_chat(job_t *j) {
+  const req_opts_t *o = &j->opts;
+  const char *msg = j->user_msg;
+  route_t r;
+  pick_route(live.conf, o->model, o->think, msg, serve_debug, &r);
+  session_t *s = j->stateless ? NULL : session_find(j->session, 1);
+  const char *prompt = turn_system_prompt(live.conf, s, &r, msg, serve_prompt, SYSTEM_MAX);
+  j->route = r.index;
+  j->prompt_ms = elapsed_ms_since(&j->started);
+  j->skills_ms = prompt_info.skills_ms;
+  if (serve_debug) daemon_debug_print(live.conf, &r, prompt, msg);
+  int n;
+  llm_message_t *msgs = turn_messages(s, msg, &n);
+  if (!msgs) {
+    job_finish(j, -1, LLM_ABORT_NONE, NULL, 0);
+    return;
+  }
+  llm_request_t req = { r.base_url, r.model, r.api_key, r.max_tokens, r.temperature, prompt, msgs, n,
+                        r.thinking, r.think_budget, r.no_think, r.backend, s ? s->id : NULL, r.slots };
+  job_run(j, &req, o->timeout_s);
+  free(msgs);
+}
+
+/* POST /v1/chat/completions is queued like any request; its body is parsed once it
+   starts. The connection takes no further requests until it is answered. */
+static void http_submit(conn_t *c, const char *body, int lane) {
+  char id[64];
+  snprintf(id, sizeof(id), "chatcmpl-neo%x-%lu", (unsigned)getpid(), ++http_seq);
+  job_t *j = job_new(c, id);
+  if (!j || !(j->body = strdup(body))) {
+    if (j) job_unlink(j);
+    http_error(c, 502, "server_error", "out of memory");
+    return;
+  }
+  j->stateless = 1;
+  j->lane = lane >= 0 ? lane : c->lane;
+  c->busy = 1;
+  sched_submit(j, NULL, strlen(body), 0);
+}
+
+/* The client's turns go upstream behind our own system prompt (skills matched on the
+   last user turn, bootstrap, memory); the client's system messages follow it as a
+   section of their own. */
+static void http_chat(job_t *j) {
+  conn_t *c = j->conn;
+  oai_chat_t q;
+  const char *why;
+  if (oai_parse_chat(j->body, &q, &why) != 0) {
+    http_error(c, 400, "invalid_request_error", why);
+    c->busy = 0;
+    job_unlink(j);
+    conn_job_gone(c);
+    return;
+  }
+  agent_config_t *conf = live.conf;
+  j->stream_reply = q.stream;
+  j->created = (long)time(NULL);
+  route_t r; /* "auto" (or no model) lets the routes choose */
+  pick_route(conf, q.model && strcmp(q.model, "auto") != 0 ? q.model : NULL, q.thinking, q.last_user, serve_debug, &r);
+  j->route = r.index;
+  snprintf(j->model, sizeof(j->model), "%s", r.model ? r.model : "");
+
+  build_system_prompt(conf, q.last_user, serve_prompt, SYSTEM_MAX);
+  j->prompt_ms = elapsed_ms_since(&j->started);
+  j->skills_ms = prompt_info.skills_ms;
+  if (q.system) {
+    size_t used = strlen(serve_prompt);
+    snprintf(serve_prompt + used, SYSTEM_MAX - used, "## Client instructions\n\n%s\n\n", q.system);
+  }
+  if (serve_debug) daemon_debug_print(conf, &r, serve_prompt, q.last_user);
+  llm_request_t req = { r.base_url, j->model, r.api_key,
+                        q.max_tokens > 0 ? q.max_tokens : r.max_tokens,
+                        q.temperature >= 0 ? q.temperature : r.temperature,
+                        serve_prompt, q.messages, q.n_messages, r.thinking, r.think_budget, r.no_think,
+                        r.backend, q.user, r.slots };
+  job_run(j, &req, 0);
+  oai_chat_free(&q);
+}
+
+static void job_start(job_t *j) {
+  if (j->body) http_chat(j);
+  else if (j->opts.file) start_file_job(j, &j->opts, j->user_msg);
+  else run_chat(j);
+}
+
+static void http_route(conn_t *c, const http_request_t *r, const char *body) {
+  int post = strcmp(r->method, "POST") == 0, get = strcmp(r->method, "GET") == 0;
+  if (strcmp(r->path, "/v1/chat/completions") == 0) {
+    if (post) http_submit(c, body, parse_lane(r->priority));
+    else http_error(c, 405, "invalid_request_error", "use POST");
+  } else if (strcmp(r->path, "/v1/models") == 0 && get) {
+    buf_t b = {0};
+    oai_models(&b, live.conf->model.name ? live.conf->model.name : "");
+    http_response(&c->out, 200, "application/json", b.data, b.len, c->keep_alive);
+    buf_free(&b);
+  } else if (strcmp(r->path, "/metrics") == 0 && get) {
+    buf_t b = {0};
+    stats_prometheus(&b);
+    http_response(&c->out, 200, "text/plain; version=0.0.4", b.data, b.len, c->keep_alive);
+    buf_free(&b);
+  } else if (strcmp(r->path, "/health") == 0 && get)
+    http_response(&c->out, 200, "text/plain", "ok\n", 3, c->keep_alive);
+  else
+    http_error(c, 404, "invalid_request_error", "unknown endpoint");
+}
+
+/* Take complete requests off the front of the buffer while none is in flight. */
+static void http_parse(conn_t *c) {
+  while (c->in.len > 0 && !c->busy && !c->closing) {
+    http_request_t r;
+    long head = http_parse_head(c->in.data, c->in.len, &r);
+    if (head == 0) return;
+    c->keep_alive = head > 0 && r.keep_alive;
+    if (head < 0 || r.chunked || r.content_length > FRAME_MAX) {
+      int status = head < 0 ? 400 : r.chunked ? 411 : 413;
+      http_error(c, status, "invalid_request_error", http_reason(status));
+      c->closing = 1;
+      return;
+    }
+    size_t total = (size_t)head + (size_t)r.content_length;
+    if (c->in.len < total) {
+      if (r.expect_continue && !c->continued) {
+        buf_puts(&c->out, "HTTP/1.1 100 Continue\r\n\r\n");
+        c->continued = 1;
+      }
+      return;
+    }
+    char *body = malloc((size_t)r.content_length + 1);
+    if (!body) {
+      c->closing = 1;
+      return;
+    }
+    memcpy(body, c->in.data + head, (size_t)r.content_length);
+    body[r.content_length] = '\0';
+    buf_consume(&c->in, total);
+    c->continued = 0;
+    http_route(c, &r, body);
+    free(body);
+    if (!c->keep_alive && !c->busy) c->closing = 1;
+  }
+}
+
+/* REQ <id> <len> [session=<name>|-] [timeout=<s>] [model=<name>] [stats=1]
+   [file=<path> [chunk_tokens=<n>] [parallel=<n>]]\n<len bytes>,
+   or STATS <id> 0\n for the metrics. Returns bytes used, 0 if the frame is incomplete,
+   -1 if it is malformed. */
+static long parse_frame(conn_t *c) {
+  char *nl = memchr(c->in.data, '\n', c->in.len);
+  if (!nl) return c->in.len > 1024 ? -1 : 0;
+  size_t hdr_len = (size_t)(nl - c->in.data) + 1;
+  char hdr[1024];
+  if (hdr_len > sizeof(hdr)) return -1;
+  memcpy(hdr, c->in.data, hdr_len - 1);
+  hdr[hdr_len - 1] = '\0';
+  if (hdr_len > 1 && hdr[hdr_len - 2] == '\r') hdr[hdr_len - 2] = '\0';
+
+  char *save = NULL;
+  char *type = strtok_r(hdr, " ", &save);
+  char *id = strtok_r(NULL, " ", &save);
+  char *len_s = strtok_r(NULL, " ", &save);
+  if (type && strcmp(type, "STATS") == 0 && id) {
+    char id_copy[64];
+    snprintf(id_copy, sizeof(id_copy), "%s", id);
+    buf_consume(&c->in, hdr_len);
+    buf_t b = {0};
+    stats_prometheus(&b);
+    frame(c, "CHUNK", id_copy, b.data, b.len);
+    frame(c, "END", id_copy, NULL, 0);
+    buf_free(&b);
+    return (long)hdr_len;
+  }
+  if (!type || strcmp(type, "REQ") != 0 || !id || !len_s) return -1;
+  char *end;
+  long len = strtol(len_s, &end, 10);
+  if (*end || len < 0 || len > FRAME_MAX) return -1;
+  if (c->in.len < hdr_len + (size_t)len) return 0;
+
+  req_opts_t o = { "", 0, NULL, 0, NULL, 0, 0, LLM_THINK_DEFAULT, -1 };
+  for (char *kv; (kv = strtok_r(NULL, " ", &save)) != NULL;) {
+    if (strncmp(kv, "session=", 8) == 0) o.session = kv + 8;
+    else if (strncmp(kv, "timeout=", 8) == 0) o.timeout_s = atoi(kv + 8);
+    else if (strncmp(kv, "model=", 6) == 0 && kv[6]) o.model = kv + 6;
+    else if (strcmp(kv, "stats=1") == 0) o.stats = 1;
+    else if (strncmp(kv, "file=", 5) == 0 && kv[5] == '/') o.file = kv + 5;
+    else if (strncmp(kv, "chunk_tokens=", 13) == 0) o.chunk_tokens = atoi(kv + 13);
+    else if (strncmp(kv, "parallel=", 9) == 0) o.parallel = atoi(kv + 9);
+    else if (strcmp(kv, "think=on") == 0) o.think = LLM_THINK_ON;
+    else if (strcmp(kv, "think=off") == 0) o.think = LLM_THINK_OFF;
+    else if (strncmp(kv, "prio=", 5) == 0) o.lane = parse_lane(kv + 5);
+  }
+  if (o.timeout_s > CLIENT_TIMEOUT_MAX) o.timeout_s = CLIENT_TIMEOUT_MAX;
+  int owner = !o.file && strcmp(o.session, "-") != 0 ? session_owner(o.session) : 0;
+  if (owner && owner != serve_worker) { /* another worker's session: the connection moves there */
+    if (c->jobs || conn_flush(c) != 0 || c->out.len) return 0; /* once what ran here is answered */
+    if (conn_hand_off(c, owner) == 0) return (long)(hdr_len + (size_t)len);
+    char id_copy[64];
+    snprintf(id_copy, sizeof(id_copy), "%s", id);
+    buf_consume(&c->in, hdr_len + (size_t)len);
+    frame(c, "ERR", id_copy, "busy: session worker unreachable", 32);
+    return (long)(hdr_len + (size_t)len);
+  }
+  char *msg = malloc((size_t)len + 1);
+  if (!msg) return -1;
+  memcpy(msg, c->in.data + hdr_len, (size_t)len);
+  msg[len] = '\0';
+  char id_copy[64];
+  snprintf(id_copy, sizeof(id_copy), "%s", id);
+  buf_consume(&c->in, hdr_len + (size_t)len);
+  if (*msg) start_job(c, id_copy, &o, msg);
+  else frame(c, "ERR", id_copy, "empty message", 13);
+  free(msg);
+  return (long)(hdr_len + (size_t)len);
+}
+
+static void conn_parse(conn_t *c) {
+  if (c->http) {
+    http_parse(c);
+    return;
+  }
+  if (c->framed < 0) {
+    if (c->in.len >= 4 && memcmp(c->in.data, "STAT", 4) != 0) c->framed = memcmp(c->in.data, "REQ ", 4) == 0;
+    else if (c->in.len >= 6) c->framed = memcmp(c->in.data, "STATS ", 6) == 0;
+    else if (c->read_eof || (c->in.len && memchr(c->in.data, '\n', c->in.len))) c->framed = 0;
+    else return;
+  }
+  if (!c->framed) {
+    if (c->closing) return;
+    if (c->in.len == 0) { c->closing = c->read_eof; return; }
+    size_t n = 0;
+    while (n < c->in.len && c->in.data[n] != '\n' && c->in.data[n] != '\r') n++;
+    if (n == c->in.len && !c->read_eof && c->in.len < LINE_MAX - 1) return;
+    if (n > LINE_MAX - 1) n = LINE_MAX - 1;
+    c->in.data[n] = '\0';
+    c->closing = 1;
+    int timeout_s, lane;
+    char *msg = parse_line_prefix(c->in.data, &timeout_s, &lane);
+    /* under workers a line client has no session of its own to be routed by: stateless */
+    req_opts_t o = { serve_worker ? "-" : "", timeout_s, NULL, 0, NULL, 0, 0, LLM_THINK_DEFAULT, lane };
+    if (strcmp(msg, "stats") == 0) stats_prometheus(&c->out);
+    else if (*msg) start_job(c, "-", &o, msg);
+    return;
+  }
+  while (c->in.len > 0 && !c->closing) {
+    long used = parse_frame(c);
+    if (used == 0) break;
+    if (used < 0) {
+      frame(c, "ERR", "-", "bad frame", 9);
+      c->closing = 1;
+    }
+  }
+}
+
+static void on_conn(int fd, int revents, void *user) {
+  conn_t *c = user;
+  if (revents & (POLLHUP | POLLERR)) {
+    conn_close(c, 1);
+    return;
+  }
+  if (revents & POLLIN) {
+    char tmp[16384];
+    for (;;) {
+      ssize_t n = read(fd, tmp, sizeof(tmp));
+      if (n > 0) { buf_append(&c->in, tmp, (size_t)n); continue; }
+      if (n == 0) {
+        if (c->http && c->jobs) { /* HTTP clients don't half-close: EOF is a hangup */
+          conn_close(c, 1);
+          return;
+        }
+        c->read_eof = 1;
+      }
+      else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) { conn_close(c, 1); return; }
+      break;
+    }
+  }
+  if ((revents & POLLIN) || (c->framed > 0 && c->in.len && !c->jobs)) { /* or a hand-off waiting on output */
+    c->in_parse = 1;
+    conn_parse(c);
+    c->in_parse = 0;
+  }
+  conn_update(c);
+}
+
+/* Flush output, re-arm the watch, and close the connection once it has nothing left to do. */
+static void conn_update(conn_t *c) {
+  if (conn_flush(c) != 0) {
+    conn_close(c, 1);
+    return;
+  }
+  if ((c->read_eof || c->closing) && !c->jobs && c->out.len == 0) {
+    conn_close(c, 0);
+    return;
+  }
+  if (!c->jobs && c->in.len == 0 && c->out.len == 0) { /* idle keep-alive: hold no buffers */
+    buf_free(&c->in);
+    buf_free(&c->out);
+  }
+  int events = (c->read_eof || c->closing) ? 0 : POLLIN;
+  if (c->out.len) events |= POLLOUT;
+  loop_watch(c->fd, events, on_conn, c);
+}
+
+static void set_nonblocking(int fd) {
+  int fl = fcntl(fd, F_GETFL, 0);
+  if (fl >= 0) fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+static void peer_cred(conn_t *c) {
+#ifdef SO_PEERCRED
+  struct ucred uc;
+  socklen_t len = sizeof(uc);
+  if (getsockopt(c->fd, SOL_SOCKET, SO_PEERCRED, &uc, &len) == 0) {
+    c->peer_uid = uc.uid;
+    c->peer_gid = uc.gid;
+    c->peer_known = 1;
+  }
+#else
+  c->peer_known = getpeereid(c->fd, &c->peer_uid, &c->peer_gid) == 0;
+#endif
+}
+
+static void on_accept(int fd, int revents, void *user) {
+  (void)revents; (void)user;
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) return; /* EAGAIN, or another worker took it */
+    set_nonblocking(client);
+    conn_t *c = calloc(1, sizeof(*c));
+    if (!c) { close(client); continue; }
+    c->fd = client;
+    c->framed = -1;
+    if (fd == http_listen_fd) {
+      int one = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      c->http = 1;
+    } else
+      peer_cred(c);
+    c->last = '\n';
+    loop_watch(client, POLLIN, on_conn, c);
+  }
+}
+
+/*
+ * Session routing under --workers: a session lives in the worker its id hashes to, so
+ * its history and its journal stay in one process. A framed request for a session that
+ * another worker owns moves the whole connection there: its fd and the bytes read from
+ * it so far go over a datagram socket pair the supervisor made for each worker before
+ * forking (so a restarted worker gets the same one); leftovers too big for one datagram
+ * go through an unlinked temp file passed along with it.
+ */
+#define HANDOFF_INLINE 2000 /* bytes carried in the datagram itself (macOS caps one at 2 KB) */
+
+typedef struct {
+  int lane;
+  int via_file; /* the bytes are in the second fd */
+} handoff_t;
+
+static int n_workers;     /* prefork with routing: how many; 0 otherwise */
+static int (*handoff)[2]; /* per worker: [0] the others send on, [1] it receives on */
+
+/* Worker 1..n_workers that keeps session id; 0 when every process keeps its own. The
+   hash is mixed first: ids that differ only in their last byte would all land together. */
+static int session_owner(const char *id) {
+  uint64_t h = cache_hash_str(CACHE_HASH_INIT, id) * 0x9E3779B97F4A7C15ULL;
+  return n_workers ? (int)((h >> 32) % (uint64_t)n_workers) + 1 : 0;
+}
+
+/* Pass c, with everything in c->in, to worker; c is then left to close. -1: not sent. */
+static int conn_hand_off(conn_t *c, int worker) {
+  handoff_t h = { c->lane, c->in.len > HANDOFF_INLINE };
+  FILE *tf = NULL;
+  if (h.via_file && (!(tf = tmpfile()) || fwrite(c->in.data, 1, c->in.len, tf) != c->in.len || fflush(tf) != 0)) {
+    if (tf) fclose(tf);
+    return -1;
+  }
+  int fds[2] = { c->fd, tf ? fileno(tf) : -1 }, nfd = tf ? 2 : 1;
+  union {
+    struct cmsghdr align;
+    char space[CMSG_SPACE(sizeof(fds))];
+  } ctl;
+  struct iovec iov[2] = { { &h, sizeof(h) }, { c->in.data, h.via_file ? 0 : c->in.len } };
+  struct msghdr m;
+  memset(&m, 0, sizeof(m));
+  memset(&ctl, 0, sizeof(ctl));
+  m.msg_iov = iov;
+  m.msg_iovlen = 2;
+  m.msg_control = ctl.space;
+  m.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&m);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(nfd * sizeof(int));
+  memcpy(CMSG_DATA(cm), fds, nfd * sizeof(int));
+  ssize_t n = sendmsg(handoff[worker - 1][0], &m, MSG_DONTWAIT);
+  if (tf) fclose(tf);
+  if (n < 0) return -1;
+  if (serve_debug) fprintf(stderr, "neo daemon: connection handed to worker %d\n", worker);
+  buf_consume(&c->in, c->in.len);
+  c->closing = 1; /* our copy of the fd; the client stays connected to the owner */
+  return 0;
+}
+
+static void on_handoff(int fd, int revents, void *user) {
+  (void)revents; (void)user;
+  for (;;) {
+    handoff_t h;
+    char data[HANDOFF_INLINE];
+    int fds[2] = { -1, -1 };
+    union {
+      struct cmsghdr align;
+      char space[CMSG_SPACE(sizeof(fds))];
+    } ctl;
+    struct iovec iov[2] = { { &h, sizeof(h) }, { data, sizeof(data) } };
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = iov;
+    m.msg_iovlen = 2;
+    m.msg_control = ctl.space;
+    m.msg_controllen = sizeof(ctl.space);
+    ssize_t n = recvmsg(fd, &m, MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        size_t got = cm->cmsg_len - CMSG_LEN(0);
+        memcpy(fds, CMSG_DATA(cm), got < sizeof(fds) ? got : sizeof(fds));
+      }
+    conn_t *c = fds[0] >= 0 && n >= (ssize_t)sizeof(h) ? calloc(1, sizeof(*c)) : NULL;
+    int ok = c != NULL;
+    if (ok && h.via_file) {
+      struct stat sb;
+      ok = fds[1] >= 0 && fstat(fds[1], &sb) == 0 && buf_reserve(&c->in, (size_t)sb.st_size) == 0 &&
+           pread(fds[1], c->in.data, (size_t)sb.st_size, 0) == (ssize_t)sb.st_size;
+      if (ok) c->in.len = (size_t)sb.st_size;
+    } else if (ok)
+      ok = buf_append(&c->in, data, (size_t)n - sizeof(h)) == 0;
+    if (fds[1] >= 0) close(fds[1]);
+    if (!ok) {
+      if (c) buf_free(&c->in);
+      free(c);
+      if (fds[0] >= 0) close(fds[0]);
+      continue;
+    }
+    c->fd = fds[0];
+    c->framed = 1;
+    c->lane = h.lane;
+    c->last = '\n';
+    peer_cred(c);
+    c->in_parse = 1;
+    conn_parse(c);
+    c->in_parse = 0;
+    conn_update(c);
+  }
+}
+
+/*
+ * Reloads off the loop. Reading, compacting and embedding every skill takes a while, so
+ * a serving process builds the new snapshot on a thread of its own and the loop only
+ * swaps it in by pointer: streams in flight go on meanwhile. A reload asked for while
+ * one is being built runs again once that one is in.
+ *
+ * Under --workers the supervisor does the building instead, into one of two shared
+ * slots mapped before the fork, and publishes it in `shared`; on the SIGHUP that follows
+ * each worker points live at it. A slot is refilled only once no process reads it
+ * (`using`, one bit per slot), so all workers share one copy after every reload, not
+ * just the first. If a snapshot outgrows the slots each worker builds its own, as above.
+ */
+typedef struct {
+  int cur; /* slot holding the latest snapshot; -1: each process built its own */
+  struct {
+    agent_config_t *conf;
+    const skills_index_t *skills;
+  } slot[2];
+  int using[]; /* per worker: bit k set while its live snapshot is in slot k */
+} shared_t;
+
+static arena_t slots[2];
+static shared_t *shared;
+static int live_slot = -1; /* the slot live is in, -1: this process's own arena */
+
+static struct {
+  pthread_t thread;
+  int running, threaded, again, discard;
+  int done; /* set by the thread; __atomic */
+  int rc;
+  const char *why;
+  struct timespec t0;
+  snapshot_t next;
+} rebuild;
+
+static void *rebuild_main(void *arg) {
+  (void)arg;
+  rebuild.rc = reload_build(&rebuild.next, rebuild.why);
+  trace_flush();
+  __atomic_store_n(&rebuild.done, 1, __ATOMIC_RELEASE);
+  if (wake_pipe[1] >= 0) {
+    ssize_t n = write(wake_pipe[1], "", 1);
+    (void)n;
+  }
+  return NULL;
+}
+
+static void reload_start(const char *why) {
+  rebuild.why = why;
+  if (rebuild.running) {
+    rebuild.again = 1;
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &rebuild.t0);
+  rebuild.done = 0;
+  rebuild.discard = 0;
+  rebuild.running = 1;
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old); /* signals stay with the loop */
+  int e = pthread_create(&rebuild.thread, NULL, rebuild_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  rebuild.threaded = e == 0;
+  if (e != 0) {
+    fprintf(stderr, "neo daemon: reload thread: %s, reloading in the loop\n", strerror(e));
+    rebuild_main(NULL);
+  }
+}
+
+/* Swap in what the thread built, once it is done; 1 if live changed. */
+static int reload_finish(int verbose) {
+  if (!rebuild.running || !__atomic_load_n(&rebuild.done, __ATOMIC_ACQUIRE)) return 0;
+  if (rebuild.threaded) pthread_join(rebuild.thread, NULL);
+  rebuild.running = 0;
+  int swapped = rebuild.rc == 0 && !rebuild.discard;
+  if (swapped) {
+    reload_swap(&rebuild.next, rebuild.why, &rebuild.t0, verbose);
+    live_slot = -1;
+    if (shared && serve_worker > 0) __atomic_store_n(&shared->using[serve_worker - 1], 0, __ATOMIC_SEQ_CST);
+    if (watch_fd >= 0) watch_arm();
+  } else if (rebuild.rc == 0)
+    arena_free(&rebuild.next.arena); /* a shared snapshot came in meanwhile */
+  if (rebuild.again) {
+    rebuild.again = 0;
+    reload_start(rebuild.why);
+  }
+  return swapped;
+}
+
+/* Worker, on the supervisor's SIGHUP: point live at the slot it published. Both slots
+   are marked in use until then, and cur is read again after, so the supervisor cannot
+   start refilling the new one in between. 1 if live changed. */
+static int shared_adopt(int verbose) {
+  int *using = &shared->using[serve_worker - 1];
+  int k, held = live_slot >= 0 ? 1 << live_slot : 0;
+  for (;;) {
+    k = __atomic_load_n(&shared->cur, __ATOMIC_SEQ_CST);
+    if (k < 0) {
+      reload_start("SIGHUP");
+      return 0;
+    }
+    if (k == live_slot) return 0;
+    __atomic_store_n(using, held | 1 << k, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared->cur, __ATOMIC_SEQ_CST) == k) break;
+    __atomic_store_n(using, held, __ATOMIC_SEQ_CST);
+  }
+  snapshot_t next = { .conf = shared->slot[k].conf, .skills = shared->slot[k].skills };
+  struct timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  reload_swap(&next, "SIGHUP, shared", &t0, verbose);
+  live_slot = k;
+  __atomic_store_n(using, 1 << k, __ATOMIC_SEQ_CST);
+  if (rebuild.running) {
+    rebuild.discard = 1;
+    rebuild.again = 0;
+  }
+  return 1;
+}
+
+/* Supervisor: map the shared state and two slots with room to spare, before forking. */
+static void shared_setup(int n) {
+  static arena_t ctl;
+  size_t room = snapshot_size(live.conf) * 4;
+  if (room < (size_t)16 << 20) room = (size_t)16 << 20;
+  if (arena_init(&ctl, sizeof(shared_t) + (size_t)n * sizeof(int)) != 0 || arena_init(&slots[0], room) != 0 ||
+      arena_init(&slots[1], room) != 0) {
+    fprintf(stderr, "neo daemon: reloads are per worker (mmap failed)\n");
+    arena_free(&slots[0]);
+    arena_free(&ctl);
+    return;
+  }
+  shared = arena_alloc(&ctl, sizeof(shared_t) + (size_t)n * sizeof(int));
+  shared->cur = -1;
+}
+
+/* Supervisor: build the new snapshot into a slot no process reads and publish it.
+   0: there is something to pass on; 1: a worker still reads both slots, try again
+   shortly; -1: keep the running config. */
+static int shared_reload(const char *why, const pid_t *pids, int n) {
+  if (!shared) return daemon_reload(why, 1);
+  if (!reload_path) return -1;
+  int k = -1;
+  for (int t = 0; t < 2 && k < 0; t++) {
+    int c = (shared->cur + 1 + t) & 1, busy = c == live_slot;
+    for (int i = 0; i < n && !busy; i++)
+      busy = pids[i] > 0 && (__atomic_load_n(&shared->using[i], __ATOMIC_SEQ_CST) & 1 << c);
+    if (!busy) k = c;
+  }
+  if (k < 0) return 1;
+  struct timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  agent_config_t c;
+  if (reload_config(&c, why) != 0) return -1;
+  snapshot_t next = {0};
+  int rc = -1;
+  if (snapshot_size(&c) <= slots[k].size) {
+    arena_reset(&slots[k]);
+    rc = snapshot_fill(&next, &slots[k], &c);
+  }
+  if (rc != 0) {
+    fprintf(stderr, "neo daemon: reload (%s): too big for the shared slots, each worker builds its own\n", why);
+    k = -1;
+    rc = snapshot_build(&next, &c);
+  }
+  config_free(&c);
+  if (rc != 0) {
+    fprintf(stderr, "neo daemon: reload (%s): out of memory, keeping the running config\n", why);
+    return -1;
+  }
+  reload_swap(&next, why, &t0, 1);
+  live_slot = k;
+  if (k >= 0) {
+    shared->slot[k].conf = live.conf;
+    shared->slot[k].skills = live.skills;
+  }
+  __atomic_store_n(&shared->cur, k, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+static void on_wake(int fd, int revents, void *user) {
+  (void)fd; (void)revents; (void)user;
+  wake_drain(); /* the flags are looked at by the loop */
+}
+
+static void on_watch(int fd, int revents, void *user) {
+  (void)fd; (void)revents; (void)user;
+  if (watch_changed()) reload_start("file changed"); /* re-armed once it is in */
+}
+
+/* Event loop run by the single process (worker 0) or by prefork worker 1..n on the
+   shared fds (either may be -1). A worker reloads on the SIGHUP its supervisor forwards;
+   a single process also watches the files itself. Each keeps the sessions it owns, and
+   its own journal of them (the first worker shares the single process's). */
+static void serve_socket(int fd, int http_fd, int debug, int worker) {
+  warm_t0 = now_ms();
+  serve_debug = debug;
+  serve_worker = worker;
+  serve_prompt = malloc(SYSTEM_MAX);
+  if (!serve_prompt) return;
+  if (live.conf->session_journal)
+    journal_open(live.conf->session_journal, worker > 0 ? worker - 1 : 0, live.conf->session_journal_sync_ms,
+                 live.conf->session_max_turns, (size_t)live.conf->session_max_bytes);
+  http_listen_fd = http_fd;
+  if (fd >= 0) {
+    set_nonblocking(fd);
+    loop_watch(fd, POLLIN, on_accept, NULL);
+  }
+  if (http_fd >= 0) {
+    set_nonblocking(http_fd);
+    loop_watch(http_fd, POLLIN, on_accept, NULL);
+  }
+  wake_open();
+  if (wake_pipe[0] >= 0) loop_watch(wake_pipe[0], POLLIN, on_wake, NULL);
+  if (watch_fd >= 0) loop_watch(watch_fd, POLLIN, on_watch, NULL);
+  if (worker > 0 && n_workers) {
+    set_nonblocking(handoff[worker - 1][1]);
+    loop_watch(handoff[worker - 1][1], POLLIN, on_handoff, NULL);
+  }
+  catch_signal(SIGHUP, 1);
+  double t0 = now_ms();
+  build_system_prompt(live.conf, "", serve_prompt, SYSTEM_MAX);
+  warm_prompt_ms = now_ms() - t0;
+  warm_on = 1;
+  warm_pending = 0;
+  warm_setup();
+  for (;;) {
+    if (reload_requested) {
+      reload_requested = 0;
+      if (worker > 0 && shared) {
+        if (shared_adopt(debug)) warm_setup();
+      } else
+        reload_start("SIGHUP");
+    }
+    if (reload_finish(!worker || debug)) warm_setup(); /* between two rounds of callbacks */
+    int timeout = llm_async_timeout_ms(), sync_due = journal_timeout_ms(), probe_due = warm_timeout_ms();
+    if (sync_due >= 0 && (timeout < 0 || sync_due < timeout)) timeout = sync_due;
+    if (probe_due >= 0 && (timeout < 0 || probe_due < timeout)) timeout = probe_due;
+    if (loop_poll(timeout) < 0 && errno != EINTR) break;
+    llm_async_tick();
+    warm_tick();
+    journal_commit(); /* everything that finished this round, in one write */
+  }
+  free(serve_prompt);
+}
+
+static pid_t spawn_worker(int fd, int http_fd, int debug, int index) {
+  trace_flush(); /* or the child would write the parent's pending events again */
+  if (shared) __atomic_store_n(&shared->using[index], live_slot >= 0 ? 1 << live_slot : 0, __ATOMIC_SEQ_CST);
+  pid_t pid = fork();
+  if (pid == 0) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    if (watch_fd >= 0) close(watch_fd); /* the supervisor watches and forwards SIGHUP */
+    watch_fd = -1;
+    serve_socket(fd, http_fd, debug, index + 1);
+    _exit(1);
+  }
+  if (pid < 0) perror("fork");
+  return pid;
+}
+
+/* Supervisor: prefork n workers that all accept on the listening fds, restart any that
+   die, and take them down on SIGINT/SIGTERM. On SIGHUP or a file change it builds the
+   new snapshot into a shared slot (which workers restarted later inherit) and passes
+   SIGHUP on, so each worker swaps it in while keeping its connections and sessions. */
+static int run_workers(int fd, int http_fd, const char *where, int n, int debug) {
+  pid_t *pids = calloc((size_t)n, sizeof(pid_t));
+  time_t *started = calloc((size_t)n, sizeof(time_t));
+  if (!pids || !started) {
+    free(pids);
+    free(started);
+    return -1;
+  }
+  wake_open();
+  catch_signal(SIGINT, 0);
+  catch_signal(SIGTERM, 0);
+  catch_signal(SIGHUP, 0);
+  catch_signal(SIGCHLD, 0);
+  if ((handoff = calloc((size_t)n, sizeof(*handoff))) != NULL) { /* kept open here for restarted workers */
+    n_workers = n;
+    for (int i = 0; i < n && n_workers; i++)
+      if (socketpair(AF_UNIX, SOCK_DGRAM, 0, handoff[i]) != 0) n_workers = 0;
+  }
+  if (!n_workers) fprintf(stderr, "neo daemon: cannot route sessions (%s), each worker keeps its own\n", strerror(errno));
+  shared_setup(n);
+  for (int i = 0; i < n; i++) {
+    pids[i] = spawn_worker(fd, http_fd, debug, i);
+    started[i] = time(NULL);
+  }
+  fprintf(stderr, "neo daemon: starting %d workers on %s\n", n, where);
+
+  const char *waiting = NULL; /* a reload put off until a slot is free */
+  while (!stop_requested) {
+    struct pollfd pf[2] = { { wake_pipe[0], POLLIN, 0 }, { watch_fd, POLLIN, 0 } };
+    if (!reload_requested && !child_exited && poll(pf, 2, waiting ? 50 : -1) < 0 && errno != EINTR) break;
+    wake_drain();
+    int changed = watch_changed();
+    if (reload_requested || changed || waiting) {
+      const char *why = reload_requested ? "SIGHUP" : changed ? "file changed" : waiting;
+      reload_requested = 0;
+      int rc = shared_reload(why, pids, n);
+      waiting = rc == 1 ? why : NULL;
+      if (rc == 0)
+        for (int i = 0; i < n; i++)
+          if (pids[i] > 0) kill(pids[i], SIGHUP);
+      if (rc != 1) watch_arm();
+    }
+    child_exited = 0;
+    int status;
+    pid_t pid;
+    while (!stop_requested && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (int i = 0; i < n; i++) {
+        if (pids[i] != pid) continue;
+        if (WIFSIGNALED(status))
+          fprintf(stderr, "neo daemon: worker %d (pid %d) killed by signal %d, restarting\n", i, (int)pid, WTERMSIG(status));
+        else
+          fprintf(stderr, "neo daemon: worker %d (pid %d) exited with %d, restarting\n", i, (int)pid, WEXITSTATUS(status));
+        if (time(NULL) - started[i] < 1) sleep(1); /* don't spin if it crashes on startup */
+        if (stop_requested) break;
+        pids[i] = spawn_worker(fd, http_fd, debug, i);
+        started[i] = time(NULL);
+      }
+    }
+  }
+  for (int i = 0; i < n; i++)
+    if (pids[i] > 0) kill(pids[i], SIGTERM);
+  while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {}
+  free(pids);
+  free(started);
+  return 0;
+}
+
+static int listen_unix(const char *socket_path, int backlog) {
   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
   if (fd < 0) {
     perror("socket");
@@ -208,60 +2018,224 @@ int run_daemon_socket(agent_config_t *conf, const char *socket_path, int debug)
     close(fd);
     return -1;
   }
-  if (listen(fd, 5) < 0) {
+  if (listen(fd, backlog) < 0) {
     perror("listen");
     close(fd);
     return -1;
   }
-  fprintf(stderr, "neo daemon: listening on %s\n", socket_path);
+  return fd;
+}
 
-  char *system_prompt = malloc(SYSTEM_MAX);
-  char *line_buf = malloc(LINE_MAX);
-  if (!system_prompt || !line_buf) {
-    free(system_prompt);
-    free(line_buf);
+/* HOST:PORT, [V6HOST]:PORT or just PORT (loopback). */
+static int listen_tcp(const char *spec) {
+  char host[256] = "127.0.0.1";
+  const char *port = spec;
+  const char *colon = strrchr(spec, ':');
+  if (colon) {
+    const char *h = spec;
+    size_t n = (size_t)(colon - spec);
+    if (n >= 2 && h[0] == '[' && h[n - 1] == ']') { h++; n -= 2; }
+    if (n >= sizeof(host)) n = sizeof(host) - 1;
+    if (n > 0) {
+      memcpy(host, h, n);
+      host[n] = '\0';
+    }
+    port = colon + 1;
+  }
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  int rc = getaddrinfo(host, port, &hints, &res);
+  if (rc != 0) {
+    fprintf(stderr, "neo daemon: --http %s: %s\n", spec, gai_strerror(rc));
+    return -1;
+  }
+  int fd = socket(res->ai_family, SOCK_STREAM, 0);
+  int one = 1;
+  if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+    fprintf(stderr, "neo daemon: --http %s: %s\n", spec, strerror(errno));
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+int run_daemon_socket(agent_config_t *conf, const char *socket_path, const char *http_addr, int workers, int debug) {
+  int fd = -1, http_fd = -1;
+  if (socket_path && (fd = listen_unix(socket_path, workers > 1 ? SOMAXCONN : 5)) < 0) return -1;
+  if (http_addr && (http_fd = listen_tcp(http_addr)) < 0) {
+    if (fd >= 0) {
+      close(fd);
+      unlink(socket_path);
+    }
+    return -1;
+  }
+  char where[512];
+  snprintf(where, sizeof(where), "%s%s%s%s", socket_path ? socket_path : "",
+           socket_path && http_addr ? " and " : "", http_addr ? "http://" : "", http_addr ? http_addr : "");
+  signal(SIGPIPE, SIG_IGN); /* a client that left must not take the daemon down */
+  daemon_prepare(conf);
+  watch_arm();
+  int r = 0;
+  if (workers > 1)
+    r = run_workers(fd, http_fd, where, workers, debug);
+  else {
+    serve_where = where; /* logged once warmed up */
+    serve_socket(fd, http_fd, debug, 0);
+  }
+  if (fd >= 0) {
+    close(fd);
+    unlink(socket_path);
+  }
+  if (http_fd >= 0) close(http_fd);
+  return r;
+}
+
+/* Value of key in the END info ("key=value" tokens, in any order) into out; 0: not there. */
+static int info_value(const char *info, const char *key, char *out, size_t cap) {
+  size_t klen = strlen(key);
+  for (const char *p = info; *p; p += strcspn(p, " ")) {
+    p += strspn(p, " ");
+    if (strncmp(p, key, klen) != 0 || p[klen] != '=') continue;
+    size_t n = strcspn(p + klen + 1, " ");
+    if (n >= cap) n = cap - 1;
+    memcpy(out, p + klen + 1, n);
+    out[n] = '\0';
+    return 1;
+  }
+  return 0;
+}
+
+static double info_ms(const char *info, const char *key) {
+  char v[32];
+  return info_value(info, key, v, sizeof(v)) ? atof(v) : 0;
+}
+
+/* Client end of the framed protocol for one-shot runs: send msg as a stateless request
+   and stream the answer to stdout. Returns 0 when answered, 1 when the daemon reported
+   an error, -1 when no daemon answered (the caller then runs the query in-process). */
+int daemon_forward(const char *socket_path, const char *msg, const char *model, const char *opts, int debug) {
+  if (model && strchr(model, ' ')) return -1; /* can't go in a frame header */
+  struct timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  uint64_t span = trace_begin();
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
     close(fd);
     return -1;
   }
+  signal(SIGPIPE, SIG_IGN);
+  double connected_ms = elapsed_ms_since(&t0);
+  buf_t out = {0}, in = {0};
+  buf_printf(&out, "REQ 1 %zu session=-%s%s%s%s%s\n", strlen(msg), model ? " model=" : "", model ? model : "",
+             debug ? " stats=1" : "", opts ? " " : "", opts ? opts : "");
+  buf_puts(&out, msg);
+  int rc = -1, got = 0;
+  char last = '\n';
+  double first_ms = 0;
+  char info[256] = ""; /* all read after done:, which a failed write jumps to */
+  for (size_t off = 0; off < out.len;) {
+    ssize_t n = write(fd, out.data + off, out.len - off);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) goto done;
+    off += (size_t)n;
+  }
 
   for (;;) {
-    int client = accept(fd, NULL, NULL);
-    if (client < 0) continue;
-    line_buf[0] = '\0';
-    size_t n = 0;
-    while (n < LINE_MAX - 1) {
-      char c;
-      if (read(client, &c, 1) != 1) break;
-      if (c == '\n' || c == '\r') break;
-      line_buf[n++] = c;
-    }
-    line_buf[n] = '\0';
-    if (n > 0) {
-      build_system_prompt(conf, line_buf, system_prompt, SYSTEM_MAX);
-      if (debug) daemon_debug_print(conf, system_prompt, line_buf);
-      llm_response_t resp = {0};
-      if (do_one_turn(conf, system_prompt, line_buf, &resp) == 0 && resp.data && resp.size) {
-        write(client, resp.data, resp.size);
-        if (resp.size > 0 && resp.data[resp.size - 1] != '\n') write(client, "\n", 1);
-        session_append("user", line_buf);
-        session_append("assistant", resp.data);
-        session_trim_to(conf->session_max_turns > 0 ? conf->session_max_turns : 10);
+    char *nl;
+    while (in.len && (nl = memchr(in.data, '\n', in.len)) != NULL) {
+      char type[8], id[64];
+      size_t len;
+      if (sscanf(in.data, "%7s %63s %zu", type, id, &len) != 3) {
+        rc = got ? 1 : -1;
+        goto done;
       }
-      llm_response_free(&resp);
+      size_t hdr = (size_t)(nl - in.data) + 1;
+      if (in.len < hdr + len) break;
+      const char *data = in.data + hdr;
+      if (strcmp(type, "PROG") == 0) {
+        mr_print_progress(data, len);
+      } else if (strcmp(type, "CHUNK") == 0 && len) {
+        if (!got) first_ms = elapsed_ms_since(&t0);
+        mr_print_progress(NULL, 0);
+        got = 1;
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+        last = data[len - 1];
+      } else if (strcmp(type, "END") == 0) {
+        mr_print_progress(NULL, 0);
+        snprintf(info, sizeof(info), "%.*s", (int)len, data);
+        if (last != '\n') putchar('\n');
+        fflush(stdout);
+        rc = 0;
+        goto done;
+      } else if (strcmp(type, "ERR") == 0) {
+        mr_print_progress(NULL, 0);
+        fprintf(stderr, "neo: daemon: %.*s\n", (int)len, data);
+        rc = 1;
+        goto done;
+      }
+      buf_consume(&in, hdr + len);
     }
-    close(client);
+    char tmp[16384];
+    ssize_t n = read(fd, tmp, sizeof(tmp));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      mr_print_progress(NULL, 0);
+      if (got) fprintf(stderr, "\nneo: daemon connection lost mid-answer\n");
+      rc = got ? 1 : -1;
+      goto done;
+    }
+    buf_append(&in, tmp, (size_t)n);
   }
-  free(system_prompt);
-  free(line_buf);
+
+done:
   close(fd);
-  return 0;
+  trace_end("daemon_forward", span, "bytes", (long)out.len);
+  if (debug && rc == 0) {
+    double total_ms = elapsed_ms_since(&t0);
+    double prompt = info_ms(info, "prompt_ms"), queue = info_ms(info, "queue_ms"), conn = info_ms(info, "connect_ms");
+    double cold = info_ms(info, "cold_connect_ms"), setup = info_ms(info, "setup_ms");
+    char cache[8] = "?";
+    info_value(info, "cache", cache, sizeof(cache));
+    double saved = setup + (cold > conn ? cold - conn : 0);
+    fprintf(stderr, "neo: answered by daemon at %s: connect %.1f ms, first chunk %.1f ms, total %.1f ms\n",
+            socket_path, connected_ms, first_ms, total_ms);
+    fprintf(stderr, "neo: daemon prompt build %.2f ms, queued %.1f ms, upstream connect %.1f ms (%s), cache %s\n",
+            prompt, queue, conn, conn > 0 ? "new connection" : "reused", cache);
+    fprintf(stderr, "neo: latency saved vs in-process: ~%.1f ms (config + skills load %.1f ms, upstream connect/TLS %.1f ms), plus curl init\n",
+            saved, setup, cold > conn ? cold - conn : 0);
+  }
+  buf_free(&out);
+  buf_free(&in);
+  return rc;
 }
 #else
-int run_daemon_socket(agent_config_t *conf, const char *socket_path, int debug) {
+int run_daemon_socket(agent_config_t *conf, const char *socket_path, const char *http_addr, int workers, int debug) {
   (void)conf;
   (void)socket_path;
+  (void)http_addr;
+  (void)workers;
   (void)debug;
   fprintf(stderr, "neo: Unix socket not supported on this platform\n");
   return -1;
 }
+
+int daemon_forward(const char *socket_path, const char *msg, const char *model, const char *opts, int debug) {
+  (void)socket_path;
+  (void)msg;
+  (void)model;
+  (void)opts;
+  (void)debug;
+  return -1;
+}
 #endif
@@ -3,7 +3,18 @@
 
 #include "config.h"
 
+/* Where the daemon re-reads its config from on SIGHUP, or when inotify sees the config
+   or a skill file change; model (-m), if set, again overrides model.name. Without it
+   the daemon keeps the config it started with. */
+void daemon_config_source(const char *config_path, const char *model);
+
 int run_daemon_stdin(agent_config_t *conf, int debug);
-int run_daemon_socket(agent_config_t *conf, const char *socket_path, int debug);
+/* Serve the Unix socket and/or the OpenAI-compatible HTTP gateway (either may be NULL).
+   workers > 1: prefork that many processes sharing the listening sockets. */
+int run_daemon_socket(agent_config_t *conf, const char *socket_path, const char *http_addr, int workers, int debug);
+/* One-shot client: forward msg to the daemon on socket_path and stream the answer to
+   stdout. opts: extra frame options (e.g. "file=/abs/path"), or NULL.
+   0 answered, 1 daemon error, -1 no daemon there (run in-process instead). */
+int daemon_forward(const char *socket_path, const char *msg, const char *model, const char *opts, int debug);
 
 #endif
@@ -0,0 +1,373 @@
+/*
+ * Embeddings: hashed word/bigram features or a mapped static model, mean-pooled into an
+ * int32 accumulator and quantized to int8. Dot products use SSE2 or NEON when the
+ * target has them (both are baseline on x86-64 and AArch64).
+ */
+#include "embed.h"
+#include "cache.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MAGIC    "NEOEMB1\n"
+#define DIM_MAX  4096
+#define WORD_MAX 64   /* longer ASCII words are cut */
+#define JOIN_MIN 160  /* paragraphs shorter than this join the next chunk */
+
+struct embed_model {
+  int dim;
+  uint32_t count;
+  const unsigned char *map;
+  const int8_t *rows;
+  uint32_t *tok_off;  /* vocabulary entry i at map + tok_off[i] (length byte first) */
+  uint32_t *slots;    /* open addressing: row + 1, 0 free */
+  size_t cap;
+  int max_tok;
+};
+
+typedef struct model_entry {
+  char *path;
+  embed_model_t *m; /* NULL: failed to load */
+  struct model_entry *next;
+} model_entry_t;
+
+static model_entry_t *models;
+static pthread_mutex_t models_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t rd32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static long lookup(const embed_model_t *m, const char *tok, size_t len) {
+  if (len == 0 || len > (size_t)m->max_tok) return -1;
+  size_t at = (size_t)cache_hash(CACHE_HASH_INIT, tok, len) & (m->cap - 1);
+  for (; m->slots[at]; at = (at + 1) & (m->cap - 1)) {
+    uint32_t row = m->slots[at] - 1;
+    const unsigned char *e = m->map + m->tok_off[row];
+    if (e[0] == len && memcmp(e + 1, tok, len) == 0) return row;
+  }
+  return -1;
+}
+
+static embed_model_t *load(const char *path) {
+  const char *why = "not a neo embedding model";
+  embed_model_t *m = calloc(1, sizeof(*m));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat sb;
+  size_t size = 0;
+  if (!m || fd < 0 || fstat(fd, &sb) != 0) {
+    why = strerror(errno);
+    goto fail;
+  }
+  size = (size_t)sb.st_size;
+  void *map = size >= 16 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  fd = -1;
+  if (map == MAP_FAILED) goto fail;
+  m->map = map;
+  if (memcmp(m->map, MAGIC, 8) != 0) goto fail;
+  m->dim = (int)rd32(m->map + 8);
+  m->count = rd32(m->map + 12);
+  if (m->dim <= 0 || m->dim > DIM_MAX || m->count == 0 || m->count > size) goto fail;
+  m->tok_off = malloc(m->count * sizeof(uint32_t));
+  for (m->cap = 16; m->cap < 2 * (size_t)m->count; m->cap <<= 1) {}
+  m->slots = calloc(m->cap, sizeof(uint32_t));
+  if (!m->tok_off || !m->slots) goto fail;
+  size_t off = 16;
+  for (uint32_t i = 0; i < m->count; i++) {
+    if (off >= size || off + 1 + m->map[off] > size) goto fail;
+    m->tok_off[i] = (uint32_t)off;
+    if (m->map[off] > m->max_tok) m->max_tok = m->map[off];
+    off += 1 + m->map[off];
+  }
+  if (size - off < (size_t)m->count * (size_t)m->dim) goto fail;
+  m->rows = (const int8_t *)(m->map + off);
+  for (uint32_t i = 0; i < m->count; i++) {
+    const unsigned char *e = m->map + m->tok_off[i];
+    if (lookup(m, (const char *)e + 1, e[0]) >= 0) continue; /* first of duplicates wins */
+    size_t at = (size_t)cache_hash(CACHE_HASH_INIT, e + 1, e[0]) & (m->cap - 1);
+    while (m->slots[at]) at = (at + 1) & (m->cap - 1);
+    m->slots[at] = i + 1;
+  }
+  return m;
+fail:
+  fprintf(stderr, "neo: embedding model %s: %s; using hashed vectors\n", path, why);
+  if (fd >= 0) close(fd);
+  if (m) {
+    if (m->map) munmap((void *)m->map, size);
+    free(m->tok_off);
+    free(m->slots);
+    free(m);
+  }
+  return NULL;
+}
+
+const embed_model_t *embed_model(const char *path) {
+  if (!path || !path[0]) return NULL;
+  pthread_mutex_lock(&models_lock);
+  model_entry_t *e = models;
+  while (e && strcmp(e->path, path) != 0) e = e->next;
+  if (!e && (e = calloc(1, sizeof(*e))) != NULL) {
+    e->path = strdup(path);
+    e->m = load(path);
+    e->next = models;
+    models = e;
+  }
+  pthread_mutex_unlock(&models_lock);
+  return e ? e->m : NULL;
+}
+
+int embed_dim(const embed_model_t *m) { return m ? m->dim : EMBED_HASH_DIM; }
+
+static size_t utf8_len(unsigned char c) {
+  if (c < 0xC0) return 1;
+  if (c < 0xE0) return 2;
+  if (c < 0xF0) return 3;
+  return 4;
+}
+
+/* Non-ASCII characters that carry no meaning of their own: punctuation, symbols,
+   box drawing, ideographic space. */
+static int wide_punct(const unsigned char *p, size_t k) {
+  unsigned cp = k == 2 ? (p[0] & 0x1Fu) << 6 | (p[1] & 0x3Fu)
+              : k == 3 ? (p[0] & 0x0Fu) << 12 | (p[1] & 0x3Fu) << 6 | (p[2] & 0x3Fu)
+                       : 0x10000;
+  return cp < 0xC0 || (cp >= 0x2000 && cp <= 0x2BFF) || (cp >= 0x3000 && cp <= 0x303F) ||
+         (cp >= 0xFF01 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20) || (cp >= 0xFF3B && cp <= 0xFF40) ||
+         (cp >= 0xFF5B && cp <= 0xFF65);
+}
+
+static void add_feature(int32_t *acc, int dim, uint64_t h, int weight) {
+  acc[h % (uint64_t)dim] += (h >> 63) ? -weight : weight;
+}
+
+/* English words too common to say what a text is about. */
+static int stopword(const char *w, size_t n) {
+  static const char *const words[] = { "a", "an", "and", "are", "as", "at", "be", "by", "can", "do", "does", "for",
+                                       "from", "how", "i", "if", "in", "is", "it", "me", "my", "of", "on", "or",
+                                       "the", "this", "that", "to", "was", "what", "with", "you", "your" };
+  if (n > 4) return 0;
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    if (strlen(words[i]) == n && memcmp(words[i], w, n) == 0) return 1;
+  return 0;
+}
+
+/* Hashed features: each ASCII word, and each pair of neighbouring words or characters.
+   A lone CJK character says little (个, 的); a pair is mostly a word (景点). */
+static void hash_text(const char *t, size_t n, int32_t *acc) {
+  uint64_t prev = 0;
+  char word[WORD_MAX];
+  for (size_t i = 0; i < n;) {
+    unsigned char c = (unsigned char)t[i];
+    uint64_t h;
+    if (c < 0x80) {
+      if (!isalnum(c)) {
+        if (c != '_' && c != '-') prev = 0; /* spaces and dots end a pair, "snake_case" doesn't */
+        i++;
+        continue;
+      }
+      size_t w = 0;
+      for (; i < n && (unsigned char)t[i] < 0x80 && isalnum((unsigned char)t[i]); i++)
+        if (w < WORD_MAX) word[w++] = (char)tolower((unsigned char)t[i]);
+      if (stopword(word, w)) continue; /* "format of tasks" pairs format with tasks */
+      h = cache_hash(CACHE_HASH_INIT, word, w);
+      add_feature(acc, EMBED_HASH_DIM, h, 2);
+    } else {
+      size_t k = utf8_len(c);
+      if (i + k > n) break;
+      if (wide_punct((const unsigned char *)t + i, k)) {
+        prev = 0;
+        i += k;
+        continue;
+      }
+      h = cache_hash(CACHE_HASH_INIT, t + i, k);
+      i += k;
+    }
+    if (prev) add_feature(acc, EMBED_HASH_DIM, cache_hash(prev, &h, sizeof(h)), 2);
+    prev = h;
+  }
+}
+
+static int add_row(const embed_model_t *m, long row, int32_t *acc) {
+  if (row < 0) return 0;
+  const int8_t *r = m->rows + (size_t)row * (size_t)m->dim;
+  for (int d = 0; d < m->dim; d++) acc[d] += r[d];
+  return 1;
+}
+
+/* Model tokens: ASCII words by greedy longest match ("##" on continued pieces), other
+   text by the longest vocabulary entry starting at each character. */
+static void model_text(const embed_model_t *m, const char *t, size_t n, int32_t *acc) {
+  char word[WORD_MAX + 2];
+  for (size_t i = 0; i < n;) {
+    unsigned char c = (unsigned char)t[i];
+    if (c < 0x80) {
+      if (!isalnum(c)) {
+        i++;
+        continue;
+      }
+      size_t w = 0;
+      for (; i < n && (unsigned char)t[i] < 0x80 && isalnum((unsigned char)t[i]); i++)
+        if (w < WORD_MAX) word[2 + w++] = (char)tolower((unsigned char)t[i]);
+      for (size_t pos = 0; pos < w;) {
+        size_t len = w - pos;
+        long row = -1;
+        if (pos) {
+          word[pos] = word[pos + 1] = '#';
+          for (; len > 0 && (row = lookup(m, word + pos, len + 2)) < 0; len--) {}
+        } else
+          for (; len > 0 && (row = lookup(m, word + 2, len)) < 0; len--) {}
+        if (!add_row(m, row, acc)) break; /* unknown rest of the word */
+        pos += len;
+      }
+      continue;
+    }
+    size_t k = utf8_len(c), best = 0, len = 0;
+    if (i + k > n) break;
+    if (wide_punct((const unsigned char *)t + i, k)) {
+      i += k;
+      continue;
+    }
+    long row = -1;
+    while (i + len < n && len < (size_t)m->max_tok) { /* the longest entry over whole characters */
+      unsigned char d = (unsigned char)t[i + len];
+      size_t dk = utf8_len(d);
+      if (d < 0x80 || i + len + dk > n || wide_punct((const unsigned char *)t + i + len, dk)) break;
+      len += dk;
+      long r = lookup(m, t + i, len);
+      if (r >= 0) {
+        row = r;
+        best = len;
+      }
+    }
+    add_row(m, row, acc);
+    i += best ? best : k;
+  }
+}
+
+void embed_text(const embed_model_t *m, const char *text, size_t len, int8_t *out) {
+  int dim = embed_dim(m);
+  int32_t *acc = calloc((size_t)dim, sizeof(int32_t));
+  if (!acc) {
+    memset(out, 0, (size_t)dim);
+    return;
+  }
+  if (m) model_text(m, text, len, acc);
+  else hash_text(text, len, acc);
+  double norm = 0;
+  for (int d = 0; d < dim; d++) norm += (double)acc[d] * acc[d];
+  double scale = norm > 0 ? 127.0 / sqrt(norm) : 0;
+  for (int d = 0; d < dim; d++) {
+    double v = acc[d] * scale;
+    out[d] = (int8_t)(v >= 0 ? (v > 126.5 ? 127 : v + 0.5) : (v < -126.5 ? -127 : v - 0.5));
+  }
+  free(acc);
+}
+
+int embed_dot(const int8_t *a, const int8_t *b, int dim) {
+  int d = 0, sum = 0;
+#if defined(__ARM_NEON)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (; d + 16 <= dim; d += 16) {
+    int8x16_t x = vld1q_s8(a + d), y = vld1q_s8(b + d);
+    acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(x), vget_low_s8(y)));
+    acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(x), vget_high_s8(y)));
+  }
+  int32x2_t s2 = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+  sum = vget_lane_s32(vpadd_s32(s2, s2), 0);
+#elif defined(__SSE2__)
+  __m128i acc = _mm_setzero_si128();
+  for (; d + 16 <= dim; d += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + d)), y = _mm_loadu_si128((const __m128i *)(b + d));
+    /* sign-extend to 16 bits (byte into the high half, shift back), multiply-add pairs */
+    __m128i xl = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), xh = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+    __m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8), yh = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+    acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(xl, yl), _mm_madd_epi16(xh, yh)));
+  }
+  int32_t lane[4];
+  _mm_storeu_si128((__m128i *)lane, acc);
+  sum = lane[0] + lane[1] + lane[2] + lane[3];
+#endif
+  for (; d < dim; d++) sum += a[d] * b[d];
+  return sum;
+}
+
+float embed_score(const int8_t *a, const int8_t *b, int dim) {
+  return (float)embed_dot(a, b, dim) / (127.0f * 127.0f);
+}
+
+/* Index of the newline that starts a blank line at or after i, or len. */
+static size_t paragraph_end(const char *text, size_t len, size_t i) {
+  for (const char *q = text + i; (q = memchr(q, '\n', len - (size_t)(q - text))) != NULL; q++) {
+    const char *r = q + 1;
+    while (r < text + len && (*r == ' ' || *r == '\t' || *r == '\r')) r++;
+    if (r < text + len && *r == '\n') return (size_t)(q - text);
+  }
+  return len;
+}
+
+static size_t skip_blank(const char *text, size_t len, size_t i) {
+  while (i < len && isspace((unsigned char)text[i])) i++;
+  return i;
+}
+
+int embed_split(const char *text, size_t len, embed_chunk_t *out, int cap) {
+  int n = 0;
+  size_t start = skip_blank(text, len, 0), i = start, last = start; /* chunk start, next paragraph, chunk end */
+  while (i < len && n < cap) {
+    size_t end = paragraph_end(text, len, i);
+    if (end - start > EMBED_CHUNK) {
+      if (i > start) { /* the paragraphs so far make a chunk, this one starts the next */
+        out[n].off = start;
+        out[n++].len = last - start;
+        start = i;
+        continue;
+      }
+      size_t cut = start + EMBED_CHUNK; /* one long paragraph: cut at a line end, else a character */
+      while (cut > start + EMBED_CHUNK / 2 && text[cut] != '\n') cut--;
+      if (text[cut] != '\n')
+        for (cut = start + EMBED_CHUNK; ((unsigned char)text[cut] & 0xC0) == 0x80; cut--) {}
+      out[n].off = start;
+      out[n++].len = cut - start;
+      start = i = last = skip_blank(text, len, cut);
+      continue;
+    }
+    last = end;
+    i = skip_blank(text, len, end);
+    if (last - start >= JOIN_MIN || i >= len) {
+      out[n].off = start;
+      out[n++].len = last - start;
+      start = i;
+    }
+  }
+  return n;
+}
+
+int embed_top(const float *score, int n, int k, float min, int *out) {
+  int got = 0;
+  for (int i = 0; i < n; i++) {
+    if (score[i] < min) continue;
+    int at = got < k ? got++ : k;
+    if (at == k && (k == 0 || score[i] <= score[out[k - 1]])) continue;
+    if (at == k) at = k - 1;
+    while (at > 0 && score[out[at - 1]] < score[i]) {
+      out[at] = out[at - 1];
+      at--;
+    }
+    out[at] = i;
+  }
+  return got;
+}
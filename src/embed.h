@@ -0,0 +1,49 @@
+#ifndef NEO_EMBED_H
+#define NEO_EMBED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sentence embeddings for skill and memory selection (embed: enabled: yes), CPU only.
+ * Vectors are int8, L2-normalized to 127, so a dot product over 127^2 is the cosine.
+ * Without a model file the vector of a text is its hashed words and character bigrams
+ * (lexical, but "景点" finds a skill that talks about 景点 without naming it); with one,
+ * the mean of the model's token vectors (a static embedding model, e.g. exported from
+ * model2vec). Model file, little-endian:
+ *
+ *   "NEOEMB1\n" | uint32 dim | uint32 count
+ *   count x { uint8 len, token bytes }     vocabulary; "##x" continues a word
+ *   count x int8[dim]                      one row per token
+ */
+
+#define EMBED_HASH_DIM 2048 /* fewer makes unrelated words collide as often as a real match scores */
+#define EMBED_CHUNK    300 /* longest chunk embedded as one vector, bytes */
+/* Default embed.min_score by vector kind. Hashed vectors only share the words and bigrams
+   of the text, so a fitting skill chunk scores ~0.07 ("推荐几个景点" against nanjing)
+   and an unrelated one ~0; model vectors of related text sit around 0.3 and up. */
+#define EMBED_MIN_SCORE_HASHED 0.04
+#define EMBED_MIN_SCORE_MODEL  0.3
+
+typedef struct embed_model embed_model_t;
+
+typedef struct {
+  size_t off, len;
+} embed_chunk_t;
+
+/* The model at path, loaded (mapped) on first use and kept for the process; NULL for
+   no path, or when the file can't be used (reported once): hashed vectors then. */
+const embed_model_t *embed_model(const char *path);
+int embed_dim(const embed_model_t *m);
+/* Vector of text[0..len) into out (embed_dim bytes). */
+void embed_text(const embed_model_t *m, const char *text, size_t len, int8_t *out);
+int embed_dot(const int8_t *a, const int8_t *b, int dim);
+/* Cosine of two vectors from embed_text. */
+float embed_score(const int8_t *a, const int8_t *b, int dim);
+/* Chunks of text: paragraphs, short ones joined to the next, long ones cut at a line
+   end, at most EMBED_CHUNK bytes each. Returns the count (at most cap). */
+int embed_split(const char *text, size_t len, embed_chunk_t *out, int cap);
+/* Indices of the k highest of score[0..n) that reach min, best first; returns how many. */
+int embed_top(const float *score, int n, int k, float min, int *out);
+
+#endif
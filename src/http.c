@@ -0,0 +1,108 @@
+/*
+ * HTTP/1.1 for the gateway: request heads parsed straight out of the connection
+ * buffer (no copies of header values), responses appended to the output buffer.
+ */
+#include "http.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *find_head_end(const char *data, size_t len) {
+  for (const char *p = data; (p = memchr(p, '\n', len - (size_t)(p - data))) != NULL; p++) {
+    if ((size_t)(p + 1 - data) < len && p[1] == '\n') return p + 2;
+    if ((size_t)(p + 2 - data) < len && p[1] == '\r' && p[2] == '\n') return p + 3;
+  }
+  return NULL;
+}
+
+/* Case-insensitive search for a comma-separated token in a header value. */
+static int has_token(const char *v, size_t n, const char *tok) {
+  size_t tl = strlen(tok);
+  for (size_t i = 0; i + tl <= n; i++)
+    if (strncasecmp(v + i, tok, tl) == 0 && (i == 0 || v[i - 1] == ' ' || v[i - 1] == ',') &&
+        (i + tl == n || v[i + tl] == ' ' || v[i + tl] == ',' || v[i + tl] == '\r'))
+      return 1;
+  return 0;
+}
+
+long http_parse_head(const char *data, size_t len, http_request_t *req) {
+  const char *end = find_head_end(data, len > HTTP_HEAD_MAX ? HTTP_HEAD_MAX : len);
+  if (!end) return len >= HTTP_HEAD_MAX ? -1 : 0;
+  memset(req, 0, sizeof(*req));
+
+  /* request line: METHOD SP target SP HTTP/1.x */
+  const char *eol = memchr(data, '\n', (size_t)(end - data));
+  const char *sp1 = memchr(data, ' ', (size_t)(eol - data));
+  if (!sp1 || sp1 == data || (size_t)(sp1 - data) >= sizeof(req->method)) return -1;
+  const char *sp2 = memchr(sp1 + 1, ' ', (size_t)(eol - sp1 - 1));
+  if (!sp2 || (size_t)(sp2 - sp1 - 1) >= sizeof(req->path) || sp2 == sp1 + 1) return -1;
+  if (strncmp(sp2 + 1, "HTTP/1.", 7) != 0) return -1;
+  memcpy(req->method, data, (size_t)(sp1 - data));
+  memcpy(req->path, sp1 + 1, (size_t)(sp2 - sp1 - 1));
+  char *q = strchr(req->path, '?');
+  if (q) *q = '\0';
+  req->keep_alive = sp2[8] != '0'; /* 1.0 closes by default */
+
+  for (const char *line = eol + 1; line < end; line = eol + 1) {
+    eol = memchr(line, '\n', (size_t)(end - line));
+    size_t n = (size_t)(eol - line);
+    if (n && line[n - 1] == '\r') n--;
+    if (n == 0) break;
+    const char *colon = memchr(line, ':', n);
+    if (!colon) return -1;
+    size_t klen = (size_t)(colon - line);
+    const char *v = colon + 1;
+    while (v < line + n && (*v == ' ' || *v == '\t')) v++;
+    size_t vlen = (size_t)(line + n - v);
+    if (klen == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+      char *e;
+      req->content_length = strtol(v, &e, 10);
+      if (e == v || req->content_length < 0) return -1;
+    } else if (klen == 10 && strncasecmp(line, "Connection", 10) == 0) {
+      if (has_token(v, vlen, "close")) req->keep_alive = 0;
+      else if (has_token(v, vlen, "keep-alive")) req->keep_alive = 1;
+    } else if (klen == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+      req->chunked = has_token(v, vlen, "chunked");
+    } else if (klen == 6 && strncasecmp(line, "Expect", 6) == 0) {
+      req->expect_continue = has_token(v, vlen, "100-continue");
+    } else if (klen == 14 && strncasecmp(line, "X-Neo-Priority", 14) == 0 && vlen < sizeof(req->priority)) {
+      memcpy(req->priority, v, vlen);
+    }
+  }
+  return (long)(end - data);
+}
+
+const char *http_reason(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 411: return "Length Required";
+  case 413: return "Payload Too Large";
+  case 429: return "Too Many Requests";
+  case 500: return "Internal Server Error";
+  case 502: return "Bad Gateway";
+  case 504: return "Gateway Timeout";
+  default: return "Error";
+  }
+}
+
+void http_response(buf_t *out, int status, const char *content_type, const char *body, size_t len, int keep_alive) {
+  buf_printf(out, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n",
+             status, http_reason(status), content_type, len,
+             keep_alive ? "" : "Connection: close\r\n");
+  if (len) buf_append(out, body, len);
+}
+
+void http_stream_head(buf_t *out, const char *content_type, int keep_alive) {
+  buf_printf(out, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nCache-Control: no-cache\r\n"
+                  "Transfer-Encoding: chunked\r\n%s\r\n",
+             content_type, keep_alive ? "" : "Connection: close\r\n");
+}
+
+void http_chunk(buf_t *out, const char *data, size_t len) {
+  buf_printf(out, "%zx\r\n", len);
+  if (len) buf_append(out, data, len);
+  buf_append(out, "\r\n", 2);
+}
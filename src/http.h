@@ -0,0 +1,30 @@
+#ifndef NEO_HTTP_H
+#define NEO_HTTP_H
+
+#include "buf.h"
+
+#define HTTP_HEAD_MAX (16 * 1024)
+
+/* One HTTP/1.x request head, parsed from the front of a connection buffer. */
+typedef struct {
+  char method[16];
+  char path[256];
+  int keep_alive;         /* HTTP/1.1 default unless "Connection: close" */
+  long content_length;    /* 0 when absent */
+  int chunked;            /* chunked request body: not supported, answered with 411 */
+  int expect_continue;
+  char priority[16];      /* X-Neo-Priority, empty when absent */
+} http_request_t;
+
+/* Length of the head at the start of data, 0 if it is not complete yet, -1 if it is
+   malformed or longer than HTTP_HEAD_MAX. */
+long http_parse_head(const char *data, size_t len, http_request_t *req);
+
+const char *http_reason(int status);
+/* Complete response with Content-Length. */
+void http_response(buf_t *out, int status, const char *content_type, const char *body, size_t len, int keep_alive);
+/* 200 head for a chunked body; follow with http_chunk, and http_chunk(out, NULL, 0) to end it. */
+void http_stream_head(buf_t *out, const char *content_type, int keep_alive);
+void http_chunk(buf_t *out, const char *data, size_t len);
+
+#endif
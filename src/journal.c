@@ -0,0 +1,288 @@
+/*
+ * Session journal file: "NEOSES1\n", then one record per message, each 8-byte aligned:
+ *
+ *   uint32 kind | uint32 id_len | uint64 len | uint32 time | uint32 check
+ *   id, NUL, text, NUL, zero-padded to a multiple of 8
+ *
+ * kind is clear (start the session over), user or assistant; time is the session's
+ * last use, so LRU order survives a restart; check is FNV-1a over the header and
+ * payload, so a record torn by a crash (or zeros past the end after a power loss) ends
+ * the replay instead of being read as history. Replay maps the file and applies the
+ * records through the ordinary session calls; compaction writes the live sessions to a
+ * new file, syncs it and renames it over the old one.
+ */
+#include "journal.h"
+#include "buf.h"
+#include "cache.h"
+#include "session.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+#define MAGIC       "NEOSES1\n"
+#define COMPACT_MIN (1 << 20) /* growth past the last snapshot before compacting */
+
+enum { REC_CLEAR = 1, REC_USER, REC_ASSISTANT };
+
+typedef struct {
+  uint32_t kind;
+  uint32_t id_len;
+  uint64_t len;
+  uint32_t time;
+  uint32_t check;
+} record_t;
+
+static int fd = -1;
+static char path[1024];
+static buf_t pending;      /* records of this loop round */
+static int pending_n;
+static size_t file_size;   /* bytes written to the file */
+static size_t snap_size;   /* live sessions' size at the last replay or compaction */
+static int dirty;          /* written, not synced yet */
+static double last_sync;
+static int sync_ms;
+static int limit_turns;
+static size_t limit_bytes;
+
+static size_t pad8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t record_check(const record_t *h, const char *id, const char *text) {
+  uint64_t x = cache_hash(CACHE_HASH_INIT, h, offsetof(record_t, check));
+  x = cache_hash(x, id, h->id_len);
+  x = cache_hash(x, text, (size_t)h->len);
+  return (uint32_t)(x ^ (x >> 32));
+}
+
+static void record_put(buf_t *b, uint32_t kind, const char *id, const char *text, time_t t) {
+  static const char zeros[8];
+  if (!text) text = "";
+  size_t id_len = strlen(id), len = strlen(text), body = id_len + len + 2;
+  record_t h = { kind, (uint32_t)id_len, len, (uint32_t)t, 0 };
+  h.check = record_check(&h, id, text);
+  buf_append(b, (const char *)&h, sizeof(h));
+  buf_append(b, id, id_len + 1);
+  buf_append(b, text, len + 1);
+  buf_append(b, zeros, pad8(body) - body);
+}
+
+static int write_all(int f, const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(f, p, n);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return -1;
+    p += w;
+    n -= (size_t)w;
+  }
+  return 0;
+}
+
+/* What a snapshot of the live sessions would take. */
+static size_t live_size(void) {
+  size_t n = 8;
+  session_table_t *t = session_process_table();
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    const session_t *s = t->slots[i];
+    for (int m = 0; s && m < s->count; m++)
+      n += sizeof(record_t) + pad8(strlen(s->id) + strlen(s->messages[m].content) + 2);
+  }
+  return n;
+}
+
+/* Apply the records of map[8..len) to the session table; returns the end of the last
+   good one. */
+static size_t replay(const char *map, size_t len, long *n_msgs) {
+  session_t *s = NULL;
+  size_t off = 8;
+  while (off + sizeof(record_t) <= len) {
+    const record_t *r = (const record_t *)(map + off);
+    if (r->kind < REC_CLEAR || r->kind > REC_ASSISTANT || r->id_len >= SESSION_ID_MAX || r->len > len) break;
+    size_t next = off + sizeof(record_t) + pad8((size_t)r->id_len + (size_t)r->len + 2);
+    if (next > len) break;
+    const char *id = (const char *)(r + 1), *text = id + r->id_len + 1;
+    if (id[r->id_len] || text[r->len] || record_check(r, id, text) != r->check) break;
+    if (!s || strcmp(s->id, id) != 0) s = session_find(id, 1); /* a turn's records come together */
+    if (s) {
+      if (r->kind == REC_CLEAR) session_clear(s);
+      else {
+        session_append(s, r->kind == REC_USER ? "user" : "assistant", text);
+        if (r->kind == REC_ASSISTANT) session_trim_to(s, limit_turns, limit_bytes);
+        (*n_msgs)++;
+      }
+      s->last_used = (time_t)r->time;
+    }
+    off = next;
+  }
+  return off;
+}
+
+int journal_open(const char *dir, int worker, int sync_interval, int max_turns, size_t max_bytes) {
+  double t0 = now_ms();
+  snprintf(path, sizeof(path), "%s/sessions-%d.journal", dir, worker);
+  mkdir(dir, 0700);
+  int f = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (f < 0) {
+    fprintf(stderr, "neo daemon: cannot open session journal %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (flock(f, LOCK_EX | LOCK_NB) != 0) {
+    fprintf(stderr, "neo daemon: session journal %s is in use by another process, not journaling\n", path);
+    close(f);
+    return -1;
+  }
+  limit_turns = max_turns > 0 ? max_turns : 10;
+  limit_bytes = max_bytes;
+  struct stat sb;
+  size_t size = fstat(f, &sb) == 0 ? (size_t)sb.st_size : 0, good = 8;
+  long n_msgs = 0;
+  if (size < 8) {
+    if (ftruncate(f, 0) != 0 || write_all(f, MAGIC, 8) != 0) {
+      fprintf(stderr, "neo daemon: cannot write session journal %s\n", path);
+      close(f);
+      return -1;
+    }
+    size = 8;
+  } else {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, f, 0);
+    if (map == MAP_FAILED || memcmp(map, MAGIC, 8) != 0) {
+      fprintf(stderr, "neo daemon: %s is not a neo session journal\n", path);
+      if (map != MAP_FAILED) munmap(map, size);
+      close(f);
+      return -1;
+    }
+    good = replay(map, size, &n_msgs);
+    munmap(map, size);
+  }
+  if (good < size) { /* cut the torn tail so new records don't land behind it */
+    fprintf(stderr, "neo daemon: session journal %s: dropped %zu bytes of incomplete records\n", path, size - good);
+    if (ftruncate(f, (off_t)good) != 0) {
+      close(f);
+      return -1;
+    }
+  }
+  fd = f;
+  file_size = good;
+  snap_size = live_size(); /* a journal mostly of evicted sessions compacts on the first round */
+  sync_ms = sync_interval > 0 ? sync_interval : 0;
+  last_sync = now_ms();
+  int n_sessions = 0, n_kept = 0;
+  session_table_t *t = session_process_table();
+  for (int i = 0; i < MAX_SESSIONS; i++)
+    if (t->slots[i] && t->slots[i]->count) {
+      n_sessions++;
+      n_kept += t->slots[i]->count;
+    }
+  fprintf(stderr, "neo daemon: replayed %ld messages (%zu KB) from %s in %.1f ms: %d sessions, %d messages kept\n",
+          n_msgs, good / 1024, path, now_ms() - t0, n_sessions, n_kept);
+  return 0;
+}
+
+int journal_enabled(void) { return fd >= 0; }
+
+void journal_turn(const char *id, int fresh, const char *user, const char *answer) {
+  if (fd < 0) return;
+  time_t now = time(NULL);
+  if (!id) id = "";
+  if (fresh) record_put(&pending, REC_CLEAR, id, NULL, now);
+  record_put(&pending, REC_USER, id, user, now);
+  record_put(&pending, REC_ASSISTANT, id, answer, now);
+  pending_n += fresh ? 3 : 2;
+}
+
+/* Rewrite the file as the live sessions only. The new file is locked before it takes
+   the old one's name, so no other daemon can open it in between. */
+static void compact(void) {
+  double t0 = now_ms();
+  char tmp[1040];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  buf_t out = {0};
+  buf_append(&out, MAGIC, 8);
+  session_table_t *t = session_process_table();
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    const session_t *s = t->slots[i];
+    for (int m = 0; s && m < s->count; m++)
+      record_put(&out, strcmp(s->messages[m].role, "assistant") == 0 ? REC_ASSISTANT : REC_USER, s->id,
+                 s->messages[m].content, s->last_used);
+  }
+  int f = out.data ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600) : -1;
+  if (f < 0 || flock(f, LOCK_EX | LOCK_NB) != 0 || write_all(f, out.data, out.len) != 0 || fdatasync(f) != 0 ||
+      rename(tmp, path) != 0) {
+    fprintf(stderr, "neo daemon: session journal compaction failed: %s\n", strerror(errno));
+    if (f >= 0) {
+      close(f);
+      unlink(tmp);
+    }
+    snap_size = file_size; /* don't retry on every round */
+    buf_free(&out);
+    return;
+  }
+  char *slash = strrchr(path, '/');
+  if (slash) { /* make the rename itself durable */
+    *slash = '\0';
+    int d = open(path, O_RDONLY | O_CLOEXEC);
+    *slash = '/';
+    if (d >= 0) {
+      fsync(d);
+      close(d);
+    }
+  }
+  close(fd);
+  fd = f;
+  file_size = snap_size = out.len;
+  buf_free(&out);
+  stats_journal(STATS_JOURNAL_COMPACT, now_ms() - t0, 0);
+}
+
+static void commit(int force) {
+  if (fd < 0) return;
+  if (pending.len) {
+    double t0 = now_ms();
+    if (write_all(fd, pending.data, pending.len) == 0) {
+      file_size += pending.len;
+      dirty = 1;
+      stats_journal(STATS_JOURNAL_WRITE, now_ms() - t0, pending_n);
+    } else {
+      fprintf(stderr, "neo daemon: session journal write failed: %s\n", strerror(errno));
+      if (ftruncate(fd, (off_t)file_size) != 0) {} /* keep the file replayable to the end */
+    }
+    pending.len = 0;
+    pending_n = 0;
+  }
+  double now = now_ms();
+  if (dirty && (force || now - last_sync >= sync_ms)) {
+    fdatasync(fd);
+    dirty = 0;
+    last_sync = now_ms();
+    stats_journal(STATS_JOURNAL_SYNC, last_sync - now, 0);
+  }
+  if (!dirty && file_size > 2 * snap_size + COMPACT_MIN) compact();
+}
+
+void journal_commit(void) { commit(0); }
+
+void journal_sync(void) { commit(1); }
+
+int journal_timeout_ms(void) {
+  if (fd < 0 || !dirty) return -1;
+  double left = last_sync + sync_ms - now_ms();
+  return left <= 0 ? 0 : (int)left + 1;
+}
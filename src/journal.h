@@ -0,0 +1,32 @@
+#ifndef NEO_JOURNAL_H
+#define NEO_JOURNAL_H
+
+#include <stddef.h>
+
+/*
+ * Session journal (session.journal: DIR): every finished turn is appended to
+ * DIR/sessions-<worker>.journal so a restarted daemon, or a worker restarted after a
+ * crash, picks its conversations up again. Records of one event-loop round go out in a
+ * single write; fdatasync follows at most every session.journal_sync_ms, so turns that
+ * finish close together share one sync. Once the file has grown well past what the
+ * live sessions hold, it is rewritten as a snapshot of just those.
+ */
+
+/* Replay the journal into the process session table (mapped, checked record by record,
+   a torn tail cut off), then keep it open for appends. worker picks the file; the
+   limits are applied during replay as they are to live sessions. -1: no journal (the
+   file can't be opened, or another process holds it). */
+int journal_open(const char *dir, int worker, int sync_ms, int max_turns, size_t max_bytes);
+int journal_enabled(void);
+/* Queue a finished turn of session id; fresh: the session had no history before it
+   (new, or evicted and reused), so replay must start it over. */
+void journal_turn(const char *id, int fresh, const char *user, const char *answer);
+/* Write what was queued and sync if it is due; compacts when the file has grown.
+   Call once per loop round. */
+void journal_commit(void);
+/* Milliseconds until a deferred sync is due, for the loop's poll timeout; -1: none. */
+int journal_timeout_ms(void);
+/* Write and sync everything now. */
+void journal_sync(void);
+
+#endif
@@ -0,0 +1,152 @@
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *json_ws(const char *p) {
+  while (p && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+  return p;
+}
+
+static void put_utf8(buf_t *b, unsigned cp) {
+  char u[4];
+  size_t n;
+  if (cp < 0x80) { u[0] = (char)cp; n = 1; }
+  else if (cp < 0x800) { u[0] = (char)(0xC0 | (cp >> 6)); u[1] = (char)(0x80 | (cp & 0x3F)); n = 2; }
+  else if (cp < 0x10000) { u[0] = (char)(0xE0 | (cp >> 12)); u[1] = (char)(0x80 | ((cp >> 6) & 0x3F)); u[2] = (char)(0x80 | (cp & 0x3F)); n = 3; }
+  else { u[0] = (char)(0xF0 | (cp >> 18)); u[1] = (char)(0x80 | ((cp >> 12) & 0x3F)); u[2] = (char)(0x80 | ((cp >> 6) & 0x3F)); u[3] = (char)(0x80 | (cp & 0x3F)); n = 4; }
+  buf_append(b, u, n);
+}
+
+static int hex4(const char *p, unsigned *out) {
+  unsigned v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9') v |= (unsigned)(c - '0');
+    else if (c >= 'a' && c <= 'f') v |= (unsigned)(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F') v |= (unsigned)(c - 'A' + 10);
+    else return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+const char *json_string(const char *p, buf_t *out) {
+  if (!p || *p != '"') return NULL;
+  p++;
+  const char *run = p;
+  while (*p && *p != '"') {
+    if (*p != '\\') { p++; continue; }
+    if (out) buf_append(out, run, (size_t)(p - run));
+    char c = p[1];
+    if (c == 'u') {
+      unsigned cp, lo;
+      if (hex4(p + 2, &cp) != 0) return NULL;
+      p += 6;
+      if (cp >= 0xD800 && cp < 0xDC00 && p[0] == '\\' && p[1] == 'u' && hex4(p + 2, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        p += 6;
+      }
+      if (out) put_utf8(out, cp);
+    } else if (c) {
+      char d = c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c == 'b' ? '\b' : c == 'f' ? '\f' : c;
+      if (out) buf_append(out, &d, 1);
+      p += 2;
+    } else
+      return NULL;
+    run = p;
+  }
+  if (*p != '"') return NULL;
+  if (out) buf_append(out, run, (size_t)(p - run));
+  return p + 1;
+}
+
+const char *json_skip(const char *p) {
+  p = json_ws(p);
+  if (!p || !*p) return NULL;
+  if (*p == '"') return json_string(p, NULL);
+  if (*p == '{' || *p == '[') {
+    char close = *p == '{' ? '}' : ']';
+    p = json_ws(p + 1);
+    if (p && *p == close) return p + 1;
+    while (p && *p) {
+      if (close == '}') {
+        p = json_string(json_ws(p), NULL);
+        p = json_ws(p);
+        if (!p || *p != ':') return NULL;
+        p++;
+      }
+      p = json_ws(json_skip(p));
+      if (!p) return NULL;
+      if (*p == close) return p + 1;
+      if (*p != ',') return NULL;
+      p = json_ws(p + 1);
+    }
+    return NULL;
+  }
+  const char *start = p; /* number, true, false, null */
+  while (*p && !strchr(",}] \t\r\n", *p)) p++;
+  return p > start ? p : NULL;
+}
+
+const char *json_member(const char *obj, const char *key) {
+  const char *p = json_ws(obj);
+  if (!p || *p != '{') return NULL;
+  p = json_ws(p + 1);
+  size_t klen = strlen(key);
+  while (p && *p == '"') {
+    const char *k = p + 1;
+    const char *after = json_string(p, NULL);
+    if (!after) return NULL;
+    int match = (size_t)(after - 1 - k) == klen && memcmp(k, key, klen) == 0;
+    p = json_ws(after);
+    if (!p || *p != ':') return NULL;
+    p = json_ws(p + 1);
+    if (match) return p;
+    p = json_ws(json_skip(p));
+    if (!p || *p != ',') return NULL;
+    p = json_ws(p + 1);
+  }
+  return NULL;
+}
+
+const char *json_array_first(const char *arr) {
+  const char *p = json_ws(arr);
+  if (!p || *p != '[') return NULL;
+  p = json_ws(p + 1);
+  return (p && *p && *p != ']') ? p : NULL;
+}
+
+const char *json_array_next(const char *elem) {
+  const char *p = json_ws(json_skip(elem));
+  if (!p || *p != ',') return NULL;
+  return json_ws(p + 1);
+}
+
+int json_number(const char *p, double *out) {
+  char *end;
+  p = json_ws(p);
+  if (!p) return -1;
+  double v = strtod(p, &end);
+  if (end == p) return -1;
+  *out = v;
+  return 0;
+}
+
+int json_bool(const char *p, int *out) {
+  p = json_ws(p);
+  if (p && strncmp(p, "true", 4) == 0) { *out = 1; return 0; }
+  if (p && strncmp(p, "false", 5) == 0) { *out = 0; return 0; }
+  return -1;
+}
+
+int json_find_string(const char *p, const char *key, buf_t *out) {
+  char needle[64];
+  snprintf(needle, sizeof(needle), "\"%s\"", key);
+  p = strstr(p, needle);
+  if (!p) return -1;
+  p = json_ws(p + strlen(needle));
+  if (*p != ':') return -1;
+  return json_string(json_ws(p + 1), out) ? 0 : -1;
+}
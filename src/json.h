@@ -0,0 +1,23 @@
+#ifndef NEO_JSON_H
+#define NEO_JSON_H
+
+#include "buf.h"
+
+/* Just enough JSON for OpenAI-style payloads: walk values in place, decode strings.
+   Every function takes a pointer at (or before, for json_ws) a value and returns NULL
+   on malformed input. */
+
+const char *json_ws(const char *p);
+const char *json_skip(const char *p);                  /* past the value at p */
+const char *json_string(const char *p, buf_t *out);    /* decode the string literal at p */
+const char *json_member(const char *obj, const char *key); /* value of a top-level member */
+const char *json_array_first(const char *arr);         /* first element, NULL if empty */
+const char *json_array_next(const char *elem);         /* element after elem, NULL at the end */
+int json_number(const char *p, double *out);           /* 0 if p is a number */
+int json_bool(const char *p, int *out);                /* 0 if p is true/false */
+
+/* Decode the string value of the first "key" found at or after p by plain search (good
+   enough for provider responses); 0 if found and it is a string rather than null. */
+int json_find_string(const char *p, const char *key, buf_t *out);
+
+#endif
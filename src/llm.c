@@ -1,12 +1,33 @@
 #include "llm.h"
+#include "buf.h"
+#include "cache.h"
+#include "cassette.h"
+#include "json.h"
+#include "loop.h"
+#include "trace.h"
 #include <curl/curl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#ifdef NEO_LOWMEM
+#define POOL_CONNECTS 4L    /* idle upstream connections kept warm */
+#define RECV_BUFFER   4096L /* per transfer; curl's default is 16 KB */
+#else
+#define POOL_CONNECTS 64L
+#define RECV_BUFFER   0L
+#endif
+
+typedef struct {
+  llm_response_t *out;
+  cassette_rec_t *rec; /* --record: raw bytes and their arrival times */
+} sink_t;
+
 static size_t write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
-  llm_response_t *r = (llm_response_t *)userdata;
+  sink_t *sink = (sink_t *)userdata;
+  llm_response_t *r = sink->out;
   size_t total = size * nmemb;
   char *n = realloc(r->data, r->size + total + 1);
   if (!n) return 0;
@@ -14,90 +35,328 @@ static size_t write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
   memcpy(r->data + r->size, ptr, total);
   r->size += total;
   r->data[r->size] = '\0';
+  if (sink->rec) cassette_rec_add(sink->rec, ptr, total);
   return total;
 }
 
-static void json_escape(const char *in, char *out, size_t out_max) {
-  size_t j = 0;
-  for (; in && *in && j < out_max - 2; in++) {
-    if (*in == '\\' || *in == '"' || *in == '\n' || *in == '\r' || *in == '\t') {
-      if (j < out_max - 2) { out[j++] = '\\'; out[j++] = (*in == '\n') ? 'n' : (*in == '\r') ? 'r' : (*in == '\t') ? 't' : *in; }
-    } else
-      out[j++] = *in;
-  }
-  out[j] = '\0';
-}
-
 void llm_response_free(llm_response_t *r) {
   if (!r) return;
   free(r->data);
-  r->data = NULL;
-  r->size = 0;
+  free(r->thinking);
+  r->data = r->thinking = NULL;
+  r->size = r->thinking_size = 0;
+}
+
+/* Splits model output into answer and reasoning. Only a <think> that opens the output
+   counts (an answer that talks about the tag is left alone), and either tag may arrive
+   split across stream deltas. */
+typedef struct {
+  int state;     /* 0 before any text, 1 inside <think>, 2 answer */
+  int trim;      /* drop the blank lines between </think> and the answer */
+  char pend[8];  /* a tag seen only partly so far */
+  size_t pend_len;
+} think_filter_t;
+
+static void think_emit(think_filter_t *f, const char *p, size_t n, buf_t *answer, buf_t *thinking) {
+  if (f->state == 1) {
+    buf_append(thinking, p, n);
+    return;
+  }
+  if (f->trim || f->state == 0)
+    while (n && (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')) p++, n--;
+  if (!n) return;
+  f->trim = 0;
+  f->state = 2;
+  buf_append(answer, p, n);
+}
+
+static void think_feed(think_filter_t *f, const char *p, size_t n, buf_t *answer, buf_t *thinking) {
+  size_t i = 0;
+  while (i < n) {
+    const char *tag = f->state == 1 ? "</think>" : f->state == 0 ? "<think>" : NULL;
+    if (f->pend_len) {
+      if (p[i] == tag[f->pend_len]) {
+        f->pend[f->pend_len++] = p[i++];
+        if (tag[f->pend_len] == '\0') {
+          f->trim = f->state == 1;
+          f->state = f->state == 1 ? 2 : 1;
+          f->pend_len = 0;
+        }
+        continue;
+      }
+      size_t k = f->pend_len;
+      f->pend_len = 0;
+      think_emit(f, f->pend, k, answer, thinking);
+      continue;
+    }
+    if (tag && p[i] == '<') {
+      f->pend[f->pend_len++] = p[i++];
+      continue;
+    }
+    size_t j = i;
+    while (j < n && !(tag && p[j] == '<')) j++;
+    think_emit(f, p + i, j - i, answer, thinking);
+    i = j;
+  }
+}
+
+/* End of output: a tag prefix still pending was text after all. */
+static void think_flush(think_filter_t *f, buf_t *answer, buf_t *thinking) {
+  size_t k = f->pend_len;
+  f->pend_len = 0;
+  if (k) think_emit(f, f->pend, k, answer, thinking);
+}
+
+static double now_ms(void);
+
+static void timing_reset(llm_timing_t *t) {
+  memset(t, 0, sizeof(*t));
+  t->prompt_tokens = t->completion_tokens = t->cached_tokens = -1;
+}
+
+/* Network phases of the last transfer on curl. */
+static void read_curl_timing(CURL *curl, llm_timing_t *t) {
+  curl_off_t dns = 0, conn = 0, app = 0, pre = 0, start = 0, total = 0;
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &conn);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app);
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pre);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  t->new_connection = connects > 0;
+  if (t->new_connection) {
+    t->dns_ms = (double)dns / 1000.0;
+    t->connect_ms = conn > dns ? (double)(conn - dns) / 1000.0 : 0;
+    t->tls_ms = app > conn ? (double)(app - conn) / 1000.0 : 0;
+  }
+  t->ttfb_ms = start > pre ? (double)(start - pre) / 1000.0 : 0;
+  t->transfer_ms = total > start ? (double)(total - start) / 1000.0 : 0;
+  if (trace_on) { /* curl's offsets are from the start of the transfer, which ended just now */
+    uint64_t base = trace_now_us() - (uint64_t)total;
+    if (t->new_connection) {
+      trace_record("curl dns", base, (uint64_t)dns, NULL, 0);
+      if (conn > dns) trace_record("curl connect", base + (uint64_t)dns, (uint64_t)(conn - dns), NULL, 0);
+      if (app > conn) trace_record("curl tls", base + (uint64_t)conn, (uint64_t)(app - conn), NULL, 0);
+    }
+    if (start > pre) trace_record("curl ttfb", base + (uint64_t)pre, (uint64_t)(start - pre), NULL, 0);
+    if (total > start) trace_record("curl transfer", base + (uint64_t)start, (uint64_t)(total - start), NULL, 0);
+  }
+}
+
+/* Token counts from a "usage" object anywhere in json, if the provider sent one, and
+   the prompt tokens served from the server's cache: usage.prompt_tokens_details (OpenAI,
+   vLLM with --enable-prompt-tokens-details) or llama.cpp's own "timings". */
+static void read_usage(const char *json, llm_timing_t *t) {
+  double v;
+  const char *m, *u = strstr(json, "\"usage\"");
+  if (u && *(u = json_ws(u + 7)) == ':') {
+    u = json_ws(u + 1);
+    if ((m = json_member(u, "prompt_tokens")) && json_number(m, &v) == 0) t->prompt_tokens = (long)v;
+    if ((m = json_member(u, "completion_tokens")) && json_number(m, &v) == 0) t->completion_tokens = (long)v;
+    if ((m = json_member(u, "prompt_tokens_details")) && (m = json_member(m, "cached_tokens")) &&
+        json_number(m, &v) == 0)
+      t->cached_tokens = (long)v;
+  }
+  const char *tm = strstr(json, "\"timings\"");
+  if (tm && *(tm = json_ws(tm + 9)) == ':' && (m = json_member(json_ws(tm + 1), "cache_n")) &&
+      json_number(m, &v) == 0)
+    t->cached_tokens = (long)v;
 }
 
 static int extract_content_from_json(const char *json, llm_response_t *out) {
-  const char *needle = "\"content\":";
-  const char *p = strstr(json, needle);
-  if (!p) {
-    needle = "\"content\": ";
-    p = strstr(json, needle);
-  }
-  if (!p) return -1;
-  p = strchr(p + strlen(needle), '"');
-  if (!p) return -1;
-  p++;
-  const char *end = p;
-  while (*end && !(end[0] == '"' && end[-1] != '\\')) end++;
-  size_t len = (size_t)(end - p);
-  out->data = malloc(len + 1);
-  if (!out->data) return -1;
-  memcpy(out->data, p, len);
-  out->data[len] = '\0';
-  out->size = len;
-  for (char *q = out->data; *q; q++) {
-    if (q[0] == '\\' && (q[1] == 'n' || q[1] == 'r' || q[1] == 't' || q[1] == '"' || q[1] == '\\')) {
-      if (q[1] == 'n') *q = '\n'; else if (q[1] == 'r') *q = '\r'; else if (q[1] == 't') *q = '\t'; else *q = q[1];
-      memmove(q + 1, q + 2, strlen(q + 2) + 1);
+  buf_t raw = {0}, b = {0}, think = {0};
+  if (json_find_string(json, "content", &raw) != 0) {
+    buf_free(&raw);
+    return -1;
+  }
+  if (json_find_string(json, "reasoning_content", &think) != 0) json_find_string(json, "reasoning", &think);
+  think_filter_t f = {0};
+  think_feed(&f, raw.data ? raw.data : "", raw.len, &b, &think);
+  think_flush(&f, &b, &think);
+  buf_free(&raw);
+  if (buf_reserve(&b, 0) != 0) {
+    buf_free(&b);
+    buf_free(&think);
+    return -1;
+  }
+  out->data = b.data;
+  out->size = b.len;
+  out->thinking = think.len ? think.data : NULL;
+  out->thinking_size = think.len;
+  if (!think.len) buf_free(&think);
+  return 0;
+}
+
+static double now_ms(void) {
+  struct timespec ts; /* monotonic */
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+typedef struct {
+  llm_opts_t *opts;
+  double deadline; /* monotonic ms */
+} xfer_state_t;
+
+/* Progress callback; returning non-zero makes curl abort with CURLE_ABORTED_BY_CALLBACK. */
+static int xferinfo_cb(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  xfer_state_t *st = (xfer_state_t *)userdata;
+  (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+  if (st->opts->cancel_fd >= 0) {
+    /* POLLHUP is only raised once the peer closed both directions, so a client that
+       half-closes after sending its line (nc -N) is not mistaken for a hangup. */
+    struct pollfd pfd = { st->opts->cancel_fd, 0, 0 };
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR))) {
+      st->opts->aborted = LLM_ABORT_HANGUP;
+      return 1;
     }
   }
+  if (now_ms() >= st->deadline) {
+    st->opts->aborted = LLM_ABORT_DEADLINE;
+    return 1;
+  }
   return 0;
 }
 
-static int do_request(CURL *curl, const char *body, llm_response_t *out, long *http_code) {
+static int do_request(CURL *curl, const char *body, uint64_t key, llm_response_t *out, long *http_code) {
   out->data = NULL;
   out->size = 0;
+  cassette_rec_t rec;
+  sink_t sink = { out, cassette_mode() == CASSETTE_RECORD ? &rec : NULL };
+  if (sink.rec) cassette_rec_begin(sink.rec);
   curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, out);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
   CURLcode res = curl_easy_perform(curl);
-  if (res != CURLE_OK) return -1;
+  if (res != CURLE_OK) {
+    if (sink.rec) cassette_rec_free(sink.rec);
+    return -1;
+  }
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+  if (sink.rec) cassette_rec_end(sink.rec, key, *http_code);
   return 0;
 }
 
-int llm_chat(const char *base_url, const char *model, const char *api_key,
-             int max_tokens, double temperature,
-             const char *system_prompt, const char *user_message,
-             llm_response_t *out) {
-  out->data = NULL;
-  out->size = 0;
+static void sleep_ms(double ms) {
+  if (ms <= 0) return;
+  struct timespec ts = { (time_t)(ms / 1000.0), (long)((ms - (double)(long)(ms / 1000.0) * 1000.0) * 1e6) };
+  while (nanosleep(&ts, &ts) != 0) {}
+}
+
+/* Recorded TTFB and transfer time of a cassette entry. */
+static void replay_timing(const cassette_entry_t *e, llm_timing_t *t) {
+  if (e->n_segs == 0) return;
+  t->ttfb_ms = e->segs[0].at_us / 1000.0;
+  t->transfer_ms = (e->segs[e->n_segs - 1].at_us - e->segs[0].at_us) / 1000.0;
+}
+
+/* --replay: answer from the cassette instead of the provider. */
+static int replay_sync(uint64_t key, llm_opts_t *opts, long timeout_ms, llm_response_t *out, long *code) {
+  cassette_entry_t e;
+  if (cassette_find(key, &e) != 0) {
+    fprintf(stderr, "neo: cassette has no recording of this request\n");
+    return -1;
+  }
+  if (cassette_realtime() && e.n_segs) {
+    double took = e.segs[e.n_segs - 1].at_us / 1000.0;
+    if (took > (double)timeout_ms) {
+      sleep_ms((double)timeout_ms);
+      opts->aborted = LLM_ABORT_DEADLINE;
+      return -1;
+    }
+    sleep_ms(took);
+  }
+  out->data = malloc(e.len + 1);
+  if (!out->data) return -1;
+  memcpy(out->data, e.data, e.len);
+  out->data[e.len] = '\0';
+  out->size = e.len;
+  *code = e.status;
+  replay_timing(&e, &opts->timing);
+  return 0;
+}
 
+/* Reasoning switches. OpenRouter takes its own "reasoning" object; everything else gets
+   Qwen3's enable_thinking both top-level (DashScope, SGLang) and as a chat template
+   argument (vLLM, llama.cpp server), which servers without the feature ignore. */
+static void put_reasoning(buf_t *b, const llm_request_t *req) {
+  int off = req->thinking == LLM_THINK_OFF;
+  if (req->base_url && strstr(req->base_url, "openrouter.ai")) {
+    if (off) buf_puts(b, ",\"reasoning\":{\"enabled\":false}");
+    else if (req->think_budget > 0) buf_printf(b, ",\"reasoning\":{\"max_tokens\":%d}", req->think_budget);
+    else if (req->thinking == LLM_THINK_ON) buf_puts(b, ",\"reasoning\":{\"enabled\":true}");
+    return;
+  }
+  if (req->thinking != LLM_THINK_DEFAULT)
+    buf_printf(b, ",\"enable_thinking\":%s,\"chat_template_kwargs\":{\"enable_thinking\":%s}",
+               off ? "false" : "true", off ? "false" : "true");
+  if (req->think_budget > 0 && !off) buf_printf(b, ",\"thinking_budget\":%d", req->think_budget);
+}
+
+/* Prompt cache steering for local servers. llama.cpp keeps one KV cache per slot and,
+   with cache_prompt, prefills only what follows the longest prefix it shares with the
+   slot's last prompt; id_slot sends every turn of a conversation to the same slot.
+   vLLM's prefix cache needs no switch; "user" names the conversation for a session-aware
+   router in front of it. */
+static void put_cache(buf_t *b, const llm_request_t *req) {
+  if (req->backend == LLM_BACKEND_LLAMACPP) {
+    buf_puts(b, ",\"cache_prompt\":true");
+    if (req->cache_key && req->slots > 0)
+      buf_printf(b, ",\"id_slot\":%d", (int)(cache_hash_str(CACHE_HASH_INIT, req->cache_key) % (uint64_t)req->slots));
+  } else if (req->backend == LLM_BACKEND_VLLM && req->cache_key && *req->cache_key) {
+    buf_puts(b, ",\"user\":\"");
+    buf_json_escape(b, req->cache_key);
+    buf_puts(b, "\"");
+  }
+}
+
+/* JSON body for /chat/completions: system prompt, then the messages in order. */
+static int build_chat_body(buf_t *b, const llm_request_t *req, int stream) {
+  int max_tokens = req->max_tokens;
+  double temperature = req->temperature;
   if (max_tokens <= 0) max_tokens = 4096;
   if (max_tokens > 16384) max_tokens = 16384; /* cap to avoid provider 502 */
   if (temperature < 0.0 || temperature > 2.0) temperature = 0.7;
+  buf_puts(b, "{\"model\":\"");
+  buf_json_escape(b, req->model ? req->model : "qwen3:8b");
+  buf_puts(b, "\",\"messages\":[{\"role\":\"system\",\"content\":\"");
+  buf_json_escape(b, req->system_prompt ? req->system_prompt : "");
+  buf_puts(b, "\"}");
+  int n = 0;
+  while (n < req->n_messages && req->messages[n].role && req->messages[n].content) n++;
+  for (int i = 0; i < n; i++) {
+    const char *role = strcmp(req->messages[i].role, "assistant") == 0 ? "assistant" : "user";
+    buf_printf(b, ",{\"role\":\"%s\",\"content\":\"", role);
+    buf_json_escape(b, req->messages[i].content);
+    /* Qwen3 soft switch, for servers that ignore enable_thinking. A caching backend gets
+       it on every user turn, so the history reads the same on the next turn. */
+    if ((i == n - 1 || req->backend >= LLM_BACKEND_LLAMACPP) && req->no_think && req->thinking == LLM_THINK_OFF &&
+        strcmp(role, "user") == 0)
+      buf_puts(b, " /no_think");
+    buf_puts(b, "\"}");
+  }
+  buf_printf(b, "],\"max_tokens\":%d,\"temperature\":%.2f", max_tokens, temperature);
+  put_reasoning(b, req);
+  put_cache(b, req);
+  buf_printf(b, "%s}", stream ? ",\"stream\":true,\"stream_options\":{\"include_usage\":true}" : "");
+  return b->data ? 0 : -1;
+}
 
-  char sys_esc[65536];
-  char usr_esc[32768];
-  json_escape(system_prompt ? system_prompt : "", sys_esc, sizeof(sys_esc));
-  json_escape(user_message ? user_message : "", usr_esc, sizeof(usr_esc));
+/* POST body to base_url/chat/completions, retrying once on 429/5xx. The whole exchange is
+   bounded by opts->timeout_ms and cut short when opts->cancel_fd hangs up. */
+static int perform_chat(const char *base_url, const char *api_key, const char *body,
+                        llm_opts_t *opts, llm_response_t *out, long *code) {
+  llm_opts_t defaults = { .timeout_ms = 0, .cancel_fd = -1 };
+  if (!opts) opts = &defaults;
+  opts->aborted = LLM_ABORT_NONE;
+  long timeout_ms = opts->timeout_ms > 0 ? opts->timeout_ms : 120000L;
+  xfer_state_t st = { opts, now_ms() + (double)timeout_ms };
 
   char url[1024];
   snprintf(url, sizeof(url), "%s/chat/completions", base_url);
-
-  char body[128 * 1024];
-  int n = snprintf(body, sizeof(body),
-    "{\"model\":\"%s\",\"messages\":[{\"role\":\"system\",\"content\":\"%s\"},{\"role\":\"user\",\"content\":\"%s\"}],\"max_tokens\":%d,\"temperature\":%.2f}",
-    model ? model : "qwen3:8b", sys_esc, usr_esc, max_tokens, temperature);
-  if (n < 0 || (size_t)n >= sizeof(body)) return -1;
+  uint64_t key = cassette_mode() != CASSETTE_OFF ? cassette_key(url, body) : 0;
+  if (cassette_mode() == CASSETTE_REPLAY) return replay_sync(key, opts, timeout_ms, out, code);
 
   CURL *curl = curl_easy_init();
   if (!curl) return -1;
@@ -113,114 +372,618 @@ int llm_chat(const char *base_url, const char *model, const char *api_key,
   curl_easy_setopt(curl, CURLOPT_URL, url);
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
-
-  long code = 0;
-  int err = do_request(curl, body, out, &code);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_cb);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &st);
+  if (RECV_BUFFER) curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, RECV_BUFFER);
 
-  if (err == 0 && (code == 429 || code == 503 || (code >= 500 && code < 600))) {
+  int err = do_request(curl, body, key, out, code);
+  if (err == 0 && (*code == 429 || *code == 503 || (*code >= 500 && *code < 600))
+      && st.deadline - now_ms() > 1500.0) {
     llm_response_free(out);
     struct timespec ts = { 1, 0 };
     nanosleep(&ts, NULL);
-    err = do_request(curl, body, out, &code);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)(st.deadline - now_ms()));
+    err = do_request(curl, body, key, out, code);
   }
+  if (err != 0 && opts->aborted == LLM_ABORT_NONE && now_ms() >= st.deadline)
+    opts->aborted = LLM_ABORT_DEADLINE; /* CURLOPT_TIMEOUT fired before the callback did */
+  read_curl_timing(curl, &opts->timing);
 
   curl_slist_free_all(headers);
   curl_easy_cleanup(curl);
+  return err;
+}
 
-  if (err != 0) {
-    llm_response_free(out);
+/* Single-turn convenience wrapper; the body is built in a growable buffer, so neither
+   prompt is truncated. */
+int llm_chat(const char *base_url, const char *model, const char *api_key,
+             int max_tokens, double temperature,
+             const char *system_prompt, const char *user_message,
+             llm_response_t *out) {
+  llm_message_t msg = { "user", user_message ? user_message : "" };
+  return llm_chat_messages_ex(base_url, model, api_key, max_tokens, temperature,
+                              system_prompt, &msg, 1, NULL, out);
+}
+
+int llm_chat_messages(const char *base_url, const char *model, const char *api_key,
+                      int max_tokens, double temperature,
+                      const char *system_prompt,
+                      const llm_message_t *messages, int n_messages,
+                      llm_response_t *out) {
+  return llm_chat_messages_ex(base_url, model, api_key, max_tokens, temperature,
+                              system_prompt, messages, n_messages, NULL, out);
+}
+
+int llm_chat_messages_ex(const char *base_url, const char *model, const char *api_key,
+                         int max_tokens, double temperature,
+                         const char *system_prompt,
+                         const llm_message_t *messages, int n_messages,
+                         llm_opts_t *opts, llm_response_t *out) {
+  llm_request_t req = { base_url, model, api_key, max_tokens, temperature, system_prompt, messages, n_messages,
+                        LLM_THINK_DEFAULT, 0, 0, LLM_BACKEND_DEFAULT, NULL, 0 };
+  return llm_chat_request(&req, opts, out);
+}
+
+int llm_chat_request(const llm_request_t *req, llm_opts_t *opts, llm_response_t *out) {
+  memset(out, 0, sizeof(*out));
+  llm_opts_t defaults = { .timeout_ms = 0, .cancel_fd = -1 };
+  if (!opts) opts = &defaults;
+  timing_reset(&opts->timing);
+  const char *base_url = req->base_url, *api_key = req->api_key;
+  buf_t body = {0};
+  uint64_t span = trace_begin();
+  double t0 = now_ms();
+  if (build_chat_body(&body, req, 0) != 0) {
+    buf_free(&body);
     return -1;
   }
-  if (code != 200) {
+  double encode_ms = now_ms() - t0;
+  trace_end("encode", span, "bytes", (long)body.len);
+
+  long code = 0;
+  int err = perform_chat(base_url, api_key, body.data, opts, out, &code);
+  opts->timing.encode_ms = encode_ms;
+  buf_free(&body);
+
+  if (err != 0 || code != 200) {
     if (out->data && out->size) fprintf(stderr, "neo: LLM HTTP %ld: %.*s\n", code, (int)(out->size > 512 ? 512 : out->size), out->data);
     llm_response_free(out);
+    trace_end("llm_chat_messages", span, "status", code);
     return -1;
   }
   if (!out->data) { llm_response_free(out); return -1; }
+  uint64_t tr = trace_begin();
+  t0 = now_ms();
+  read_usage(out->data, &opts->timing);
   llm_response_t extracted = {0};
   if (extract_content_from_json(out->data, &extracted) == 0) {
     llm_response_free(out);
     *out = extracted;
   }
+  opts->timing.parse_ms = now_ms() - t0;
+  trace_end("parse", tr, "bytes", (long)out->size);
+  trace_end("llm_chat_messages", span, "status", code);
   return 0;
 }
 
-int llm_chat_messages(const char *base_url, const char *model, const char *api_key,
-                      int max_tokens, double temperature,
-                      const char *system_prompt,
-                      const llm_message_t *messages, int n_messages,
-                      llm_response_t *out) {
-  out->data = NULL;
-  out->size = 0;
-  if (max_tokens <= 0) max_tokens = 4096;
-  if (max_tokens > 16384) max_tokens = 16384;
-  if (temperature < 0.0 || temperature > 2.0) temperature = 0.7;
+/* ---- Streaming requests on a shared curl multi handle, driven by the event loop ---- */
+
+struct llm_stream {
+  CURL *easy;
+  struct curl_slist *headers;
+  buf_t body;     /* request body; POSTFIELDS does not copy it */
+  buf_t line;     /* partial SSE line */
+  buf_t content;  /* answer so far */
+  buf_t thinking; /* reasoning held back from the answer */
+  think_filter_t think;
+  buf_t raw;      /* non-SSE bytes: error bodies or servers that ignore "stream" */
+  int sse;
+  llm_timing_t timing;
+  uint64_t trace_start;
+  uint64_t key;             /* cassette key of the request */
+  cassette_rec_t rec;       /* --record: this attempt's raw bytes */
+  int recording;
+  cassette_entry_t replay;  /* --replay: the recorded response being played back */
+  int replaying;
+  int replay_seg;           /* next segment to deliver */
+  double replay_t0;
+  int retried;
+  int in_multi;
+  int borrowed;   /* easy belongs to the caller (llm_chat_stream) */
+  int probe;      /* llm_probe_start: no body, no answer, not recorded */
+  double deadline;
+  double retry_at;
+  llm_chunk_fn on_chunk;
+  llm_done_fn on_done;
+  void *user;
+  struct llm_stream *next_retry;
+};
+
+static CURLM *multi;
+static double multi_timer_at = -1; /* from CURLMOPT_TIMERFUNCTION, monotonic ms */
+static llm_stream_t *retry_list;
+
+static void process_done(void);
+
+static void on_curl_fd(int fd, int revents, void *user) {
+  (void)user;
+  int action = 0;
+  if (revents & (POLLIN | POLLHUP)) action |= CURL_CSELECT_IN;
+  if (revents & POLLOUT) action |= CURL_CSELECT_OUT;
+  if (revents & POLLERR) action |= CURL_CSELECT_ERR;
+  int running;
+  curl_multi_socket_action(multi, fd, action, &running);
+  process_done();
+}
 
-  char sys_esc[65536];
-  json_escape(system_prompt ? system_prompt : "", sys_esc, sizeof(sys_esc));
+static int socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+  (void)easy; (void)userp; (void)socketp;
+  if (what == CURL_POLL_REMOVE) {
+    loop_unwatch(s);
+    return 0;
+  }
+  int events = 0;
+  if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) events |= POLLIN;
+  if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) events |= POLLOUT;
+  loop_watch(s, events, on_curl_fd, NULL);
+  return 0;
+}
 
-  static char body_buf[512 * 1024];
-  int off = snprintf(body_buf, sizeof(body_buf),
-    "{\"model\":\"%s\",\"messages\":[{\"role\":\"system\",\"content\":\"%s\"}",
-    model ? model : "qwen3:8b", sys_esc);
-  if (off < 0 || off >= (int)sizeof(body_buf)) return -1;
+static int timer_cb(CURLM *m, long timeout_ms, void *userp) {
+  (void)m; (void)userp;
+  multi_timer_at = timeout_ms < 0 ? -1 : now_ms() + (double)timeout_ms;
+  return 0;
+}
+
+/* Answer text through the think filter; only what is left goes to on_chunk. */
+static void stream_text(llm_stream_t *st, const char *p, size_t n) {
+  size_t before = st->content.len;
+  if (p) think_feed(&st->think, p, n, &st->content, &st->thinking);
+  else think_flush(&st->think, &st->content, &st->thinking);
+  if (st->content.len > before && st->on_chunk)
+    st->on_chunk(st->user, st->content.data + before, st->content.len - before);
+}
 
-  char esc_buf[32768];
-  for (int i = 0; i < n_messages && messages[i].role && messages[i].content; i++) {
-    json_escape(messages[i].content, esc_buf, sizeof(esc_buf));
-    const char *role = (messages[i].role && strcmp(messages[i].role, "assistant") == 0) ? "assistant" : "user";
-    int n = snprintf(body_buf + off, (size_t)(sizeof(body_buf) - off),
-      ",{\"role\":\"%s\",\"content\":\"%s\"}", role, esc_buf);
-    if (n < 0 || off + n >= (int)sizeof(body_buf)) break;
-    off += n;
+/* Handle one complete SSE line: "data: {...delta...}" carries the next piece of text. */
+static void stream_line(llm_stream_t *st, char *line, size_t len) {
+  if (len && line[len - 1] == '\r') line[--len] = '\0';
+  if (strncmp(line, "data:", 5) != 0) {
+    if (len && line[0] != ':' && strncmp(line, "event:", 6) != 0 && strncmp(line, "id:", 3) != 0) {
+      buf_append(&st->raw, line, len);
+      buf_append(&st->raw, "\n", 1);
+    }
+    return;
   }
-  int nn = snprintf(body_buf + off, (size_t)(sizeof(body_buf) - off),
-    "],\"max_tokens\":%d,\"temperature\":%.2f}", max_tokens, temperature);
-  if (nn < 0 || off + nn >= (int)sizeof(body_buf)) return -1;
+  const char *p = line + 5;
+  while (*p == ' ') p++;
+  st->sse = 1;
+  if (strcmp(p, "[DONE]") == 0) return;
+  read_usage(p, &st->timing);
+  const char *delta = strstr(p, "\"delta\"");
+  if (!delta) return;
+  buf_t piece = {0};
+  if (json_find_string(delta, "reasoning_content", &piece) == 0 || json_find_string(delta, "reasoning", &piece) == 0)
+    buf_append(&st->thinking, piece.data, piece.len);
+  piece.len = 0;
+  if (json_find_string(delta, "content", &piece) == 0 && piece.len > 0) stream_text(st, piece.data, piece.len);
+  buf_free(&piece);
+}
 
-  CURL *curl = curl_easy_init();
-  if (!curl) return -1;
+static long stream_status(llm_stream_t *st) {
+  long code = 0;
+  if (st->replaying) return st->replay.status;
+  curl_easy_getinfo(st->easy, CURLINFO_RESPONSE_CODE, &code);
+  return code;
+}
 
-  char url[1024];
-  snprintf(url, sizeof(url), "%s/chat/completions", base_url);
+static size_t stream_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+  llm_stream_t *st = (llm_stream_t *)userdata;
+  size_t total = size * nmemb;
+  if (st->recording) cassette_rec_add(&st->rec, ptr, total);
+  long code = stream_status(st);
+  if (code != 200) { /* keep error bodies verbatim for the log */
+    buf_append(&st->raw, ptr, total);
+    return total;
+  }
+  if (buf_append(&st->line, ptr, total) != 0) return 0;
+  double t0 = now_ms();
+  char *nl;
+  while ((nl = memchr(st->line.data, '\n', st->line.len)) != NULL) {
+    *nl = '\0';
+    stream_line(st, st->line.data, (size_t)(nl - st->line.data));
+    buf_consume(&st->line, (size_t)(nl - st->line.data) + 1);
+  }
+  st->timing.parse_ms += now_ms() - t0; /* includes on_chunk, which only queues output */
+  return total;
+}
 
-  struct curl_slist *headers = NULL;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
+static void stream_clear(llm_stream_t *st) {
+  if (st->in_multi) curl_multi_remove_handle(multi, st->easy);
+  if (!st->borrowed) curl_easy_cleanup(st->easy);
+  curl_slist_free_all(st->headers);
+  buf_free(&st->body);
+  buf_free(&st->line);
+  buf_free(&st->content);
+  buf_free(&st->thinking);
+  buf_free(&st->raw);
+  if (st->recording) cassette_rec_free(&st->rec);
+}
+
+static void stream_free(llm_stream_t *st) {
+  stream_clear(st);
+  free(st);
+}
+
+/* Request options for st's easy handle, once st->body is built. */
+static void stream_setup(llm_stream_t *st, const char *url, const char *api_key) {
+  st->headers = curl_slist_append(st->headers, "Content-Type: application/json");
   if (api_key && api_key[0]) {
     char auth[1024];
     snprintf(auth, sizeof(auth), "Authorization: Bearer %s", api_key);
-    headers = curl_slist_append(headers, auth);
+    st->headers = curl_slist_append(st->headers, auth);
   }
+  curl_easy_setopt(st->easy, CURLOPT_URL, url);
+  curl_easy_setopt(st->easy, CURLOPT_HTTPHEADER, st->headers);
+  curl_easy_setopt(st->easy, CURLOPT_POSTFIELDS, st->body.data);
+  curl_easy_setopt(st->easy, CURLOPT_POSTFIELDSIZE, (long)st->body.len);
+  curl_easy_setopt(st->easy, CURLOPT_WRITEFUNCTION, stream_write_cb);
+  curl_easy_setopt(st->easy, CURLOPT_WRITEDATA, st);
+  curl_easy_setopt(st->easy, CURLOPT_PRIVATE, st);
+  curl_easy_setopt(st->easy, CURLOPT_NOSIGNAL, 1L);
+  if (RECV_BUFFER) curl_easy_setopt(st->easy, CURLOPT_BUFFERSIZE, RECV_BUFFER);
+}
 
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body_buf);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, out);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+/* 1 when a finished attempt should be tried once more: the provider was busy and
+   nothing has been streamed yet. */
+static int stream_should_retry(llm_stream_t *st, CURLcode res, long code) {
+  return !st->replaying && res == CURLE_OK && (code == 429 || code == 503 || (code >= 500 && code < 600))
+         && !st->retried && st->content.len == 0 && st->deadline - now_ms() > 1500.0;
+}
 
-  long code = 0;
-  int err = do_request(curl, body_buf, out, &code);
-  if (err == 0 && (code == 429 || code == 503 || (code >= 500 && code < 600))) {
-    llm_response_free(out);
-    struct timespec ts = { 1, 0 };
-    nanosleep(&ts, NULL);
-    err = do_request(curl, body_buf, out, &code);
+/* Last piece of the answer and the outcome of the final attempt into r. */
+static void stream_result(llm_stream_t *st, CURLcode res, long code, llm_result_t *r) {
+  if (st->line.len > 0) stream_line(st, st->line.data, st->line.len); /* unterminated last line */
+  stream_text(st, NULL, 0);
+  *r = (llm_result_t){ 0, LLM_ABORT_NONE, code, NULL, 0, st->timing, "", 0 };
+  if (st->replaying) replay_timing(&st->replay, &r->timing);
+  else read_curl_timing(st->easy, &r->timing);
+  if (res != CURLE_OK) {
+    r->err = -1;
+    if (res == CURLE_OPERATION_TIMEDOUT) r->aborted = LLM_ABORT_DEADLINE;
+    else if (res != CURLE_ABORTED_BY_CALLBACK) fprintf(stderr, "neo: LLM request failed: %s\n", curl_easy_strerror(res));
+  } else if (code != 200) {
+    r->err = -1;
+    if (st->raw.len) fprintf(stderr, "neo: LLM HTTP %ld: %.*s\n", code, (int)(st->raw.len > 512 ? 512 : st->raw.len), st->raw.data);
+  } else if (!st->sse && st->raw.len) {
+    llm_response_t whole = {0};
+    read_usage(st->raw.data, &r->timing);
+    if (extract_content_from_json(st->raw.data, &whole) == 0) {
+      buf_append(&st->content, whole.data, whole.size);
+      if (whole.thinking) buf_append(&st->thinking, whole.thinking, whole.thinking_size);
+      if (st->on_chunk && whole.size) st->on_chunk(st->user, whole.data, whole.size);
+    }
+    llm_response_free(&whole);
   }
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
+  if (r->err == 0 && st->content.len == 0) r->err = -1;
+  r->content = st->content.data ? st->content.data : "";
+  r->len = st->content.len;
+  r->thinking = st->thinking.data ? st->thinking.data : "";
+  r->thinking_len = st->thinking.len;
+}
 
-  if (err != 0 || code != 200) {
-    if (out->data && out->size) fprintf(stderr, "neo: LLM HTTP %ld: %.*s\n", code, (int)(out->size > 512 ? 512 : out->size), out->data);
-    llm_response_free(out);
-    return -1;
+static int stream_submit(llm_stream_t *st) {
+  long left = (long)(st->deadline - now_ms());
+  if (left < 1) left = 1;
+  curl_easy_setopt(st->easy, CURLOPT_TIMEOUT_MS, left);
+  if (curl_multi_add_handle(multi, st->easy) != CURLM_OK) return -1;
+  st->in_multi = 1;
+  if (cassette_mode() == CASSETTE_RECORD && !st->probe) {
+    if (st->recording) cassette_rec_free(&st->rec);
+    cassette_rec_begin(&st->rec);
+    st->recording = 1;
   }
-  if (!out->data) { llm_response_free(out); return -1; }
-  llm_response_t extracted = {0};
-  if (extract_content_from_json(out->data, &extracted) == 0) {
-    llm_response_free(out);
-    *out = extracted;
+  return 0;
+}
+
+static void stream_finish(llm_stream_t *st, CURLcode res) {
+  long code = stream_status(st);
+  if (st->in_multi) curl_multi_remove_handle(multi, st->easy);
+  st->in_multi = 0;
+  if (st->recording) {
+    if (res == CURLE_OK) cassette_rec_end(&st->rec, st->key, code);
+    else cassette_rec_free(&st->rec);
+    st->recording = 0;
   }
+  if (st->probe) {
+    llm_result_t r = { res == CURLE_OK ? 0 : -1, res == CURLE_OPERATION_TIMEDOUT ? LLM_ABORT_DEADLINE : LLM_ABORT_NONE,
+                       code, "", 0, st->timing, "", 0 };
+    read_curl_timing(st->easy, &r.timing);
+    trace_end("llm_probe", st->trace_start, "status", code);
+    if (st->on_done) st->on_done(st->user, &r);
+    stream_free(st);
+    return;
+  }
+  if (stream_should_retry(st, res, code)) {
+    st->retried = 1;
+    st->retry_at = now_ms() + 1000.0;
+    st->line.len = st->raw.len = st->thinking.len = 0;
+    st->next_retry = retry_list;
+    retry_list = st;
+    return;
+  }
+  llm_result_t r;
+  stream_result(st, res, code, &r);
+  trace_end("llm_stream", st->trace_start, "status", code);
+  if (st->on_done) st->on_done(st->user, &r);
+  stream_free(st);
+}
+
+static void process_done(void) {
+  CURLMsg *msg;
+  int q;
+  while ((msg = curl_multi_info_read(multi, &q)) != NULL) {
+    if (msg->msg != CURLMSG_DONE) continue;
+    llm_stream_t *st = NULL;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&st);
+    if (st) stream_finish(st, msg->data.result);
+  }
+}
+
+static int multi_init(void) {
+  if (multi) return 0;
+  multi = curl_multi_init();
+  if (!multi) return -1;
+  curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_cb);
+  curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_cb);
+  curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, POOL_CONNECTS); /* keep upstream connections warm across requests */
   return 0;
 }
+
+llm_stream_t *llm_stream_start(const llm_request_t *req, long timeout_ms,
+                               llm_chunk_fn on_chunk, llm_done_fn on_done, void *user) {
+  if (multi_init() != 0) return NULL;
+  llm_stream_t *st = calloc(1, sizeof(*st));
+  if (!st) return NULL;
+  timing_reset(&st->timing);
+  st->trace_start = trace_begin();
+  double t0 = now_ms();
+  st->easy = curl_easy_init();
+  if (!st->easy || build_chat_body(&st->body, req, 1) != 0) {
+    if (st->easy) curl_easy_cleanup(st->easy);
+    buf_free(&st->body);
+    free(st);
+    return NULL;
+  }
+  st->timing.encode_ms = now_ms() - t0;
+  trace_end("encode", st->trace_start, "bytes", (long)st->body.len);
+  st->on_chunk = on_chunk;
+  st->on_done = on_done;
+  st->user = user;
+  st->deadline = now_ms() + (double)(timeout_ms > 0 ? timeout_ms : 120000L);
+
+  char url[1024];
+  snprintf(url, sizeof(url), "%s/chat/completions", req->base_url);
+  if (cassette_mode() != CASSETTE_OFF) st->key = cassette_key(url, st->body.data);
+  if (cassette_mode() == CASSETTE_REPLAY) { /* played back from llm_async_tick, never from here */
+    if (cassette_find(st->key, &st->replay) != 0) {
+      fprintf(stderr, "neo: cassette has no recording of this request\n");
+      stream_free(st);
+      return NULL;
+    }
+    st->replaying = 1;
+    st->replay_t0 = now_ms();
+    st->retry_at = st->replay_t0;
+    st->next_retry = retry_list;
+    retry_list = st;
+    return st;
+  }
+  stream_setup(st, url, req->api_key);
+  if (stream_submit(st) != 0) {
+    stream_free(st);
+    return NULL;
+  }
+  return st;
+}
+
+llm_stream_t *llm_probe_start(const char *base_url, const char *api_key, long timeout_ms, llm_done_fn on_done,
+                              void *user) {
+  if (!base_url || cassette_mode() == CASSETTE_REPLAY || multi_init() != 0) return NULL;
+  llm_stream_t *st = calloc(1, sizeof(*st));
+  if (!st) return NULL;
+  timing_reset(&st->timing);
+  st->trace_start = trace_begin();
+  st->probe = 1;
+  st->on_done = on_done;
+  st->user = user;
+  st->deadline = now_ms() + (double)(timeout_ms > 0 ? timeout_ms : 5000L);
+  if (!(st->easy = curl_easy_init())) {
+    free(st);
+    return NULL;
+  }
+  char url[1024];
+  snprintf(url, sizeof(url), "%s/models", base_url);
+  stream_setup(st, url, api_key);
+  curl_easy_setopt(st->easy, CURLOPT_NOBODY, 1L); /* HEAD: OpenRouter's model list alone is megabytes */
+  if (stream_submit(st) != 0) {
+    stream_free(st);
+    return NULL;
+  }
+  return st;
+}
+
+void llm_stream_cancel(llm_stream_t *st) {
+  if (!st) return;
+  for (llm_stream_t **pp = &retry_list; *pp; pp = &(*pp)->next_retry)
+    if (*pp == st) { *pp = st->next_retry; break; }
+  stream_free(st);
+}
+
+/* Deliver the recorded segments that are due (all of them unless --realtime), then
+   either wait for the next one or finish the stream. */
+static void replay_step(llm_stream_t *st, double now) {
+  if (now >= st->deadline) {
+    stream_finish(st, CURLE_OPERATION_TIMEDOUT);
+    return;
+  }
+  const cassette_entry_t *e = &st->replay;
+  size_t off = 0;
+  for (int i = 0; i < st->replay_seg; i++) off += e->segs[i].len;
+  while (st->replay_seg < e->n_segs) {
+    const cassette_seg_t *seg = &e->segs[st->replay_seg];
+    double at = st->replay_t0 + seg->at_us / 1000.0;
+    if (cassette_realtime() && at > now) {
+      st->retry_at = at;
+      st->next_retry = retry_list;
+      retry_list = st;
+      return;
+    }
+    stream_write_cb((char *)e->data + off, 1, seg->len, st);
+    off += seg->len;
+    st->replay_seg++;
+  }
+  stream_finish(st, CURLE_OK);
+}
+
+int llm_async_timeout_ms(void) {
+  double next = multi_timer_at;
+  for (llm_stream_t *st = retry_list; st; st = st->next_retry)
+    if (next < 0 || st->retry_at < next) next = st->retry_at;
+  if (next < 0) return -1;
+  double left = next - now_ms();
+  return left <= 0 ? 0 : (int)left + 1;
+}
+
+void llm_async_tick(void) {
+  if (!multi) return;
+  double now = now_ms();
+  if (multi_timer_at >= 0 && now >= multi_timer_at) {
+    int running;
+    multi_timer_at = -1;
+    curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  }
+  llm_stream_t **pp = &retry_list;
+  while (*pp) {
+    llm_stream_t *st = *pp;
+    if (st->retry_at > now) { pp = &st->next_retry; continue; }
+    *pp = st->next_retry;
+    if (st->replaying) {
+      replay_step(st, now);
+      continue;
+    }
+    if (stream_submit(st) != 0) {
+      llm_result_t r = { -1, LLM_ABORT_NONE, 0, "", 0, st->timing, "", 0 };
+      if (st->on_done) st->on_done(st->user, &r);
+      stream_free(st);
+    }
+  }
+  process_done();
+}
+
+/* ---- The same streamed request run to the end on the calling thread ---- */
+
+/* --replay: the recorded segments through the usual parser, spaced as recorded with
+   --realtime (up to the deadline). */
+static CURLcode replay_blocking(llm_stream_t *st) {
+  const cassette_entry_t *e = &st->replay;
+  double t0 = now_ms();
+  size_t off = 0;
+  for (int i = 0; i < e->n_segs; i++) {
+    double at = t0 + e->segs[i].at_us / 1000.0;
+    if (cassette_realtime() && at > st->deadline) {
+      sleep_ms(st->deadline - now_ms());
+      return CURLE_OPERATION_TIMEDOUT;
+    }
+    if (cassette_realtime()) sleep_ms(at - now_ms());
+    stream_write_cb((char *)e->data + off, 1, e->segs[i].len, st);
+    off += e->segs[i].len;
+  }
+  return CURLE_OK;
+}
+
+int llm_chat_stream(const llm_request_t *req, llm_opts_t *opts, void *curl,
+                    llm_chunk_fn on_chunk, void *user, llm_response_t *out) {
+  memset(out, 0, sizeof(*out));
+  llm_opts_t defaults = { .timeout_ms = 0, .cancel_fd = -1 };
+  if (!opts) opts = &defaults;
+  opts->aborted = LLM_ABORT_NONE;
+  llm_stream_t st;
+  memset(&st, 0, sizeof(st));
+  timing_reset(&st.timing);
+  st.trace_start = trace_begin();
+  double t0 = now_ms();
+  if (build_chat_body(&st.body, req, 1) != 0) {
+    buf_free(&st.body);
+    return -1;
+  }
+  st.timing.encode_ms = now_ms() - t0;
+  st.on_chunk = on_chunk;
+  st.user = user;
+  st.deadline = now_ms() + (double)(opts->timeout_ms > 0 ? opts->timeout_ms : 120000L);
+  char url[1024];
+  snprintf(url, sizeof(url), "%s/chat/completions", req->base_url);
+  if (cassette_mode() != CASSETTE_OFF) st.key = cassette_key(url, st.body.data);
+
+  CURLcode res;
+  long code;
+  xfer_state_t xs = { opts, st.deadline };
+  if (cassette_mode() == CASSETTE_REPLAY) {
+    if (cassette_find(st.key, &st.replay) != 0) {
+      fprintf(stderr, "neo: cassette has no recording of this request\n");
+      buf_free(&st.body);
+      return -1;
+    }
+    st.replaying = 1;
+    res = replay_blocking(&st);
+    code = stream_status(&st);
+  } else {
+    st.easy = curl ? curl : curl_easy_init();
+    st.borrowed = curl != NULL;
+    if (!st.easy) {
+      buf_free(&st.body);
+      return -1;
+    }
+    if (st.borrowed) curl_easy_reset(st.easy); /* drops the last call's options, keeps its connection */
+    stream_setup(&st, url, req->api_key);
+    curl_easy_setopt(st.easy, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(st.easy, CURLOPT_XFERINFOFUNCTION, xferinfo_cb);
+    curl_easy_setopt(st.easy, CURLOPT_XFERINFODATA, &xs);
+    for (;;) {
+      long left = (long)(st.deadline - now_ms());
+      curl_easy_setopt(st.easy, CURLOPT_TIMEOUT_MS, left < 1 ? 1L : left);
+      st.recording = cassette_mode() == CASSETTE_RECORD;
+      if (st.recording) cassette_rec_begin(&st.rec);
+      res = curl_easy_perform(st.easy);
+      code = stream_status(&st);
+      if (st.recording) { /* every attempt, as in stream_finish */
+        if (res == CURLE_OK) cassette_rec_end(&st.rec, st.key, code);
+        else cassette_rec_free(&st.rec);
+        st.recording = 0;
+      }
+      if (!stream_should_retry(&st, res, code)) break;
+      st.retried = 1;
+      st.line.len = st.raw.len = st.thinking.len = 0;
+      sleep_ms(1000.0);
+    }
+  }
+  llm_result_t r;
+  stream_result(&st, res, code, &r);
+  if (r.err && opts->aborted == LLM_ABORT_NONE) opts->aborted = r.aborted;
+  opts->timing = r.timing;
+  trace_end("llm_stream", st.trace_start, "status", code);
+  int err = r.err;
+  if (err == 0) { /* hand the buffers over rather than copy them */
+    out->data = st.content.data;
+    out->size = st.content.len;
+    st.content = (buf_t){0};
+    if (st.thinking.len) {
+      out->thinking = st.thinking.data;
+      out->thinking_size = st.thinking.len;
+      st.thinking = (buf_t){0};
+    }
+  }
+  stream_clear(&st);
+  return err;
+}
@@ -6,6 +6,8 @@
 typedef struct {
   char *data;
   size_t size;
+  char *thinking;       /* <think> / reasoning_content, kept out of data; NULL if none */
+  size_t thinking_size;
 } llm_response_t;
 
 void llm_response_free(llm_response_t *r);
@@ -26,4 +28,109 @@ int llm_chat_messages(const char *base_url, const char *model, const char *api_k
                       const llm_message_t *messages, int n_messages,
                       llm_response_t *out);
 
+enum { LLM_ABORT_NONE = 0, LLM_ABORT_DEADLINE, LLM_ABORT_HANGUP };
+
+/* Where one request's time went, in ms (from CURLINFO_*_TIME for the network phases).
+   dns/connect/tls are 0 when a pooled connection was reused. */
+typedef struct {
+  int new_connection; /* 0: reused a pooled upstream connection */
+  double encode_ms;   /* JSON request body */
+  double dns_ms;
+  double connect_ms;
+  double tls_ms;
+  double ttfb_ms;     /* request sent -> first response byte */
+  double transfer_ms; /* first byte -> last byte */
+  double parse_ms;    /* SSE / JSON decoding of the answer */
+  long prompt_tokens; /* from the provider's "usage"; -1 if not reported */
+  long completion_tokens;
+  long cached_tokens; /* of prompt_tokens, taken from the server's prompt cache instead of
+                         prefilled (llama.cpp timings, usage.prompt_tokens_details); -1 if not reported */
+} llm_timing_t;
+
+/* Per-request limits. The transfer is aborted as soon as the deadline passes or the
+   peer on cancel_fd hangs up, so no further provider tokens are spent on it. */
+typedef struct {
+  long timeout_ms; /* budget for the whole request incl. retry; <= 0: 120 s */
+  int cancel_fd;   /* client connection to watch; -1: none */
+  int aborted;     /* out: LLM_ABORT_* */
+  llm_timing_t timing; /* out */
+} llm_opts_t;
+
+int llm_chat_messages_ex(const char *base_url, const char *model, const char *api_key,
+                         int max_tokens, double temperature,
+                         const char *system_prompt,
+                         const llm_message_t *messages, int n_messages,
+                         llm_opts_t *opts, llm_response_t *out);
+
+/* Reasoning models (Qwen3 and the like): whether to think at all. DEFAULT sends
+   nothing and leaves it to the provider. */
+enum { LLM_THINK_DEFAULT = 0, LLM_THINK_ON, LLM_THINK_OFF };
+
+/* Server kind, for steering its prompt (KV) cache. DEFAULT is any OpenAI-compatible
+   API and gets nothing extra. */
+enum { LLM_BACKEND_DEFAULT = 0, LLM_BACKEND_OPENAI, LLM_BACKEND_LLAMACPP, LLM_BACKEND_VLLM };
+
+typedef struct {
+  const char *base_url;
+  const char *model;
+  const char *api_key;
+  int max_tokens;
+  double temperature;
+  const char *system_prompt;
+  const llm_message_t *messages;
+  int n_messages;
+  int thinking;       /* LLM_THINK_* */
+  int think_budget;   /* > 0: cap on reasoning tokens */
+  int no_think;       /* with LLM_THINK_OFF: also append Qwen3's "/no_think" to the last user turn */
+  int backend;        /* LLM_BACKEND_* */
+  const char *cache_key; /* conversation this request continues (session id); NULL: none */
+  int slots;          /* llama.cpp: > 0 pins each cache_key to one of this many server slots */
+} llm_request_t;
+
+/* llm_chat_messages_ex for a request struct (reasoning controls included). */
+int llm_chat_request(const llm_request_t *req, llm_opts_t *opts, llm_response_t *out);
+
+/* ---- Streaming (daemon event loop) ---- */
+
+typedef struct {
+  int err;          /* 0 on success */
+  int aborted;      /* LLM_ABORT_DEADLINE when the timeout cut the request short */
+  long http_code;
+  const char *content; /* whole answer; valid only during the callback */
+  size_t len;
+  llm_timing_t timing;
+  const char *thinking; /* reasoning kept out of content (not streamed); "" if none */
+  size_t thinking_len;
+} llm_result_t;
+
+typedef struct llm_stream llm_stream_t;
+typedef void (*llm_chunk_fn)(void *user, const char *text, size_t len);
+typedef void (*llm_done_fn)(void *user, const llm_result_t *res);
+
+/* Start a streamed chat request on the shared multi handle; its sockets are registered
+   with the event loop (loop.h). on_chunk gets each text delta as it arrives, with any
+   leading <think> block and reasoning_content deltas held back in the result; on_done
+   fires exactly once unless the stream is cancelled. The request body is built now,
+   so req and its strings need not outlive the call. */
+llm_stream_t *llm_stream_start(const llm_request_t *req, long timeout_ms,
+                               llm_chunk_fn on_chunk, llm_done_fn on_done, void *user);
+/* Connect to base_url ahead of need: a HEAD of its /models on the shared multi handle,
+   which leaves the connection (DNS, TCP, TLS done) in the pool for the next request.
+   on_done gets err 0 for any HTTP answer, and the connect phases in timing. Cancel
+   with llm_stream_cancel. NULL when there is nothing to connect to (--replay). */
+llm_stream_t *llm_probe_start(const char *base_url, const char *api_key, long timeout_ms, llm_done_fn on_done,
+                              void *user);
+/* Drop a stream (e.g. the client hung up). Not to be called from its own callbacks. */
+void llm_stream_cancel(llm_stream_t *st);
+/* A streamed request run to the end on the calling thread instead of the event loop:
+   on_chunk (may be NULL) gets the answer as it arrives, *out the whole of it. Touches
+   no state shared between calls (cassettes don't apply), so threads may run their own
+   side by side. curl: an easy handle to run on, which keeps its connection warm for
+   the next call (one handle per thread at a time); NULL: a fresh one for this call. */
+int llm_chat_stream(const llm_request_t *req, llm_opts_t *opts, void *curl,
+                    llm_chunk_fn on_chunk, void *user, llm_response_t *out);
+/* Milliseconds until llm_async_tick() has timer work, -1 if none. */
+int llm_async_timeout_ms(void);
+void llm_async_tick(void);
+
 #endif
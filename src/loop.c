@@ -0,0 +1,153 @@
+/*
+ * Event loop over poll(2), or epoll(7) on Linux so thousands of idle keep-alive
+ * connections cost nothing per wakeup. Watches live in a dense array with an fd -> slot
+ * map; each watch carries a generation so a callback that closes fd N and accepts a new
+ * fd N in the same round never receives the old fd's events.
+ */
+#include "loop.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#define USE_EPOLL 1
+#endif
+
+typedef struct {
+  int fd;
+  short events;
+  loop_cb cb;
+  void *user;
+  unsigned gen;
+} watch_t;
+
+static watch_t *watches;
+static int n_watches, cap_watches;
+static int *slot_of; /* fd -> index + 1, 0 = not watched */
+static int slot_cap;
+static unsigned next_gen;
+
+#ifdef USE_EPOLL
+static int epfd = -1;
+
+/* poll and epoll share the IN/OUT/ERR/HUP bit values on Linux. */
+static int ep_set(int op, const watch_t *w) {
+  if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) return -1;
+  struct epoll_event ev = { .events = (uint32_t)w->events,
+                            .data.u64 = ((uint64_t)w->gen << 32) | (uint32_t)w->fd };
+  if (epoll_ctl(epfd, op, w->fd, &ev) == 0) return 0;
+  /* fd closed without unwatch (the kernel dropped it) or re-added after a failed DEL */
+  if (op == EPOLL_CTL_MOD && errno == ENOENT) return epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &ev);
+  if (op == EPOLL_CTL_ADD && errno == EEXIST) return epoll_ctl(epfd, EPOLL_CTL_MOD, w->fd, &ev);
+  return -1;
+}
+#else
+static struct pollfd *pfds;
+static unsigned *pgen;
+static int pcap;
+#endif
+
+int loop_watch(int fd, int events, loop_cb cb, void *user) {
+  if (fd < 0) return -1;
+  if (fd >= slot_cap) {
+    int cap = slot_cap ? slot_cap : 64;
+    while (cap <= fd) cap *= 2;
+    int *n = realloc(slot_of, cap * sizeof(int));
+    if (!n) return -1;
+    memset(n + slot_cap, 0, (cap - slot_cap) * sizeof(int));
+    slot_of = n;
+    slot_cap = cap;
+  }
+  if (slot_of[fd]) {
+    watch_t *w = &watches[slot_of[fd] - 1];
+    int changed = w->events != (short)events;
+    w->events = (short)events;
+    w->cb = cb;
+    w->user = user;
+#ifdef USE_EPOLL
+    if (changed) return ep_set(EPOLL_CTL_MOD, w);
+#else
+    (void)changed;
+#endif
+    return 0;
+  }
+  if (n_watches == cap_watches) {
+    int cap = cap_watches ? cap_watches * 2 : 64;
+    watch_t *n = realloc(watches, cap * sizeof(watch_t));
+    if (!n) return -1;
+    watches = n;
+    cap_watches = cap;
+  }
+  watches[n_watches] = (watch_t){ fd, (short)events, cb, user, ++next_gen };
+  slot_of[fd] = ++n_watches;
+#ifdef USE_EPOLL
+  if (ep_set(EPOLL_CTL_ADD, &watches[n_watches - 1]) != 0) {
+    loop_unwatch(fd);
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+void loop_unwatch(int fd) {
+  if (fd < 0 || fd >= slot_cap || !slot_of[fd]) return;
+  int i = slot_of[fd] - 1;
+  slot_of[fd] = 0;
+#ifdef USE_EPOLL
+  if (epfd >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL); /* EBADF if already closed: fine */
+#endif
+  if (i != n_watches - 1) {
+    watches[i] = watches[n_watches - 1];
+    slot_of[watches[i].fd] = i + 1;
+  }
+  n_watches--;
+}
+
+#ifdef USE_EPOLL
+int loop_poll(int timeout_ms) {
+  struct epoll_event evs[256];
+  if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) return -1;
+  int r = epoll_wait(epfd, evs, 256, timeout_ms);
+  for (int i = 0; i < r; i++) {
+    int fd = (int)(uint32_t)evs[i].data.u64;
+    if (fd >= slot_cap || !slot_of[fd]) continue;
+    watch_t *w = &watches[slot_of[fd] - 1];
+    if (w->gen != (unsigned)(evs[i].data.u64 >> 32)) continue;
+    w->cb(fd, (int)(evs[i].events & (POLLIN | POLLOUT | POLLERR | POLLHUP)), w->user);
+  }
+  return r;
+}
+#else
+int loop_poll(int timeout_ms) {
+  if (n_watches > pcap) {
+    struct pollfd *np = realloc(pfds, n_watches * sizeof(*np));
+    if (!np) return -1;
+    pfds = np;
+    unsigned *ng = realloc(pgen, n_watches * sizeof(*ng));
+    if (!ng) return -1;
+    pgen = ng;
+    pcap = n_watches;
+  }
+  int n = n_watches;
+  for (int i = 0; i < n; i++) {
+    pfds[i].fd = watches[i].fd;
+    pfds[i].events = watches[i].events;
+    pfds[i].revents = 0;
+    pgen[i] = watches[i].gen;
+  }
+  int r = poll(pfds, (nfds_t)n, timeout_ms);
+  if (r <= 0) return r;
+  for (int i = 0; i < n; i++) {
+    if (!pfds[i].revents) continue;
+    int fd = pfds[i].fd;
+    if (fd >= slot_cap || !slot_of[fd]) continue;
+    watch_t *w = &watches[slot_of[fd] - 1];
+    if (w->gen != pgen[i]) continue;
+    w->cb(fd, pfds[i].revents, w->user);
+  }
+  return r;
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef NEO_LOOP_H
+#define NEO_LOOP_H
+
+/* Minimal single-threaded fd event loop (one per process). Events are poll(2) bits;
+   POLLHUP/POLLERR are always reported, even for an fd watched with events == 0. */
+typedef void (*loop_cb)(int fd, int revents, void *user);
+
+int loop_watch(int fd, int events, loop_cb cb, void *user); /* add, or update events of a watched fd */
+void loop_unwatch(int fd);
+int loop_poll(int timeout_ms); /* wait once and dispatch; -1 on error */
+
+#endif
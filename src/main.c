@@ -1,64 +1,82 @@
 /*
  * Neo: minimal C agent. One process per query, or daemon mode.
  * Usage: neo [OPTIONS] "user message"
- *        neo daemon [--socket PATH]
+ *        neo -f FILE [OPTIONS] "instruction"
+ *        neo daemon [--socket PATH] [--http HOST:PORT] [--workers N]
  * Env:   NEO_CONFIG, NEO_MODEL, NEO_API_KEY
  * Output: LLM response to stdout.
  */
+#include "buf.h"
+#include "cache.h"
+#include "cassette.h"
 #include "config.h"
 #include "daemon.h"
 #include "llm.h"
-#include "skills.h"
+#include "mapreduce.h"
+#include "prompt.h"
+#include "route.h"
+#include "stats.h"
+#include "trace.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define SYSTEM_MAX (256 * 1024)
-#define USER_MAX   (64 * 1024)
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
 
-static size_t read_file_into(char *buf, size_t cap, const char *path, size_t max_chars) {
-  FILE *f = fopen(path, "r");
-  if (!f) return 0;
-  size_t n = 0;
-  if (max_chars <= 0 || max_chars > cap - 1) max_chars = cap - 1;
-  while (n < max_chars && fgets(buf + n, (int)(cap - n), f))
-    n = strlen(buf);
-  if (n >= cap - 1) n = cap - 2;
-  buf[n] = '\0';
-  fclose(f);
-  return n;
+/* The arguments joined by spaces; caller frees. NULL when out of memory. */
+static char *build_user_message(char **argv, int start, int argc) {
+  buf_t b = {0};
+  for (int i = start; i < argc; i++) {
+    if (i > start) buf_puts(&b, " ");
+    buf_puts(&b, argv[i]);
+  }
+  return b.data;
 }
 
-static void append_section(char *dest, size_t cap, const char *title, const char *path, const char *content) {
-  if (!content || !content[0]) return;
-  size_t used = strlen(dest);
-  if (used + strlen(title) + strlen(path) + strlen(content) + 64 > cap) return;
-  strncat(dest, title, cap - used - 1);
-  strncat(dest, path, cap - used - 1);
-  strncat(dest, "\n\n", cap - used - 1);
-  strncat(dest, content, cap - used - 1);
-  strncat(dest, "\n\n", cap - used - 1);
+static char answer_last = '\n'; /* last byte of the -f answer written so far */
+
+static void print_answer_chunk(void *user, const char *text, size_t len) {
+  (void)user;
+  mr_print_progress(NULL, 0);
+  fwrite(text, 1, len, stdout);
+  fflush(stdout);
+  if (len) answer_last = text[len - 1];
 }
 
-static void build_user_message(char *buf, size_t cap, char **argv, int start, int argc) {
-  buf[0] = '\0';
-  for (int i = start; i < argc; i++) {
-    if (i > start) strncat(buf, " ", cap - strlen(buf) - 1);
-    strncat(buf, argv[i], cap - strlen(buf) - 1);
-  }
+static void print_progress(void *user, const char *line, size_t len) {
+  (void)user;
+  mr_print_progress(line, len);
 }
 
 static void print_usage(const char *prog) {
   fprintf(stderr, "Usage: %s [OPTIONS] \"your message\"\n", prog);
-  fprintf(stderr, "       %s daemon [--socket PATH]\n", prog);
+  fprintf(stderr, "       %s -f FILE [OPTIONS] \"instruction\"\n", prog);
+  fprintf(stderr, "       %s daemon [--socket PATH] [--http HOST:PORT] [--workers N]\n", prog);
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -c, --config PATH   Config file (default: config.yaml or NEO_CONFIG)\n");
   fprintf(stderr, "  -m, --model NAME    Override model name\n");
+  fprintf(stderr, "  -f, --file FILE     Apply the instruction to FILE of any size: chunks in parallel, then merged\n");
+  fprintf(stderr, "  --chunk-tokens N    (with -f) Tokens of the file per request (default %d)\n", MR_CHUNK_TOKENS);
+  fprintf(stderr, "  --parallel N        (with -f) Chunk requests in flight at once (default %d)\n", MR_PARALLEL);
+  fprintf(stderr, "  --think, --no-think Turn model reasoning on/off for this query (thinking models such as Qwen3)\n");
+  fprintf(stderr, "  --show-thinking     Print the model's reasoning to stderr (it never goes into the answer)\n");
   fprintf(stderr, "  -d, --debug         Print system prompt, user message and request params to stderr\n");
+  fprintf(stderr, "  --trace FILE        Write Chrome/Perfetto trace events (prompt build, skills, LLM phases) to FILE\n");
+  fprintf(stderr, "  --record FILE       Save raw provider responses (with chunk timing) to a cassette\n");
+  fprintf(stderr, "  --replay FILE       Answer from a cassette instead of the provider (offline, deterministic)\n");
+  fprintf(stderr, "  --realtime          (with --replay) Reproduce the recorded TTFB and streaming pace\n");
+  fprintf(stderr, "  --no-daemon         Answer in-process even if a daemon is running (NEO_SOCKET / daemon.socket)\n");
   fprintf(stderr, "  -h, --help          Show this help\n");
   fprintf(stderr, "  daemon              Run as daemon: read from stdin, reply to stdout\n");
   fprintf(stderr, "  --socket PATH       (with daemon) Listen on Unix socket instead of stdin\n");
+  fprintf(stderr, "  --http HOST:PORT    (with daemon) Serve OpenAI-compatible /v1/chat/completions over HTTP\n");
+  fprintf(stderr, "  --workers N         (with --socket/--http) Prefork N worker processes sharing the sockets\n");
 }
 
 /* ANSI colors for debug (no-op if stderr not a tty; call debug_color_ok() to decide) */
@@ -74,7 +92,8 @@ static int debug_color_ok(void) {
 
 static void debug_print_request(agent_config_t *conf,
                                 const char *base_url, const char *model, int max_tokens, double temperature,
-                                const char *system_prompt, const char *user_message) {
+                                const char *system_prompt, const compact_saved_t *saved, const char *picked,
+                                const char *user_message) {
   int use_color = debug_color_ok();
   const char *cy = use_color ? D_CYAN : "";
   const char *yl = use_color ? D_YELLOW : "";
@@ -95,6 +114,13 @@ static void debug_print_request(agent_config_t *conf,
   }
   fprintf(stderr, "\n%s%s=== NEO DEBUG: system prompt (%zu chars) ===%s\n%s%s%s\n%s%s=== END system prompt ===%s\n",
           bd, yl, system_prompt ? strlen(system_prompt) : 0u, re, yl, system_prompt ? system_prompt : "", re, bd, yl, re);
+  if (picked && picked[0]) fprintf(stderr, "%sskills picked by embedding: %s%s\n", yl, picked, re);
+  if (system_prompt && saved && saved->chars) {
+    size_t len = strlen(system_prompt);
+    fprintf(stderr, "%s~%zu tokens; compaction took out %zu chars (~%zu tokens, %.0f%%)%s\n", yl,
+            compact_tokens(system_prompt, len), saved->chars, saved->tokens,
+            100.0 * (double)saved->chars / (double)(len + saved->chars), re);
+  }
   fprintf(stderr, "\n%s%s=== NEO DEBUG: user message (%zu chars) ===%s\n%s%s%s\n%s%s=== END user message ===%s\n\n",
           bd, gr, user_message ? strlen(user_message) : 0u, re, gr, user_message ? user_message : "", re, bd, gr, re);
 }
@@ -106,8 +132,17 @@ int main(int argc, char **argv) {
   int arg_start = 1;
 
   const char *socket_path = NULL;
+  const char *http_addr = NULL;
   int daemon_mode = 0;
   int debug = 0;
+  int workers = -1;
+  int no_daemon = 0;
+  const char *trace_path = NULL;
+  const char *cassette_path = NULL;
+  int cassette = CASSETTE_OFF, realtime = 0;
+  const char *file_path = NULL;
+  int chunk_tokens = 0, parallel = 0;
+  int think = LLM_THINK_DEFAULT, show_thinking = 0;
 
   while (arg_start < argc) {
     if (strcmp(argv[arg_start], "--help") == 0 || strcmp(argv[arg_start], "-h") == 0) {
@@ -137,6 +172,64 @@ int main(int argc, char **argv) {
       arg_start += 2;
       continue;
     }
+    if (strcmp(argv[arg_start], "--http") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: --http requires HOST:PORT\n"); return 1; }
+      http_addr = argv[arg_start + 1];
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--workers") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: --workers requires N\n"); return 1; }
+      workers = atoi(argv[arg_start + 1]);
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--trace") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: --trace requires FILE\n"); return 1; }
+      trace_path = argv[arg_start + 1];
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--record") == 0 || strcmp(argv[arg_start], "--replay") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: %s requires FILE\n", argv[arg_start]); return 1; }
+      cassette = argv[arg_start][2] == 'r' && argv[arg_start][4] == 'c' ? CASSETTE_RECORD : CASSETTE_REPLAY;
+      cassette_path = argv[arg_start + 1];
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--file") == 0 || strcmp(argv[arg_start], "-f") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: --file requires FILE\n"); return 1; }
+      file_path = argv[arg_start + 1];
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--chunk-tokens") == 0 || strcmp(argv[arg_start], "--parallel") == 0) {
+      if (arg_start + 1 >= argc) { fprintf(stderr, "neo: %s requires N\n", argv[arg_start]); return 1; }
+      *(argv[arg_start][2] == 'c' ? &chunk_tokens : &parallel) = atoi(argv[arg_start + 1]);
+      arg_start += 2;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--think") == 0 || strcmp(argv[arg_start], "--no-think") == 0) {
+      think = argv[arg_start][2] == 'n' ? LLM_THINK_OFF : LLM_THINK_ON;
+      arg_start++;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--show-thinking") == 0) {
+      show_thinking = 1;
+      no_daemon = 1; /* the daemon does not send reasoning back */
+      arg_start++;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--realtime") == 0) {
+      realtime = 1;
+      arg_start++;
+      continue;
+    }
+    if (strcmp(argv[arg_start], "--no-daemon") == 0) {
+      no_daemon = 1;
+      arg_start++;
+      continue;
+    }
     if (strcmp(argv[arg_start], "--debug") == 0 || strcmp(argv[arg_start], "-d") == 0) {
       debug = 1;
       arg_start++;
@@ -144,6 +237,14 @@ int main(int argc, char **argv) {
     }
     break;
   }
+  if (trace_path && trace_open(trace_path) != 0) {
+    fprintf(stderr, "neo: cannot write trace to %s\n", trace_path);
+    return 1;
+  }
+  if (cassette_path) {
+    if (cassette_open(cassette_path, cassette, realtime) != 0) return 1;
+    no_daemon = 1; /* the cassette is used in this process, not by a running daemon */
+  }
 
   if (daemon_mode) {
     agent_config_t conf;
@@ -159,7 +260,11 @@ int main(int argc, char **argv) {
       conf.model.name = malloc(strlen(model_override) + 1);
       if (conf.model.name) strcpy(conf.model.name, model_override);
     }
-    int r = socket_path ? run_daemon_socket(&conf, socket_path, debug) : run_daemon_stdin(&conf, debug);
+    daemon_config_source(config_path, model_override);
+    if (workers < 0) workers = conf.daemon_workers;
+    if (!socket_path && !http_addr) socket_path = conf.daemon_socket;
+    int r = (socket_path || http_addr) ? run_daemon_socket(&conf, socket_path, http_addr, workers, debug)
+                                       : run_daemon_stdin(&conf, debug);
     config_free(&conf);
     return r != 0;
   }
@@ -169,13 +274,62 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  char *user_message = build_user_message(argv, arg_start, argc);
+  if (!user_message) return 1;
+
+  /* -f goes to the daemon as file=<absolute path>, so its cache outlives this run. */
+  char file_abs[PATH_MAX], fwd_opts[PATH_MAX + 80];
+  const char *fwd = NULL;
+  fwd_opts[0] = '\0';
+  if (file_path) {
+    if (!realpath(file_path, file_abs)) {
+      fprintf(stderr, "neo: cannot read %s\n", file_path);
+      free(user_message);
+      return 1;
+    }
+    snprintf(fwd_opts, sizeof(fwd_opts), "file=%s chunk_tokens=%d parallel=%d", file_abs, chunk_tokens, parallel);
+    if (strpbrk(file_abs, " \t\r\n")) no_daemon = 1; /* can't go in a frame header */
+  }
+  if (think) {
+    size_t n = strlen(fwd_opts);
+    snprintf(fwd_opts + n, sizeof(fwd_opts) - n, "%sthink=%s", n ? " " : "", think == LLM_THINK_ON ? "on" : "off");
+  }
+  if (fwd_opts[0]) fwd = fwd_opts;
+
+  /* A warm daemon already has config, skills and upstream connections: NEO_SOCKET is
+     tried before even parsing the config, daemon.socket right after. */
+  const char *env_socket = getenv("NEO_SOCKET");
+  const char *fwd_model = model_override;
+  if (!fwd_model && getenv("NEO_MODEL") && getenv("NEO_MODEL")[0]) fwd_model = getenv("NEO_MODEL");
+  if (!no_daemon && env_socket && env_socket[0]) {
+    int r = daemon_forward(env_socket, user_message, fwd_model, fwd, debug);
+    if (r >= 0) {
+      free(user_message);
+      return r;
+    }
+    if (debug) fprintf(stderr, "neo: no daemon at %s, answering in-process\n", env_socket);
+  }
+
+  stats_request_t rec = {0};
+  double t0 = now_ms(); /* config load counts as part of the prompt phase here */
   agent_config_t conf;
   config_init(&conf);
   if (config_load_file(&conf, config_path) != 0) {
     fprintf(stderr, "neo: failed to load config from %s\n", config_path);
     config_free(&conf);
+    free(user_message);
     return 1;
   }
+  if (!no_daemon && conf.daemon_socket && conf.daemon_socket[0] && !(env_socket && env_socket[0])) {
+    int r = daemon_forward(conf.daemon_socket, user_message, fwd_model, fwd, debug);
+    if (r >= 0) {
+      config_free(&conf);
+      free(user_message);
+      return r;
+    }
+    if (debug) fprintf(stderr, "neo: no daemon at %s, answering in-process\n", conf.daemon_socket);
+    t0 = now_ms();
+  }
   config_apply_env(&conf);
   if (model_override) {
     free(conf.model.name);
@@ -184,79 +338,96 @@ int main(int argc, char **argv) {
   }
 
   char *system_prompt = malloc(SYSTEM_MAX);
-  char *user_message  = malloc(USER_MAX);
-  char *tmp           = malloc(65536);
-  if (!system_prompt || !user_message) {
-    free(system_prompt);
+  if (!system_prompt) {
     free(user_message);
-    free(tmp);
     config_free(&conf);
     return 1;
   }
-  system_prompt[0] = '\0';
-  user_message[0]  = '\0';
-  if (!tmp) tmp = malloc(1024);
+  prompt_info_t info;
+  prompt_build(&conf, NULL, user_message, system_prompt, SYSTEM_MAX, &info);
+  rec.skills_ms = info.skills_ms;
+  rec.prompt_ms = now_ms() - t0;
 
-  strncat(system_prompt, "You are a helpful assistant. Follow any skill and bootstrap instructions below.\n\n", SYSTEM_MAX - 1);
+  /* -m / NEO_MODEL pin the model; otherwise the configured routes pick a profile */
+  route_t route;
+  char why[256];
+  for (int i = 0; i < conf.profile_count; i++) stats_route_name(i + 1, conf.profiles[i].name);
+  if (fwd_model) {
+    route_default(&conf, &route);
+    snprintf(why, sizeof(why), "model %s pinned, routes skipped", route.model ? route.model : "(null)");
+  } else
+    route_pick(&conf, user_message, &route, why, sizeof(why));
+  if (think) route.thinking = think;
+  rec.route = route.index;
 
-  {
-    time_t now = time(NULL);
-    struct tm *utc = gmtime(&now);
-    char datebuf[80];
-    char line[96];
-    if (utc && strftime(datebuf, sizeof(datebuf), "%Y-%m-%d %H:%M UTC", utc) > 0)
-      snprintf(line, sizeof(line), "Current date and time: %s\n\n", datebuf);
-    else
-      strcpy(line, "Current date and time: (unknown)\n\n");
-    strncat(system_prompt, line, SYSTEM_MAX - 1);
+  if (debug) {
+    fprintf(stderr, "neo: route: %s\n", why);
+    debug_print_request(&conf, route.base_url, route.model, route.max_tokens, route.temperature,
+                       system_prompt, &info.saved, info.picked, user_message);
   }
 
-  build_user_message(user_message, USER_MAX, argv, arg_start, argc);
-  skills_append_to_system_prompt(&conf, user_message, system_prompt, SYSTEM_MAX, 1); /* high priority first */
-  if (tmp) {
-    for (int i = 0; i < conf.bootstrap.path_count; i++) {
-      const char *path = conf.bootstrap.paths[i];
-      size_t max_c = (conf.bootstrap.max_chars_per_file > 0) ? (size_t)conf.bootstrap.max_chars_per_file : 8000;
-      if (read_file_into(tmp, 65536, path, max_c) > 0)
-        append_section(system_prompt, SYSTEM_MAX, "## Bootstrap: ", path, tmp);
-    }
-  }
-  skills_append_to_system_prompt(&conf, user_message, system_prompt, SYSTEM_MAX, 0); /* normal skills */
-
-  if (conf.memory.path && tmp) {
-    if (read_file_into(tmp, 65536, conf.memory.path, (size_t)conf.memory.max_chars) > 0)
-      append_section(system_prompt, SYSTEM_MAX, "## Memory (context)\n\n", "", tmp);
+  if (file_path) {
+    if (conf.cache.entries > 0 && cache_init(conf.cache.entries, conf.cache.max_bytes, conf.cache.ttl) != 0)
+      fprintf(stderr, "neo: response cache disabled (mmap failed)\n");
+    mr_params_t p = { .model = { route.base_url, route.model, route.api_key, route.max_tokens, route.temperature,
+                                 system_prompt, NULL, 0, route.thinking, route.think_budget, route.no_think,
+                                 route.backend, NULL, route.slots },
+                      .path = file_abs, .instruction = user_message, .chunk_tokens = chunk_tokens,
+                      .parallel = parallel, .fd = -1 };
+    int err = mr_run(&p, print_answer_chunk, print_progress, NULL);
+    mr_print_progress(NULL, 0);
+    if (err == 0 && answer_last != '\n') putchar('\n');
+    fflush(stdout);
+    config_free(&conf);
+    free(system_prompt);
+    free(user_message);
+    if (err != 0) fprintf(stderr, "neo: map-reduce over %s failed\n", file_path);
+    return err != 0;
   }
 
-  if (debug)
-    debug_print_request(&conf, conf.model.base_url, conf.model.name, conf.model.max_tokens, conf.model.temperature,
-                       system_prompt, user_message);
-
   llm_response_t resp = {0};
-  int err = llm_chat(
-    conf.model.base_url,
-    conf.model.name,
-    conf.model.api_key,
-    conf.model.max_tokens,
-    conf.model.temperature,
+  llm_message_t msg = { "user", user_message };
+  llm_opts_t opts = { .timeout_ms = 0, .cancel_fd = -1 };
+  llm_request_t req = {
+    route.base_url,
+    route.model,
+    route.api_key,
+    route.max_tokens,
+    route.temperature,
     system_prompt,
-    user_message,
-    &resp
-  );
+    &msg, 1,
+    route.thinking,
+    route.think_budget,
+    route.no_think,
+    route.backend,
+    NULL,
+    route.slots
+  };
+  int err = llm_chat_request(&req, &opts, &resp);
+  rec.llm = opts.timing;
+  rec.total_ms = now_ms() - t0;
+  rec.failed = err != 0;
   config_free(&conf);
   free(system_prompt);
   free(user_message);
-  free(tmp);
 
   if (err != 0) {
+    if (debug) stats_print_request(stderr, &rec);
     fprintf(stderr, "neo: LLM request failed\n");
     llm_response_free(&resp);
     return 1;
   }
+  if (resp.thinking && show_thinking) {
+    fwrite(resp.thinking, 1, resp.thinking_size, stderr);
+    if (resp.thinking[resp.thinking_size - 1] != '\n') fputc('\n', stderr);
+  } else if (resp.thinking && debug)
+    fprintf(stderr, "neo: %zu bytes of reasoning left out (--show-thinking prints it)\n", resp.thinking_size);
   if (resp.data && resp.size) {
     fwrite(resp.data, 1, resp.size, stdout);
     if (resp.data[resp.size - 1] != '\n') putchar('\n');
   }
+  fflush(stdout);
+  if (debug) stats_print_request(stderr, &rec);
   llm_response_free(&resp);
   return 0;
 }
@@ -0,0 +1,466 @@
+/*
+ * Map-reduce over a large file: see mapreduce.h. Rounds run one after the other; within
+ * a round, items (file chunks, then batches of partial answers) are dispatched in order
+ * with at most `parallel` of them in flight.
+ */
+#include "mapreduce.h"
+#include "buf.h"
+#include "cache.h"
+#include "loop.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#endif
+
+typedef struct {
+  mr_job_t *job;
+  int idx;            /* item of the current round, -1 when the slot is free */
+  uint64_t key;       /* response cache key, 0 when the cache is off */
+  llm_stream_t *st;
+} slot_t;
+
+struct mr_job {
+  char *base_url, *model, *api_key, *system_prompt, *instruction;
+  const char *name;   /* file name as shown to the model, points into path */
+  char *path;
+  int fd;             /* path opened by the caller, until map_file; -1: none */
+  int max_tokens;
+  double temperature;
+  int thinking, think_budget, no_think, backend;
+  long timeout_ms;
+  int budget;         /* tokens per chunk / per reduce batch */
+  int parallel;
+  const char *map;    /* the whole file */
+  size_t map_len;
+  size_t *cuts;       /* chunk i is [cuts[i], cuts[i + 1]) */
+  int n_chunks;
+  int round;          /* 0: map, then reduce rounds */
+  char **parts;       /* reduce: answers of the previous round */
+  size_t *part_len;
+  int n_parts;
+  int *batch;         /* reduce: item i merges parts [batch[i], batch[i + 1]) */
+  int n_items, next, done, cached, running;
+  char **out;         /* answers of this round, one per item */
+  size_t *out_len;
+  slot_t *slots;
+  uint64_t trace_start;
+  llm_chunk_fn on_chunk;
+  mr_progress_fn on_progress;
+  mr_done_fn on_done;
+  void *user;
+};
+
+/* Rough token count: ~4 bytes per token for ASCII, one per multi-byte character (CJK
+   text runs close to that). Only used to size requests, so it needn't be exact. */
+static size_t est_tokens(const char *p, size_t n) {
+  size_t ascii = 0, wide = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)p[i];
+    if (c < 0x80) ascii++;
+    else if (c >= 0xC0) wide++;
+  }
+  return ascii / 4 + wide;
+}
+
+/* Length of the next chunk of p: up to budget tokens, cut after the last newline in its
+   second half if there is one, otherwise on a UTF-8 character boundary. */
+static size_t cut_chunk(const char *p, size_t n, size_t budget) {
+  size_t ascii = 0, wide = 0, last_nl = 0, i;
+  for (i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)p[i];
+    if (c < 0x80) ascii++;
+    else if (c >= 0xC0) wide++;
+    if (ascii / 4 + wide > budget) break;
+    if (c == '\n') last_nl = i + 1;
+  }
+  if (i >= n) return n;
+  if (last_nl > i / 2) return last_nl;
+  while (i > 0 && ((unsigned char)p[i] & 0xC0) == 0x80) i--;
+  return i > 0 ? i : 1;
+}
+
+static int map_file(mr_job_t *m) {
+  int fd = m->fd >= 0 ? m->fd : open(m->path, O_RDONLY | O_CLOEXEC);
+  m->fd = -1;
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+    if (fd >= 0) close(fd);
+    fprintf(stderr, "neo: cannot read %s\n", m->path);
+    return -1;
+  }
+  m->map_len = (size_t)sb.st_size;
+  if (m->map_len == 0) {
+    close(fd);
+    fprintf(stderr, "neo: %s is empty\n", m->path);
+    return -1;
+  }
+#ifdef HAVE_MMAP
+  void *p = mmap(NULL, m->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p != MAP_FAILED) madvise(p, m->map_len, MADV_SEQUENTIAL);
+  m->map = p == MAP_FAILED ? NULL : p;
+#else
+  char *p = malloc(m->map_len);
+  if (p && read(fd, p, m->map_len) != (ssize_t)m->map_len) { free(p); p = NULL; }
+  m->map = p;
+#endif
+  close(fd);
+  if (!m->map) {
+    fprintf(stderr, "neo: cannot map %s\n", m->path);
+    return -1;
+  }
+  size_t cap = 16;
+  m->cuts = malloc(cap * sizeof(size_t));
+  if (!m->cuts) return -1;
+  m->cuts[0] = 0;
+  for (size_t off = 0; off < m->map_len;) {
+    off += cut_chunk(m->map + off, m->map_len - off, (size_t)m->budget);
+    if ((size_t)m->n_chunks + 2 > cap) {
+      size_t *n = realloc(m->cuts, (cap *= 2) * sizeof(size_t));
+      if (!n) return -1;
+      m->cuts = n;
+    }
+    m->cuts[++m->n_chunks] = off;
+  }
+  return 0;
+}
+
+static void free_strings(char **v, int n) {
+  for (int i = 0; v && i < n; i++) free(v[i]);
+  free(v);
+}
+
+static void job_free(mr_job_t *m) {
+  for (int i = 0; m->slots && i < m->parallel; i++) llm_stream_cancel(m->slots[i].st);
+  free(m->slots);
+  free_strings(m->out, m->n_items);
+  free(m->out_len);
+  free_strings(m->parts, m->n_parts);
+  free(m->part_len);
+  free(m->batch);
+  free(m->cuts);
+#ifdef HAVE_MMAP
+  if (m->map) munmap((void *)m->map, m->map_len);
+#else
+  free((void *)m->map);
+#endif
+  free(m->base_url);
+  free(m->model);
+  free(m->api_key);
+  free(m->system_prompt);
+  free(m->instruction);
+  free(m->path);
+  free(m);
+}
+
+/* The last round: one item whose answer is the answer. */
+static int final_round(const mr_job_t *m) {
+  return m->n_items == 1 && (m->round > 0 || m->n_chunks == 1);
+}
+
+static void progress(mr_job_t *m) {
+  if (!m->on_progress || (final_round(m) && m->done == m->n_items)) return; /* the answer says it all */
+  char line[128];
+  int n;
+  if (m->round == 0)
+    n = snprintf(line, sizeof(line), "map %d/%d chunks", m->done, m->n_items);
+  else
+    n = snprintf(line, sizeof(line), "reduce %d/%d (round %d)", m->done, m->n_items, m->round);
+  if (m->cached && n < (int)sizeof(line))
+    n += snprintf(line + n, sizeof(line) - (size_t)n, ", %d cached", m->cached);
+  if (n >= (int)sizeof(line)) n = (int)sizeof(line) - 1;
+  m->on_progress(m->user, line, (size_t)n);
+}
+
+/* The user message for item i of the current round. */
+static int item_message(mr_job_t *m, int i, buf_t *b) {
+  if (m->round == 0) {
+    const char *p = m->map + m->cuts[i];
+    size_t n = m->cuts[i + 1] - m->cuts[i];
+    if (m->n_chunks == 1)
+      buf_printf(b, "%s\n\nFile %s:\n\n", m->instruction, m->name);
+    else /* no part number: an unchanged chunk keeps its cache key when the file grows */
+      buf_printf(b, "%s\n\nFile %s is too long for one request and comes in parts; this is one of them. "
+                 "Work on this part only, the answers for all parts are merged afterwards.\n\n",
+                 m->instruction, m->name);
+    size_t at = b->len;
+    if (buf_append(b, p, n) != 0) return -1;
+    for (char *z = b->data + at; (z = memchr(z, '\0', (size_t)(b->data + b->len - z))) != NULL; z++)
+      *z = ' '; /* the message goes out as a C string */
+    return 0;
+  }
+  int first = m->batch[i], last = m->batch[i + 1];
+  buf_printf(b, "%s\n\nFile %s was too long for one request, so it was worked on in consecutive parts. "
+             "Below are the answers for %d of them, in order. Merge them into one answer to the instruction "
+             "above, as if the file had been read in one go; don't mention the parts.\n\n",
+             m->instruction, m->name, last - first);
+  for (int k = first; k < last; k++) {
+    buf_printf(b, "### Answer %d\n\n", k - first + 1);
+    if (buf_append(b, m->parts[k], m->part_len[k]) != 0) return -1;
+    buf_puts(b, "\n\n");
+  }
+  return b->data ? 0 : -1;
+}
+
+static void take_answer(mr_job_t *m, int i, char *text, size_t len) {
+  m->out[i] = text;
+  m->out_len[i] = len;
+  m->done++;
+}
+
+static void slot_chunk(void *user, const char *text, size_t len) {
+  slot_t *s = user;
+  if (final_round(s->job) && s->job->on_chunk) s->job->on_chunk(s->job->user, text, len);
+}
+
+static void pump(mr_job_t *m);
+
+/* Report the outcome and free the job. */
+static void finish(mr_job_t *m, int err, int aborted) {
+  mr_done_fn done = m->on_done;
+  void *u = m->user;
+  char *text = err ? NULL : m->out[0];
+  size_t len = err ? 0 : m->out_len[0];
+  if (!err) m->out[0] = NULL;
+  trace_end("map-reduce", m->trace_start, "chunks", m->n_chunks);
+  job_free(m);
+  done(u, err, aborted, text, len);
+  free(text);
+}
+
+static void slot_done(void *user, const llm_result_t *res) {
+  slot_t *s = user;
+  mr_job_t *m = s->job;
+  s->st = NULL; /* freed by llm after this callback */
+  m->running--;
+  int idx = s->idx;
+  s->idx = -1;
+  char *text = res->err ? NULL : malloc(res->len + 1);
+  if (!text) {
+    if (res->err) fprintf(stderr, "neo: %s %d of %d failed\n", m->round ? "reduce batch" : "chunk", idx + 1, m->n_items);
+    finish(m, -1, res->aborted);
+    return;
+  }
+  memcpy(text, res->content, res->len);
+  text[res->len] = '\0';
+  if (s->key) cache_put(s->key, res->content, res->len);
+  take_answer(m, idx, text, res->len);
+  progress(m);
+  pump(m);
+}
+
+/* Answer item i from the cache or send it upstream. -1 on failure. */
+static int start_item(mr_job_t *m, int i) {
+  buf_t msg = {0};
+  if (item_message(m, i, &msg) != 0) {
+    buf_free(&msg);
+    return -1;
+  }
+  llm_message_t um = { "user", msg.data };
+  llm_request_t req = { m->base_url, m->model, m->api_key, m->max_tokens, m->temperature, m->system_prompt, &um, 1,
+                        m->thinking, m->think_budget, m->no_think, m->backend, NULL, 0 };
+  uint64_t key = cache_enabled() ? cache_request_key(&req) : 0;
+  size_t len;
+  char *hit = key ? cache_get(key, &len) : NULL;
+  if (hit) {
+    buf_free(&msg);
+    m->cached++;
+    if (final_round(m) && m->on_chunk) m->on_chunk(m->user, hit, len);
+    take_answer(m, i, hit, len);
+    progress(m);
+    return 0;
+  }
+  slot_t *s = NULL;
+  for (int k = 0; k < m->parallel && !s; k++)
+    if (m->slots[k].idx < 0) s = &m->slots[k];
+  s->idx = i;
+  s->key = key;
+  s->st = llm_stream_start(&req, m->timeout_ms, slot_chunk, slot_done, s);
+  buf_free(&msg);
+  if (!s->st) {
+    s->idx = -1;
+    return -1;
+  }
+  m->running++;
+  return 0;
+}
+
+/* Turn this round's answers into the parts of a reduce round: consecutive answers are
+   batched up to the token budget, at least two per batch so every round shrinks. */
+static int next_round(mr_job_t *m) {
+  free_strings(m->parts, m->n_parts);
+  free(m->part_len);
+  m->parts = m->out;
+  m->part_len = m->out_len;
+  m->n_parts = m->n_items;
+  m->out = NULL;
+  m->out_len = NULL;
+  m->n_items = 0;
+  free(m->batch);
+  if (!(m->batch = malloc(((size_t)m->n_parts + 1) * sizeof(int)))) return -1;
+  m->batch[0] = 0;
+  size_t tokens = 0;
+  for (int k = 0; k < m->n_parts; k++) {
+    size_t t = est_tokens(m->parts[k], m->part_len[k]);
+    if (k - m->batch[m->n_items] >= 2 && tokens + t > (size_t)m->budget) {
+      m->batch[++m->n_items] = k;
+      tokens = 0;
+    }
+    tokens += t;
+  }
+  m->batch[++m->n_items] = m->n_parts;
+  if (m->n_items > 1 && m->batch[m->n_items] - m->batch[m->n_items - 1] == 1) {
+    m->batch[m->n_items - 1] = m->n_parts; /* don't leave a lone answer for a batch of its own */
+    m->n_items--;
+  }
+  m->round++;
+  m->next = m->done = m->cached = 0;
+  m->out = calloc((size_t)m->n_items, sizeof(char *));
+  m->out_len = calloc((size_t)m->n_items, sizeof(size_t));
+  return m->out && m->out_len ? 0 : -1;
+}
+
+/* Keep the round moving; on to the next round or the answer once it is complete. */
+static void pump(mr_job_t *m) {
+  for (;;) {
+    int err = 0;
+    while (!err && m->next < m->n_items && m->running < m->parallel)
+      err = start_item(m, m->next++);
+    if (!err && m->done < m->n_items) return;
+    if (!err && !final_round(m)) {
+      if (next_round(m) == 0) {
+        progress(m);
+        continue;
+      }
+      err = -1;
+    }
+    finish(m, err ? -1 : 0, LLM_ABORT_NONE);
+    return;
+  }
+}
+
+static char *dup_or_null(const char *s) {
+  return s ? strdup(s) : NULL;
+}
+
+int mr_start(const mr_params_t *p, llm_chunk_fn on_chunk, mr_progress_fn on_progress, mr_done_fn on_done,
+             void *user, mr_job_t **handle) {
+  mr_job_t *m = calloc(1, sizeof(*m));
+  if (!m) {
+    if (p->fd >= 0) close(p->fd);
+    return -1;
+  }
+  m->fd = p->fd;
+  m->trace_start = trace_begin();
+  m->base_url = dup_or_null(p->model.base_url);
+  m->model = dup_or_null(p->model.model);
+  m->api_key = dup_or_null(p->model.api_key);
+  m->system_prompt = strdup(p->model.system_prompt ? p->model.system_prompt : "");
+  m->instruction = strdup(p->instruction ? p->instruction : "");
+  m->path = strdup(p->path);
+  m->max_tokens = p->model.max_tokens;
+  m->temperature = p->model.temperature;
+  m->thinking = p->model.thinking;
+  m->think_budget = p->model.think_budget;
+  m->no_think = p->model.no_think;
+  m->backend = p->model.backend;
+  m->timeout_ms = p->timeout_ms;
+  m->budget = p->chunk_tokens > 0 ? p->chunk_tokens : MR_CHUNK_TOKENS;
+  if (m->budget < 256) m->budget = 256;
+  m->parallel = p->parallel > 0 ? p->parallel : MR_PARALLEL;
+  if (m->parallel > MR_PARALLEL_MAX) m->parallel = MR_PARALLEL_MAX;
+  m->on_chunk = on_chunk;
+  m->on_progress = on_progress;
+  m->on_done = on_done;
+  m->user = user;
+  m->slots = calloc((size_t)m->parallel, sizeof(slot_t));
+  if (!m->system_prompt || !m->instruction || !m->path || !m->slots || map_file(m) != 0) {
+    if (m->fd >= 0) close(m->fd);
+    job_free(m);
+    return -1;
+  }
+  const char *slash = strrchr(m->path, '/');
+  m->name = slash ? slash + 1 : m->path;
+  for (int i = 0; i < m->parallel; i++) {
+    m->slots[i].job = m;
+    m->slots[i].idx = -1;
+  }
+  m->n_items = m->n_chunks;
+  m->out = calloc((size_t)m->n_items, sizeof(char *));
+  m->out_len = calloc((size_t)m->n_items, sizeof(size_t));
+  if (!m->out || !m->out_len) {
+    job_free(m);
+    return -1;
+  }
+  *handle = m;
+  progress(m);
+  pump(m);
+  return 0;
+}
+
+void mr_cancel(mr_job_t *m) {
+  if (m) job_free(m);
+}
+
+typedef struct {
+  int finished;
+  int err;
+  llm_chunk_fn on_chunk;
+  mr_progress_fn on_progress;
+  void *user;
+} run_t;
+
+static void run_chunk(void *user, const char *text, size_t len) {
+  run_t *r = user;
+  if (r->on_chunk) r->on_chunk(r->user, text, len);
+}
+
+static void run_progress(void *user, const char *line, size_t len) {
+  run_t *r = user;
+  if (r->on_progress) r->on_progress(r->user, line, len);
+}
+
+static void run_done(void *user, int err, int aborted, const char *text, size_t len) {
+  run_t *r = user;
+  (void)aborted; (void)text; (void)len;
+  r->finished = 1;
+  r->err = err;
+}
+
+int mr_run(const mr_params_t *p, llm_chunk_fn on_chunk, mr_progress_fn on_progress, void *user) {
+  run_t r = { 0, 0, on_chunk, on_progress, user };
+  mr_job_t *m = NULL;
+  if (mr_start(p, run_chunk, run_progress, run_done, &r, &m) != 0) return -1;
+  while (!r.finished) {
+    if (loop_poll(llm_async_timeout_ms()) < 0 && errno != EINTR) {
+      mr_cancel(m);
+      return -1;
+    }
+    llm_async_tick();
+  }
+  return r.err;
+}
+
+void mr_print_progress(const char *line, size_t len) {
+  static int open; /* a progress line is on the terminal, not yet ended */
+  int tty = isatty(2);
+  if (!line) {
+    if (open) fputc('\n', stderr);
+    open = 0;
+    return;
+  }
+  if (tty) {
+    fprintf(stderr, "\rneo: %.*s\033[K", (int)len, line);
+    open = 1;
+  } else
+    fprintf(stderr, "neo: %.*s\n", (int)len, line);
+  fflush(stderr);
+}
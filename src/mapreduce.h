@@ -0,0 +1,48 @@
+#ifndef NEO_MAPREDUCE_H
+#define NEO_MAPREDUCE_H
+
+#include "llm.h"
+
+/*
+ * Map-reduce over a file too big for one request (neo -f FILE "instruction"). The file
+ * is mapped and cut into token-budgeted chunks on line boundaries; every chunk goes out
+ * with the instruction as a request of its own, at most `parallel` at a time on the
+ * shared multi handle, and the partial answers are then merged by reduce requests
+ * (several rounds if they don't fit one) until a single answer is left. Each request is
+ * looked up in the response cache first, so a rerun only pays for chunks that changed.
+ */
+#define MR_CHUNK_TOKENS 4000
+#define MR_PARALLEL     4
+#define MR_PARALLEL_MAX 32
+
+typedef struct {
+  llm_request_t model;     /* endpoint, sampling and system prompt; messages are unused */
+  const char *path;
+  const char *instruction;
+  int chunk_tokens;        /* <= 0: MR_CHUNK_TOKENS */
+  int parallel;            /* <= 0: MR_PARALLEL */
+  long timeout_ms;         /* per request, as for llm_stream_start */
+  int fd;                  /* -1: open path; else path already opened (and checked) by the caller, mr_start closes it */
+} mr_params_t;
+
+typedef struct mr_job mr_job_t;
+/* One progress line ("map 3/10 (1 cached)"), not NUL-terminated. */
+typedef void (*mr_progress_fn)(void *user, const char *line, size_t len);
+/* Fires exactly once unless the job is cancelled; text is valid only during the call. */
+typedef void (*mr_done_fn)(void *user, int err, int aborted, const char *text, size_t len);
+
+/* Start the job. *handle is set before anything can complete, since on_done may
+   already fire from here (every request cached). on_chunk gets the final answer as it
+   streams. -1 when the file can't be read (no callback then). */
+int mr_start(const mr_params_t *p, llm_chunk_fn on_chunk, mr_progress_fn on_progress, mr_done_fn on_done,
+             void *user, mr_job_t **handle);
+/* Drop the job and its requests in flight. Not to be called from its own callbacks. */
+void mr_cancel(mr_job_t *m);
+/* Run a job to the end on this process's event loop (one-shot mode). 0 answered. */
+int mr_run(const mr_params_t *p, llm_chunk_fn on_chunk, mr_progress_fn on_progress, void *user);
+
+/* Progress on stderr: one line rewritten in place on a terminal, a line per update
+   otherwise. (NULL, 0) ends the line before other output goes to the terminal. */
+void mr_print_progress(const char *line, size_t len);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Memory writer thread. Entries queue in one buffer under a lock and the writer swaps it
+ * out whole, so replies that finish close together become one batch. What the file holds
+ * is known by line hash, open todos also by where their "[ ]" is, from one scan of the
+ * file; the scan is repeated only when the file no longer has the stamp the last batch
+ * left it with (another worker, or an editor, wrote in between).
+ */
+#include "memory.h"
+#include "buf.h"
+#include "cache.h"
+#include "prompt.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#define st_mtim   st_mtimespec
+#endif
+
+#define ENTRY_MAX 1000 /* longer lines are not taken as entries */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; /* something queued */
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER; /* a batch is done */
+static buf_t queued;
+static char queued_path[1024];
+static int started, busy;
+
+/* Writer thread only: lines of the file as of the last scan or batch. at is where the
+   blank of an open todo's "[ ]" is, kept under the hash of its ticked form; else -1. */
+typedef struct {
+  uint64_t hash;
+  off_t at;
+} line_t;
+
+static line_t *table;
+static size_t table_n, table_cap;
+static char known_path[1024];
+static struct stat known;
+static int known_ok;
+static int ends_nl; /* the file ends with a newline (or is empty) */
+
+static uint64_t key_hash(const char *k, size_t n) { return cache_hash(CACHE_HASH_INIT, k, n) | 1; /* 0: free */ }
+
+/* Hash of "- [x] task" for the open todo k = "- [ ] task". */
+static uint64_t ticked_hash(const char *k, size_t n) {
+  return cache_hash(cache_hash(CACHE_HASH_INIT, "- [x] ", 6), k + 6, n - 6) | 1;
+}
+
+static int open_todo(const char *k, size_t n) { return n > 6 && memcmp(k, "- [ ] ", 6) == 0; }
+
+static line_t *find(uint64_t h) {
+  if (!table_cap) return NULL;
+  size_t at = (size_t)h & (table_cap - 1);
+  while (table[at].hash && table[at].hash != h) at = (at + 1) & (table_cap - 1);
+  return &table[at];
+}
+
+static int remember(uint64_t h, off_t at) {
+  if ((table_n + 1) * 2 > table_cap) {
+    size_t cap = table_cap ? table_cap * 2 : 256, old_cap = table_cap;
+    line_t *old = table;
+    if (!(table = calloc(cap, sizeof(line_t)))) {
+      table = old;
+      return -1;
+    }
+    table_cap = cap;
+    for (size_t i = 0; i < old_cap; i++)
+      if (old[i].hash) *find(old[i].hash) = old[i];
+    free(old);
+  }
+  line_t *s = find(h);
+  if (!s->hash) {
+    s->hash = h;
+    s->at = at;
+    table_n++;
+  } else if (at >= 0)
+    s->at = at; /* the task was added again after it was ticked off */
+  return 0;
+}
+
+/* Line p[0..n) as an entry key into out: no surrounding blanks, "-" bullet, "[x]" lower
+   case. *lead: blanks cut from the front. 0: blank or too long. */
+static size_t entry_key(const char *p, size_t n, char *out, size_t *lead) {
+  size_t i = 0;
+  while (i < n && (p[i] == ' ' || p[i] == '\t')) i++;
+  while (n > i && (p[n - 1] == ' ' || p[n - 1] == '\t' || p[n - 1] == '\r')) n--;
+  if (n == i || n - i > ENTRY_MAX) return 0;
+  memcpy(out, p + i, n - i);
+  if (lead) *lead = i;
+  n -= i;
+  if (n >= 2 && (out[0] == '*' || out[0] == '+') && out[1] == ' ') out[0] = '-';
+  if (n >= 5 && memcmp(out, "- [X]", 5) == 0) out[3] = 'x';
+  return n;
+}
+
+static int scan(int fd, off_t size) {
+  char *text = malloc((size_t)size + 1), key[ENTRY_MAX + 1];
+  size_t got = 0;
+  if (!text) return -1;
+  while (got < (size_t)size) {
+    ssize_t r = pread(fd, text + got, (size_t)size - got, (off_t)got);
+    if (r <= 0) break;
+    got += (size_t)r;
+  }
+  if (table) memset(table, 0, table_cap * sizeof(line_t));
+  table_n = 0;
+  for (size_t r = 0; r < got;) {
+    const char *p = text + r, *eol = memchr(p, '\n', got - r);
+    size_t n = eol ? (size_t)(eol - p) : got - r, lead = 0, k = entry_key(p, n, key, &lead);
+    if (k && (remember(key_hash(key, k), -1) != 0 ||
+              (open_todo(key, k) && remember(ticked_hash(key, k), (off_t)(r + lead + 3)) != 0))) {
+      free(text);
+      return -1;
+    }
+    r += n + (eol ? 1 : 0);
+  }
+  ends_nl = got == 0 || text[got - 1] == '\n';
+  free(text);
+  return 0;
+}
+
+static int same_stamp(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void write_batch(const char *path, const char *entries, size_t len) {
+  uint64_t tr = trace_begin();
+  buf_t out = {0}, ticked = {0};
+  struct stat before, after;
+  char key[ENTRY_MAX + 1];
+  int added = 0, ticks = 0, fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0 || fstat(fd, &before) != 0) goto fail;
+  if (!known_ok || strcmp(known_path, path) != 0 || !same_stamp(&known, &before)) {
+    known_ok = 0;
+    if (scan(fd, before.st_size) != 0) goto fail;
+  }
+  known_ok = 0; /* until the batch is down */
+  if (!ends_nl) buf_append(&out, "\n", 1);
+  for (size_t r = 0; r < len;) {
+    const char *p = entries + r, *eol = memchr(p, '\n', len - r);
+    size_t n = eol ? (size_t)(eol - p) : len - r, k = entry_key(p, n, key, NULL);
+    r += n + (eol ? 1 : 0);
+    if (!k) continue;
+    uint64_t h = key_hash(key, k);
+    line_t *s = find(h);
+    if (s && s->hash && s->at >= before.st_size) { /* added by this batch */
+      out.data[s->at - before.st_size] = 'x';
+      s->at = -1;
+      continue;
+    }
+    if (s && s->hash && s->at >= 0) { /* "- [x] task" with "- [ ] task" in the file */
+      if (pwrite(fd, "x", 1, s->at) != 1) goto fail;
+      s->at = -1;
+      key[3] = ' ';
+      buf_append(&ticked, key, k);
+      buf_append(&ticked, "\n", 1);
+      ticks++;
+      continue;
+    }
+    if (s && s->hash) continue; /* already there */
+    off_t at = before.st_size + (off_t)out.len;
+    if (buf_append(&out, key, k) != 0 || buf_append(&out, "\n", 1) != 0 || remember(h, -1) != 0 ||
+        (open_todo(key, k) && remember(ticked_hash(key, k), at + 3) != 0))
+      goto fail;
+    added++;
+  }
+  for (size_t w = 0; added && w < out.len;) {
+    ssize_t n = pwrite(fd, out.data + w, out.len - w, before.st_size + (off_t)w);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) goto fail;
+    w += (size_t)n;
+  }
+  if ((added || ticks) && fdatasync(fd) != 0) goto fail;
+  if (fstat(fd, &after) != 0) goto fail;
+  known = after;
+  known_ok = 1;
+  snprintf(known_path, sizeof(known_path), "%s", path);
+  if (added) ends_nl = 1;
+  close(fd);
+  if (added || ticks)
+    prompt_file_changed(path, &before, &after, added ? out.data : NULL, added ? out.len : 0, ticked.data);
+  buf_free(&out);
+  buf_free(&ticked);
+  trace_end("memory write", tr, "entries", added + ticks);
+  return;
+fail:
+  fprintf(stderr, "neo daemon: memory %s: %s\n", path, errno ? strerror(errno) : "out of memory");
+  if (fd >= 0) close(fd);
+  buf_free(&out);
+  buf_free(&ticked);
+}
+
+static void *writer(void *arg) {
+  buf_t batch = {0};
+  char path[sizeof(queued_path)];
+  (void)arg;
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (!queued.len) pthread_cond_wait(&wake, &lock);
+    buf_t t = queued; /* swap: the next batch fills the buffer this one came in last time */
+    queued = batch;
+    queued.len = 0;
+    batch = t;
+    memcpy(path, queued_path, sizeof(path));
+    busy = 1;
+    pthread_mutex_unlock(&lock);
+    errno = 0;
+    write_batch(path, batch.data, batch.len);
+    trace_flush();
+    pthread_mutex_lock(&lock);
+    busy = 0;
+    pthread_cond_broadcast(&idle);
+  }
+  return NULL;
+}
+
+/* "```memory" or "~~~ memory" */
+static int memory_fence(const char *s, size_t n) {
+  size_t i = 0;
+  while (i < n && (s[i] == '`' || s[i] == '~')) i++;
+  while (i < n && s[i] == ' ') i++;
+  if (n - i < 6 || memcmp(s + i, "memory", 6) != 0) return 0;
+  for (i += 6; i < n; i++)
+    if (s[i] != ' ' && s[i] != '\r') return 0;
+  return 1;
+}
+
+int memory_reply(const agent_config_t *conf, const char *reply, size_t len) {
+  if (!conf->memory.write_back || !conf->memory.path || !reply) return 0;
+  buf_t got = {0};
+  int n = 0, fence = 0, in = 0;
+  for (size_t r = 0; r < len;) {
+    const char *p = reply + r, *eol = memchr(p, '\n', len - r);
+    size_t k = eol ? (size_t)(eol - p) : len - r;
+    r += k + (eol ? 1 : 0);
+    while (k && (*p == ' ' || *p == '\t')) p++, k--;
+    if (k >= 3 && (memcmp(p, "```", 3) == 0 || memcmp(p, "~~~", 3) == 0)) {
+      in = !fence && memory_fence(p, k);
+      fence = !fence;
+    } else if (in && k > 2 && k <= ENTRY_MAX && (*p == '-' || *p == '*' || *p == '+') && p[1] == ' ') {
+      buf_append(&got, p, k);
+      buf_append(&got, "\n", 1);
+      n++;
+    }
+  }
+  if (n) {
+    pthread_mutex_lock(&lock);
+    if (!started) {
+      pthread_t t;
+      int e = pthread_create(&t, NULL, writer, NULL);
+      if (e == 0) pthread_detach(t);
+      else fprintf(stderr, "neo daemon: memory writer: %s\n", strerror(e));
+      started = e == 0;
+    }
+    if (started && buf_append(&queued, got.data, got.len) == 0) {
+      snprintf(queued_path, sizeof(queued_path), "%s", conf->memory.path);
+      pthread_cond_signal(&wake);
+    } else
+      n = 0;
+    pthread_mutex_unlock(&lock);
+  }
+  buf_free(&got);
+  return n;
+}
+
+void memory_flush(void) {
+  pthread_mutex_lock(&lock);
+  while (started && (queued.len || busy)) pthread_cond_wait(&idle, &lock);
+  pthread_mutex_unlock(&lock);
+}
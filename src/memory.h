@@ -0,0 +1,25 @@
+#ifndef NEO_MEMORY_H
+#define NEO_MEMORY_H
+
+#include "config.h"
+#include <stddef.h>
+
+/*
+ * Memory write-back (memory.write_back: yes, daemon only). The note and todo skills have
+ * the model put what is to be remembered in a ```memory block of its reply, one "- …"
+ * line per entry. The daemon picks those lines out as the reply finishes and queues them
+ * for a writer thread, so the request path does no file I/O. The writer takes everything
+ * queued since its last round as one batch: entries the file already has are dropped,
+ * "- [x] task" ticks off an open "- [ ] task" line in place, the rest is appended in one
+ * write and the batch synced once, under flock so prefork workers take turns. It then
+ * patches the prompt's cached copy of the file (prompt_file_changed), so the next turn
+ * sees the new facts without MEMORY.md being read or compacted again.
+ */
+
+/* Queue the ```memory entries of reply[0..len) for conf->memory.path (nothing unless
+   write_back is on); the writer starts on first use. Returns how many were queued. */
+int memory_reply(const agent_config_t *conf, const char *reply, size_t len);
+/* Wait until everything queued is on disk. */
+void memory_flush(void);
+
+#endif
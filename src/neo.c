@@ -0,0 +1,178 @@
+/*
+ * libneo: the one-shot path (prompt, route, chat) behind a context handle, with the
+ * daemon's session histories and response cache. Config, skill index and routes are
+ * read-only once neo_open returns; sessions and the idle curl handles are behind one
+ * mutex, held only to copy in or out, never across a request.
+ */
+#include "neo.h"
+#include "arena.h"
+#include "cache.h"
+#include "cassette.h"
+#include "config.h"
+#include "llm.h"
+#include "prompt.h"
+#include "route.h"
+#include "session.h"
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IDLE_MAX 16 /* curl handles kept with a warm connection */
+
+struct neo_ctx {
+  agent_config_t conf;
+  arena_t arena;
+  const skills_index_t *skills;
+  cache_t *cache;
+  pthread_mutex_t lock;
+  session_table_t sessions;
+  CURL *idle[IDLE_MAX];
+  int n_idle;
+};
+
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+
+static void curl_setup(void) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+neo_ctx_t *neo_open(const char *config_path) {
+  pthread_once(&curl_once, curl_setup);
+  neo_ctx_t *ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) return NULL;
+  config_init(&ctx->conf);
+  if (config_load_file(&ctx->conf, config_path ? config_path : "config.yaml") != 0) {
+    config_free(&ctx->conf);
+    free(ctx);
+    return NULL;
+  }
+  config_apply_env(&ctx->conf);
+  if (arena_init(&ctx->arena, 256 * 1024 + skills_index_size(&ctx->conf)) == 0) {
+    ctx->skills = skills_index_build(&ctx->conf, &ctx->arena);
+    arena_seal(&ctx->arena);
+  }
+  ctx->cache = cache_create(ctx->conf.cache.entries, ctx->conf.cache.max_bytes, ctx->conf.cache.ttl);
+  pthread_mutex_init(&ctx->lock, NULL);
+  return ctx;
+}
+
+void neo_close(neo_ctx_t *ctx) {
+  if (!ctx) return;
+  for (int i = 0; i < ctx->n_idle; i++) curl_easy_cleanup(ctx->idle[i]);
+  session_table_free(&ctx->sessions);
+  pthread_mutex_destroy(&ctx->lock);
+  cache_destroy(ctx->cache);
+  arena_free(&ctx->arena);
+  config_free(&ctx->conf);
+  free(ctx);
+}
+
+char *neo_prompt(neo_ctx_t *ctx, const char *message) {
+  char *p = malloc(SYSTEM_MAX);
+  if (!p) return NULL;
+  prompt_build(&ctx->conf, ctx->skills, message ? message : "", p, SYSTEM_MAX, NULL);
+  char *fit = realloc(p, strlen(p) + 1);
+  return fit ? fit : p;
+}
+
+/* History of session id plus the new message, copied out under the lock; caller frees
+   the array and every content. */
+static llm_message_t *turn_messages(neo_ctx_t *ctx, const char *id, const char *message, int *n_out) {
+  pthread_mutex_lock(&ctx->lock);
+  session_t *s = id ? session_get(&ctx->sessions, id, 0) : NULL;
+  int count = s ? s->count : 0, n = 0;
+  llm_message_t *msgs = malloc((size_t)(count + 1) * sizeof(llm_message_t));
+  for (int i = 0; msgs && i < count; i++) {
+    char *c = strdup(s->messages[i].content);
+    if (c) msgs[n++] = (llm_message_t){ s->messages[i].role, c };
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  if (!msgs) return NULL;
+  msgs[n].role = "user";
+  msgs[n++].content = strdup(message);
+  *n_out = n;
+  return msgs;
+}
+
+static void free_messages(llm_message_t *msgs, int n) {
+  for (int i = 0; i < n; i++) free((char *)msgs[i].content);
+  free(msgs);
+}
+
+static CURL *take_handle(neo_ctx_t *ctx) {
+  pthread_mutex_lock(&ctx->lock);
+  CURL *c = ctx->n_idle ? ctx->idle[--ctx->n_idle] : NULL;
+  pthread_mutex_unlock(&ctx->lock);
+  return c ? c : curl_easy_init();
+}
+
+static void give_back(neo_ctx_t *ctx, CURL *c) {
+  if (!c) return;
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->n_idle < IDLE_MAX) {
+    ctx->idle[ctx->n_idle++] = c;
+    c = NULL;
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  if (c) curl_easy_cleanup(c);
+}
+
+char *neo_chat(neo_ctx_t *ctx, const char *session, const char *message, neo_chunk_fn on_chunk, void *user) {
+  if (!message) return NULL;
+  const char *id = session && strcmp(session, "-") != 0 ? session : NULL;
+  char *prompt = malloc(SYSTEM_MAX);
+  int n = 0;
+  llm_message_t *msgs = prompt ? turn_messages(ctx, id, message, &n) : NULL;
+  if (!msgs || !msgs[n - 1].content) {
+    free(prompt);
+    if (msgs) free_messages(msgs, n);
+    return NULL;
+  }
+  prompt_build(&ctx->conf, ctx->skills, message, prompt, SYSTEM_MAX, NULL);
+  route_t r;
+  route_pick(&ctx->conf, message, &r, NULL, 0);
+  llm_request_t req = { r.base_url, r.model, r.api_key, r.max_tokens, r.temperature, prompt, msgs, n,
+                        r.thinking, r.think_budget, r.no_think, r.backend, id, r.slots };
+
+  llm_response_t resp = {0};
+  uint64_t key = ctx->cache ? cache_request_key(&req) : 0;
+  int err = 0;
+  if (key && (resp.data = cache_lookup(ctx->cache, key, &resp.size)) != NULL) {
+    if (on_chunk && resp.size) on_chunk(user, resp.data, resp.size);
+  } else {
+    llm_opts_t opts = { .timeout_ms = ctx->conf.daemon_request_timeout * 1000L, .cancel_fd = -1 };
+    CURL *c = take_handle(ctx);
+    err = llm_chat_stream(&req, &opts, c, on_chunk, user, &resp);
+    give_back(ctx, c);
+    if (err == 0 && key) cache_store(ctx->cache, key, resp.data, resp.size);
+  }
+  free(prompt);
+  free_messages(msgs, n);
+  if (err != 0 || !resp.data) {
+    llm_response_free(&resp);
+    return NULL;
+  }
+  if (id) {
+    pthread_mutex_lock(&ctx->lock);
+    session_t *s = session_get(&ctx->sessions, id, 1);
+    session_append(s, "user", message);
+    session_append(s, "assistant", resp.data);
+    session_trim_to(s, ctx->conf.session_max_turns > 0 ? ctx->conf.session_max_turns : 10,
+                    (size_t)ctx->conf.session_max_bytes);
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  free(resp.thinking);
+  return resp.data;
+}
+
+void neo_reset(neo_ctx_t *ctx, const char *session) {
+  pthread_mutex_lock(&ctx->lock);
+  session_t *s = session ? session_get(&ctx->sessions, session, 0) : NULL;
+  if (s) session_clear(s);
+  pthread_mutex_unlock(&ctx->lock);
+}
+
+int neo_cassette(const char *path, int replay, int realtime) {
+  return cassette_open(path, replay ? CASSETTE_REPLAY : CASSETTE_RECORD, realtime);
+}
@@ -0,0 +1,48 @@
+#ifndef NEO_H
+#define NEO_H
+
+/*
+ * libneo: neo's prompt building and chat, embedded in another program (make lib builds
+ * libneo.a and libneo.so; link with -lneo -lcurl -lpthread).
+ *
+ * Everything lives in a neo_ctx_t: the config, the skill index, the response cache
+ * (cache.entries > 0), the idle upstream connections and the session histories. A
+ * context may be shared by any number of threads; each call runs on the caller's
+ * thread and blocks until it is done. Different contexts share nothing.
+ */
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define NEO_API __attribute__((visibility("default")))
+#else
+#define NEO_API
+#endif
+
+typedef struct neo_ctx neo_ctx_t;
+/* One piece of the answer as it streams in; not NUL-terminated. */
+typedef void (*neo_chunk_fn)(void *user, const char *text, size_t len);
+
+/* Load config_path (NULL: config.yaml), apply NEO_MODEL / NEO_API_KEY, and read the
+   skill files once. NULL when the config can't be read. */
+NEO_API neo_ctx_t *neo_open(const char *config_path);
+/* No call on ctx may still be running. */
+NEO_API void neo_close(neo_ctx_t *ctx);
+
+/* The system prompt neo sends with message (skills, bootstrap, memory); caller frees. */
+NEO_API char *neo_prompt(neo_ctx_t *ctx, const char *message);
+
+/* One turn: message goes to the model the routes pick, after the history of session
+   ("" the default one; NULL or "-" none), and the exchange is added to that history.
+   on_chunk (may be NULL) gets the answer as it streams; the whole answer is returned
+   (caller frees), NULL on failure. Turns of one session should not overlap. */
+NEO_API char *neo_chat(neo_ctx_t *ctx, const char *session, const char *message, neo_chunk_fn on_chunk, void *user);
+
+/* Forget the history of session. */
+NEO_API void neo_reset(neo_ctx_t *ctx, const char *session);
+
+/* Record every model response to the cassette at path, or with replay answer from it
+   instead of the provider (realtime: at the recorded pace), like neo --record/--replay.
+   For the whole process; call before the first neo_chat. 0 on success. */
+NEO_API int neo_cassette(const char *path, int replay, int realtime);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * OpenAI chat-completions wire format for the HTTP gateway: decode requests into
+ * llm_message_t turns, encode answers as chat.completion / chat.completion.chunk.
+ */
+#include "openai.h"
+#include "json.h"
+#include <stdlib.h>
+#include <string.h>
+
+void oai_chat_free(oai_chat_t *c) {
+  for (int i = 0; i < c->n_messages; i++) free((char *)c->messages[i].content);
+  free(c->messages);
+  free(c->model);
+  free(c->system);
+  free(c->user);
+  memset(c, 0, sizeof(*c));
+}
+
+/* content is a string, or an array of parts of which the "text" ones are kept. */
+static int read_content(const char *v, buf_t *out) {
+  v = json_ws(v);
+  if (!v) return -1;
+  if (*v == '"') return json_string(v, out) ? 0 : -1;
+  if (*v != '[') return -1;
+  for (const char *part = json_array_first(v); part; part = json_array_next(part)) {
+    const char *text = json_member(part, "text");
+    if (text && json_string(text, out) == NULL) return -1;
+  }
+  return 0;
+}
+
+static char *take(buf_t *b) {
+  if (buf_reserve(b, 0) != 0) { buf_free(b); return NULL; }
+  return b->data;
+}
+
+int oai_parse_chat(const char *body, oai_chat_t *out, const char **why) {
+  memset(out, 0, sizeof(*out));
+  out->temperature = -1;
+  out->last_user = "";
+  const char *p = json_ws(body);
+  if (!p || *p != '{' || !json_skip(p)) { *why = "request body is not a JSON object"; return -1; }
+
+  const char *v;
+  if ((v = json_member(p, "model")) && *v == '"') {
+    buf_t b = {0};
+    if (json_string(v, &b) && b.len) out->model = take(&b);
+    else buf_free(&b);
+  }
+  if ((v = json_member(p, "user")) && *v == '"') {
+    buf_t b = {0};
+    if (json_string(v, &b) && b.len) out->user = take(&b);
+    else buf_free(&b);
+  }
+  if ((v = json_member(p, "stream"))) json_bool(v, &out->stream);
+  double d;
+  if ((v = json_member(p, "max_tokens")) && json_number(v, &d) == 0 && d > 0) out->max_tokens = (int)d;
+  if ((v = json_member(p, "max_completion_tokens")) && json_number(v, &d) == 0 && d > 0) out->max_tokens = (int)d;
+  if ((v = json_member(p, "temperature")) && json_number(v, &d) == 0 && d >= 0) out->temperature = d;
+  int on; /* Qwen3's switch, top-level or as a chat template argument */
+  const char *kw = json_member(p, "chat_template_kwargs");
+  if (((v = json_member(p, "enable_thinking")) || (kw && *kw == '{' && (v = json_member(kw, "enable_thinking"))))
+      && json_bool(v, &on) == 0)
+    out->thinking = on ? LLM_THINK_ON : LLM_THINK_OFF;
+
+  const char *arr = json_member(p, "messages");
+  if (!arr || *arr != '[') { *why = "\"messages\" must be an array"; return -1; }
+  int cap = 0;
+  for (const char *m = json_array_first(arr); m; m = json_array_next(m)) cap++;
+  out->messages = calloc((size_t)(cap ? cap : 1), sizeof(llm_message_t));
+  if (!out->messages) { *why = "out of memory"; return -1; }
+
+  buf_t sys = {0};
+  for (const char *m = json_array_first(arr); m; m = json_array_next(m)) {
+    buf_t role = {0}, text = {0};
+    const char *r = json_member(m, "role");
+    const char *c = json_member(m, "content");
+    if (!r || !json_string(r, &role) || !role.data) {
+      buf_free(&role);
+      oai_chat_free(out);
+      buf_free(&sys);
+      *why = "every message needs a string \"role\"";
+      return -1;
+    }
+    if (c && strncmp(c, "null", 4) != 0 && read_content(c, &text) != 0) {
+      buf_free(&role);
+      buf_free(&text);
+      oai_chat_free(out);
+      buf_free(&sys);
+      *why = "message \"content\" must be a string or an array of parts";
+      return -1;
+    }
+    if (text.len == 0) { /* e.g. an assistant turn that only made tool calls */
+      buf_free(&role);
+      buf_free(&text);
+      continue;
+    }
+    if (strcmp(role.data, "system") == 0 || strcmp(role.data, "developer") == 0) {
+      if (sys.len) buf_puts(&sys, "\n\n");
+      buf_append(&sys, text.data, text.len);
+      buf_free(&text);
+    } else {
+      int assistant = strcmp(role.data, "assistant") == 0;
+      char *s = take(&text);
+      if (!s) { buf_free(&role); oai_chat_free(out); buf_free(&sys); *why = "out of memory"; return -1; }
+      out->messages[out->n_messages++] = (llm_message_t){ assistant ? "assistant" : "user", s };
+      if (!assistant) out->last_user = s;
+    }
+    buf_free(&role);
+  }
+  if (sys.len) out->system = take(&sys);
+  else buf_free(&sys);
+  if (out->n_messages == 0) {
+    oai_chat_free(out);
+    *why = "no user or assistant message with content";
+    return -1;
+  }
+  return 0;
+}
+
+static void head(buf_t *out, const char *object, const char *id, const char *model, long created) {
+  buf_printf(out, "{\"id\":\"%s\",\"object\":\"%s\",\"created\":%ld,\"model\":\"", id, object, created);
+  buf_json_escape(out, model);
+  buf_puts(out, "\",\"choices\":[{\"index\":0,");
+}
+
+static void escape_n(buf_t *out, const char *s, size_t len) {
+  char *z = malloc(len + 1); /* buf_json_escape wants a C string */
+  if (!z) return;
+  memcpy(z, s, len);
+  z[len] = '\0';
+  buf_json_escape(out, z);
+  free(z);
+}
+
+void oai_completion(buf_t *out, const char *id, const char *model, long created, const char *content, size_t len) {
+  head(out, "chat.completion", id, model, created);
+  buf_puts(out, "\"message\":{\"role\":\"assistant\",\"content\":\"");
+  escape_n(out, content ? content : "", content ? len : 0);
+  buf_puts(out, "\"},\"finish_reason\":\"stop\"}]}");
+}
+
+void oai_chunk_event(buf_t *out, const char *id, const char *model, long created,
+                     const char *role, const char *content, size_t len, const char *finish) {
+  buf_puts(out, "data: ");
+  head(out, "chat.completion.chunk", id, model, created);
+  buf_puts(out, "\"delta\":{");
+  if (role) buf_printf(out, "\"role\":\"%s\"%s", role, content ? "," : "");
+  if (content) {
+    buf_puts(out, "\"content\":\"");
+    escape_n(out, content, len);
+    buf_puts(out, "\"");
+  }
+  if (finish) buf_printf(out, "},\"finish_reason\":\"%s\"}]}\n\n", finish);
+  else buf_puts(out, "},\"finish_reason\":null}]}\n\n");
+}
+
+void oai_error(buf_t *out, const char *type, const char *message) {
+  buf_puts(out, "{\"error\":{\"message\":\"");
+  buf_json_escape(out, message);
+  buf_printf(out, "\",\"type\":\"%s\"}}", type);
+}
+
+void oai_models(buf_t *out, const char *model) {
+  buf_puts(out, "{\"object\":\"list\",\"data\":[{\"id\":\"");
+  buf_json_escape(out, model);
+  buf_puts(out, "\",\"object\":\"model\",\"owned_by\":\"neo\"}]}");
+}
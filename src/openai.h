@@ -0,0 +1,33 @@
+#ifndef NEO_OPENAI_H
+#define NEO_OPENAI_H
+
+#include "buf.h"
+#include "llm.h"
+
+/* A /v1/chat/completions request body, decoded. */
+typedef struct {
+  char *model;              /* NULL: use the configured model */
+  int stream;
+  int max_tokens;           /* 0: configured */
+  double temperature;       /* < 0: configured */
+  int thinking;             /* LLM_THINK_*: enable_thinking, also inside chat_template_kwargs */
+  char *system;             /* client system/developer messages joined; NULL if none */
+  llm_message_t *messages;  /* user/assistant turns, strings owned */
+  int n_messages;
+  const char *last_user;    /* last user turn (for skill matching), "" if none */
+  char *user;               /* "user": the client's conversation or end-user id; NULL if none */
+} oai_chat_t;
+
+/* 0 on success; on failure *why says what is wrong with the request. */
+int oai_parse_chat(const char *body, oai_chat_t *out, const char **why);
+void oai_chat_free(oai_chat_t *c);
+
+/* Response bodies in the OpenAI shape. */
+void oai_completion(buf_t *out, const char *id, const char *model, long created, const char *content, size_t len);
+/* One SSE event "data: {chat.completion.chunk}\n\n"; role and finish may be NULL. */
+void oai_chunk_event(buf_t *out, const char *id, const char *model, long created,
+                     const char *role, const char *content, size_t len, const char *finish);
+void oai_error(buf_t *out, const char *type, const char *message);
+void oai_models(buf_t *out, const char *model);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * System prompt assembly, shared by one-shot runs, the daemon and libneo. The only state
+ * kept between calls is the compacted bootstrap and memory files (locked), so threads
+ * may build prompts side by side.
+ */
+#include "prompt.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define FILE_CACHE 16
+
+static size_t read_file_into(char *buf, size_t cap, const char *path, size_t max_chars) {
+  FILE *f = fopen(path, "r");
+  if (!f) return 0;
+  size_t n = 0;
+  if (max_chars <= 0 || max_chars > cap - 1) max_chars = cap - 1;
+  while (n < max_chars && fgets(buf + n, (int)(cap - n), f))
+    n = strlen(buf);
+  if (n >= cap - 1) n = cap - 2;
+  buf[n] = '\0';
+  fclose(f);
+  return n;
+}
+
+/* A bootstrap or memory file as compaction left it (and, for memory with embed on, its
+   chunks and their vectors), for as long as it keeps its inode, size and mtime: requests
+   stat the file and read it again only after it changed. */
+typedef struct {
+  char *path;
+  size_t max_chars; /* 0: whole file, chunks picked per message */
+  int compact;
+  const embed_model_t *model;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  long mtime_ns; /* a ticked todo keeps the size, and often the second */
+  char *text;
+  size_t len;
+  compact_saved_t saved;
+  embed_chunk_t *chunks;
+  int8_t *vecs;
+  int nchunks;
+} file_version_t;
+
+static file_version_t files[FILE_CACHE];
+static int files_next;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long mtime_ns(const struct stat *sb) {
+#ifdef __APPLE__
+  return sb->st_mtimespec.tv_nsec;
+#else
+  return sb->st_mtim.tv_nsec;
+#endif
+}
+
+static int stamp_is(const file_version_t *v, const struct stat *sb) {
+  return v->dev == sb->st_dev && v->ino == sb->st_ino && v->size == sb->st_size && v->mtime == sb->st_mtime &&
+         v->mtime_ns == mtime_ns(sb);
+}
+
+static void stamp_set(file_version_t *v, const struct stat *sb) {
+  v->dev = sb->st_dev;
+  v->ino = sb->st_ino;
+  v->size = sb->st_size;
+  v->mtime = sb->st_mtime;
+  v->mtime_ns = mtime_ns(sb);
+}
+
+static void file_load(file_version_t *v, const char *path, size_t size, int embed) {
+  size_t room = size + 2;
+  free(v->text);
+  free(v->chunks);
+  free(v->vecs);
+  v->chunks = NULL;
+  v->vecs = NULL;
+  v->nchunks = 0;
+  v->saved.chars = v->saved.tokens = 0;
+  v->text = malloc(room);
+  v->len = v->text ? read_file_into(v->text, room, path, v->max_chars) : 0;
+  if (v->len && v->compact) v->len = compact_text(v->text, v->len, &v->saved);
+  if (!embed || !v->len) return;
+  int dim = embed_dim(v->model), cap = (int)(v->len / (EMBED_CHUNK / 4)) + 1;
+  v->chunks = malloc((size_t)cap * sizeof(embed_chunk_t));
+  if (v->chunks) v->nchunks = embed_split(v->text, v->len, v->chunks, cap);
+  v->vecs = v->nchunks ? malloc((size_t)v->nchunks * (size_t)dim) : NULL;
+  if (!v->vecs) v->nchunks = 0;
+  for (int k = 0; k < v->nchunks; k++)
+    embed_text(v->model, v->text + v->chunks[k].off, v->chunks[k].len, v->vecs + (size_t)k * dim);
+}
+
+/* The chunks of v closest to q that fit in max_chars together, in file order. */
+static size_t pick_chunks(const file_version_t *v, const int8_t *q, size_t max_chars, char *buf, size_t cap) {
+  int n = v->nchunks, dim = embed_dim(v->model);
+  float *score = malloc((size_t)n * sizeof(float));
+  int *order = malloc((size_t)n * sizeof(int));
+  unsigned char *take = calloc((size_t)n, 1);
+  size_t used = 0;
+  if (score && order && take) {
+    for (int k = 0; k < n; k++) score[k] = embed_score(q, v->vecs + (size_t)k * dim, dim);
+    int got = embed_top(score, n, n, -2.0f, order);
+    for (int k = 0; k < got; k++) {
+      size_t len = v->chunks[order[k]].len + (used ? 2 : 0);
+      if (used + len <= max_chars) {
+        take[order[k]] = 1;
+        used += len;
+      }
+    }
+    used = 0;
+    for (int k = 0; k < n; k++) {
+      if (!take[k] || used + v->chunks[k].len + 3 > cap) continue;
+      if (used) {
+        memcpy(buf + used, "\n\n", 2);
+        used += 2;
+      }
+      memcpy(buf + used, v->text + v->chunks[k].off, v->chunks[k].len);
+      used += v->chunks[k].len;
+    }
+  }
+  buf[used] = '\0';
+  free(score);
+  free(order);
+  free(take);
+  return used;
+}
+
+/* path into buf (cap bytes) from the cache: compacted (conf->prompt_compact), and when
+   q is given and the file is over max_chars, cut to the chunks closest to q. */
+static size_t read_cached(char *buf, size_t cap, const char *path, size_t max_chars, const agent_config_t *conf,
+                          const int8_t *q, compact_saved_t *saved) {
+  struct stat sb;
+  if (stat(path, &sb) != 0 || cap < 2) return 0;
+  const embed_model_t *model = q ? embed_model(conf->embed.model) : NULL;
+  size_t limit = q ? 0 : max_chars;
+  pthread_mutex_lock(&files_lock);
+  file_version_t *v = NULL;
+  for (int i = 0; i < FILE_CACHE && !v; i++)
+    if (files[i].path && files[i].max_chars == limit && files[i].compact == conf->prompt_compact &&
+        files[i].model == model && (files[i].vecs != NULL) == (q != NULL) && strcmp(files[i].path, path) == 0)
+      v = &files[i];
+  if (!v) {
+    v = &files[files_next];
+    files_next = (files_next + 1) % FILE_CACHE;
+    free(v->path);
+    v->path = strdup(path);
+    v->max_chars = limit;
+    v->compact = conf->prompt_compact;
+    v->model = model;
+    v->size = -1;
+  }
+  if (!stamp_is(v, &sb)) {
+    uint64_t tr = trace_begin();
+    file_load(v, path, (size_t)sb.st_size, q != NULL);
+    trace_end("load", tr, "chunks", v->nchunks);
+    stamp_set(v, &sb);
+    if (!v->text || !v->path) v->size = -1; /* not kept: read again next time */
+  }
+  size_t n;
+  if (q && max_chars > 0 && v->len > max_chars && v->nchunks) {
+    uint64_t tr = trace_begin();
+    n = pick_chunks(v, q, max_chars, buf, cap);
+    trace_end("embed pick", tr, "chunks", v->nchunks);
+  } else {
+    n = v->len < cap - 1 ? v->len : cap - 1;
+    if (n) memcpy(buf, v->text, n);
+    buf[n] = '\0';
+  }
+  if (saved) {
+    saved->chars += v->saved.chars;
+    saved->tokens += v->saved.tokens;
+  }
+  pthread_mutex_unlock(&files_lock);
+  return n;
+}
+
+/* Tick off the open todo line (as it is in the file) in v's text; 0: not there. */
+static int tick(file_version_t *v, const char *line, size_t n) {
+  char want[1024];
+  if (n < 5 || n >= sizeof(want)) return 0;
+  memcpy(want, line, n);
+  want[n] = '\0';
+  if (v->compact) n = compact_text(want, n, NULL);
+  for (char *p = v->text; (p = strstr(p, want)) != NULL; p++) {
+    const char *b = p;
+    while (b > v->text && (b[-1] == ' ' || b[-1] == '\t')) b--;
+    if ((b == v->text || b[-1] == '\n') && (p[n] == '\n' || p[n] == '\0' || p[n] == '\r')) {
+      p[3] = 'x'; /* "- [ ] …" */
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* added[0..len) appended to v's text, compacted and embedded the way file_load would;
+   0: out of memory. */
+static int append_text(file_version_t *v, const char *added, size_t len) {
+  size_t old = v->len, sep = v->compact && old ? 1 : 0;
+  char *t = realloc(v->text, old + sep + len + 1);
+  if (!t) return 0;
+  v->text = t;
+  memcpy(t + old + sep, added, len);
+  t[old + sep + len] = '\0';
+  size_t n = v->compact ? compact_text(t + old + sep, len, &v->saved) : len;
+  if (n == 0) {
+    t[old] = '\0';
+    return 1;
+  }
+  if (sep) t[old] = '\n';
+  v->len = old + sep + n;
+  if (!v->vecs) return 1;
+  int dim = embed_dim(v->model), cap = (int)(n / (EMBED_CHUNK / 4)) + 1;
+  embed_chunk_t *chunks = realloc(v->chunks, (size_t)(v->nchunks + cap) * sizeof(embed_chunk_t));
+  if (!chunks) return 0;
+  v->chunks = chunks;
+  int got = embed_split(t + old + sep, n, chunks + v->nchunks, cap);
+  int8_t *vecs = realloc(v->vecs, (size_t)(v->nchunks + got) * (size_t)dim);
+  if (!vecs) return 0;
+  v->vecs = vecs;
+  for (int k = v->nchunks; k < v->nchunks + got; k++) {
+    chunks[k].off += old + sep;
+    embed_text(v->model, t + chunks[k].off, chunks[k].len, vecs + (size_t)k * dim);
+  }
+  v->nchunks += got;
+  return 1;
+}
+
+void prompt_file_changed(const char *path, const struct stat *before, const struct stat *after, const char *added,
+                         size_t len, const char *ticked) {
+  pthread_mutex_lock(&files_lock);
+  for (int i = 0; i < FILE_CACHE; i++) {
+    file_version_t *v = &files[i];
+    if (!v->path || !v->text || strcmp(v->path, path) != 0 || !stamp_is(v, before)) continue;
+    /* a copy cut at max_chars already ends before anything appended */
+    int whole = !v->max_chars || (size_t)before->st_size < v->max_chars, ok = 1;
+    for (const char *p = ticked; p && *p;) {
+      const char *eol = strchr(p, '\n');
+      size_t n = eol ? (size_t)(eol - p) : strlen(p);
+      if (!tick(v, p, n) && whole) ok = 0;
+      p += n + (eol ? 1 : 0);
+    }
+    if (len && whole && ok)
+      ok = (!v->max_chars || (size_t)after->st_size <= v->max_chars) && append_text(v, added, len);
+    if (ok) stamp_set(v, after);
+    else v->size = -1;
+  }
+  pthread_mutex_unlock(&files_lock);
+}
+
+/* Appends "<title><shown>\n\n<file at path>\n\n" to dest, reading the file straight into
+   place (no staging buffer), or copying it from the cache when it is compacted, picked
+   from (q: the message's vector) or kept current by the memory writer. Bytes of the
+   file taken; 0 adds nothing. */
+static size_t append_file_section(char *dest, size_t cap, const char *title, const char *shown, const char *path,
+                                  size_t max_chars, const agent_config_t *conf, const int8_t *q, compact_saved_t *saved) {
+  size_t used = strlen(dest), head = strlen(title) + strlen(shown) + 2;
+  if (used + head + 64 > cap) return 0;
+  char *body = dest + used + head;
+  size_t room = cap - used - head - 62;
+  size_t n = conf->prompt_compact || q || conf->memory.write_back
+                 ? read_cached(body, room, path, max_chars, conf, q, saved)
+                 : read_file_into(body, room, path, max_chars);
+  if (n == 0 || !body[0]) {
+    dest[used] = '\0';
+    return 0;
+  }
+  memcpy(dest + used, title, strlen(title));
+  memcpy(dest + used + strlen(title), shown, strlen(shown));
+  memcpy(body - 2, "\n\n", 2);
+  memcpy(body + n, "\n\n", 3);
+  return n;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void append_skills(const agent_config_t *conf, const skills_index_t *idx, const char *user_message,
+                          char *out, size_t cap, int priority_filter, skills_report_t *report) {
+  if (idx) skills_append_from_index(idx, user_message, out, cap, priority_filter, report);
+  else skills_append_to_system_prompt(conf, user_message, out, cap, priority_filter, report);
+}
+
+void prompt_build(const agent_config_t *conf, const skills_index_t *idx, const char *user_message,
+                  char *out, size_t cap, prompt_info_t *info) {
+  uint64_t span = trace_begin(), tr;
+  skills_report_t report;
+  compact_saved_t *saved = &report.saved;
+  memset(&report, 0, sizeof(report));
+  out[0] = '\0';
+  strncat(out, "You are a helpful assistant. Follow any skill and bootstrap instructions below.\n\n", cap - 1);
+  {
+    time_t now = time(NULL);
+    struct tm utc;
+    char datebuf[80];
+    char line[128]; /* the prefix and all of datebuf */
+    if (gmtime_r(&now, &utc) && strftime(datebuf, sizeof(datebuf), "%Y-%m-%d %H:%M UTC", &utc) > 0)
+      snprintf(line, sizeof(line), "Current date and time: %s\n\n", datebuf);
+    else
+      strcpy(line, "Current date and time: (unknown)\n\n");
+    strncat(out, line, cap - 1);
+  }
+  double t0 = now_ms();
+  tr = trace_begin();
+  append_skills(conf, idx, user_message, out, cap, 1, &report); /* high priority first */
+  trace_end("skills high_priority", tr, NULL, 0);
+  double skill_time = now_ms() - t0;
+  for (int i = 0; i < conf->bootstrap.path_count; i++) {
+    size_t max_c = (conf->bootstrap.max_chars_per_file > 0) ? (size_t)conf->bootstrap.max_chars_per_file : 8000;
+    tr = trace_begin();
+    size_t n = append_file_section(out, cap, "## Bootstrap: ", conf->bootstrap.paths[i], conf->bootstrap.paths[i], max_c,
+                                   conf, NULL, saved);
+    trace_end(conf->bootstrap.paths[i], tr, "bytes", (long)n);
+  }
+  t0 = now_ms();
+  tr = trace_begin();
+  append_skills(conf, idx, user_message, out, cap, 0, &report); /* normal skills */
+  trace_end("skills", tr, NULL, 0);
+  skill_time += now_ms() - t0;
+  if (conf->memory.path) {
+    tr = trace_begin();
+    int8_t *q = NULL; /* embed: a memory over max_chars sends the chunks closest to the message */
+    if (conf->embed.enabled && user_message) {
+      const embed_model_t *m = embed_model(conf->embed.model);
+      if ((q = malloc((size_t)embed_dim(m))) != NULL) embed_text(m, user_message, strlen(user_message), q);
+    }
+    size_t n = append_file_section(out, cap, "## Memory (context)\n\n", "", conf->memory.path,
+                                   (size_t)conf->memory.max_chars, conf, q, saved);
+    free(q);
+    trace_end("memory", tr, "bytes", (long)n);
+  }
+  size_t len = strlen(out);
+  if (conf->prompt_compact) {
+    tr = trace_begin();
+    size_t before = saved->chars;
+    len = compact_dedupe(out, len, saved);
+    trace_end("dedupe", tr, "bytes", (long)(saved->chars - before));
+  }
+  trace_end("build_system_prompt", span, "bytes", (long)len);
+  if (info) {
+    info->skills_ms = skill_time;
+    info->saved = *saved;
+    memcpy(info->picked, report.picked, sizeof(info->picked));
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef NEO_PROMPT_H
+#define NEO_PROMPT_H
+
+#include "config.h"
+#include "skills.h"
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifdef NEO_LOWMEM /* make LOWMEM=1: prompts past 64 KB lose their last sections */
+#define SYSTEM_MAX (64 * 1024)
+#else
+#define SYSTEM_MAX (256 * 1024)
+#endif
+
+typedef struct {
+  double skills_ms;      /* spent on skill matching */
+  compact_saved_t saved; /* what prompt.compact took out */
+  char picked[160];      /* skills picked by embedding (skills_report_t) */
+} prompt_info_t;
+
+/* System prompt for one user message into out (cap bytes): preamble, clock, high-priority
+   skills, bootstrap files, the other skills, memory. Skills come from idx when there is
+   one, else straight from disk. With prompt.compact the sections are compacted and lines
+   repeated across them dropped (compact.h). With embed.enabled, skills close to the message
+   are injected full and a memory file over memory.max_chars is cut to its closest chunks
+   (embed.h). Reentrant; info may be NULL. */
+void prompt_build(const agent_config_t *conf, const skills_index_t *idx, const char *user_message,
+                  char *out, size_t cap, prompt_info_t *info);
+/* The memory writer (memory.h) changed path from stamp *before to *after: appended
+   added[0..len) and/or ticked off the open todos listed in ticked (lines as they were in
+   the file, one per line; may be NULL). Cached copies current at *before take the change
+   and the new stamp, so the next prompt neither reads nor compacts the file again; any
+   other copy is read again as usual. */
+void prompt_file_changed(const char *path, const struct stat *before, const struct stat *after, const char *added,
+                         size_t len, const char *ticked);
+
+#endif
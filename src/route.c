@@ -0,0 +1,96 @@
+/*
+ * Model routing: cheap queries (a matched translate/me skill, a short message) go to a
+ * small fast profile, code and long inputs to a bigger one. Everything here is a few
+ * string scans of the user message; no request is made to decide.
+ */
+#include "route.h"
+#include "skills.h"
+#include <stdio.h>
+#include <string.h>
+
+void route_default(const agent_config_t *conf, route_t *out) {
+  out->index = 0;
+  out->name = "default";
+  out->base_url = conf->model.base_url;
+  out->model = conf->model.name;
+  out->api_key = conf->model.api_key;
+  out->max_tokens = conf->model.max_tokens;
+  out->temperature = conf->model.temperature;
+  out->thinking = conf->model.thinking;
+  out->think_budget = conf->model.think_budget;
+  out->no_think = conf->model.no_think;
+  out->backend = conf->model.backend;
+  out->slots = conf->model.slots;
+}
+
+static int find_profile(const agent_config_t *conf, const char *name) {
+  for (int i = 0; name && i < conf->profile_count; i++)
+    if (conf->profiles[i].name && strcmp(conf->profiles[i].name, name) == 0) return i;
+  return -1;
+}
+
+static size_t utf8_chars(const char *s) {
+  size_t n = 0;
+  for (; *s; s++)
+    if (((unsigned char)*s & 0xC0) != 0x80) n++;
+  return n;
+}
+
+/* A fenced block, or at least two lines ending in ; { or }. */
+static int looks_like_code(const char *s) {
+  if (strstr(s, "```")) return 1;
+  int lines = 0;
+  for (const char *p = s; *p; p++) {
+    if (p[1] != '\n' && p[1] != '\0') continue;
+    const char *q = p;
+    while (q > s && (*q == ' ' || *q == '\t' || *q == '\r')) q--;
+    if (*q == ';' || *q == '{' || *q == '}') lines++;
+  }
+  return lines >= 2;
+}
+
+void route_pick(const agent_config_t *conf, const char *user_message, route_t *out, char *why, size_t cap) {
+  route_default(conf, out);
+  const char *msg = user_message ? user_message : "";
+  size_t chars = utf8_chars(msg);
+  int code = -1; /* looked at only if a route asks */
+  for (int i = 0; i < conf->route_count; i++) {
+    const route_config_t *r = &conf->routes[i];
+    int p = find_profile(conf, r->profile);
+    if (p < 0) continue;
+    if (r->min_chars > 0 && chars < (size_t)r->min_chars) continue;
+    if (r->max_chars > 0 && chars > (size_t)r->max_chars) continue;
+    if (r->code) {
+      if (code < 0) code = looks_like_code(msg);
+      if (!code) continue;
+    }
+    const char *skill = NULL;
+    for (int k = 0; k < r->skill_count && !skill; k++)
+      if (skills_matched(conf, r->skills[k], msg)) skill = r->skills[k];
+    if (r->skill_count > 0 && !skill) continue;
+
+    const profile_config_t *pc = &conf->profiles[p];
+    out->index = p + 1;
+    out->name = pc->name;
+    if (pc->base_url) out->base_url = pc->base_url;
+    if (pc->model) out->model = pc->model;
+    if (pc->api_key) out->api_key = pc->api_key;
+    if (pc->max_tokens > 0) out->max_tokens = pc->max_tokens;
+    if (pc->temperature >= 0) out->temperature = pc->temperature;
+    if (pc->thinking) {
+      out->thinking = pc->thinking;
+      out->no_think = pc->no_think;
+    }
+    if (pc->think_budget > 0) out->think_budget = pc->think_budget;
+    if (pc->backend) {
+      out->backend = pc->backend;
+      out->slots = pc->slots;
+    }
+    if (why)
+      snprintf(why, cap, "route %d -> profile %s (%s, max_tokens %d): %s%s%s%zu chars%s", i + 1, pc->name,
+               out->model ? out->model : "?", out->max_tokens, skill ? "skill " : "", skill ? skill : "",
+               skill ? ", " : "", chars, r->code ? ", looks like code" : "");
+    return;
+  }
+  if (why) snprintf(why, cap, "no route taken (%zu chars) -> default model %s", chars, out->model ? out->model : "?");
+}
@@ -0,0 +1,28 @@
+#ifndef NEO_ROUTE_H
+#define NEO_ROUTE_H
+
+#include "config.h"
+#include <stddef.h>
+
+/* The model one query goes to: the profile picked by the config's routes, or model.*. */
+typedef struct {
+  int index;          /* 0: model.*, i: profiles[i - 1] (stats key) */
+  const char *name;   /* profile name, "default" for model.* */
+  const char *base_url;
+  const char *model;
+  const char *api_key;
+  int max_tokens;
+  double temperature;
+  int thinking;       /* LLM_THINK_* */
+  int think_budget;
+  int no_think;
+  int backend;        /* LLM_BACKEND_* */
+  int slots;
+} route_t;
+
+/* model.* as is: no routes configured, or the caller named a model explicitly. */
+void route_default(const agent_config_t *conf, route_t *out);
+/* Try the routes in order on user_message. why (may be NULL) gets the reason for -d. */
+void route_pick(const agent_config_t *conf, const char *user_message, route_t *out, char *why, size_t cap);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Session table: a small fixed set of histories keyed by client-chosen id, LRU-evicted.
+ */
+#include "session.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+static session_table_t process_sessions;
+
+void session_clear(session_t *s) {
+  for (int i = 0; i < s->count; i++) free(s->messages[i].content);
+  free(s->system);
+  s->system = NULL;
+  s->count = 0;
+  s->bytes = 0;
+}
+
+session_t *session_find(const char *id, int create) {
+  return session_get(&process_sessions, id, create);
+}
+
+session_table_t *session_process_table(void) {
+  return &process_sessions;
+}
+
+session_t *session_get(session_table_t *t, const char *id, int create) {
+  session_t **sessions = t->slots;
+  if (!id) id = "";
+  int free_slot = -1, lru = -1;
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    session_t *s = sessions[i];
+    if (!s) { if (free_slot < 0) free_slot = i; continue; }
+    if (strcmp(s->id, id) == 0) {
+      s->last_used = time(NULL);
+      return s;
+    }
+    if (lru < 0 || s->last_used < sessions[lru]->last_used) lru = i;
+  }
+  if (!create) return NULL;
+  session_t *s;
+  if (free_slot >= 0) {
+    s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    sessions[free_slot] = s;
+  } else {
+    s = sessions[lru];
+    session_clear(s);
+  }
+  strncpy(s->id, id, sizeof(s->id) - 1);
+  s->id[sizeof(s->id) - 1] = '\0';
+  s->last_used = time(NULL);
+  return s;
+}
+
+void session_table_free(session_table_t *t) {
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    if (!t->slots[i]) continue;
+    session_clear(t->slots[i]);
+    free(t->slots[i]);
+    t->slots[i] = NULL;
+  }
+}
+
+static void drop_oldest(session_t *s) {
+  s->bytes -= strlen(s->messages[0].content);
+  free(s->messages[0].content);
+  memmove(&s->messages[0], &s->messages[1], (s->count - 1) * sizeof(s->messages[0]));
+  s->count--;
+}
+
+void session_append(session_t *s, const char *role, const char *content) {
+  if (!s || !role || !content) return;
+  if (s->count >= MAX_SESSION_MESSAGES) drop_oldest(s);
+  s->messages[s->count].role = strcmp(role, "assistant") == 0 ? "assistant" : "user";
+  s->messages[s->count].content = strdup(content);
+  if (s->messages[s->count].content) {
+    s->bytes += strlen(content);
+    s->count++;
+  }
+}
+
+void session_trim_to(session_t *s, int max_turns, size_t max_bytes) {
+  int max_msg = max_turns * 2;
+  if (!s || (s->count <= max_msg && (!max_bytes || s->bytes <= max_bytes))) return;
+  uint64_t t0 = trace_begin();
+  int before = s->count;
+  while (s->count > max_msg || (max_bytes && s->bytes > max_bytes && s->count > 2)) drop_oldest(s);
+  trace_end("session_trim", t0, "dropped", before - s->count);
+}
@@ -0,0 +1,46 @@
+#ifndef NEO_SESSION_H
+#define NEO_SESSION_H
+
+#include <time.h>
+
+#define MAX_SESSION_MESSAGES 64
+#define SESSION_ID_MAX 64
+
+typedef struct {
+  const char *role; /* "user" or "assistant", not allocated */
+  char *content;
+} session_msg_t;
+
+/* Conversation history for one client session. The daemon's line protocol and stdin
+   mode share the session with the empty id. */
+typedef struct {
+  char id[SESSION_ID_MAX];
+  session_msg_t messages[MAX_SESSION_MESSAGES];
+  int count;
+  size_t bytes;     /* content held, for session.max_bytes */
+  time_t last_used;
+  char *system;     /* system prompt kept from the first turn for a caching backend; NULL: none */
+} session_t;
+
+#define MAX_SESSIONS 256
+
+/* A small fixed set of histories keyed by id, LRU-evicted. Not locked: a table used
+   from several threads needs the caller's lock around it. */
+typedef struct {
+  session_t *slots[MAX_SESSIONS];
+} session_table_t;
+
+/* Look up a session in t; with create, make it, evicting the least recently used one
+   when the table is full. */
+session_t *session_get(session_table_t *t, const char *id, int create);
+void session_table_free(session_table_t *t);
+/* session_get on the process's own table (daemon, stdin mode). */
+session_t *session_find(const char *id, int create);
+session_table_t *session_process_table(void);
+void session_append(session_t *s, const char *role, const char *content);
+void session_clear(session_t *s); /* forget the history, keep the session */
+/* Drop the oldest messages until at most max_turns pairs and (max_bytes > 0) at most
+   max_bytes of text are left; the newest pair is always kept. */
+void session_trim_to(session_t *s, int max_turns, size_t max_bytes);
+
+#endif
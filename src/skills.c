@@ -3,14 +3,18 @@
  * Reduces system prompt size when many skills are configured.
  */
 #include "skills.h"
+#include "trace.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define SKILL_INDEX_CHARS 400
 #define SKILL_FULL_CHARS  32000
 #define TMP_BUF_SIZE      65536
+#define SKILL_CHUNKS      128   /* vectors per skill at most (embed) */
+#define CHUNK_BYTES_MIN   64    /* embed_split: what a chunk covers at least, on average */
 
 /* Get directory name from path, e.g. "skills/nanjing/SKILL.md" -> "nanjing". */
 static void path_to_skill_name(const char *path, char *name_out, size_t name_max) {
@@ -19,7 +23,7 @@ static void path_to_skill_name(const char *path, char *name_out, size_t name_max
   if (!last_slash) return;
   const char *prev_slash = last_slash;
   while (prev_slash > path && prev_slash[-1] != '/') prev_slash--;
-  const char *segment = (prev_slash > path && prev_slash[0] == '/') ? prev_slash + 1 : path;
+  const char *segment = prev_slash; /* the directory holding SKILL.md */
   size_t len = (size_t)(last_slash - segment);
   if (len >= name_max) len = name_max - 1;
   memcpy(name_out, segment, len);
@@ -44,25 +48,21 @@ static int keyword_in_message(const char *user_message, const char *keyword) {
   return strstr(user_message, keyword) != NULL;
 }
 
-/* 1 if we should load full skill content for this path given user_message. */
-static int skill_matches_user(const char *path, const char *user_message) {
-  char name[64];
-  path_to_skill_name(path, name, sizeof(name));
-  if (!*name) return 0;
-
-  static char lower_buf[65536];
-  size_t ulen = user_message ? strlen(user_message) : 0;
-  if (ulen >= sizeof(lower_buf)) ulen = sizeof(lower_buf) - 1;
-  for (size_t i = 0; i < ulen; i++)
-    lower_buf[i] = (unsigned char)user_message[i] < 128 ? (char)tolower((unsigned char)user_message[i]) : user_message[i];
-  lower_buf[ulen] = '\0';
+/* strstr ignoring ASCII case, for a needle already in lower case; the message is not copied. */
+static int contains_lower(const char *hay, const char *needle) {
+  size_t n = strlen(needle);
+  for (; *hay; hay++) {
+    size_t i = 0;
+    while (i < n && tolower((unsigned char)hay[i]) == (unsigned char)needle[i]) i++;
+    if (i == n) return 1;
+  }
+  return 0;
+}
 
-  char name_lower[64];
-  size_t nlen = strlen(name);
-  if (nlen >= sizeof(name_lower)) nlen = sizeof(name_lower) - 1;
-  for (size_t i = 0; i <= nlen; i++)
-    name_lower[i] = (char)tolower((unsigned char)name[i]);
-  if (strstr(lower_buf, name_lower)) return 1;
+/* 1 if the skill called name (already lower-case) is relevant to user_message. */
+static int skill_name_matches(const char *name, const char *name_lower, const char *user_message) {
+  if (!*name) return 0;
+  if (user_message && contains_lower(user_message, name_lower)) return 1;
 
   const char *kw = get_keywords_for_name(name);
   while (*kw) {
@@ -72,6 +72,40 @@ static int skill_matches_user(const char *path, const char *user_message) {
   return 0;
 }
 
+static void lower_name(const char *name, char *out, size_t cap) {
+  size_t nlen = strlen(name);
+  if (nlen >= cap) nlen = cap - 1;
+  for (size_t i = 0; i < nlen; i++)
+    out[i] = (char)tolower((unsigned char)name[i]);
+  out[nlen] = '\0';
+}
+
+/* 1 if we should load full skill content for this path given user_message. */
+static int skill_matches_user(const char *path, const char *user_message) {
+  char name[64];
+  char name_lower[64];
+  path_to_skill_name(path, name, sizeof(name));
+  lower_name(name, name_lower, sizeof(name_lower));
+  return skill_name_matches(name, name_lower, user_message);
+}
+
+int skills_matched(const agent_config_t *conf, const char *name, const char *user_message) {
+  char path_name[64], name_lower[64];
+  for (int i = 0; i < conf->skills.path_count; i++) {
+    path_to_skill_name(conf->skills.paths[i], path_name, sizeof(path_name));
+    if (strcmp(path_name, name) != 0) continue;
+    lower_name(name, name_lower, sizeof(name_lower));
+    return skill_name_matches(path_name, name_lower, user_message);
+  }
+  return 0;
+}
+
+/* Largest n' <= n that does not split a UTF-8 sequence. */
+static size_t utf8_floor(const char *s, size_t n) {
+  while (n > 0 && ((unsigned char)s[n] & 0xC0) == 0x80) n--;
+  return n;
+}
+
 static size_t read_file_into(char *buf, size_t cap, const char *path, size_t max_chars) {
   FILE *f = fopen(path, "r");
   if (!f) return 0;
@@ -96,23 +130,227 @@ static void append_section(char *dest, size_t cap, const char *title, const char
   strncat(dest, "\n\n", cap - used - 1);
 }
 
-void skills_append_to_system_prompt(agent_config_t *conf, const char *user_message, char *dest, size_t cap, int priority_filter) {
+static void report_saved(skills_report_t *report, const compact_saved_t *one) {
+  if (!report) return;
+  report->saved.chars += one->chars;
+  report->saved.tokens += one->tokens;
+}
+
+static void report_pick(skills_report_t *report, const char *name, float score) {
+  if (!report) return;
+  size_t used = strlen(report->picked);
+  if (used + strlen(name) + 10 < sizeof(report->picked))
+    snprintf(report->picked + used, sizeof(report->picked) - used, "%s%s %.2f", used ? ", " : "", name, score);
+}
+
+/* embed.min_score, or the default for m's kind of vector when not set. */
+static float pick_min_score(const agent_config_t *conf, const embed_model_t *m) {
+  if (conf->embed.min_score >= 0) return (float)conf->embed.min_score;
+  return m ? EMBED_MIN_SCORE_MODEL : EMBED_MIN_SCORE_HASHED;
+}
+
+/* Set pick[i] for the top_k of score[0..n) that reach min_score; returns the order in
+   top (best first, top_k slots) and the count. */
+static int pick_top(const float *score, int n, int top_k, float min_score, unsigned char *pick, int *top) {
+  int got = embed_top(score, n, top_k, min_score, top);
+  for (int k = 0; k < got; k++) pick[top[k]] = 1;
+  return got;
+}
+
+/* Best cosine between q and the chunks of text[0..n), embedded on the spot. */
+static float best_chunk(const embed_model_t *m, const int8_t *q, const char *text, size_t n, int8_t *v) {
+  embed_chunk_t ch[SKILL_CHUNKS];
+  int dim = embed_dim(m), c = embed_split(text, n, ch, SKILL_CHUNKS);
+  float best = -1;
+  for (int k = 0; k < c; k++) {
+    embed_text(m, text + ch[k].off, ch[k].len, v);
+    float sc = embed_score(q, v, dim);
+    if (sc > best) best = sc;
+  }
+  return best;
+}
+
+/* One-shot embedding pass: read and score every normal skill in the filter against the
+   message, then mark the closest in pick (path_count entries). */
+static void disk_pick(const agent_config_t *conf, const char *user_message, int priority_filter, char *tmp,
+                      unsigned char *pick, skills_report_t *report) {
+  int n = conf->skills.path_count, k = conf->embed.top_k;
+  const embed_model_t *m = embed_model(conf->embed.model);
+  int dim = embed_dim(m);
+  float *score = malloc((size_t)n * sizeof(float));
+  int *top = malloc((size_t)(k > 0 ? k : 1) * sizeof(int));
+  int8_t *q = malloc((size_t)dim * 2), *v = q + dim;
+  if (!score || !top || !q) goto out;
+  uint64_t t0 = trace_begin();
+  embed_text(m, user_message, strlen(user_message), q);
+  for (int i = 0; i < n; i++) {
+    int p = conf->skills.priority ? conf->skills.priority[i] : 0;
+    score[i] = -1;
+    if (p != 0 || (priority_filter >= 0 && priority_filter != 0)) continue;
+    size_t len = read_file_into(tmp, TMP_BUF_SIZE, conf->skills.paths[i], SKILL_FULL_CHARS);
+    if (len > 0 && conf->prompt_compact) len = compact_text(tmp, len, NULL);
+    if (len > 0) score[i] = best_chunk(m, q, tmp, len, v);
+  }
+  int got = pick_top(score, n, k, pick_min_score(conf, m), pick, top);
+  for (int j = 0; j < got; j++) {
+    char name[64];
+    path_to_skill_name(conf->skills.paths[top[j]], name, sizeof(name));
+    report_pick(report, name, score[top[j]]);
+  }
+  trace_end("embed pick", t0, "skills", (long)n);
+out:
+  free(score);
+  free(top);
+  free(q);
+}
+
+void skills_append_to_system_prompt(const agent_config_t *conf, const char *user_message, char *dest, size_t cap, int priority_filter,
+                                    skills_report_t *report) {
   char *tmp = malloc(TMP_BUF_SIZE);
-  if (!tmp) return;
+  unsigned char *pick = calloc((size_t)conf->skills.path_count + 1, 1);
+  if (!tmp || !pick) {
+    free(tmp);
+    free(pick);
+    return;
+  }
+  if (conf->embed.enabled && priority_filter != 1 && user_message)
+    disk_pick(conf, user_message, priority_filter, tmp, pick, report);
 
   for (int i = 0; i < conf->skills.path_count; i++) {
     int p = (conf->skills.priority && i < conf->skills.path_count) ? conf->skills.priority[i] : 0;
     if (priority_filter >= 0 && (priority_filter ? (p != 1) : (p != 0))) continue; /* -1: all; 1: only high; 0: only normal */
     const char *path = conf->skills.paths[i];
     /* High-priority skills always load full content so key data (e.g. 必引) is never truncated */
-    int full = (priority_filter == 1 && p == 1) ? 1 : skill_matches_user(path, user_message);
+    int full = (priority_filter == 1 && p == 1) ? 1 : pick[i] || skill_matches_user(path, user_message);
     if (!full && conf->skills.unmatched) continue; /* skip this skill to save context */
-    size_t max_c = full ? (size_t)SKILL_FULL_CHARS : (size_t)SKILL_INDEX_CHARS;
-    if (read_file_into(tmp, TMP_BUF_SIZE, path, max_c) > 0) {
+    /* compaction shrinks the text, so the index prefix is cut after it */
+    size_t max_c = full || conf->prompt_compact ? (size_t)SKILL_FULL_CHARS : (size_t)SKILL_INDEX_CHARS;
+    uint64_t t0 = trace_begin();
+    size_t n = read_file_into(tmp, TMP_BUF_SIZE, path, max_c);
+    if (n > 0 && conf->prompt_compact) {
+      compact_saved_t one = {0, 0};
+      compact_text(tmp, n, &one);
+      if (full) report_saved(report, &one);
+    }
+    if (n > 0) {
       if (!full && strlen(tmp) > (size_t)SKILL_INDEX_CHARS)
-        tmp[SKILL_INDEX_CHARS] = '\0';
+        tmp[utf8_floor(tmp, SKILL_INDEX_CHARS)] = '\0';
       append_section(dest, cap, "## Skill: ", path, tmp);
     }
+    trace_end(path, t0, "bytes", (long)n);
+  }
+  free(tmp);
+  free(pick);
+}
+
+size_t skills_index_size(const agent_config_t *conf) {
+  int dim = conf->embed.enabled ? embed_dim(embed_model(conf->embed.model)) : 0;
+  size_t size = sizeof(skills_index_t) + (size_t)conf->skills.path_count * sizeof(skill_entry_t);
+  for (int i = 0; i < conf->skills.path_count; i++) {
+    struct stat sb;
+    size_t len = stat(conf->skills.paths[i], &sb) == 0 ? (size_t)sb.st_size : 0, chunks;
+    if (len > SKILL_FULL_CHARS) len = SKILL_FULL_CHARS;
+    chunks = len / CHUNK_BYTES_MIN + 2;
+    if (chunks > SKILL_CHUNKS) chunks = SKILL_CHUNKS;
+    size += strlen(conf->skills.paths[i]) + len + 64 + chunks * (size_t)dim; /* 64: NULs and alignment */
+  }
+  return size;
+}
+
+skills_index_t *skills_index_build(const agent_config_t *conf, arena_t *a) {
+  skills_index_t *idx = arena_alloc(a, sizeof(*idx));
+  char *tmp = malloc(TMP_BUF_SIZE);
+  if (!idx || !tmp) { free(tmp); return NULL; }
+  idx->unmatched = conf->skills.unmatched;
+  idx->count = 0;
+  idx->embed = conf->embed.enabled;
+  idx->model = idx->embed ? embed_model(conf->embed.model) : NULL;
+  idx->top_k = conf->embed.top_k;
+  idx->min_score = pick_min_score(conf, idx->model);
+  idx->entries = conf->skills.path_count > 0 ? arena_alloc(a, conf->skills.path_count * sizeof(skill_entry_t)) : NULL;
+  for (int i = 0; i < conf->skills.path_count && idx->entries; i++) {
+    skill_entry_t *e = &idx->entries[idx->count];
+    size_t n = read_file_into(tmp, TMP_BUF_SIZE, conf->skills.paths[i], SKILL_FULL_CHARS);
+    e->saved.chars = e->saved.tokens = 0;
+    if (n > 0 && conf->prompt_compact) n = compact_text(tmp, n, &e->saved);
+    if (n == 0) continue;
+    e->path = arena_strdup(a, conf->skills.paths[i]);
+    e->content = arena_memdup(a, tmp, n);
+    if (!e->path || !e->content) {
+      fprintf(stderr, "neo: skill index full, %d of %d skills left out (from %s)\n", conf->skills.path_count - i,
+              conf->skills.path_count, conf->skills.paths[i]);
+      break;
+    }
+    e->len = n;
+    e->index_len = n > SKILL_INDEX_CHARS ? utf8_floor(tmp, SKILL_INDEX_CHARS) : n;
+    e->priority = conf->skills.priority ? conf->skills.priority[i] : 0;
+    e->vecs = NULL;
+    e->nvecs = 0;
+    if (idx->embed) { /* embedded once here, so a request only embeds the message */
+      embed_chunk_t ch[SKILL_CHUNKS];
+      int dim = embed_dim(idx->model), c = embed_split(tmp, n, ch, SKILL_CHUNKS);
+      int8_t *v = c > 0 ? arena_alloc(a, (size_t)c * (size_t)dim) : NULL;
+      if (c > 0 && !v) fprintf(stderr, "neo: skill index full, %s gets no vectors\n", e->path);
+      for (int k = 0; v && k < c; k++) embed_text(idx->model, tmp + ch[k].off, ch[k].len, v + (size_t)k * dim);
+      e->vecs = v;
+      e->nvecs = v ? c : 0;
+    }
+    path_to_skill_name(e->path, e->name, sizeof(e->name));
+    lower_name(e->name, e->name_lower, sizeof(e->name_lower));
+    idx->count++;
   }
   free(tmp);
+  return idx;
+}
+
+/* Daemon embedding pass: the message against the vectors built with the index. */
+static void index_pick(const skills_index_t *idx, const char *user_message, int priority_filter, unsigned char *pick,
+                       skills_report_t *report) {
+  int dim = embed_dim(idx->model), k = idx->top_k;
+  float *score = malloc((size_t)idx->count * sizeof(float));
+  int *top = malloc((size_t)(k > 0 ? k : 1) * sizeof(int));
+  int8_t *q = malloc((size_t)dim);
+  if (!score || !top || !q) goto out;
+  uint64_t t0 = trace_begin();
+  embed_text(idx->model, user_message, strlen(user_message), q);
+  for (int i = 0; i < idx->count; i++) {
+    const skill_entry_t *e = &idx->entries[i];
+    score[i] = -1;
+    if (e->priority != 0 || (priority_filter >= 0 && priority_filter != 0)) continue;
+    for (int j = 0; j < e->nvecs; j++) {
+      float sc = embed_score(q, e->vecs + (size_t)j * dim, dim);
+      if (sc > score[i]) score[i] = sc;
+    }
+  }
+  int got = pick_top(score, idx->count, k, idx->min_score, pick, top);
+  for (int j = 0; j < got; j++) report_pick(report, idx->entries[top[j]].name, score[top[j]]);
+  trace_end("embed pick", t0, "skills", (long)idx->count);
+out:
+  free(score);
+  free(top);
+  free(q);
+}
+
+void skills_append_from_index(const skills_index_t *idx, const char *user_message, char *dest, size_t cap, int priority_filter,
+                              skills_report_t *report) {
+  unsigned char *pick = NULL;
+  if (idx->embed && priority_filter != 1 && user_message && (pick = calloc((size_t)idx->count + 1, 1)) != NULL)
+    index_pick(idx, user_message, priority_filter, pick, report);
+  for (int i = 0; i < idx->count; i++) {
+    const skill_entry_t *e = &idx->entries[i];
+    if (priority_filter >= 0 && (priority_filter ? (e->priority != 1) : (e->priority != 0))) continue;
+    int full = (priority_filter == 1 && e->priority == 1) ? 1
+             : (pick && pick[i]) || skill_name_matches(e->name, e->name_lower, user_message);
+    if (!full && idx->unmatched) continue;
+    size_t n = full ? e->len : e->index_len;
+    size_t used = strlen(dest);
+    if (used + strlen(e->path) + n + 64 > cap) continue;
+    uint64_t t0 = trace_begin();
+    used += (size_t)snprintf(dest + used, cap - used, "## Skill: %s\n\n", e->path);
+    memcpy(dest + used, e->content, n);
+    memcpy(dest + used + n, "\n\n", 3);
+    if (full) report_saved(report, &e->saved);
+    trace_end(e->path, t0, "bytes", (long)n);
+  }
+  free(pick);
 }
@@ -1,10 +1,59 @@
 #ifndef NEO_SKILLS_H
 #define NEO_SKILLS_H
 
+#include "compact.h"
 #include "config.h"
+#include "embed.h"
 #include <stddef.h>
 
-/* Append skills to system prompt. priority_filter: 1=only high-priority, 0=only normal, -1=all. High-priority skills should be appended first (right after time) for short-context models. */
-void skills_append_to_system_prompt(agent_config_t *conf, const char *user_message, char *dest, size_t cap, int priority_filter);
+/* What skill injection did for one prompt, for -d. */
+typedef struct {
+  compact_saved_t saved; /* taken out of full injections by prompt.compact */
+  char picked[160];      /* skills injected full for embedding similarity: "nanjing 0.21, ..." */
+} skills_report_t;
+
+/* Append skills to system prompt. priority_filter: 1=only high-priority, 0=only normal, -1=all. High-priority skills should be appended first (right after time) for short-context models.
+   A normal skill is injected full when its name or keywords are in the message, or
+   (embed.enabled) when it is among the embed.top_k closest to it. With prompt.compact
+   on, files are compacted as read. report (may be NULL) is added to. */
+void skills_append_to_system_prompt(const agent_config_t *conf, const char *user_message, char *dest, size_t cap, int priority_filter,
+                                    skills_report_t *report);
+
+/* 1 if a configured skill called name (e.g. "translate") matches user_message, the same
+   test that decides whether its full content is injected. */
+int skills_matched(const agent_config_t *conf, const char *name, const char *user_message);
+
+/* Skill files read once into an arena so the daemon (and all its workers) match and
+   inject without touching the filesystem on the request path. */
+typedef struct {
+  const char *path;
+  char name[64];
+  char name_lower[64];
+  int priority;
+  const char *content; /* up to the full-injection limit */
+  size_t len;
+  size_t index_len;    /* prefix injected when the skill is not matched */
+  compact_saved_t saved; /* taken out of content by prompt.compact */
+  const int8_t *vecs;    /* embed: one vector per chunk of content (embed_split) */
+  int nvecs;
+} skill_entry_t;
+
+typedef struct {
+  skill_entry_t *entries;
+  int count;
+  int unmatched;
+  int embed; /* entries carry vectors; the rest as in embed_config_t */
+  const embed_model_t *model;
+  int top_k;
+  float min_score;
+} skills_index_t;
+
+/* Arena bytes skills_index_build may use for conf: file contents and, with embed on,
+   their vectors. */
+size_t skills_index_size(const agent_config_t *conf);
+skills_index_t *skills_index_build(const agent_config_t *conf, arena_t *a);
+/* Same output as skills_append_to_system_prompt, served from the index. */
+void skills_append_from_index(const skills_index_t *idx, const char *user_message, char *dest, size_t cap, int priority_filter,
+                              skills_report_t *report);
 
 #endif
@@ -0,0 +1,277 @@
+/*
+ * Request statistics: per-phase latency histograms and counters, kept in one shared
+ * mapping so prefork workers add to the same figures. Histograms are HDR-style
+ * log-linear (16 linear sub-buckets per power of two of microseconds, ~6% precision,
+ * 1 us to ~19 h), updated with relaxed atomics: no locks on the request path.
+ */
+#include "stats.h"
+#include "cache.h"
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define SUB_BITS 4
+#define SUB      (1 << SUB_BITS)
+#define MAX_EXP  36
+#define BUCKETS  (SUB + (MAX_EXP - SUB_BITS + 1) * SUB)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t buckets[BUCKETS];
+} hist_t;
+
+#define ROUTES (MAX_PROFILES + 1)
+
+enum { PH_PROMPT, PH_SKILLS, PH_ENCODE, PH_DNS, PH_CONNECT, PH_TLS, PH_TTFB, PH_TRANSFER, PH_PARSE, PH_TOTAL, PH_COUNT };
+static const char *phase_names[PH_COUNT] = {
+  "prompt", "skill_match", "encode", "dns", "connect", "tls", "ttfb", "transfer", "parse", "total"
+};
+static const char *journal_ops[3] = { "write", "sync", "compact" };
+static const char *lane_names[2] = { "interactive", "batch" };
+
+typedef struct {
+  hist_t phases[PH_COUNT];
+  hist_t route_total[ROUTES]; /* per model profile, to see what routing buys */
+  hist_t route_ttfb[ROUTES];
+  hist_t journal[3];          /* session journal, per op */
+  hist_t queue_wait[2];       /* per scheduler lane */
+  hist_t queue_depth[2];      /* requests ahead on arrival; counts, not microseconds */
+  uint64_t requests, errors, cached;
+  uint64_t conn_new, conn_reused;
+  uint64_t prompt_tokens, completion_tokens;
+  uint64_t prefill_saved;     /* prompt tokens the server served from its cache */
+  uint64_t abort_hangup, abort_deadline;
+  uint64_t journal_records;
+  uint64_t queued[2], running, shed[2]; /* gauges go up and down by wrapping adds */
+} stats_t;
+
+static stats_t local;
+static stats_t *st = &local;
+static char route_names[ROUTES][32] = { "default" }; /* copies: the config may be freed first */
+
+int stats_init(void) {
+#ifdef HAVE_MMAP
+  void *p = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return -1;
+  st = p;
+#endif
+  return 0;
+}
+
+void stats_route_name(int i, const char *name) {
+  if (i > 0 && i < ROUTES) snprintf(route_names[i], sizeof(route_names[i]), "%s", name ? name : "?");
+}
+
+static void add(uint64_t *v, uint64_t n) {
+  __atomic_fetch_add(v, n, __ATOMIC_RELAXED);
+}
+
+static uint64_t get(const uint64_t *v) {
+  return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static int bucket_of(uint64_t us) {
+  if (us < SUB) return (int)us;
+  int e = 63 - __builtin_clzll(us);
+  if (e > MAX_EXP) return BUCKETS - 1;
+  return SUB + (e - SUB_BITS) * SUB + (int)((us >> (e - SUB_BITS)) & (SUB - 1));
+}
+
+/* Midpoint of a bucket, in microseconds. */
+static double bucket_value(int i) {
+  if (i < SUB) return i;
+  int e = (i - SUB) / SUB + SUB_BITS;
+  uint64_t width = (uint64_t)1 << (e - SUB_BITS);
+  uint64_t lower = (uint64_t)(SUB + (i - SUB) % SUB) * width;
+  return (double)lower + (double)width / 2.0;
+}
+
+static void hist_add(hist_t *h, uint64_t v) {
+  add(&h->count, 1);
+  add(&h->sum_us, v);
+  add(&h->buckets[bucket_of(v)], 1);
+}
+
+static void hist_record(hist_t *h, double ms) {
+  hist_add(h, ms > 0 ? (uint64_t)(ms * 1000.0 + 0.5) : 0);
+}
+
+static double hist_quantile(const hist_t *h, double q) {
+  uint64_t n = get(&h->count);
+  if (n == 0) return 0;
+  uint64_t rank = (uint64_t)(q * (double)(n - 1)) + 1, seen = 0;
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += get(&h->buckets[i]);
+    if (seen >= rank) return bucket_value(i);
+  }
+  return bucket_value(BUCKETS - 1);
+}
+
+void stats_record(const stats_request_t *r) {
+  add(&st->requests, 1);
+  if (r->failed) add(&st->errors, 1);
+  hist_record(&st->phases[PH_PROMPT], r->prompt_ms);
+  hist_record(&st->phases[PH_SKILLS], r->skills_ms);
+  hist_record(&st->phases[PH_TOTAL], r->total_ms);
+  int route = r->route > 0 && r->route < ROUTES ? r->route : 0;
+  hist_record(&st->route_total[route], r->total_ms);
+  if (!r->cached && !r->failed) hist_record(&st->route_ttfb[route], r->llm.ttfb_ms);
+  if (r->cached) {
+    add(&st->cached, 1);
+    return;
+  }
+  const llm_timing_t *t = &r->llm;
+  hist_record(&st->phases[PH_ENCODE], t->encode_ms);
+  if (t->new_connection) { /* connect phases only mean something when one happened */
+    add(&st->conn_new, 1);
+    hist_record(&st->phases[PH_DNS], t->dns_ms);
+    hist_record(&st->phases[PH_CONNECT], t->connect_ms);
+    hist_record(&st->phases[PH_TLS], t->tls_ms);
+  } else if (!r->failed)
+    add(&st->conn_reused, 1);
+  if (!r->failed) {
+    hist_record(&st->phases[PH_TTFB], t->ttfb_ms);
+    hist_record(&st->phases[PH_TRANSFER], t->transfer_ms);
+    hist_record(&st->phases[PH_PARSE], t->parse_ms);
+  }
+  if (t->prompt_tokens > 0) add(&st->prompt_tokens, (uint64_t)t->prompt_tokens);
+  if (t->completion_tokens > 0) add(&st->completion_tokens, (uint64_t)t->completion_tokens);
+  if (t->cached_tokens > 0) add(&st->prefill_saved, (uint64_t)t->cached_tokens);
+}
+
+void stats_abort(int reason) {
+  add(reason == STATS_ABORT_HANGUP ? &st->abort_hangup : &st->abort_deadline, 1);
+}
+
+void stats_journal(int op, double ms, int records) {
+  if (op < 0 || op > STATS_JOURNAL_COMPACT) return;
+  hist_record(&st->journal[op], ms);
+  if (records > 0) add(&st->journal_records, (uint64_t)records);
+}
+
+static int lane_of(int lane) {
+  return lane == STATS_LANE_BATCH ? STATS_LANE_BATCH : STATS_LANE_INTERACTIVE;
+}
+
+void stats_queue(int lane, int depth) {
+  lane = lane_of(lane);
+  hist_add(&st->queue_depth[lane], depth > 0 ? (uint64_t)depth : 0);
+  add(&st->queued[lane], 1);
+}
+
+void stats_dequeue(int lane, double wait_ms, int started) {
+  lane = lane_of(lane);
+  add(&st->queued[lane], (uint64_t)-1);
+  if (started) hist_record(&st->queue_wait[lane], wait_ms);
+}
+
+void stats_shed(int lane) {
+  add(&st->shed[lane_of(lane)], 1);
+}
+
+void stats_running(int delta) {
+  add(&st->running, (uint64_t)(int64_t)delta);
+}
+
+void stats_aborts(unsigned long *hangup, unsigned long *deadline) {
+  *hangup = (unsigned long)get(&st->abort_hangup);
+  *deadline = (unsigned long)get(&st->abort_deadline);
+}
+
+/* p50/p90/p99, sum and count of h as metric{label="value",...}, values divided by scale
+   (1e6: microseconds to seconds). */
+static void summary_scaled(buf_t *out, const char *metric, const char *label, const char *value, const hist_t *h,
+                           double scale) {
+  static const double qs[] = { 0.5, 0.9, 0.99 };
+  for (int i = 0; i < 3; i++)
+    buf_printf(out, "%s{%s=\"%s\",quantile=\"%g\"} %.6f\n", metric, label, value, qs[i],
+               hist_quantile(h, qs[i]) / scale);
+  buf_printf(out, "%s_sum{%s=\"%s\"} %.6f\n", metric, label, value, (double)get(&h->sum_us) / scale);
+  buf_printf(out, "%s_count{%s=\"%s\"} %llu\n", metric, label, value, (unsigned long long)get(&h->count));
+}
+
+static void summary(buf_t *out, const char *metric, const char *label, const char *value, const hist_t *h) {
+  summary_scaled(out, metric, label, value, h, 1e6);
+}
+
+void stats_prometheus(buf_t *out) {
+  buf_puts(out, "# HELP neo_phase_seconds Time spent per request in each phase.\n"
+                "# TYPE neo_phase_seconds summary\n");
+  for (int p = 0; p < PH_COUNT; p++) summary(out, "neo_phase_seconds", "phase", phase_names[p], &st->phases[p]);
+  buf_puts(out, "# HELP neo_profile_seconds Request latency per routed model profile.\n"
+                "# TYPE neo_profile_seconds summary\n");
+  for (int i = 0; i < ROUTES; i++)
+    if (route_names[i][0]) summary(out, "neo_profile_seconds", "profile", route_names[i], &st->route_total[i]);
+  buf_puts(out, "# HELP neo_profile_ttfb_seconds Time to first upstream byte per routed model profile.\n"
+                "# TYPE neo_profile_ttfb_seconds summary\n");
+  for (int i = 0; i < ROUTES; i++)
+    if (route_names[i][0]) summary(out, "neo_profile_ttfb_seconds", "profile", route_names[i], &st->route_ttfb[i]);
+  if (get(&st->journal[STATS_JOURNAL_WRITE].count)) {
+    buf_puts(out, "# HELP neo_journal_seconds Session journal writes, syncs and compactions.\n"
+                  "# TYPE neo_journal_seconds summary\n");
+    for (int i = 0; i < 3; i++) summary(out, "neo_journal_seconds", "op", journal_ops[i], &st->journal[i]);
+    buf_printf(out, "# TYPE neo_journal_records_total counter\nneo_journal_records_total %llu\n",
+               (unsigned long long)get(&st->journal_records));
+  }
+  buf_puts(out, "# HELP neo_queue_wait_seconds Time a request waited for an upstream slot, per lane.\n"
+                "# TYPE neo_queue_wait_seconds summary\n");
+  for (int i = 0; i < 2; i++) summary(out, "neo_queue_wait_seconds", "lane", lane_names[i], &st->queue_wait[i]);
+  buf_puts(out, "# HELP neo_queue_depth Requests already waiting in the lane when one was queued.\n"
+                "# TYPE neo_queue_depth summary\n");
+  for (int i = 0; i < 2; i++) summary_scaled(out, "neo_queue_depth", "lane", lane_names[i], &st->queue_depth[i], 1);
+  buf_printf(out,
+             "# TYPE neo_queued gauge\nneo_queued{lane=\"interactive\"} %lld\nneo_queued{lane=\"batch\"} %lld\n"
+             "# TYPE neo_inflight gauge\nneo_inflight %lld\n"
+             "# TYPE neo_shed_total counter\nneo_shed_total{lane=\"interactive\"} %llu\n"
+             "neo_shed_total{lane=\"batch\"} %llu\n",
+             (long long)get(&st->queued[0]), (long long)get(&st->queued[1]), (long long)get(&st->running),
+             (unsigned long long)get(&st->shed[0]), (unsigned long long)get(&st->shed[1]));
+  unsigned long hits, misses;
+  cache_counts(&hits, &misses);
+  buf_printf(out,
+             "# TYPE neo_requests_total counter\nneo_requests_total %llu\n"
+             "# TYPE neo_request_errors_total counter\nneo_request_errors_total %llu\n"
+             "# TYPE neo_cache_lookups_total counter\nneo_cache_lookups_total{result=\"hit\"} %lu\n"
+             "neo_cache_lookups_total{result=\"miss\"} %lu\n"
+             "# TYPE neo_upstream_connections_total counter\nneo_upstream_connections_total{kind=\"new\"} %llu\n"
+             "neo_upstream_connections_total{kind=\"reused\"} %llu\n"
+             "# TYPE neo_tokens_total counter\nneo_tokens_total{kind=\"prompt\"} %llu\n"
+             "neo_tokens_total{kind=\"completion\"} %llu\n"
+             "# TYPE neo_prefill_tokens_saved_total counter\nneo_prefill_tokens_saved_total %llu\n"
+             "# TYPE neo_aborts_total counter\nneo_aborts_total{reason=\"hangup\"} %llu\n"
+             "neo_aborts_total{reason=\"deadline\"} %llu\n",
+             (unsigned long long)get(&st->requests), (unsigned long long)get(&st->errors), hits, misses,
+             (unsigned long long)get(&st->conn_new), (unsigned long long)get(&st->conn_reused),
+             (unsigned long long)get(&st->prompt_tokens), (unsigned long long)get(&st->completion_tokens),
+             (unsigned long long)get(&st->prefill_saved),
+             (unsigned long long)get(&st->abort_hangup), (unsigned long long)get(&st->abort_deadline));
+}
+
+void stats_print_request(FILE *f, const stats_request_t *r) {
+  const llm_timing_t *t = &r->llm;
+  const char *route = r->route > 0 && r->route < ROUTES && route_names[r->route][0] ? route_names[r->route] : "default";
+  if (r->cached) {
+    fprintf(f, "neo: timing: prompt %.2f ms (skill match %.2f), cache hit, total %.2f ms, profile %s\n",
+            r->prompt_ms, r->skills_ms, r->total_ms, route);
+    return;
+  }
+  fprintf(f, "neo: timing: prompt %.2f ms (skill match %.2f), encode %.2f, dns %.1f, connect %.1f, tls %.1f, "
+             "ttfb %.1f, transfer %.1f, parse %.2f, total %.1f ms",
+          r->prompt_ms, r->skills_ms, t->encode_ms, t->dns_ms, t->connect_ms, t->tls_ms,
+          t->ttfb_ms, t->transfer_ms, t->parse_ms, r->total_ms);
+  if (t->prompt_tokens >= 0 || t->completion_tokens >= 0) {
+    fprintf(f, "; tokens %ld prompt", t->prompt_tokens);
+    if (t->cached_tokens >= 0) fprintf(f, " (%ld cached)", t->cached_tokens);
+    fprintf(f, " + %ld completion", t->completion_tokens);
+  }
+  fprintf(f, ", profile %s%s\n", route, r->failed ? " (failed)" : "");
+}
@@ -0,0 +1,45 @@
+#ifndef NEO_STATS_H
+#define NEO_STATS_H
+
+#include "buf.h"
+#include "llm.h"
+#include <stdio.h>
+
+/* One finished request, as measured by the daemon or a one-shot run. */
+typedef struct {
+  double prompt_ms;   /* system prompt build, skill matching included */
+  double skills_ms;
+  llm_timing_t llm;   /* zero for cache hits */
+  double total_ms;
+  int cached;
+  int failed;
+  int route;          /* route_t.index: 0 model.*, i profile i - 1 */
+} stats_request_t;
+
+enum { STATS_ABORT_HANGUP, STATS_ABORT_DEADLINE };
+enum { STATS_JOURNAL_WRITE, STATS_JOURNAL_SYNC, STATS_JOURNAL_COMPACT };
+enum { STATS_LANE_INTERACTIVE, STATS_LANE_BATCH };
+
+/* Put the counters in shared memory; call before forking workers so they all add to
+   the same figures. Without it stats stay per process. */
+int stats_init(void);
+/* Label for route index i in the per-profile figures; name must outlive the stats. */
+void stats_route_name(int i, const char *name);
+void stats_record(const stats_request_t *r);
+void stats_abort(int reason);
+void stats_aborts(unsigned long *hangup, unsigned long *deadline);
+/* Daemon scheduler: a request joined its lane's queue behind depth others; left it
+   after wait_ms, started or dropped (client gone); was turned away as busy; started or
+   finished upstream (delta +1/-1). */
+void stats_queue(int lane, int depth);
+void stats_dequeue(int lane, double wait_ms, int started);
+void stats_shed(int lane);
+void stats_running(int delta);
+/* One session journal write (of records records), sync or compaction. */
+void stats_journal(int op, double ms, int records);
+/* Prometheus text exposition of everything recorded so far. */
+void stats_prometheus(buf_t *out);
+/* One line per request for -d. */
+void stats_print_request(FILE *f, const stats_request_t *r);
+
+#endif
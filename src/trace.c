@@ -0,0 +1,128 @@
+/*
+ * Trace events in the Chrome JSON array format, one "X" (complete) event per span.
+ * Each thread owns a ring of fixed-size events with private head/tail counters, so
+ * recording is a copy and an increment; a full ring is written out in one write().
+ * The file is opened O_APPEND, so prefork workers can share it without locking.
+ */
+#include "trace.h"
+#include "buf.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define RING_EVENTS 4096 /* power of two */
+
+typedef struct {
+  char name[56];
+  const char *arg; /* static string or NULL */
+  long value;
+  uint64_t ts, dur;
+} trace_event_t;
+
+typedef struct {
+  trace_event_t ev[RING_EVENTS];
+  uint64_t head, tail; /* next slot to fill / next to write out; only the owner thread moves them */
+} ring_t;
+
+int trace_on;
+static int trace_fd = -1;
+static pid_t trace_owner; /* the process that opened the file closes the array */
+static __thread ring_t *ring;
+
+uint64_t trace_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static long thread_id(void) {
+#ifdef SYS_gettid
+  return (long)syscall(SYS_gettid);
+#else
+  return (long)getpid();
+#endif
+}
+
+static void write_all(const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(trace_fd, p, n);
+    if (w <= 0) return;
+    p += w;
+    n -= (size_t)w;
+  }
+}
+
+int trace_open(const char *path) {
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (trace_fd < 0) return -1;
+  write_all("[\n", 2);
+  trace_owner = getpid();
+  trace_on = 1;
+  atexit(trace_close);
+  return 0;
+}
+
+/* Copy name, cutting on a UTF-8 boundary so the JSON stays valid. */
+static void copy_name(char *dst, size_t cap, const char *src) {
+  size_t n = strlen(src);
+  if (n >= cap) {
+    n = cap - 1;
+    while (n > 0 && ((unsigned char)src[n] & 0xC0) == 0x80) n--;
+  }
+  memcpy(dst, src, n);
+  dst[n] = '\0';
+}
+
+void trace_record(const char *name, uint64_t start_us, uint64_t dur_us, const char *arg, long value) {
+  ring_t *r = ring;
+  if (!r) {
+    r = ring = calloc(1, sizeof(*r));
+    if (!r) return;
+  }
+  if (r->head - r->tail == RING_EVENTS) trace_flush();
+  trace_event_t *e = &r->ev[r->head & (RING_EVENTS - 1)];
+  copy_name(e->name, sizeof(e->name), name);
+  e->arg = arg;
+  e->value = value;
+  e->ts = start_us;
+  e->dur = dur_us;
+  r->head++;
+}
+
+void trace_flush(void) {
+  ring_t *r = ring;
+  if (trace_fd < 0 || !r || r->head == r->tail) return;
+  long pid = (long)getpid(), tid = thread_id(); /* read here, not per event: workers inherit the ring */
+  buf_t b = {0};
+  for (; r->tail != r->head; r->tail++) {
+    const trace_event_t *e = &r->ev[r->tail & (RING_EVENTS - 1)];
+    buf_puts(&b, "{\"name\":\"");
+    buf_json_escape(&b, e->name);
+    buf_printf(&b, "\",\"cat\":\"neo\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%ld,\"tid\":%ld",
+               (unsigned long long)e->ts, (unsigned long long)e->dur, pid, tid);
+    if (e->arg) buf_printf(&b, ",\"args\":{\"%s\":%ld}", e->arg, e->value);
+    buf_puts(&b, "},\n");
+  }
+  if (b.data) write_all(b.data, b.len);
+  buf_free(&b);
+}
+
+void trace_close(void) {
+  if (trace_fd < 0) return;
+  trace_flush();
+  if (getpid() == trace_owner) { /* a metadata event closes the array; workers leave it open */
+    buf_t b = {0};
+    buf_printf(&b, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"neo\"}}\n]\n",
+               (long)getpid());
+    if (b.data) write_all(b.data, b.len);
+    buf_free(&b);
+  }
+  close(trace_fd);
+  trace_fd = -1;
+  trace_on = 0;
+}
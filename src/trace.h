@@ -0,0 +1,35 @@
+#ifndef NEO_TRACE_H
+#define NEO_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Chrome / Perfetto trace-event output (--trace FILE). Spans are "complete" events
+ * recorded into a per-thread ring and written out in batches, so the request path
+ * never takes a lock or makes a syscall per event. Off by default: every entry point
+ * is one predictable branch on trace_on.
+ */
+extern int trace_on;
+
+/* Start writing events to path (truncated). Call before forking workers: they append
+   to the same file, one pid per process. */
+int trace_open(const char *path);
+/* Write out this thread's buffered events; the daemon calls it after each request. */
+void trace_flush(void);
+/* Flush and terminate the JSON array; registered with atexit by trace_open. */
+void trace_close(void);
+
+uint64_t trace_now_us(void);
+void trace_record(const char *name, uint64_t start_us, uint64_t dur_us, const char *arg, long value);
+
+/* Timestamp to pass to trace_end; 0 (and no clock read) when tracing is off. */
+static inline uint64_t trace_begin(void) {
+  return trace_on ? trace_now_us() : 0;
+}
+
+/* Span from start_us to now; arg/value is an optional numeric argument (arg NULL: none). */
+static inline void trace_end(const char *name, uint64_t start_us, const char *arg, long value) {
+  if (trace_on) trace_record(name, start_us, trace_now_us() - start_us, arg, value);
+}
+
+#endif